@@ -28,6 +28,9 @@
 #include "libdali.h"
 #include "portable.h"
 
+static int dl_requestinfo (DLCP *dlconn, const char *infotype, char *infomatch,
+                           const char *caller);
+
 /***********************************************************************/ /**
  * @brief Create a new DataLink Connection Parameter (DLCP) structure
  *
@@ -57,6 +60,7 @@ dl_newdlcp (char *address, char *progname)
     dlconn->clientid[0] = '\0';
   dlconn->keepalive      = 600;
   dlconn->iotimeout      = 60;
+  dlconn->statekey[0]    = '\0';
   dlconn->link           = -1;
   dlconn->serverproto    = 0.0;
   dlconn->maxpktsize     = 0;
@@ -68,6 +72,8 @@ dl_newdlcp (char *address, char *progname)
   dlconn->terminate      = 0;
   dlconn->streaming      = 0;
 
+  memset (&dlconn->stats, 0, sizeof (DLStats));
+
   dlconn->log = NULL;
 
   return dlconn;
@@ -591,7 +597,11 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
               dlconn->addr);
     return -1;
   }
-  else if (replylen > 0)
+
+  dlconn->stats.pktsent++;
+  dlconn->stats.bytesent += packetlen;
+
+  if (replylen > 0)
   {
     /* Reply message, if sent, will be placed into the reply buffer */
     rv = dl_handlereply (dlconn, reply, sizeof (reply), &replyvalue);
@@ -615,6 +625,182 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
   return replyvalue;
 } /* End of dl_write() */
 
+/***********************************************************************/ /**
+ * @brief Send a batch of packets to a DataLink server
+ *
+ * Send @a count packets to the server with a single vectored send,
+ * each described by a ::DLWriteItem.  Headers are created from the
+ * item parameters and the packet data is sent directly from the item
+ * buffers without being copied.
+ *
+ * When acknowledgement is requested the server replies are received,
+ * in order, after all packets have been sent, so the batch costs a
+ * single round trip.  The reply value of each item is set to the
+ * packet ID acknowledged by the server or -1 if the server returned
+ * an error for the packet.  Without acknowledgement the reply values
+ * are set to 0.
+ *
+ * If this routine returns -1 the connection should be considered to
+ * be in a bad state and should be shut down.  Items whose replies were
+ * received before the error keep their reply values and the others are
+ * set to ::DLNOREPLY, those packets may or may not have been stored by
+ * the server.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param items Array of packets to send
+ * @param count Number of packets in @a items
+ * @param ack Acknowledgement flag, if true request acknowledgement
+ *
+ * @return the number of packets accepted (all packets when no
+ * acknowledgement is requested) on success and -1 on error.
+ ***************************************************************************/
+int
+dl_writebatch (DLCP *dlconn, DLWriteItem *items, int count, int ack)
+{
+  int64_t replyvalue;
+  char reply[256];
+  char *flags = (ack) ? "A" : "N";
+  char *headers = NULL;
+  char *header;
+  void **buffers = NULL;
+  size_t *lengths = NULL;
+  int headerlen;
+  int accepted = 0;
+  int idx;
+  int rv;
+
+  if (!dlconn || !items)
+  {
+    dl_log_r (dlconn, 1, 1, "dl_writebatch(): dlconn || items is not anticipated value \n");
+    return -1;
+  }
+
+  if (count <= 0)
+    return 0;
+
+  if (dlconn->link < 0)
+  {
+    dl_log_r (dlconn, 1, 3, "[%s] dl_writebatch(): dlconn->link = %d, expect >=0 \n", dlconn->addr, dlconn->link);
+    return -1;
+  }
+
+  /* Sanity check that connection is not in streaming mode */
+  if (dlconn->streaming)
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] dl_writebatch(): Connection in streaming mode, cannot continue\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  /* Each packet is sent from two buffers: preheader + header and packet data */
+  headers = (char *)malloc ((size_t)count * 258);
+  buffers = (void **)malloc ((size_t)count * 2 * sizeof (void *));
+  lengths = (size_t *)malloc ((size_t)count * 2 * sizeof (size_t));
+
+  if (!headers || !buffers || !lengths)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_writebatch(): Cannot allocate memory\n", dlconn->addr);
+    accepted = -1;
+    goto cleanup;
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    items[idx].reply = (ack) ? DLNOREPLY : 0;
+
+    /* Sanity check that packet data is not larger than max packet size if known */
+    if (!items[idx].packet || !items[idx].streamid ||
+        (dlconn->maxpktsize > 0 && items[idx].packetlen > dlconn->maxpktsize))
+    {
+      dl_log_r (dlconn, 1, 1, "[%s] dl_writebatch(): Packet %d is invalid or larger than max packet size (%d)\n",
+                dlconn->addr, idx, dlconn->maxpktsize);
+      accepted = -1;
+      goto cleanup;
+    }
+
+    /* Create packet header with command: "WRITE streamid hpdatastart hpdataend flags size" */
+    header    = headers + (size_t)idx * 258;
+    headerlen = snprintf (header + 3, 255, "WRITE %s %lld %lld %s %d",
+                          items[idx].streamid, (long long int)items[idx].datastart,
+                          (long long int)items[idx].dataend, flags, items[idx].packetlen);
+
+    if (headerlen <= 0 || headerlen >= 255)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_writebatch(): Packet header too large for %s\n",
+                dlconn->addr, items[idx].streamid);
+      accepted = -1;
+      goto cleanup;
+    }
+
+    header[0] = 'D';
+    header[1] = 'L';
+    header[2] = (uint8_t)headerlen;
+
+    buffers[idx * 2]     = header;
+    lengths[idx * 2]     = 3 + headerlen;
+    buffers[idx * 2 + 1] = items[idx].packet;
+    lengths[idx * 2 + 1] = items[idx].packetlen;
+  }
+
+  /* Send all packets */
+  if (dl_sendbuffers (dlconn, buffers, lengths, count * 2) < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_writebatch(): problem sending WRITE commands\n",
+              dlconn->addr);
+    accepted = -1;
+    goto cleanup;
+  }
+
+  dlconn->stats.pktsent += count;
+  for (idx = 0; idx < count; idx++)
+    dlconn->stats.bytesent += items[idx].packetlen;
+
+  if (!ack)
+  {
+    accepted = count;
+    goto cleanup;
+  }
+
+  /* Receive the reply to each packet, in order */
+  for (idx = 0; idx < count; idx++)
+  {
+    if (dl_recvheader (dlconn, reply, sizeof (reply) - 1, 1) < 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_writebatch(): problem receiving WRITE reply\n",
+                dlconn->addr);
+      accepted = -1;
+      goto cleanup;
+    }
+
+    replyvalue = 0;
+    rv = dl_handlereply (dlconn, reply, sizeof (reply) - 1, &replyvalue);
+
+    if (rv == 0)
+    {
+      dl_log_r (dlconn, 1, 3, "[%s] %s\n", dlconn->addr, reply);
+      items[idx].reply = replyvalue;
+      accepted++;
+    }
+    else if (rv == 1)
+    {
+      dl_log_r (dlconn, 1, 0, "[%s] %s: %s\n", dlconn->addr, items[idx].streamid, reply);
+      items[idx].reply = -1;
+    }
+    else
+    {
+      accepted = -1;
+      goto cleanup;
+    }
+  }
+
+cleanup:
+  free (headers);
+  free (buffers);
+  free (lengths);
+
+  return accepted;
+} /* End of dl_writebatch() */
+
 /***********************************************************************/ /**
  * @brief Request a packet from the DataLink server
  *
@@ -710,6 +896,7 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
     packet->datastart = sdatastart;
     packet->dataend   = sdataend;
     packet->datasize  = sdatasize;
+    packet->recvtime  = dlconn->recvtime;
 
     /* Check that the packet data size is not beyond the max receive buffer size */
     if (packet->datasize > (int64_t)maxdatasize)
@@ -756,6 +943,11 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
     /* Update most recently received packet ID and time */
     dlconn->pktid   = packet->pktid;
     dlconn->pkttime = packet->pkttime;
+
+    dlconn->stats.pktrecv++;
+    dlconn->stats.byterecv += packet->datasize;
+    if (packet->datasize > dlconn->stats.maxpktrecv)
+      dlconn->stats.maxpktrecv = packet->datasize;
   }
   else if (!strncmp (header, "ERROR", 5))
   {
@@ -804,9 +996,6 @@ int
 dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
             char **infodata, size_t maxinfosize)
 {
-  char header[255];
-  char type[255];
-  int headerlen;
   int infosize = 0;
   int rv       = 0;
 
@@ -816,14 +1005,131 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   if (maxinfosize && !*infodata)
     return -1;
 
+  if ((infosize = dl_requestinfo (dlconn, infotype, infomatch, "dl_getinfo")) < 0)
+    return -1;
+
+  /* If a maximum buffer size was specified check that it's large enough */
+  if (maxinfosize && infosize > (int64_t)maxinfosize)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): INFO data larger (%d) than the maximum size (%" PRIsize_t ")\n",
+              dlconn->addr, infosize, maxinfosize);
+    return -1;
+  }
+
+  /* Allocate the infobuffer if needed */
+  if (maxinfosize == 0)
+  {
+    if (!(*infodata = malloc (infosize)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): error allocating receving buffer of %d bytes\n",
+                dlconn->addr, infosize);
+      return -1;
+    }
+  }
+
+  /* Receive INFO data, blocking until complete */
+  if ((rv = dl_recvdata (dlconn, *infodata, infosize, 1)) != infosize)
+  {
+    /* Only log an error if the connection was not shut down */
+    if (rv < -1)
+      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receiving INFO data\n",
+                dlconn->addr);
+    return -1;
+  }
+
+  return infosize;
+} /* End of dl_getinfo() */
+
+/***********************************************************************/ /**
+ * @brief Request information from the DataLink server in chunks
+ *
+ * Request information from the server using the DataLink INFO command
+ * like dl_getinfo(), but instead of collecting the complete response
+ * in a buffer pass it to @a infohandler in chunks as it is received,
+ * so that large responses can be processed incrementally with a small,
+ * fixed amount of memory.  Chunks are at most DL_INFOCHUNKSIZE bytes.
+ *
+ * If @a infohandler returns non-zero the rest of the response is
+ * received and discarded, keeping the connection usable, and -1 is
+ * returned.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param infotype The INFO type to request
+ * @param infomatch An optional match pattern
+ * @param infohandler Function called with each chunk of the response
+ * @param handlerdata Pointer passed to @a infohandler
+ *
+ * @return The length of the INFO response in bytes on success and -1
+ * on error.
+ ***************************************************************************/
+int
+dl_getinfochunks (DLCP *dlconn, const char *infotype, char *infomatch,
+                  int (*infohandler) (char *chunk, int chunklen, void *handlerdata),
+                  void *handlerdata)
+{
+  char chunk[DL_INFOCHUNKSIZE];
+  int infosize = 0;
+  int received = 0;
+  int chunklen;
+  int failed = 0;
+  int rv     = 0;
+
+  if (!dlconn || !infotype || !infohandler)
+    return -1;
+
+  if ((infosize = dl_requestinfo (dlconn, infotype, infomatch, "dl_getinfochunks")) < 0)
+    return -1;
+
+  /* Receive INFO data in chunks, blocking until each is complete */
+  while (received < infosize)
+  {
+    chunklen = ((infosize - received) < (int)sizeof (chunk)) ? (infosize - received) : (int)sizeof (chunk);
+
+    if ((rv = dl_recvdata (dlconn, chunk, chunklen, 1)) != chunklen)
+    {
+      /* Only log an error if the connection was not shut down */
+      if (rv < -1)
+        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfochunks(): problem receiving INFO data\n",
+                  dlconn->addr);
+      return -1;
+    }
+
+    received += chunklen;
+
+    if (!failed && infohandler (chunk, chunklen, handlerdata))
+      failed = 1;
+  }
+
+  return (failed) ? -1 : infosize;
+} /* End of dl_getinfochunks() */
+
+/***************************************************************************
+ * dl_requestinfo:
+ *
+ * Send an INFO request to the server and receive the response header.
+ * The caller name is used in log messages.
+ *
+ * Returns the size of the INFO response data that follows on success
+ * and -1 on error.
+ ***************************************************************************/
+static int
+dl_requestinfo (DLCP *dlconn, const char *infotype, char *infomatch,
+                const char *caller)
+{
+  char header[255];
+  char type[255];
+  int headerlen;
+  int infosize = 0;
+  int rv       = 0;
+
   if (dlconn->link < 0)
     return -1;
 
   /* Sanity check that connection is not in streaming mode */
   if (dlconn->streaming)
   {
-    dl_log_r (dlconn, 1, 1, "[%s] dl_getinfo(): Connection in streaming mode, cannot continue\n",
-              dlconn->addr);
+    dl_log_r (dlconn, 1, 1, "[%s] %s(): Connection in streaming mode, cannot continue\n",
+              dlconn->addr, caller);
     return -1;
   }
 
@@ -835,8 +1141,8 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   /* Send command and packet to server */
   if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem sending INFO command\n",
-              dlconn->addr);
+    dl_log_r (dlconn, 2, 0, "[%s] %s(): problem sending INFO command\n",
+              dlconn->addr, caller);
     return -1;
   }
 
@@ -845,8 +1151,8 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   {
     /* Only log an error if the connection was not shut down */
     if (rv < -1)
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receving packet header\n",
-                dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): problem receving packet header\n",
+                dlconn->addr, caller);
     return -1;
   }
 
@@ -855,46 +1161,17 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
     /* Parse INFO header */
     rv = sscanf (header, "INFO %s %d", type, &infosize);
 
-    if (rv != 2)
+    if (rv != 2 || infosize < 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): cannot parse INFO header\n",
-                dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): cannot parse INFO header\n",
+                dlconn->addr, caller);
       return -1;
     }
 
     if (strncasecmp (infotype, type, strlen (infotype)))
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): requested type %s but received type %s\n",
-                dlconn->addr, infotype, type);
-      return -1;
-    }
-
-    /* If a maximum buffer size was specified check that it's large enough */
-    if (maxinfosize && infosize > (int64_t)maxinfosize)
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): INFO data larger (%d) than the maximum size (%" PRIsize_t ")\n",
-                dlconn->addr, infosize, maxinfosize);
-      return -1;
-    }
-
-    /* Allocate the infobuffer if needed */
-    if (maxinfosize == 0)
-    {
-      if (!(*infodata = malloc (infosize)))
-      {
-        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): error allocating receving buffer of %d bytes\n",
-                  dlconn->addr, infosize);
-        return -1;
-      }
-    }
-
-    /* Receive INFO data, blocking until complete */
-    if ((rv = dl_recvdata (dlconn, *infodata, infosize, 1)) != infosize)
-    {
-      /* Only log an error if the connection was not shut down */
-      if (rv < -1)
-        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receiving INFO data\n",
-                  dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): requested type %s but received type %s\n",
+                dlconn->addr, caller, infotype, type);
       return -1;
     }
   }
@@ -911,13 +1188,13 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   }
   else
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): Unrecognized reply string %.6s\n",
-              dlconn->addr, header);
+    dl_log_r (dlconn, 2, 0, "[%s] %s(): Unrecognized reply string %.6s\n",
+              dlconn->addr, caller, header);
     return -1;
   }
 
   return infosize;
-} /* End of dl_getinfo() */
+} /* End of dl_requestinfo() */
 
 /***********************************************************************/ /**
  * @brief Collect packets streaming from the DataLink server
@@ -949,6 +1226,7 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
             size_t maxdatasize, int8_t endflag)
 {
   dltime_t now;
+  dltime_t waitstart;
   char header[255];
   int headerlen;
   int rv;
@@ -1027,6 +1305,7 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
       }
 
       dlconn->keepalive_trig = -1;
+      dlconn->stats.keepalives++;
     }
 
     /* Poll the socket for available data */
@@ -1035,7 +1314,12 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
     select_tv.tv_sec  = 0;
     select_tv.tv_usec = 500000; /* Block up to 0.5 seconds */
 
+    dlconn->stats.syscalls++;
+    waitstart  = dlp_time ();
     select_ret = select ((dlconn->link + 1), &select_fd, NULL, NULL, &select_tv);
+    waitstart  = dlp_time () - waitstart;
+    if (waitstart > 0)
+      dlconn->stats.waittime += waitstart;
 
     /* Check the return from select(), an interrupted system call error
 	 will be reported if a signal handler was used.  If the terminate
@@ -1082,6 +1366,7 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
           packet->datastart = sdatastart;
           packet->dataend   = sdataend;
           packet->datasize  = sdatasize;
+          packet->recvtime  = dlconn->recvtime;
 
           if (packet->datasize > (int64_t)maxdatasize)
           {
@@ -1106,6 +1391,11 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
           dlconn->pktid   = packet->pktid;
           dlconn->pkttime = packet->pkttime;
 
+          dlconn->stats.pktrecv++;
+          dlconn->stats.byterecv += packet->datasize;
+          if (packet->datasize > dlconn->stats.maxpktrecv)
+            dlconn->stats.maxpktrecv = packet->datasize;
+
           return DLPACKET;
         }
         else if (!strncmp (header, "ID", 2))
@@ -1261,6 +1551,7 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
       }
 
       dlconn->keepalive_trig = -1;
+      dlconn->stats.keepalives++;
     }
   }
 
@@ -1300,6 +1591,7 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
       packet->datastart = sdatastart;
       packet->dataend   = sdataend;
       packet->datasize  = sdatasize;
+      packet->recvtime  = dlconn->recvtime;
 
       if (packet->datasize > (int64_t)maxdatasize)
       {
@@ -1324,6 +1616,11 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
       dlconn->pktid   = packet->pktid;
       dlconn->pkttime = packet->pkttime;
 
+      dlconn->stats.pktrecv++;
+      dlconn->stats.byterecv += packet->datasize;
+      if (packet->datasize > dlconn->stats.maxpktrecv)
+        dlconn->stats.maxpktrecv = packet->datasize;
+
       return DLPACKET;
     }
     else if (!strncmp (header, "ID", 2))
@@ -1478,3 +1775,83 @@ dl_terminate (DLCP *dlconn)
 
   dlconn->terminate = 1;
 } /* End of dl_terminate() */
+
+/***********************************************************************/ /**
+ * @brief Retrieve the statistics of a DataLink connection
+ *
+ * Copy the cumulative counters maintained for a connection into @a
+ * stats.  The counters are updated by the library as packets are
+ * received and network system calls are made; they are never reset
+ * by the library and persist across re-connections.
+ *
+ * Maintaining the counters costs an increment or comparison where
+ * the event occurs.  The time blocked waiting is measured around the
+ * select() of dl_collect() and around receives completing a partial
+ * read, reads that find data waiting are not timed.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param stats Destination for a copy of the connection statistics
+ *
+ * @return -1 on errors, 0 on success.
+ ***************************************************************************/
+int
+dl_getstats (DLCP *dlconn, DLStats *stats)
+{
+  if (!dlconn || !stats)
+    return -1;
+
+  memcpy (stats, &dlconn->stats, sizeof (DLStats));
+
+  return 0;
+} /* End of dl_getstats() */
+
+/***********************************************************************/ /**
+ * @brief Retrieve the receive backlog of a DataLink connection
+ *
+ * Set @a backlog to the number of bytes received by the kernel for
+ * the connection and not yet read, the size of the kernel receive
+ * buffer, and the ID and time of the last packet received.  Packets
+ * are read directly from the socket into the caller's buffers, the
+ * library holds no received data of its own, so the kernel queue is
+ * all the data received and not yet returned to the caller.
+ *
+ * A receive queue approaching the buffer size means packets are not
+ * being collected as fast as the server sends them.  The distance of
+ * @a backlog->pktid from the server's latest packet ID, see INFO
+ * STATUS, is how far the client is behind in the server's ring.
+ *
+ * Like other routines using the connection this is not thread-safe,
+ * it should be called by the thread using the connection.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param backlog Destination for the receive backlog
+ *
+ * @return -1 on errors, 0 on success.
+ ***************************************************************************/
+int
+dl_getbacklog (DLCP *dlconn, DLBacklog *backlog)
+{
+  SOCKET link;
+
+  if (!dlconn || !backlog)
+    return -1;
+
+  backlog->socketqueued = -1;
+  backlog->socketsize   = -1;
+  backlog->pktid        = dlconn->pktid;
+  backlog->pkttime      = dlconn->pkttime;
+
+  link = dlconn->link;
+
+  if (link == -1)
+    return -1;
+
+  if (dlp_sockrecvqueue (link, &backlog->socketqueued, &backlog->socketsize))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_getbacklog(): cannot query socket receive queue: %s\n",
+              dlconn->addr, dlp_strerror ());
+    return -1;
+  }
+
+  return 0;
+} /* End of dl_getbacklog() */
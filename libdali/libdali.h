@@ -28,8 +28,8 @@
 extern "C" {
 #endif
 
-#define LIBDALI_VERSION "1.8.1"      /**< libdali version */
-#define LIBDALI_RELEASE "2023.335"   /**< libdali release date */
+#define LIBDALI_VERSION "2.0.0"      /**< libdali version */
+#define LIBDALI_RELEASE "2026.291"   /**< libdali release date */
 
 /** @defgroup connection Connection managment functions */
 /** @defgroup network Connection network functions */
@@ -138,6 +138,7 @@ extern "C" {
 
 #define MAXPACKETSIZE       16384    /**< Maximum packet size for libdali */
 #define MAXREGEXSIZE        16384    /**< Maximum regex pattern size */
+#define DL_INFOCHUNKSIZE    16384    /**< Chunk size for dl_getinfochunks() */
 #define MAX_LOG_MSG_LENGTH  200      /**< Maximum length of log messages */
 
 #define LIBDALI_POSITION_EARLIEST -2 /**< Earliest position in the buffer */
@@ -231,6 +232,34 @@ typedef struct DLLog_s
 
     @{ */
 
+/** DataLink connection statistics, cumulative counters */
+typedef struct DLStats_s
+{
+  uint64_t    pktrecv;          /**< Count of packets received */
+  uint64_t    byterecv;         /**< Count of packet data bytes received */
+  uint64_t    recvcalls;        /**< Count of socket receive calls */
+  uint64_t    sendcalls;        /**< Count of socket send calls */
+  uint64_t    syscalls;         /**< Count of all network system calls, including receive and send */
+  uint64_t    pktsent;          /**< Count of packets sent with dl_write() and dl_writebatch() */
+  uint64_t    bytesent;         /**< Count of packet data bytes sent */
+  uint64_t    headers;          /**< Count of packet headers received and parsed, including replies */
+  uint64_t    partialreads;     /**< Count of socket receive calls returning less data than requested */
+  uint64_t    keepalives;       /**< Count of keepalive packets sent */
+  uint64_t    connects;         /**< Count of connections established */
+  uint64_t    reconnects;       /**< Count of connections established after the first */
+  dltime_t    waittime;         /**< Time blocked waiting for data, in DLTMODULUS units */
+  int32_t     maxpktrecv;       /**< Size of the largest packet data received */
+} DLStats;
+
+/** DataLink connection receive backlog, see dl_getbacklog() */
+typedef struct DLBacklog_s
+{
+  int64_t     socketqueued;     /**< Bytes received by the kernel and not yet read, -1 if unknown */
+  int64_t     socketsize;       /**< Size of the kernel receive buffer in bytes, -1 if unknown */
+  int64_t     pktid;            /**< Packet ID of last packet received */
+  dltime_t    pkttime;          /**< Packet time of last packet received */
+} DLBacklog;
+
 /** DataLink connection parameters */
 typedef struct DLCP_s
 {
@@ -252,6 +281,11 @@ typedef struct DLCP_s
   int8_t      streaming;        /**< Boolean flag to indicate streaming status, maintained internally */
 
   DLLog      *log;              /**< Logging parameters, maintained internally */
+
+  /* Members added after the original layout, appended to preserve the ABI */
+  char        statekey[100];    /**< Key of state file entry, the server address if empty */
+  DLStats     stats;            /**< Connection statistics, maintained internally */
+  dltime_t    recvtime;         /**< Receive time of last data received, maintained internally */
 } DLCP;
 
 /** DataLink packet */
@@ -263,8 +297,23 @@ typedef struct DLPacket_s
   dltime_t    datastart;        /**< Data start time */
   dltime_t    dataend;          /**< Data end time */
   int32_t     datasize;         /**< Data size in bytes */
+  dltime_t    recvtime;         /**< Receive time, kernel timestamp when available */
 } DLPacket;
 
+/** Reply value of a batch item whose reply was not received, see dl_writebatch() */
+#define DLNOREPLY  -2
+
+/** Packet description for batched writes, see dl_writebatch() */
+typedef struct DLWriteItem_s
+{
+  char       *streamid;         /**< Stream ID of packet */
+  dltime_t    datastart;        /**< Data start time */
+  dltime_t    dataend;          /**< Data end time */
+  void       *packet;           /**< Packet data buffer */
+  int32_t     packetlen;        /**< Length of packet data in bytes */
+  int64_t     reply;            /**< Packet ID acknowledged by server, -1 if rejected, ::DLNOREPLY if unknown, set by dl_writebatch() */
+} DLWriteItem;
+
 extern DLCP *  dl_newdlcp (char *address, char *progname);
 extern void    dl_freedlcp (DLCP *dlconn);
 extern int     dl_exchangeIDs (DLCP *dlconn, int parseresp);
@@ -274,10 +323,14 @@ extern int64_t dl_match (DLCP *dlconn, char *matchpattern);
 extern int64_t dl_reject (DLCP *dlconn, char *rejectpattern);
 extern int64_t dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
 			 dltime_t datastart, dltime_t dataend, int ack);
+extern int     dl_writebatch (DLCP *dlconn, DLWriteItem *items, int count, int ack);
 extern int     dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet,
 			void *packetdata, size_t maxdatasize);
 extern int     dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
 			   char **infodata, size_t maxinfosize);
+extern int     dl_getinfochunks (DLCP *dlconn, const char *infotype, char *infomatch,
+				 int (*infohandler) (char *chunk, int chunklen, void *handlerdata),
+				 void *handlerdata);
 extern int     dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
 			   size_t maxdatasize, int8_t endflag);
 extern int     dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
@@ -287,6 +340,9 @@ extern void    dl_terminate (DLCP *dlconn);
 extern char   *dl_read_streamlist (DLCP *dlconn, const char *streamfile);
 extern int     dl_recoverstate (DLCP *dlconn, const char *statefile);
 extern int     dl_savestate (DLCP *dlconn, const char *statefile);
+extern int     dl_savestates (DLCP **dlconns, int count, const char *statefile);
+extern int     dl_getstats (DLCP *dlconn, DLStats *stats);
+extern int     dl_getbacklog (DLCP *dlconn, DLBacklog *backlog);
 /** @} */
 
 
@@ -297,6 +353,7 @@ extern int     dl_savestate (DLCP *dlconn, const char *statefile);
 extern SOCKET  dl_connect (DLCP *dlconn);
 extern void    dl_disconnect (DLCP *dlconn);
 extern int     dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen);
+extern int     dl_sendbuffers (DLCP *dlconn, void **buffers, size_t *lengths, int count);
 extern int     dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 			      void *databuf, size_t datalen,
 			      void *respbuf, int resplen);
@@ -335,6 +392,8 @@ extern DLLog  *dl_loginit_rl (DLLog *log, int verbosity,
     @{ */
 extern const char *dlp_strerror (void);
 extern int     dlp_openfile (const char *filename, char perm);
+extern int     dlp_fsync (int fd);
+extern int     dlp_renamefile (const char *oldpath, const char *newpath);
 extern int64_t dlp_time (void);
 extern void    dlp_usleep (unsigned long int useconds);
 extern int     dlp_genclientid (char *progname, char *clientid, size_t maxsize);
@@ -27,6 +27,16 @@
 #include "libdali.h"
 #include "portable.h"
 
+#if !defined(DLP_WIN)
+#include <sys/uio.h>
+#include <sys/un.h>
+#endif
+
+/* Maximum number of buffers passed to a single vectored send call */
+#define DL_MAXIOV 128
+
+static SOCKET dl_connectunix (DLCP *dlconn);
+
 /***********************************************************************/ /**
  * @brief Connect to a DataLink server
  *
@@ -38,6 +48,9 @@
  * neither is specified (only a separator) then 'localhost' and port
  * '16000' are assumed.
  *
+ * If 'dlconn->addr' begins with a '/' it is the path of a UNIX domain
+ * socket, which is not supported on Windows.
+ *
  * If a permanent error is detected (invalid port specified) the
  * dlconn->terminate flag will be set so the dl_collect() family of
  * routines will not continue trying to connect.
@@ -67,6 +80,16 @@ dl_connect (DLCP *dlconn)
     return -1;
   }
 
+  /* An absolute path is a UNIX domain socket */
+  if (dlconn->addr[0] == '/')
+  {
+    if ((sock = dl_connectunix (dlconn)) < 0)
+      return -1;
+
+    socket_family = PF_UNIX;
+    goto connected;
+  }
+
   /* Search address host-port separator, first for '@', then ':' */
   if ((ptr = strchr (dlconn->addr, '@')) == NULL && (ptr = strchr (dlconn->addr, ':')))
   {
@@ -168,11 +191,18 @@ dl_connect (DLCP *dlconn)
 
   freeaddrinfo(addr0);
 
+connected:
   if (dlconn->iotimeout < 0)
   {
     dl_log_r (dlconn, 1, 2, "[%s] using system socket timeouts\n", dlconn->addr);
   }
 
+  /* Enable kernel receive timestamps, otherwise receive times are measured */
+  if (dlp_socktimestamps (sock) <= 0)
+  {
+    dl_log_r (dlconn, 1, 2, "[%s] kernel receive timestamps not available\n", dlconn->addr);
+  }
+
   /* Set socket to non-blocking */
   if (dlp_socknoblock (sock))
   {
@@ -191,6 +221,11 @@ dl_connect (DLCP *dlconn)
   case PF_INET6:
     dl_log_r (dlconn, 1, 1, "(IPv6)\n");
     break;
+#if !defined(DLP_WIN)
+  case PF_UNIX:
+    dl_log_r (dlconn, 1, 1, "(UNIX)\n");
+    break;
+#endif
   default:
     dl_log_r (dlconn, 1, 1, "(Unknown protocol)\n");
   }
@@ -204,9 +239,75 @@ dl_connect (DLCP *dlconn)
     return -1;
   }
 
+  if (dlconn->stats.connects++ > 0)
+    dlconn->stats.reconnects++;
+
   return sock;
 } /* End of dl_connect() */
 
+/***********************************************************************/ /**
+ * @brief Connect to a DataLink server on a UNIX domain socket
+ *
+ * Create a socket and connect it to the UNIX domain socket path in
+ * 'dlconn->addr', setting socket I/O timeouts if configured.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return the socket descriptor created.
+ * @retval -1 on errors
+ ***************************************************************************/
+static SOCKET
+dl_connectunix (DLCP *dlconn)
+{
+#if !defined(DLP_WIN)
+  struct sockaddr_un addr;
+  SOCKET sock;
+  int timeout;
+
+  if (strlen (dlconn->addr) >= sizeof (addr.sun_path))
+  {
+    dl_log_r (dlconn, 2, 0, "socket path too long: %s\n", dlconn->addr);
+    dlconn->terminate = 1;
+    return -1;
+  }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, dlconn->addr);
+
+  if ((sock = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] Cannot create socket: %s\n", dlconn->addr, dlp_strerror ());
+    return -1;
+  }
+
+  /* Set socket I/O timeouts if possible */
+  if (dlconn->iotimeout)
+  {
+    timeout = (dlconn->iotimeout > 0) ? dlconn->iotimeout : -dlconn->iotimeout;
+
+    if (dlp_setsocktimeo (sock, timeout) == 1)
+    {
+      /* Negate timeout to indicate socket timeouts are set */
+      dlconn->iotimeout = -timeout;
+    }
+  }
+
+  if (dlp_sockconnect (sock, (struct sockaddr *)&addr, sizeof (addr)))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: %s\n", dlconn->addr, dlp_strerror ());
+    dlp_sockclose (sock);
+    return -1;
+  }
+
+  return sock;
+#else
+  dl_log_r (dlconn, 2, 0, "UNIX domain sockets are not supported on this platform\n");
+  dlconn->terminate = 1;
+  return -1;
+#endif
+} /* End of dl_connectunix() */
+
 /***********************************************************************/ /**
  * @brief Disconnect a DataLink connection
  *
@@ -250,7 +351,50 @@ dl_disconnect (DLCP *dlconn)
 int
 dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
 {
+  return dl_sendbuffers (dlconn, &buffer, &sendlen, 1);
+} /* End of dl_senddata() */
+
+/***********************************************************************/ /**
+ * @brief Send a sequence of buffers to a DataLink server
+ *
+ * Send the contents of @a count buffers, in order, as a contiguous
+ * stream of data using vectored send calls (sendmsg() or WSASend()) so
+ * that the data is not copied into an intermediate buffer.  Partial
+ * sends are continued until all data has been sent.
+ *
+ * If a user specified network I/O timeout was not applied at the
+ * system socket level this routine will implement the timeout using
+ * an alarm timer to interrupt the blocked send.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param buffers Array of buffers containing data to send
+ * @param lengths Array of the number of bytes to send from each buffer
+ * @param count Number of buffers
+ *
+ * @retval 0 on success
+ * @retval -1 on error.
+ ***************************************************************************/
+int
+dl_sendbuffers (DLCP *dlconn, void **buffers, size_t *lengths, int count)
+{
+  size_t offset = 0;
+  int64_t sent;
+  int idx = 0;
+  int iovcnt;
+  int rv  = 0;
+#if defined(DLP_WIN)
+  WSABUF iov[DL_MAXIOV];
+  DWORD wsasent;
+#else
+  struct iovec iov[DL_MAXIOV];
+  struct msghdr msg;
+#endif
+
+  if (!dlconn || !buffers || !lengths)
+    return -1;
+
   /* Set socket to blocking */
+  dlconn->stats.syscalls += DLP_SOCKMODE_SYSCALLS;
   if (dlp_sockblock (dlconn->link))
   {
     dl_log_r (dlconn, 2, 0, "[%s] error setting socket to blocking\n",
@@ -261,6 +405,7 @@ dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
   /* Set timeout alarm if needed */
   if (dlconn->iotimeout > 0)
   {
+    dlconn->stats.syscalls++;
     if (dlp_setioalarm (dlconn->iotimeout))
     {
       dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
@@ -268,16 +413,54 @@ dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
     }
   }
 
-  /* Send data */
-  if (send (dlconn->link, buffer, sendlen, 0) != (int64_t)sendlen)
+  /* Send data, up to DL_MAXIOV buffers per call */
+  while (idx < count)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
-    return -1;
+    for (iovcnt = 0; iovcnt < DL_MAXIOV && (idx + iovcnt) < count; iovcnt++)
+    {
+#if defined(DLP_WIN)
+      iov[iovcnt].buf = (char *)buffers[idx + iovcnt] + ((iovcnt == 0) ? offset : 0);
+      iov[iovcnt].len = (ULONG)(lengths[idx + iovcnt] - ((iovcnt == 0) ? offset : 0));
+#else
+      iov[iovcnt].iov_base = (char *)buffers[idx + iovcnt] + ((iovcnt == 0) ? offset : 0);
+      iov[iovcnt].iov_len  = lengths[idx + iovcnt] - ((iovcnt == 0) ? offset : 0);
+#endif
+    }
+
+    dlconn->stats.sendcalls++;
+    dlconn->stats.syscalls++;
+#if defined(DLP_WIN)
+    sent = (WSASend (dlconn->link, iov, iovcnt, &wsasent, 0, NULL, NULL)) ? -1 : (int64_t)wsasent;
+#else
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+
+    sent = sendmsg (dlconn->link, &msg, 0);
+#endif
+
+    if (sent < 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
+      rv = -1;
+      break;
+    }
+
+    /* Advance past the buffers sent */
+    while (idx < count && sent >= (int64_t)(lengths[idx] - offset))
+    {
+      sent -= lengths[idx] - offset;
+      offset = 0;
+      idx++;
+    }
+
+    offset += (size_t)sent;
   }
 
   /* Cancel timeout alarm if set */
   if (dlconn->iotimeout > 0)
   {
+    dlconn->stats.syscalls++;
     if (dlp_setioalarm (0))
     {
       dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
@@ -286,6 +469,7 @@ dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
   }
 
   /* Set socket to non-blocking */
+  dlconn->stats.syscalls += DLP_SOCKMODE_SYSCALLS;
   if (dlp_socknoblock (dlconn->link))
   {
     dl_log_r (dlconn, 2, 0, "[%s] error setting socket to non-blocking\n",
@@ -293,8 +477,8 @@ dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
     return -1;
   }
 
-  return 0;
-} /* End of dl_senddata() */
+  return rv;
+} /* End of dl_sendbuffers() */
 
 /***********************************************************************/ /**
  * @brief Create and send a DataLink packet
@@ -330,7 +514,9 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
                void *respbuf, int resplen)
 {
   int bytesread = 0; /* bytes read into resp buffer */
-  char wirepacket[MAXPACKETSIZE];
+  char preheader[3];
+  void *buffers[3];
+  size_t lengths[3];
 
   if (!dlconn || !headerbuf)
     return -1;
@@ -352,19 +538,19 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
   }
 
   /* Set the synchronization and header size bytes */
-  wirepacket[0] = 'D';
-  wirepacket[1] = 'L';
-  wirepacket[2] = (uint8_t)headerlen;
-
-  /* Copy header into the wire packet */
-  memcpy (wirepacket + 3, headerbuf, headerlen);
+  preheader[0] = 'D';
+  preheader[1] = 'L';
+  preheader[2] = (uint8_t)headerlen;
 
-  /* Copy packet data into the wire packet if supplied */
-  if (databuf && datalen > 0)
-    memcpy (wirepacket + 3 + headerlen, databuf, datalen);
+  buffers[0] = preheader;
+  lengths[0] = 3;
+  buffers[1] = headerbuf;
+  lengths[1] = headerlen;
+  buffers[2] = databuf;
+  lengths[2] = (databuf) ? datalen : 0;
 
-  /* Send data */
-  if (dl_senddata (dlconn, wirepacket, (3 + headerlen + datalen)) < 0)
+  /* Send the preheader, header and packet data without copying */
+  if (dl_sendbuffers (dlconn, buffers, lengths, (databuf && datalen > 0) ? 3 : 2) < 0)
   {
     /* Check for a message from the server */
     if ((bytesread = dl_recvheader (dlconn, respbuf, resplen, 0)) > 0)
@@ -420,6 +606,7 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 int
 dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
 {
+  dltime_t waitstart;
   int nrecv;
   int nread  = 0;
   char *bptr = buffer;
@@ -432,6 +619,7 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
   /* Set socket to blocking if requested */
   if (blockflag)
   {
+    dlconn->stats.syscalls += DLP_SOCKMODE_SYSCALLS;
     if (dlp_sockblock (dlconn->link))
     {
       dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to blocking: %s\n",
@@ -443,6 +631,7 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
   /* Set timeout alarm if needed */
   if (dlconn->iotimeout > 0)
   {
+    dlconn->stats.syscalls++;
     if (dlp_setioalarm (dlconn->iotimeout))
     {
       dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
@@ -453,7 +642,24 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
   /* Recv until readlen bytes have been read */
   while (nread < (int64_t)readlen)
   {
-    if ((nrecv = recv (dlconn->link, bptr, readlen - nread, 0)) < 0)
+    dlconn->stats.recvcalls++;
+    dlconn->stats.syscalls++;
+
+    /* Completing a partial read is time blocked waiting for data */
+    waitstart = (nread > 0) ? dlp_time () : 0;
+
+    /* Receive time of the first data read is the receive time of the data */
+    nrecv = dlp_sockrecv (dlconn->link, bptr, readlen - nread,
+                          (nread == 0) ? &dlconn->recvtime : NULL);
+
+    if (waitstart)
+    {
+      waitstart = dlp_time () - waitstart;
+      if (waitstart > 0)
+        dlconn->stats.waittime += waitstart;
+    }
+
+    if (nrecv < 0)
     {
       /* The only acceptable error is no data on non-blocking */
       if (!blockflag && !dlp_noblockcheck ())
@@ -484,6 +690,9 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
     /* Update recv pointer and byte count */
     if (nrecv > 0)
     {
+      if (nrecv < (int64_t)readlen - nread)
+        dlconn->stats.partialreads++;
+
       bptr += nrecv;
       nread += nrecv;
     }
@@ -492,6 +701,7 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
   /* Cancel timeout alarm if set */
   if (dlconn->iotimeout > 0)
   {
+    dlconn->stats.syscalls++;
     if (dlp_setioalarm (0))
     {
       dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
@@ -502,6 +712,7 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
   /* Set socket to non-blocking if set to blocking */
   if (blockflag)
   {
+    dlconn->stats.syscalls += DLP_SOCKMODE_SYSCALLS;
     if (dlp_socknoblock (dlconn->link))
     {
       dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to non-blocking: %s\n",
@@ -534,6 +745,7 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
   int bytesread = 0;
   int headerlen;
   char *cbuffer = buffer;
+  dltime_t recvtime;
 
   if (!dlconn || !buffer)
   {
@@ -557,6 +769,9 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
       return bytesread;
   }
 
+  /* Receive time of the header is the time the first bytes were received */
+  recvtime = dlconn->recvtime;
+
   /* Test synchronization bytes */
   if (cbuffer[0] != 'D' || cbuffer[1] != 'L')
   {
@@ -578,6 +793,9 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
       return bytesread;
   }
 
+  dlconn->recvtime = recvtime;
+  dlconn->stats.headers++;
+
   /* Make sure reply is NULL terminated */
   if (bytesread == (int64_t)buflen)
     cbuffer[bytesread - 1] = '\0';
@@ -31,6 +31,10 @@
 #include "libdali.h"
 #include "portable.h"
 
+#if !defined(DLP_WIN)
+#include <sys/ioctl.h>
+#endif
+
 /************************************************************************/ /**
  * @brief Start up socket subsystem (only does something for WIN)
  *
@@ -250,6 +254,205 @@ dlp_setsocktimeo (SOCKET socket, int timeout)
   return 1;
 } /* End of dlp_setsocktimeo() */
 
+/***********************************************************************/ /**
+ * @brief Enable kernel receive timestamps on a socket
+ *
+ * Enable reporting of the time data was received by the kernel with
+ * the SO_TIMESTAMPNS socket option, or SO_TIMESTAMP with microsecond
+ * resolution where that is not defined.  The timestamps are returned
+ * by dlp_sockrecv().
+ *
+ * @param socket Network socket descriptor
+ *
+ * @return -1 on error, 0 when not possible and 1 on success.
+ ***************************************************************************/
+int
+dlp_socktimestamps (SOCKET socket)
+{
+  int on = 1;
+
+#if defined(SO_TIMESTAMPNS)
+  if (setsockopt (socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on)))
+    return -1;
+#elif defined(SO_TIMESTAMP) && !defined(DLP_WIN)
+  if (setsockopt (socket, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof (on)))
+    return -1;
+#else
+  (void)socket;
+  (void)on;
+  return 0;
+#endif
+
+  return 1;
+} /* End of dlp_socktimestamps() */
+
+/***********************************************************************/ /**
+ * @brief Receive data from a socket with the receive time
+ *
+ * Receive up to @a length bytes from a socket, equivalent to recv(),
+ * and set @a recvtime to the kernel receive timestamp of the data if
+ * enabled with dlp_socktimestamps() and supported, otherwise to the
+ * current time.
+ *
+ * @param socket Network socket descriptor
+ * @param buffer Buffer for received data
+ * @param length Maximum number of bytes to receive
+ * @param recvtime Receive time of data, set when data is received
+ *
+ * @return the return value of recv() or recvmsg().
+ ***************************************************************************/
+int
+dlp_sockrecv (SOCKET socket, void *buffer, size_t length, dltime_t *recvtime)
+{
+#if defined(DLP_WIN)
+  int nrecv = recv (socket, buffer, (int)length, 0);
+
+  if (nrecv > 0 && recvtime)
+    *recvtime = dlp_time ();
+
+  return nrecv;
+#else
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union
+  {
+    char buf[CMSG_SPACE (sizeof (struct timespec))];
+    struct cmsghdr align;
+  } control;
+  int nrecv;
+
+  iov.iov_base = buffer;
+  iov.iov_len  = length;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  nrecv = (int)recvmsg (socket, &msg, 0);
+
+  if (nrecv > 0 && recvtime)
+  {
+    *recvtime = 0;
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET)
+        continue;
+#if defined(SCM_TIMESTAMPNS)
+      if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+      {
+        struct timespec ts;
+
+        memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+        *recvtime = (dltime_t)ts.tv_sec * DLTMODULUS + ts.tv_nsec / (1000000000 / DLTMODULUS);
+        break;
+      }
+#endif
+#if defined(SCM_TIMESTAMP)
+      if (cmsg->cmsg_type == SCM_TIMESTAMP)
+      {
+        struct timeval tv;
+
+        memcpy (&tv, CMSG_DATA (cmsg), sizeof (tv));
+        *recvtime = (dltime_t)tv.tv_sec * DLTMODULUS + tv.tv_usec / (1000000 / DLTMODULUS);
+        break;
+      }
+#endif
+    }
+
+    if (*recvtime == 0)
+      *recvtime = dlp_time ();
+  }
+
+  return nrecv;
+#endif
+} /* End of dlp_sockrecv() */
+
+/***********************************************************************/ /**
+ * @brief Get the receive queue of a socket
+ *
+ * Get the number of bytes received by the kernel and not yet read
+ * from a socket, with the FIONREAD (SIOCINQ) ioctl, and the size of
+ * the kernel receive buffer, the SO_RCVBUF socket option.  Either
+ * value is set to -1 when it cannot be determined.
+ *
+ * @param socket Network socket descriptor
+ * @param queued Bytes queued in the receive buffer, may be NULL
+ * @param size Size of the receive buffer in bytes, may be NULL
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_sockrecvqueue (SOCKET socket, int64_t *queued, int64_t *size)
+{
+  int rv = 0;
+  int bufsize;
+#if defined(DLP_WIN)
+  int optlen = sizeof (bufsize);
+  u_long pending;
+
+  if (queued)
+  {
+    if (ioctlsocket (socket, FIONREAD, &pending) == SOCKET_ERROR)
+    {
+      *queued = -1;
+      rv      = -1;
+    }
+    else
+    {
+      *queued = (int64_t)pending;
+    }
+  }
+
+  if (size)
+  {
+    if (getsockopt (socket, SOL_SOCKET, SO_RCVBUF, (char *)&bufsize, &optlen) == SOCKET_ERROR)
+    {
+      *size = -1;
+      rv    = -1;
+    }
+    else
+    {
+      *size = bufsize;
+    }
+  }
+#else
+  socklen_t optlen = sizeof (bufsize);
+  int pending;
+
+  if (queued)
+  {
+    if (ioctl (socket, FIONREAD, &pending) == -1)
+    {
+      *queued = -1;
+      rv      = -1;
+    }
+    else
+    {
+      *queued = pending;
+    }
+  }
+
+  if (size)
+  {
+    if (getsockopt (socket, SOL_SOCKET, SO_RCVBUF, &bufsize, &optlen) == -1)
+    {
+      *size = -1;
+      rv    = -1;
+    }
+    else
+    {
+      *size = bufsize;
+    }
+  }
+#endif
+
+  return rv;
+} /* End of dlp_sockrecvqueue() */
+
 /***********************************************************************/ /**
  * @brief Set a network I/O real time alarm
  *
@@ -295,7 +498,8 @@ dlp_setioalarm (int timeout)
  *
  * @a perm:
  *  'r', open file with read-only permissions
- *  'w', open file with read-write permissions, creating if necessary.
+ *  'w', open file with read-write permissions, creating if necessary
+ *       and truncating an existing file.
  *
  * @param filename File to open
  * @param perm Permission flag
@@ -307,16 +511,87 @@ int
 dlp_openfile (const char *filename, char perm)
 {
 #if defined(DLP_WIN)
-  int flags = (perm == 'w') ? (_O_RDWR | _O_CREAT | _O_BINARY) : (_O_RDONLY | _O_BINARY);
+  int flags = (perm == 'w') ? (_O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY) : (_O_RDONLY | _O_BINARY);
   int mode  = (_S_IREAD | _S_IWRITE);
 #else
-  int flags   = (perm == 'w') ? (O_RDWR | O_CREAT) : O_RDONLY;
+  int flags   = (perm == 'w') ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY;
   mode_t mode = (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 #endif
 
   return open (filename, flags, mode);
 } /* End of dlp_openfile() */
 
+/***********************************************************************/ /**
+ * @brief Flush file data to storage
+ *
+ * Flush the data and metadata of an open file descriptor to the
+ * storage device, on the WIN platform with _commit().
+ *
+ * @param fd File descriptor
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_fsync (int fd)
+{
+#if defined(DLP_WIN)
+  return _commit (fd);
+#else
+  return fsync (fd);
+#endif
+} /* End of dlp_fsync() */
+
+/***********************************************************************/ /**
+ * @brief Atomically replace a file
+ *
+ * Rename @a oldpath to @a newpath, replacing @a newpath if it exists,
+ * and flush the change of directory entry to storage where possible.
+ * A reader will find either the old or the new file, never a partial
+ * file.
+ *
+ * @param oldpath Path of file to rename
+ * @param newpath New path of file
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_renamefile (const char *oldpath, const char *newpath)
+{
+#if defined(DLP_WIN)
+  if (!MoveFileExA (oldpath, newpath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    return -1;
+#else
+  char dirpath[512];
+  char *slash;
+  int dirfd;
+
+  if (rename (oldpath, newpath))
+    return -1;
+
+  /* Flush the directory containing the file */
+  snprintf (dirpath, sizeof (dirpath), "%s", newpath);
+
+  if ((slash = strrchr (dirpath, '/')))
+  {
+    if (slash == dirpath)
+      slash++;
+    *slash = '\0';
+  }
+  else
+  {
+    strcpy (dirpath, ".");
+  }
+
+  if ((dirfd = open (dirpath, O_RDONLY)) >= 0)
+  {
+    fsync (dirfd);
+    close (dirfd);
+  }
+#endif
+
+  return 0;
+} /* End of dlp_renamefile() */
+
 /***********************************************************************/ /**
  * @brief Return a description of the last system error.
  *
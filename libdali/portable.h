@@ -29,6 +29,13 @@ extern "C" {
 
 #include "libdali.h"
 
+/** Number of system calls used by dlp_sockblock() and dlp_socknoblock() */
+#if defined(DLP_WIN)
+  #define DLP_SOCKMODE_SYSCALLS 1
+#else
+  #define DLP_SOCKMODE_SYSCALLS 2
+#endif
+
 extern int dlp_sockstartup (void);
 extern int dlp_sockconnect (SOCKET socket, struct sockaddr * inetaddr, int addrlen);
 extern int dlp_sockclose (SOCKET socket);
@@ -36,6 +43,9 @@ extern int dlp_sockblock (SOCKET socket);
 extern int dlp_socknoblock (SOCKET socket);
 extern int dlp_noblockcheck (void);
 extern int dlp_setsocktimeo (SOCKET socket, int timeout);
+extern int dlp_socktimestamps (SOCKET socket);
+extern int dlp_sockrecv (SOCKET socket, void *buffer, size_t length, dltime_t *recvtime);
+extern int dlp_sockrecvqueue (SOCKET socket, int64_t *queued, int64_t *size);
 extern int dlp_setioalarm (int timeout);
 
 #ifdef __cplusplus
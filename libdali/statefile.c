@@ -22,67 +22,190 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "libdali.h"
 #include "portable.h"
 
+static const char *dl_statekey (DLCP *dlconn);
+
 /***********************************************************************/ /**
  * @brief Save a DataLink connection state to a file
  *
- * Save the all the current the sequence numbers and time stamps into the
- * given state file.
+ * Save the current sequence number and time stamp of a connection
+ * into the given state file.  The state file contains an entry for
+ * each server address, entries for other addresses are preserved so
+ * that the states of multiple connections can be saved to the same
+ * file.  Entries are keyed by DLCP.statekey when set, allowing
+ * several connections to the same server to keep separate entries.
+ *
+ * The state is written to a temporary file, "<statefile>.tmp", that is
+ * flushed to storage and renamed to replace the state file, so that
+ * the state file is never left partially written.
  *
  * @param dlconn DataLink Connection Parameters
  * @param statefile File to save state to
  *
  * @retval -1 Error
  * @retval 0 Completed successfully
+ *
+ * @sa dl_savestates()
  ***************************************************************************/
 int
 dl_savestate (DLCP *dlconn, const char *statefile)
 {
+  if (!dlconn)
+    return -1;
+
+  return dl_savestates (&dlconn, 1, statefile);
+} /* End of dl_savestate() */
+
+/***********************************************************************/ /**
+ * @brief Save the state of several DataLink connections to a file
+ *
+ * Save the current sequence numbers and time stamps of count
+ * connections into the given state file, as for dl_savestate(), with
+ * a single replacement of the file.  Either all entries are updated or
+ * the state file is left unchanged.  Messages are logged with the
+ * logging parameters of the first connection.
+ *
+ * @param dlconns Array of DataLink Connection Parameters
+ * @param count Number of connections in @p dlconns
+ * @param statefile File to save state to
+ *
+ * @retval -1 Error
+ * @retval 0 Completed successfully
+ ***************************************************************************/
+int
+dl_savestates (DLCP **dlconns, int count, const char *statefile)
+{
+  DLCP *dlconn;
   char line[200];
+  char addrstr[100];
+  char *content = NULL;
+  char *newcontent;
+  char *temppath;
+  size_t contentlen = 0;
   int linelen;
   int statefd;
+  int rv = 0;
+  int idx;
 
-  if (!dlconn || !statefile)
+  if (!dlconns || count <= 0 || !dlconns[0] || !statefile)
     return -1;
 
-  /* Open the state file */
-  if ((statefd = dlp_openfile (statefile, 'w')) < 0)
+  dlconn = dlconns[0];
+
+  /* Read the entries for other server addresses from an existing state file */
+  if ((statefd = dlp_openfile (statefile, 'r')) >= 0)
+  {
+    while ((dl_readline (statefd, line, sizeof (line))) >= 0)
+    {
+      if (sscanf (line, "%99s", addrstr) != 1)
+        continue;
+
+      for (idx = 0; idx < count; idx++)
+      {
+        if (!strncmp (dl_statekey (dlconns[idx]), addrstr, sizeof (addrstr)))
+          break;
+      }
+
+      if (idx < count)
+        continue;
+
+      linelen = strlen (line);
+
+      if (!(newcontent = (char *)realloc (content, contentlen + linelen + 2)))
+      {
+        dl_log_r (dlconn, 2, 0, "cannot allocate memory for state file entries\n");
+        free (content);
+        close (statefd);
+        return -1;
+      }
+
+      content = newcontent;
+      memcpy (content + contentlen, line, linelen);
+      contentlen += linelen;
+      content[contentlen++] = '\n';
+    }
+
+    close (statefd);
+  }
+
+  if (!(temppath = (char *)malloc (strlen (statefile) + 5)))
+  {
+    dl_log_r (dlconn, 2, 0, "cannot allocate memory for state file name\n");
+    free (content);
+    return -1;
+  }
+
+  sprintf (temppath, "%s.tmp", statefile);
+
+  /* Open the temporary state file */
+  if ((statefd = dlp_openfile (temppath, 'w')) < 0)
   {
     dl_log_r (dlconn, 2, 0, "cannot open state file for writing\n");
+    free (temppath);
+    free (content);
     return -1;
   }
 
   dl_log_r (dlconn, 1, 2, "saving connection state to state file\n");
 
+  if (contentlen > 0 && write (statefd, content, contentlen) != (int64_t)contentlen)
+    rv = -1;
+
   /* Write state information: <server address> <packet ID> <packet time> */
-  linelen = snprintf (line, sizeof (line), "%s %lld %lld\n",
-                      dlconn->addr, (long long int)dlconn->pktid,
-                      (long long int)dlconn->pkttime);
+  for (idx = 0; rv == 0 && idx < count; idx++)
+  {
+    linelen = snprintf (line, sizeof (line), "%s %lld %lld\n",
+                        dl_statekey (dlconns[idx]), (long long int)dlconns[idx]->pktid,
+                        (long long int)dlconns[idx]->pkttime);
+
+    if (write (statefd, line, linelen) != linelen)
+      rv = -1;
+  }
 
-  if (write (statefd, line, linelen) != linelen)
+  if (rv)
   {
     dl_log_r (dlconn, 2, 0, "cannot write to state file, %s\n", strerror (errno));
-    return -1;
+  }
+  else if (dlp_fsync (statefd))
+  {
+    dl_log_r (dlconn, 2, 0, "cannot flush state file, %s\n", strerror (errno));
+    rv = -1;
   }
 
+  free (content);
+
   if (close (statefd))
   {
     dl_log_r (dlconn, 2, 0, "cannot close state file, %s\n", strerror (errno));
-    return -1;
+    rv = -1;
   }
 
-  return 0;
-} /* End of dl_savestate() */
+  /* Replace the state file, or remove the incomplete temporary file */
+  if (rv == 0 && dlp_renamefile (temppath, statefile))
+  {
+    dl_log_r (dlconn, 2, 0, "cannot rename state file, %s\n", strerror (errno));
+    rv = -1;
+  }
+
+  if (rv)
+    remove (temppath);
+
+  free (temppath);
+
+  return rv;
+} /* End of dl_savestates() */
 
 /***********************************************************************/ /**
  * @brief Recover DataLink connection state from a file
  *
  * Recover connection state from a state file and set the state
- * parameters in a given DataLink Connection Paramters.
+ * parameters in a given DataLink Connection Paramters.  The entry
+ * is found by DLCP.statekey when set, otherwise by server address.
  *
  * @param dlconn DataLink Connection Parameters
  * @param statefile File to recover state from
@@ -94,6 +217,7 @@ dl_savestate (DLCP *dlconn, const char *statefile)
 int
 dl_recoverstate (DLCP *dlconn, const char *statefile)
 {
+  const char *key;
   int statefd;
   char line[200];
   char addrstr[100];
@@ -104,6 +228,8 @@ dl_recoverstate (DLCP *dlconn, const char *statefile)
   if (!dlconn || !statefile)
     return -1;
 
+  key = dl_statekey (dlconn);
+
   /* Open the state file */
   if ((statefd = dlp_openfile (statefile, 'r')) < 0)
   {
@@ -140,7 +266,7 @@ dl_recoverstate (DLCP *dlconn, const char *statefile)
     }
 
     /* Check for a matching server address and set connection values if found */
-    if (!strncmp (dlconn->addr, addrstr, sizeof (addrstr)))
+    if (!strncmp (key, addrstr, sizeof (addrstr)))
     {
       dlconn->pktid   = spktid;
       dlconn->pkttime = spkttime;
@@ -154,7 +280,7 @@ dl_recoverstate (DLCP *dlconn, const char *statefile)
 
   if (!found)
   {
-    dl_log_r (dlconn, 1, 0, "Server address not found in state file: %s\n", dlconn->addr);
+    dl_log_r (dlconn, 1, 0, "Server address not found in state file: %s\n", key);
   }
 
   if (close (statefd))
@@ -165,3 +291,15 @@ dl_recoverstate (DLCP *dlconn, const char *statefile)
 
   return 0;
 } /* End of dl_recoverstate() */
+
+/***************************************************************************
+ * dl_statekey:
+ *
+ * Return the key of the state file entry of a connection,
+ * DLCP.statekey when set and otherwise the server address.
+ ***************************************************************************/
+static const char *
+dl_statekey (DLCP *dlconn)
+{
+  return (dlconn->statekey[0]) ? dlconn->statekey : dlconn->addr;
+} /* End of dl_statekey() */
@@ -16,15 +16,37 @@ INCS = -I..\libdali -I..\ezxml -I..\libmseed
 
 all: $(BIN)
 
-$(BIN):	linenoise.obj common.obj dlconsole.obj dalixml.obj dalitool.obj
-	wlink $(lflags) name $(BIN) file {linenoise.obj common.obj dlconsole.obj dalixml.obj dalitool.obj}
+$(BIN):	linenoise.obj common.obj dlconsole.obj dalixml.obj bench.obj generate.obj replay.obj strhash.obj export.obj relay.obj fanin.obj reorder.obj dedup.obj framed.obj checkpoint.obj gaps.obj samplebuf.obj shmring.obj infoxml.obj infodelta.obj metrics.obj jsonout.obj infotop.obj shard.obj lagmon.obj trace.obj dalitool.obj
+	wlink $(lflags) name $(BIN) file {linenoise.obj common.obj dlconsole.obj dalixml.obj bench.obj generate.obj replay.obj strhash.obj export.obj relay.obj fanin.obj reorder.obj dedup.obj framed.obj checkpoint.obj gaps.obj samplebuf.obj shmring.obj infoxml.obj infodelta.obj metrics.obj jsonout.obj infotop.obj shard.obj lagmon.obj trace.obj dalitool.obj}
 
 # Source dependencies:
 linenoise.obj:	linenoise.c linenoise.h
-common.obj:	common.c common.h
-dlconsole.obj:	dlconsole.c dlconsole.h
-dalitxml.obj:	dalixml.c dalixml.h
-dalitool.obj:	dalitool.c dsarchive.h dlconsole.h dalixml.h
+common.obj:	common.c common.h trace.h
+dlconsole.obj:	dlconsole.c dlconsole.h gaps.h samplebuf.h dalixml.h
+dalitxml.obj:	dalixml.c dalixml.h infoxml.h
+bench.obj:	bench.c bench.h
+generate.obj:	generate.c generate.h
+replay.obj:	replay.c replay.h
+strhash.obj:	strhash.c strhash.h
+export.obj:	export.c export.h trace.h
+relay.obj:	relay.c relay.h
+fanin.obj:	fanin.c fanin.h trace.h
+reorder.obj:	reorder.c reorder.h
+dedup.obj:	dedup.c dedup.h
+framed.obj:	framed.c framed.h
+checkpoint.obj:	checkpoint.c checkpoint.h trace.h
+gaps.obj:	gaps.c gaps.h trace.h
+samplebuf.obj:	samplebuf.c samplebuf.h trace.h
+shmring.obj:	shmring.c shmring.h
+infoxml.obj:	infoxml.c infoxml.h
+infodelta.obj:	infodelta.c infodelta.h infoxml.h strhash.h
+metrics.obj:	metrics.c metrics.h infoxml.h strhash.h
+jsonout.obj:	jsonout.c jsonout.h infoxml.h trace.h
+infotop.obj:	infotop.c infotop.h infoxml.h strhash.h
+shard.obj:	shard.c shard.h infoxml.h strhash.h
+lagmon.obj:	lagmon.c lagmon.h common.h infoxml.h
+trace.obj:	trace.c trace.h common.h
+dalitool.obj:	dalitool.c dsarchive.h dlconsole.h dalixml.h bench.h generate.h replay.h export.h relay.h fanin.h reorder.h dedup.h framed.h checkpoint.h gaps.h samplebuf.h shmring.h infodelta.h metrics.h jsonout.h infotop.h shard.h lagmon.h trace.h
 
 # How to compile sources:
 .c.obj:
@@ -0,0 +1,295 @@
+/***************************************************************************
+ * bench.c
+ *
+ * Routines for benchmarking streaming throughput.
+ *
+ * Packets are collected in streaming mode for a fixed duration or
+ * packet count while the time spent receiving, parsing and writing
+ * output is accumulated along with the connection statistics
+ * maintained by libdali and the allocations made by libmseed.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <sys/select.h>
+#endif
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "bench.h"
+#include "common.h"
+
+/* Allocation counters, updated by the libmseed memory wrappers */
+static uint64_t mallocs  = 0;
+static uint64_t reallocs = 0;
+static uint64_t frees    = 0;
+
+static void *(*sys_malloc) (size_t);
+static void *(*sys_realloc) (void *, size_t);
+static void (*sys_free) (void *);
+
+static void *bench_malloc (size_t size);
+static void *bench_realloc (void *ptr, size_t size);
+static void bench_free (void *ptr);
+static double bench_cputime (double *user, double *sys);
+
+/***************************************************************************
+ * runbench:
+ *
+ * Collect packets in streaming mode until either the duration (in
+ * seconds) has elapsed or maxpackets have been received, whichever
+ * comes first.  A duration or maxpackets of zero is not used as a
+ * limit.  Each miniSEED packet is parsed and its samples decoded, if
+ * outfp is not NULL the packet data are written to it.
+ *
+ * A summary of the throughput and the time spent in each phase is
+ * printed when collection stops.
+ *
+ * Returns 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+runbench (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+          size_t maxdatasize, double duration, int64_t maxpackets,
+          FILE *outfp)
+{
+  MS3Record *msr = NULL;
+  DLStats startstats;
+  DLStats endstats;
+  char type[10];
+  int rv;
+
+  int64_t packets    = 0;
+  int64_t bytes      = 0;
+  int64_t parseerrs  = 0;
+  int64_t otherpkts  = 0;
+  int64_t recvtime   = 0;
+  int64_t waittime   = 0;
+  int64_t parsetime  = 0;
+  int64_t outputtime = 0;
+  int64_t starttime;
+  int64_t endtime;
+  int64_t deadline;
+  int64_t t0, t1;
+
+  double startuser, startsys, startcpu;
+  double enduser, endsys, endcpu;
+  double cputime, recvcpu;
+  double elapsed;
+  double divpkts;
+  uint64_t syscalls, recvcalls, sendcalls;
+
+  if (!dlconn || !dlpacket || !packetdata)
+    return -1;
+
+  /* Count all allocations made by libmseed during the benchmark */
+  sys_malloc              = libmseed_memory.malloc;
+  sys_realloc             = libmseed_memory.realloc;
+  sys_free                = libmseed_memory.free;
+  libmseed_memory.malloc  = bench_malloc;
+  libmseed_memory.realloc = bench_realloc;
+  libmseed_memory.free    = bench_free;
+
+  if (duration > 0)
+    dl_log (1, 1, "Benchmark limited to %.1f seconds\n", duration);
+  if (maxpackets > 0)
+    dl_log (1, 1, "Benchmark limited to %lld packets\n", (long long int)maxpackets);
+
+  dl_getstats (dlconn, &startstats);
+  startcpu  = bench_cputime (&startuser, &startsys);
+  starttime = clock_ns ();
+  deadline  = (duration > 0) ? starttime + (int64_t)(duration * 1e9) : 0;
+
+  while (!dlconn->terminate)
+  {
+    t0 = clock_ns ();
+
+    if (deadline && t0 >= deadline)
+      break;
+
+    rv = dl_collect_nb (dlconn, dlpacket, packetdata, maxdatasize, 0);
+
+    t1 = clock_ns ();
+    recvtime += t1 - t0;
+
+    if (rv == DLNOPACKET)
+    {
+#ifndef WIN32
+      fd_set readset;
+      struct timeval timeout;
+
+      /* Wait up to 1/10 second for data, this time is not attributed to receiving */
+      timeout.tv_sec  = 0;
+      timeout.tv_usec = 100000;
+
+      FD_ZERO (&readset);
+      FD_SET (dlconn->link, &readset);
+
+      if (select (dlconn->link + 1, &readset, NULL, NULL, &timeout) < 0 && errno != EINTR)
+      {
+        dl_log (2, 0, "select(): %s\n", strerror (errno));
+        break;
+      }
+#else
+      dlp_usleep (10000);
+#endif
+
+      waittime += clock_ns () - t1;
+      continue;
+    }
+    else if (rv != DLPACKET)
+    {
+      break;
+    }
+
+    packets++;
+    bytes += dlpacket->datasize;
+
+    /* Parse and decode miniSEED packets */
+    t0 = clock_ns ();
+
+    if (dl_splitstreamid (dlpacket->streamid, NULL, NULL, NULL, NULL, type) == 0 &&
+        !strncmp (type, "MSEED", sizeof (type)))
+    {
+      if (msr3_parse (packetdata, dlpacket->datasize, &msr, MSF_UNPACKDATA, 0) != MS_NOERROR)
+        parseerrs++;
+    }
+    else
+    {
+      otherpkts++;
+    }
+
+    t1 = clock_ns ();
+    parsetime += t1 - t0;
+
+    /* Write packet to output file if defined */
+    if (outfp)
+    {
+      if (fwrite (packetdata, dlpacket->datasize, 1, outfp) == 0)
+        dl_log (2, 0, "fwrite(): error writing packet data to output file\n");
+
+      outputtime += clock_ns () - t1;
+    }
+
+    if (maxpackets > 0 && packets >= maxpackets)
+      break;
+  }
+
+  endtime = clock_ns ();
+  endcpu  = bench_cputime (&enduser, &endsys);
+  dl_getstats (dlconn, &endstats);
+
+  if (msr)
+    msr3_free (&msr);
+
+  /* Restore the system allocators */
+  libmseed_memory.malloc  = sys_malloc;
+  libmseed_memory.realloc = sys_realloc;
+  libmseed_memory.free    = sys_free;
+
+  elapsed   = (double)(endtime - starttime) / 1e9;
+  cputime   = endcpu - startcpu;
+  syscalls  = endstats.syscalls - startstats.syscalls;
+  recvcalls = endstats.recvcalls - startstats.recvcalls;
+  sendcalls = endstats.sendcalls - startstats.sendcalls;
+  divpkts  = (packets > 0) ? (double)packets : 1.0;
+
+  /* Receive CPU is what remains after parsing and output, which are CPU bound */
+  recvcpu = cputime - ((double)(parsetime + outputtime) / 1e9);
+  if (recvcpu < 0.0)
+    recvcpu = 0.0;
+
+  dl_log (0, 0, "Benchmark: %lld packets, %lld bytes in %.3f seconds\n",
+          (long long int)packets, (long long int)bytes, elapsed);
+  dl_log (0, 0, "  Throughput: %.1f packets/sec, %.1f bytes/sec\n",
+          (elapsed > 0) ? packets / elapsed : 0.0,
+          (elapsed > 0) ? bytes / elapsed : 0.0);
+  dl_log (0, 0, "  Syscalls: %.2f per packet (recv: %.2f, send: %.2f)\n",
+          syscalls / divpkts, recvcalls / divpkts, sendcalls / divpkts);
+  dl_log (0, 0, "  CPU time: %.3f seconds (user: %.3f, system: %.3f), %.1f%% of elapsed\n",
+          cputime, enduser - startuser, endsys - startsys,
+          (elapsed > 0) ? 100.0 * cputime / elapsed : 0.0);
+  dl_log (0, 0, "    receive: %.3f seconds, %.2f usec/packet\n",
+          recvcpu, 1e6 * recvcpu / divpkts);
+  dl_log (0, 0, "    parse:   %.3f seconds, %.2f usec/packet\n",
+          parsetime / 1e9, parsetime / 1e3 / divpkts);
+  dl_log (0, 0, "    output:  %.3f seconds, %.2f usec/packet\n",
+          outputtime / 1e9, outputtime / 1e3 / divpkts);
+  dl_log (0, 0, "  Wall time: receiving %.3f, waiting %.3f seconds\n",
+          recvtime / 1e9, waittime / 1e9);
+  dl_log (0, 0, "  Reads: %.2f partial per packet, %.3f seconds blocked in library, largest packet %d bytes\n",
+          (endstats.partialreads - startstats.partialreads) / divpkts,
+          (double)(endstats.waittime - startstats.waittime) / DLTMODULUS, endstats.maxpktrecv);
+  dl_log (0, 0, "  Allocations: %.2f per packet (malloc: %llu, realloc: %llu, free: %llu)\n",
+          (mallocs + reallocs) / divpkts, (unsigned long long int)mallocs,
+          (unsigned long long int)reallocs, (unsigned long long int)frees);
+
+  if (parseerrs || otherpkts)
+    dl_log (0, 0, "  Parse errors: %lld, non-miniSEED packets: %lld\n",
+            (long long int)parseerrs, (long long int)otherpkts);
+
+  return 0;
+} /* End of runbench() */
+
+/***************************************************************************
+ * bench_malloc, bench_realloc, bench_free:
+ *
+ * Counting wrappers for the libmseed memory allocators.
+ ***************************************************************************/
+static void *
+bench_malloc (size_t size)
+{
+  mallocs++;
+  return sys_malloc (size);
+}
+
+static void *
+bench_realloc (void *ptr, size_t size)
+{
+  reallocs++;
+  return sys_realloc (ptr, size);
+}
+
+static void
+bench_free (void *ptr)
+{
+  if (ptr)
+    frees++;
+  sys_free (ptr);
+}
+
+/***************************************************************************
+ * bench_cputime:
+ *
+ * Return the CPU time used by the process in seconds, optionally
+ * setting the user and system components.
+ ***************************************************************************/
+static double
+bench_cputime (double *user, double *sys)
+{
+  double utime = 0.0;
+  double stime = 0.0;
+
+#ifndef WIN32
+  struct rusage ru;
+
+  if (getrusage (RUSAGE_SELF, &ru) == 0)
+  {
+    utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  }
+#endif
+
+  if (user)
+    *user = utime;
+  if (sys)
+    *sys = stime;
+
+  return utime + stime;
+} /* End of bench_cputime() */
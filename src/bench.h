@@ -0,0 +1,20 @@
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+extern int runbench (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+		     size_t maxdatasize, double duration, int64_t maxpackets,
+		     FILE *outfp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* BENCH_H */
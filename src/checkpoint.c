@@ -0,0 +1,290 @@
+/***************************************************************************
+ * checkpoint.c
+ *
+ * Periodic saving of connection state while collecting, so that
+ * collection can resume close to where it stopped after a failure.
+ *
+ * The position of the last packet received is tracked for each
+ * connection by a stage ahead of all others, so that packets dropped
+ * as duplicates also advance the position of their connection.  A
+ * checkpoint is taken after a number of packets or
+ * interval of time, whichever comes first: the output is first
+ * flushed to storage and then the positions of all connections are
+ * saved with dl_savestates(), which atomically replaces the state
+ * file.  The state therefore never refers to packets that have not
+ * been durably written.  After a failure the checkpoint is retried at
+ * the next limit.
+ *
+ * Packets held by a reorder stage have been received but not output,
+ * the position saved for a connection with held packets is that of
+ * the packet received before the earliest held packet.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "checkpoint.h"
+#include "common.h"
+#include "trace.h"
+
+/* Position of the last packet received for a connection */
+typedef struct CheckpointConn_s
+{
+  DLCP *dlconn;                 /* Connection */
+  int64_t pktid;                /* Packet ID of last packet received */
+  dltime_t pkttime;             /* Packet time of last packet received */
+} CheckpointConn;
+
+struct Checkpoint_s
+{
+  char *statefile;              /* State file */
+  CheckpointConn *conns;        /* Positions for each connection */
+  DLCP *states;                 /* State saved for each connection */
+  DLCP **saves;                 /* States with a position to save */
+  int count;                    /* Number of connections */
+  int64_t interval;             /* Maximum time between checkpoints, nanoseconds */
+  int64_t packets;              /* Maximum packets between checkpoints */
+  Reorder *reorder;             /* Reorder stage holding packets, or NULL */
+  CheckpointSync sync;          /* Function to flush output to storage */
+  void *syncdata;               /* Data passed to sync function */
+  FaninHandler handler;         /* Handler for received packets */
+  void *handlerdata;            /* Data passed to handler */
+  int64_t pending;              /* Packets output since last saved checkpoint */
+  int64_t recent;               /* Packets output since last checkpoint attempt */
+  int64_t lastsave;             /* Time of last checkpoint, nanoseconds */
+  int64_t saved;                /* Number of checkpoints saved */
+  int64_t failed;               /* Number of checkpoints failed */
+};
+
+/***************************************************************************
+ * checkpoint_new:
+ *
+ * Create a checkpoint stage saving the state of the connections to
+ * statefile at least every interval seconds and every packets packets
+ * while packets are being output, either limit may be 0 to disable
+ * it.  The sync function, if not NULL, is called to flush the output
+ * to storage before the state is saved.  Packets passed to
+ * checkpoint_receive() are passed on to the handler.
+ *
+ * Returns a pointer to the checkpoint stage on success and NULL on error.
+ ***************************************************************************/
+Checkpoint *
+checkpoint_new (const char *statefile, DLCP **conns, int count,
+                double interval, int64_t packets, Reorder *reorder,
+                CheckpointSync sync, void *syncdata,
+                FaninHandler handler, void *handlerdata)
+{
+  Checkpoint *checkpoint;
+  int idx;
+
+  if (!statefile || !conns || count <= 0 || !handler)
+    return NULL;
+
+  if (!(checkpoint = (Checkpoint *)calloc (1, sizeof (Checkpoint))) ||
+      !(checkpoint->statefile = strdup (statefile)) ||
+      !(checkpoint->conns = (CheckpointConn *)calloc (count, sizeof (CheckpointConn))) ||
+      !(checkpoint->states = (DLCP *)calloc (count, sizeof (DLCP))) ||
+      !(checkpoint->saves = (DLCP **)calloc (count, sizeof (DLCP *))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for checkpoints\n");
+    if (checkpoint)
+    {
+      free (checkpoint->statefile);
+      free (checkpoint->conns);
+      free (checkpoint->states);
+    }
+    free (checkpoint);
+    return NULL;
+  }
+
+  /* Initial positions are those recovered from the state file */
+  for (idx = 0; idx < count; idx++)
+  {
+    checkpoint->conns[idx].dlconn  = conns[idx];
+    checkpoint->conns[idx].pktid   = conns[idx]->pktid;
+    checkpoint->conns[idx].pkttime = conns[idx]->pkttime;
+  }
+
+  checkpoint->count       = count;
+  checkpoint->interval    = (int64_t)(interval * 1e9);
+  checkpoint->packets     = packets;
+  checkpoint->reorder     = reorder;
+  checkpoint->sync        = sync;
+  checkpoint->syncdata    = syncdata;
+  checkpoint->handler     = handler;
+  checkpoint->handlerdata = handlerdata;
+  checkpoint->lastsave    = clock_ns ();
+
+  return checkpoint;
+} /* End of checkpoint_new() */
+
+/***************************************************************************
+ * checkpoint_receive:
+ *
+ * Advance the position of a connection to a received packet and pass
+ * the packet to the handler.  The arguments match FaninHandler so
+ * that the stage can be used as a collection handler.
+ *
+ * Returns the handler's return value.
+ ***************************************************************************/
+int
+checkpoint_receive (DLCP *dlconn, DLPacket *dlpacket, void *packetdata, void *data)
+{
+  Checkpoint *checkpoint = (Checkpoint *)data;
+  CheckpointConn *conn;
+  int idx;
+
+  if (!checkpoint || !dlpacket)
+    return -1;
+
+  for (idx = 0; idx < checkpoint->count; idx++)
+  {
+    conn = &checkpoint->conns[idx];
+
+    if (conn->dlconn != dlconn)
+      continue;
+
+    if (dlpacket->pktid > conn->pktid)
+    {
+      conn->pktid   = dlpacket->pktid;
+      conn->pkttime = dlpacket->pkttime;
+    }
+
+    break;
+  }
+
+  return checkpoint->handler (dlconn, dlpacket, packetdata, checkpoint->handlerdata);
+} /* End of checkpoint_receive() */
+
+/***************************************************************************
+ * checkpoint_packet:
+ *
+ * Record a packet as output and take a checkpoint if the packet or
+ * time limit has been reached.
+ ***************************************************************************/
+void
+checkpoint_packet (Checkpoint *checkpoint, DLCP *dlconn, DLPacket *dlpacket)
+{
+  if (!checkpoint || !dlpacket)
+    return;
+
+  checkpoint->pending++;
+  checkpoint->recent++;
+
+  if ((checkpoint->packets > 0 && checkpoint->recent >= checkpoint->packets) ||
+      (checkpoint->interval > 0 && clock_ns () - checkpoint->lastsave >= checkpoint->interval))
+  {
+    checkpoint_save (checkpoint);
+  }
+} /* End of checkpoint_packet() */
+
+/***************************************************************************
+ * checkpoint_save:
+ *
+ * Flush the output to storage and save the positions of all
+ * connections to the state file in a single replacement.  Nothing is
+ * saved if the output could not be flushed, and the packets remain
+ * pending until a checkpoint succeeds.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+checkpoint_save (Checkpoint *checkpoint)
+{
+  DLCP *state;
+  int64_t start;
+  int64_t tstart;
+  int count = 0;
+  int rv    = 0;
+  int idx;
+
+  if (!checkpoint)
+    return -1;
+
+  start                = clock_ns ();
+  checkpoint->lastsave = start;
+  checkpoint->recent   = 0;
+
+  if (checkpoint->pending == 0)
+    return 0;
+
+  tstart = trace_start ();
+
+  if (checkpoint->sync && checkpoint->sync (checkpoint->syncdata))
+  {
+    dl_log (2, 0, "Cannot flush output, state not saved\n");
+    checkpoint->failed++;
+    return -1;
+  }
+
+  trace_span ("sync", tstart, NULL);
+  tstart = trace_start ();
+
+  for (idx = 0; idx < checkpoint->count; idx++)
+  {
+    state = &checkpoint->states[idx];
+
+    memset (state, 0, sizeof (DLCP));
+    memcpy (state->addr, checkpoint->conns[idx].dlconn->addr, sizeof (state->addr));
+    memcpy (state->statekey, checkpoint->conns[idx].dlconn->statekey, sizeof (state->statekey));
+    state->log = checkpoint->conns[idx].dlconn->log;
+
+    /* Position before the earliest packet held by the reorder stage */
+    if (!reorder_position (checkpoint->reorder, checkpoint->conns[idx].dlconn,
+                           &state->pktid, &state->pkttime))
+    {
+      state->pktid   = checkpoint->conns[idx].pktid;
+      state->pkttime = checkpoint->conns[idx].pkttime;
+    }
+
+    /* Nothing output yet for this connection, its entry is kept */
+    if (state->pktid <= 0)
+      continue;
+
+    checkpoint->saves[count++] = state;
+  }
+
+  if (count > 0 && dl_savestates (checkpoint->saves, count, checkpoint->statefile))
+    rv = -1;
+
+  trace_span ("state", tstart, NULL);
+
+  if (rv)
+  {
+    checkpoint->failed++;
+  }
+  else
+  {
+    checkpoint->pending = 0;
+    checkpoint->saved++;
+  }
+
+  if (rv == 0)
+    dl_log (1, 2, "Checkpoint saved in %.3f ms\n", (double)(clock_ns () - start) / 1e6);
+
+  return rv;
+} /* End of checkpoint_save() */
+
+/***************************************************************************
+ * checkpoint_free:
+ *
+ * Free the checkpoint stage, the final state is saved at shutdown.
+ ***************************************************************************/
+void
+checkpoint_free (Checkpoint *checkpoint)
+{
+  if (!checkpoint)
+    return;
+
+  dl_log (1, 1, "Checkpoints: %lld saved, %lld failed\n",
+          (long long int)checkpoint->saved, (long long int)checkpoint->failed);
+
+  free (checkpoint->statefile);
+  free (checkpoint->conns);
+  free (checkpoint->states);
+  free (checkpoint->saves);
+  free (checkpoint);
+} /* End of checkpoint_free() */
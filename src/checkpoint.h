@@ -0,0 +1,34 @@
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <libdali.h>
+
+#include "fanin.h"
+#include "reorder.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Flush output to storage, returns 0 on success and -1 on error */
+typedef int (*CheckpointSync) (void *syncdata);
+
+typedef struct Checkpoint_s Checkpoint;
+
+extern Checkpoint *checkpoint_new (const char *statefile, DLCP **conns, int count,
+                                   double interval, int64_t packets, Reorder *reorder,
+                                   CheckpointSync sync, void *syncdata,
+                                   FaninHandler handler, void *handlerdata);
+extern int checkpoint_receive (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+                               void *checkpoint);
+extern void checkpoint_packet (Checkpoint *checkpoint, DLCP *dlconn, DLPacket *dlpacket);
+extern int checkpoint_save (Checkpoint *checkpoint);
+extern void checkpoint_free (Checkpoint *checkpoint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CHECKPOINT_H */
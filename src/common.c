@@ -15,6 +15,7 @@
 
 #include "common.h"
 #include "dalixml.h"
+#include "trace.h"
 
 static void msr_print_samples (MS3Record *msr, int psamples);
 
@@ -42,12 +43,15 @@ packet_handler (DLPacket *dlpacket, void *packetdata,
   char type[10];
   int rv;
 
-  now = dlp_time ();
+  /* Latencies are relative to the time the packet was received, the
+   * kernel receive timestamp when available, so that they reflect
+   * network and server delay and not time spent in this process */
+  now = (dlpacket->recvtime) ? dlpacket->recvtime : dlp_time ();
 
   /* Print basic packet details */
   dl_dltime2seedtimestr (dlpacket->datastart, timestr, 1);
   dl_log (0, 0, "%s (%lld), %s, %d (data: %.1f sec, feed: %.1f sec)\n",
-          dlpacket->streamid, dlpacket->pktid, timestr, dlpacket->datasize,
+          dlpacket->streamid, (long long int)dlpacket->pktid, timestr, dlpacket->datasize,
           ((double)(now - dlpacket->dataend) / DLTMODULUS),
           ((double)(now - dlpacket->pkttime) / DLTMODULUS));
 
@@ -66,7 +70,7 @@ packet_handler (DLPacket *dlpacket, void *packetdata,
     {
       MS3Record *msr = 0;
 
-      rv = msr3_parse (packetdata, dlpacket->datasize, &msr, MSF_UNPACKDATA, psamples);
+      rv = trace_parse (packetdata, dlpacket->datasize, &msr, MSF_UNPACKDATA, psamples, dlpacket);
 
       if (rv != MS_NOERROR)
       {
@@ -94,8 +98,12 @@ packet_handler (DLPacket *dlpacket, void *packetdata,
   /* Write packet to dumpfile if defined */
   if (outfp)
   {
+    int64_t tstart = trace_start ();
+
     if (fwrite (packetdata, dlpacket->datasize, 1, outfp) == 0)
       dl_log (2, 0, "fwrite(): error writing packet data to output file\n");
+
+    trace_span ("write", tstart, dlpacket);
   }
 
   return 0;
@@ -113,6 +121,19 @@ info_handler (char *infotype, char *infodata, int infolen, int formatlevel)
 {
   ezxml_t xmldoc;
 
+  /* Lists are parsed and printed element by element */
+  if (!strncasecmp (infotype, "CONNECTIONS", 11) ||
+      !strncasecmp (infotype, "STREAMS", 7))
+  {
+    return prtinfo_list (infotype, infodata, infolen, formatlevel, stdout);
+  }
+
+  if (strncasecmp (infotype, "STATUS", 6))
+  {
+    dl_log (2, 0, "info_handler(): unrecognized INFO type: %s\n", infotype);
+    return 0;
+  }
+
   /* Parse XML string into EzXML representation */
   if ((xmldoc = ezxml_parse_str (infodata, infolen)) == NULL)
   {
@@ -122,27 +143,102 @@ info_handler (char *infotype, char *infodata, int infolen, int formatlevel)
   }
 
   /* Print formatted information */
-  if (!strncasecmp (infotype, "STATUS", 6))
-  {
-    prtinfo_status (xmldoc, formatlevel, stdout);
-  }
-  else if (!strncasecmp (infotype, "CONNECTIONS", 11))
+  prtinfo_status (xmldoc, formatlevel, stdout);
+
+  ezxml_free (xmldoc);
+
+  return 0;
+} /* End of info_handler() */
+
+/***************************************************************************
+ * info_request:
+ *
+ * Request INFO from the server and print it formatted.  Stream and
+ * connection lists are printed as they are received, without holding
+ * the complete response in memory.
+ *
+ * Returns 0 on success and -1 on errors.
+ ***************************************************************************/
+int
+info_request (DLCP *dlconn, char *infotype, char *infomatch, int formatlevel)
+{
+  char *infodata = NULL;
+  int infolen;
+  int rv;
+
+  if (!strncasecmp (infotype, "CONNECTIONS", 11) ||
+      !strncasecmp (infotype, "STREAMS", 7))
   {
-    prtinfo_connections (xmldoc, formatlevel, stdout);
+    return prtinfo_fetch (dlconn, infotype, infomatch, formatlevel, stdout);
   }
-  else if (!strncasecmp (infotype, "STREAMS", 7))
+
+  if ((infolen = dl_getinfo (dlconn, infotype, infomatch, &infodata, 0)) < 0)
+    return -1;
+
+  rv = info_handler (infotype, infodata, infolen, formatlevel);
+
+  if (infodata)
+    free (infodata);
+
+  return rv;
+} /* End of info_request() */
+
+/***************************************************************************
+ * sid2streamid:
+ *
+ * Generate a DataLink stream ID from an FDSN Source ID and miniSEED
+ * format version.  Version 2 records are identified with the
+ * traditional "NET_STA_LOC_CHAN/MSEED" form, version 3 records with
+ * the complete Source ID as "SID/MSEED3".
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+sid2streamid (const char *sid, int formatversion, char *streamid, size_t streamidsize)
+{
+  char net[11];
+  char sta[11];
+  char loc[11];
+  char chan[31];
+  int rv;
+
+  if (!sid || !streamid)
+    return -1;
+
+  if (formatversion == 3)
   {
-    prtinfo_streams (xmldoc, formatlevel, stdout);
+    rv = snprintf (streamid, streamidsize, "%s/MSEED3", sid);
   }
   else
   {
-    dl_log (2, 0, "info_handler(): unrecognized INFO type: %s\n", infotype);
+    if (ms_sid2nslc (sid, net, sta, loc, chan))
+      return -1;
+
+    rv = snprintf (streamid, streamidsize, "%s_%s_%s_%s/MSEED", net, sta, loc, chan);
   }
 
-  ezxml_free (xmldoc);
+  return (rv < 0 || rv >= (int)streamidsize) ? -1 : 0;
+} /* End of sid2streamid() */
 
-  return 0;
-} /* End of info_handler() */
+/***************************************************************************
+ * clock_ns:
+ *
+ * Return a monotonic time stamp in nanoseconds, suitable for
+ * measuring intervals.  Falls back to the system time when a
+ * monotonic clock is not available.
+ ***************************************************************************/
+int64_t
+clock_ns (void)
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+
+  return dlp_time () * (1000000000 / DLTMODULUS);
+} /* End of clock_ns() */
 
 /***************************************************************************
  * msr_print_samples:
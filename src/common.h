@@ -14,6 +14,13 @@ extern int packet_handler (DLPacket *dlpacket, void *packetdata,
 
 extern int info_handler (char *infotype, char *infodata, int infolen,
 			 int formatlevel);
+extern int info_request (DLCP *dlconn, char *infotype, char *infomatch,
+			 int formatlevel);
+
+extern int sid2streamid (const char *sid, int formatversion,
+			 char *streamid, size_t streamidsize);
+
+extern int64_t clock_ns (void);
 
 #ifdef __cplusplus
 }
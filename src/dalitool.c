@@ -19,32 +19,115 @@
 #include <libdali.h>
 #include <libmseed.h>
 
+#include "bench.h"
+#include "checkpoint.h"
+#include "dedup.h"
+#include "export.h"
+#include "fanin.h"
+#include "framed.h"
+#include "gaps.h"
+#include "generate.h"
+#include "infodelta.h"
+#include "infotop.h"
+#include "jsonout.h"
+#include "lagmon.h"
+#include "metrics.h"
+#include "relay.h"
+#include "reorder.h"
+#include "replay.h"
+#include "shmring.h"
+#include "shard.h"
+#include "trace.h"
 #include "common.h"
 #include "dalixml.h"
 #include "dlconsole.h"
 
 #define PACKAGE "dalitool"
-#define VERSION "2023.335"
+#define VERSION "2026.291"
+
+/* Records of each stream remembered by --unique without --dedup */
+#define UNIQUEWINDOW 256
 
 static char verbose        = 0; /* Flag to control general verbosity */
 static char console        = 0; /* Flag to control interactive console session */
+static char *batchfile     = 0; /* Console command script for batch mode, '-' for stdin */
+static double bufferminutes = 10; /* Console sample buffer duration in minutes, 0 disables */
+static double buffermemory  = 64; /* Console sample buffer memory limit in megabytes */
 static char ppackets       = 0; /* Flag to control printing of data packets */
 static char psamples       = 0; /* Flag to control printing of data samples */
 static char formatinfo     = 0; /* Flag to control formatting of INFO XML */
-static int repeatint       = 0; /* Repeat interval for INFO requests */
+static double repeatint    = 0; /* Repeat interval for INFO requests in seconds */
+static char delta          = 0; /* Flag to control printing only changes between INFO requests */
+static double deltalatency = 0; /* Latency threshold for changes in seconds, 0 disables */
+static char topmode        = 0; /* Flag to control the live table of streams or connections */
+static char *topsort       = 0; /* Sort key of the live table */
+static char *metricsaddr   = 0; /* Metrics exporter listen address, [host:]port */
+static double metricsinterval = 10; /* Metrics exporter poll interval in seconds */
 static char formatlevel    = 0; /* Flag to control formatted output verbosity */
+static char json           = 0; /* Flag to control JSON output of INFO and packets */
+static JsonWriter *jsonwriter = 0; /* JSON output writer */
 static char *statefile     = 0; /* State file for saving/restoring the seq. no. */
+static double checkpointinterval = 10; /* Interval between state checkpoints in seconds */
+static int64_t checkpointpackets = 0;  /* Packets between state checkpoints, 0 disables */
+static Checkpoint *checkpointer  = 0;  /* Periodic state checkpoints */
+static int outputfailed          = 0;  /* Flag: writing output failed, positions no longer saved */
 static char *matchpattern  = 0; /* Source ID matching expression */
 static char *rejectpattern = 0; /* Source ID rejecting expression */
 static char *clientpattern = 0; /* Client matching expression */
 static char *infotype      = 0; /* INFO type to request */
 static char *outfile       = 0; /* The output file */
 static FILE *outfp         = 0; /* Output file descriptor */
+static char framed         = 0; /* Flag to control framed output format */
+static FramedWriter *framer = 0; /* Framed output writer */
+static char bench          = 0; /* Flag to control throughput benchmark mode */
+static double benchtime    = 0; /* Benchmark duration in seconds */
+static int64_t benchcount  = 0; /* Benchmark packet count limit */
+static char generate       = 0; /* Flag to control synthetic load generation mode */
+static char *exportformat  = 0; /* Sample export format */
+static char *exportdir     = 0; /* Sample export directory */
+static char unique         = 0; /* Flag to control duplicate suppression across servers */
+static double reorderlatency = -1; /* Reorder latency budget in seconds, negative disables */
+static double reordermemory  = 64; /* Reorder memory limit in megabytes */
+static double gapinterval  = -1; /* Gap report interval in seconds, negative disables */
+static int64_t gaplast     = 0;  /* Time of last gap report, nanoseconds */
+static GapTracker *gaptracker = 0; /* Live gap and overlap tracking */
+static double laginterval  = 0; /* Backlog report interval in seconds, 0 disables */
+static double lagwarn      = 50; /* Backlog warning threshold in percent */
+static LagMonitor *lagmonitor = 0; /* Backlog monitoring */
+static char *shmname       = 0; /* Shared memory ring name for local consumers */
+static double shmsize      = 64; /* Shared memory ring size in megabytes */
+static ShmRing *shmring    = 0; /* Shared memory ring of collected packets */
+static char *tracefile     = 0; /* Trace output file, Chrome trace event JSON */
+static int64_t traceevents = 250000; /* Trace spans kept for each thread */
+static int dedupwindow     = 0; /* Duplicate suppression window in records, 0 disables */
+static char dedupcrc       = 0; /* Flag to include data CRC in duplicate detection */
+
+/* Synthetic load generation parameters */
+static GenParams genparams = {10, 1, 0.0, 0.0, NULL, NULL, NULL, 2, 1};
+
+/* File replay parameters */
+static ReplayParams replayparams = {NULL, 0, 1.0, 1, NULL, NULL, 1};
+
+/* Relay parameters */
+static RelayParams relayparams = {NULL, 64, 1};
 
 static DLCP *dlconn; /* connection parameters */
 
+static DLCP **servers  = 0; /* Additional server connections for fan-in */
+static int servercount = 0; /* Number of additional servers */
+
+static int shardcount      = 0; /* Connections to split the match set across */
+static char **shardmatches = 0; /* Match pattern of each connection */
+static char **shardrejects = 0; /* Reject pattern of each connection */
+static char *shardfile     = 0; /* Assignment of streams to connections */
+static int shardresume     = 0; /* Flag: continue the saved assignment */
+
 /* Functions internal to this source file */
 static int parameter_proc (int argcount, char **argvec);
+static int connect_server (DLCP *conn, char *match, char *reject);
+static int collect_handler (DLCP *conn, DLPacket *dlpacket, void *packetdata,
+                            void *handlerdata);
+static int sync_output (void *exporter);
 static char *getoptval (int argcount, char **argvec, int argopt);
 static void print_stderr (const char *message);
 static void usage (void);
@@ -60,6 +143,8 @@ main (int argc, char **argv)
   char packetdata[MAXPACKETSIZE];
   char *infobuf = 0;
   int infolen;
+  int retval = 0;
+  int idx;
 
   dltime_t current;
   dltime_t next;
@@ -89,37 +174,74 @@ main (int argc, char **argv)
     return -1;
   }
 
-  /* Connect to server */
-  if (dl_connect (dlconn) < 0)
+  /* Record spans of the packet path if requested */
+  if (tracefile && trace_open (tracefile, traceevents))
   {
-    dl_log (2, 0, "Error connecting to server\n");
+    dl_log (2, 0, "Error initializing tracing\n");
     return -1;
   }
 
-  /* Reposition connection */
-  if (dlconn->pktid > 0)
+  /* Split the match set across connections to the server */
+  if (shardcount > 1)
   {
-    if (dl_position (dlconn, dlconn->pktid, dlconn->pkttime) < 0)
+    if (dl_connect (dlconn) < 0)
+    {
+      dl_log (2, 0, "Error connecting to server\n");
+      return -1;
+    }
+
+    if (shard_split (dlconn, matchpattern, rejectpattern, shardcount,
+                     shardfile, shardresume, shardmatches, shardrejects) < 0)
       return -1;
   }
 
-  /* Send match pattern if supplied */
-  if (matchpattern)
+  /* Connect to server(s) */
+  if (connect_server (dlconn, (shardmatches) ? shardmatches[0] : matchpattern,
+                      (shardrejects) ? shardrejects[0] : rejectpattern) < 0)
+    return -1;
+
+  for (idx = 0; idx < servercount; idx++)
   {
-    if (dl_match (dlconn, matchpattern) < 0)
+    if (connect_server (servers[idx], (shardmatches) ? shardmatches[idx + 1] : matchpattern,
+                        (shardrejects) ? shardrejects[idx + 1] : rejectpattern) < 0)
       return -1;
   }
 
-  /* Send reject pattern if supplied */
-  if (rejectpattern)
+  /* Export server and client metrics over HTTP */
+  if (metricsaddr)
   {
-    if (dl_reject (dlconn, rejectpattern) < 0)
+    MetricsExporter *exporter;
+
+    if (!(exporter = metrics_new (metricsaddr)))
       return -1;
-  }
 
+    dl_log (1, 1, "Serving metrics on %s, polling every %g seconds\n",
+            metricsaddr, metricsinterval);
+
+    metrics_run (exporter, dlconn, matchpattern, metricsinterval);
+
+    metrics_free (exporter);
+  }
   /* Request INFO and print returned XML either formatted nicely or not */
-  if (infotype)
+  else if (infotype)
   {
+    InfoDelta *infodelta = NULL;
+    InfoTop *infotop     = NULL;
+
+    if (topmode)
+    {
+      if (!(infotop = infotop_new (infotype, topsort)))
+        return -1;
+
+      /* Refresh every second unless an interval is specified */
+      if (!repeatint)
+        repeatint = 1;
+    }
+    else if (delta && !(infodelta = infodelta_new (infotype, deltalatency)))
+    {
+      return -1;
+    }
+
     /* Initialize next request time stamp */
     next = dlp_time ();
 
@@ -130,75 +252,576 @@ main (int argc, char **argv)
       /* Submit INFO request and process response if at the next time stamp */
       if (current >= next)
       {
-        if ((infolen = dl_getinfo (dlconn, infotype, clientpattern, &infobuf, 0)) < 0)
+        /* Redraw the live table */
+        if (infotop)
         {
-          dl_log (2, 0, "Problem requesting INFO from server\n");
-          return -1;
+          if (infotop_poll (infotop, dlconn, clientpattern, stdout) < 0)
+          {
+            infotop_free (infotop);
+            dl_log (2, 0, "Problem requesting INFO from server\n");
+            return -1;
+          }
+        }
+        /* Print changes since the previous request */
+        else if (infodelta)
+        {
+          if (infodelta_poll (infodelta, dlconn, clientpattern, stdout) < 0)
+          {
+            dl_log (2, 0, "Problem requesting INFO from server\n");
+            return -1;
+          }
+        }
+        /* Print INFO as JSON lines */
+        else if (jsonwriter)
+        {
+          if (jsonout_info (jsonwriter, dlconn, infotype, clientpattern, stdout) < 0)
+          {
+            dl_log (2, 0, "Problem requesting INFO from server\n");
+            return -1;
+          }
         }
-
         /* Print formatted INFO */
-        if (formatinfo)
-          info_handler (infotype, infobuf, infolen, formatlevel);
+        else if (formatinfo)
+        {
+          if (info_request (dlconn, infotype, clientpattern, formatlevel) < 0)
+          {
+            dl_log (2, 0, "Problem requesting INFO from server\n");
+            return -1;
+          }
+        }
         /* Print raw XML */
         else
+        {
+          if ((infolen = dl_getinfo (dlconn, infotype, clientpattern, &infobuf, 0)) < 0)
+          {
+            dl_log (2, 0, "Problem requesting INFO from server\n");
+            return -1;
+          }
+
           printf ("%.*s\n", infolen, infobuf);
 
-        if (infobuf)
-          free (infobuf);
+          if (infobuf)
+            free (infobuf);
+        }
 
         /* Update the next time stamp to the repeat interval */
-        next += (repeatint * DLTMODULUS);
+        next += (dltime_t)(repeatint * DLTMODULUS);
 
         /* If the next time stamp is not in the future move up */
         if (next < current)
-          next = current + (repeatint * DLTMODULUS);
+          next = current + (dltime_t)(repeatint * DLTMODULUS);
 
         /* If repeating add a newline to separate output */
-        if (repeatint)
+        if (repeatint && !infodelta && !infotop && !jsonwriter)
           printf ("\n");
       }
-      /* Otherwise sleep for 1/10 second */
+      /* Otherwise sleep until the next time stamp, at most 1/10 second */
       else
       {
-        dlp_usleep (100000);
+        dlp_usleep ((next - current < 100000) ? (unsigned long)(next - current) : 100000);
       }
 
       /* If not repeating jump out */
       if (!repeatint)
         break;
     }
+
+    infodelta_free (infodelta);
+    infotop_free (infotop);
   }
-  /* Enter interactive console mode */
-  else if (console)
+  /* Enter interactive console mode or run a batch file */
+  else if (console || batchfile)
   {
-    if (runconsole (dlconn, &dlpacket, packetdata, sizeof (packetdata), verbose))
+    SampleBuffer *samples = NULL;
+
+    if (bufferminutes > 0 &&
+        !(samples = samplebuf_new (bufferminutes * 60, (size_t)(buffermemory * 1048576))))
+    {
+      dl_log (2, 0, "Error initializing sample buffer\n");
+    }
+
+    if (batchfile)
+    {
+      FILE *script = (strcmp (batchfile, "-")) ? fopen (batchfile, "r") : stdin;
+
+      if (!script)
+      {
+        dl_log (2, 0, "Cannot open batch file %s: %s\n", batchfile, strerror (errno));
+        retval = 1;
+      }
+      else
+      {
+        if (runbatch (dlconn, &dlpacket, packetdata, sizeof (packetdata), verbose, samples, script))
+        {
+          dl_log (2, 0, "Error running batch file %s\n", batchfile);
+          retval = 1;
+        }
+
+        if (script != stdin)
+          fclose (script);
+      }
+    }
+    else if (runconsole (dlconn, &dlpacket, packetdata, sizeof (packetdata), verbose, samples))
     {
       dl_log (2, 0, "Error running console()\n");
     }
+
+    samplebuf_free (samples);
+  }
+  /* Benchmark collection of packets in STREAMing mode */
+  else if (bench)
+  {
+    if (runbench (dlconn, &dlpacket, packetdata, sizeof (packetdata),
+                  benchtime, benchcount, (outfile && outfp) ? outfp : NULL))
+    {
+      dl_log (2, 0, "Error running benchmark\n");
+    }
+  }
+  /* Generate synthetic records and write them to the server */
+  else if (generate)
+  {
+    if (rungenerate (dlconn, &genparams))
+    {
+      dl_log (2, 0, "Error running load generator\n");
+    }
+  }
+  /* Replay miniSEED files to the server */
+  else if (replayparams.filecount > 0)
+  {
+    if (runreplay (dlconn, &replayparams))
+    {
+      dl_log (2, 0, "Error replaying files\n");
+    }
+  }
+  /* Relay packets to another server */
+  else if (relayparams.destination)
+  {
+    if (runrelay (dlconn, &relayparams))
+    {
+      dl_log (2, 0, "Error relaying packets\n");
+    }
   }
   /* Otherwise collect packets in STREAMing mode */
   else
   {
+    Exporter *exporter = NULL;
+    Reorder *reorder   = NULL;
+    Dedup *dedup       = NULL;
+    FaninHandler handler = collect_handler;
+    void *handlerdata;
+
+    /* Initialize sample export if requested */
+    if (exportformat && !(exporter = export_new (exportformat, exportdir)))
+    {
+      dl_log (2, 0, "Error initializing sample export\n");
+      dl_disconnect (dlconn);
+      return -1;
+    }
+
+    handlerdata = exporter;
+
+    /* Initialize reorder stage if requested */
+    if (reorderlatency >= 0)
+    {
+      if (!(reorder = reorder_new (reorderlatency, (size_t)(reordermemory * 1048576),
+                                   handler, handlerdata)))
+      {
+        dl_log (2, 0, "Error initializing reorder stage\n");
+        dl_disconnect (dlconn);
+        return -1;
+      }
+
+      handler     = reorder_packet;
+      handlerdata = reorder;
+    }
+
+    /* Initialize gap tracking if requested */
+    if (gapinterval >= 0)
+    {
+      if (!(gaptracker = gaps_new (0)))
+      {
+        dl_log (2, 0, "Error initializing gap tracking\n");
+        dl_disconnect (dlconn);
+        return -1;
+      }
+
+      gaplast = clock_ns ();
+    }
+
+    /* Create shared memory ring for local consumers if requested */
+    if (shmname)
+    {
+      if (!(shmring = shmring_create (shmname, (size_t)(shmsize * 1048576))))
+      {
+        dl_log (2, 0, "Error creating shared memory ring %s: %s\n", shmname, strerror (errno));
+        dl_disconnect (dlconn);
+        return -1;
+      }
+
+      dl_log (1, 1, "Publishing packets to shared memory ring %s\n", shmname);
+    }
+
+    /* Initialize duplicate suppression, ahead of reordering, if requested */
+    if (dedupwindow > 0 || unique)
+    {
+      if (!(dedup = dedup_new ((dedupwindow > 0) ? dedupwindow : UNIQUEWINDOW,
+                               dedupcrc, handler, handlerdata)))
+      {
+        dl_log (2, 0, "Error initializing duplicate suppression\n");
+        dl_disconnect (dlconn);
+        return -1;
+      }
+
+      handler     = dedup_packet;
+      handlerdata = dedup;
+    }
+
+    /* Initialize periodic state checkpoints, ahead of all stages, if requested */
+    if (statefile && (checkpointinterval > 0 || checkpointpackets > 0))
+    {
+      DLCP **conns = (DLCP **)malloc ((servercount + 1) * sizeof (DLCP *));
+
+      if (conns)
+      {
+        conns[0] = dlconn;
+        memcpy (conns + 1, servers, servercount * sizeof (DLCP *));
+
+        checkpointer = checkpoint_new (statefile, conns, servercount + 1,
+                                       checkpointinterval, checkpointpackets,
+                                       reorder, sync_output, exporter,
+                                       handler, handlerdata);
+        free (conns);
+      }
+
+      if (!checkpointer)
+      {
+        dl_log (2, 0, "Error initializing state checkpoints\n");
+        dl_disconnect (dlconn);
+        return -1;
+      }
+
+      handler     = checkpoint_receive;
+      handlerdata = checkpointer;
+    }
+
+    /* Initialize backlog monitoring if requested */
+    if (laginterval > 0)
+    {
+      DLCP **conns = (DLCP **)malloc ((servercount + 1) * sizeof (DLCP *));
+
+      if (conns)
+      {
+        conns[0] = dlconn;
+        memcpy (conns + 1, servers, servercount * sizeof (DLCP *));
+
+        lagmonitor = lagmon_new (conns, servercount + 1, laginterval, lagwarn);
+        free (conns);
+      }
+
+      if (!lagmonitor)
+      {
+        dl_log (2, 0, "Error initializing backlog monitoring\n");
+        dl_disconnect (dlconn);
+        return -1;
+      }
+    }
+
+    /* Collect packets in streaming mode from all servers, or through the reorder stage */
+    if (servercount > 0 || reorder)
+    {
+      DLCP **conns = (DLCP **)malloc ((servercount + 1) * sizeof (DLCP *));
+
+      if (conns)
+      {
+        conns[0] = dlconn;
+        memcpy (conns + 1, servers, servercount * sizeof (DLCP *));
+
+        if (runfanin (conns, servercount + 1, handler, handlerdata,
+                      (reorder) ? reorder_tick : NULL, reorder,
+                      (lagmonitor) ? lagmon_packet : NULL, lagmonitor))
+          dl_log (2, 0, "Error collecting packets\n");
+
+        free (conns);
+      }
+
+      /* Emit all packets held for reordering */
+      reorder_free (reorder);
+    }
     /* Collect packets in streaming mode */
-    while (dl_collect (dlconn, &dlpacket, packetdata, sizeof (packetdata), 0) == DLPACKET)
+    else
+    {
+      int64_t tstart = trace_start ();
+
+      while (dl_collect (dlconn, &dlpacket, packetdata, sizeof (packetdata), 0) == DLPACKET)
+      {
+        trace_span ("receive", tstart, &dlpacket);
+
+        if (lagmonitor)
+          lagmon_packet (dlconn, &dlpacket, lagmonitor);
+
+        tstart = trace_start ();
+        handler (dlconn, &dlpacket, packetdata, handlerdata);
+        trace_span ("handle", tstart, &dlpacket);
+
+        tstart = trace_start ();
+      }
+    }
+
+    checkpoint_free (checkpointer);
+    checkpointer = NULL;
+
+    lagmon_free (lagmonitor);
+    lagmonitor = NULL;
+
+    shmring_close (shmring);
+    shmring = NULL;
+
+    /* Final gap report */
+    if (gaptracker)
     {
-      packet_handler (&dlpacket, packetdata, ppackets, psamples, (outfile && outfp) ? outfp : NULL);
+      gaps_report (gaptracker, NULL, NULL);
+      gaps_free (gaptracker);
+      gaptracker = NULL;
     }
+
+    dedup_free (dedup);
+    export_free (exporter);
   }
 
   /* Shutdown */
   if (dlconn->link != -1)
     dl_disconnect (dlconn);
 
+  for (idx = 0; idx < servercount; idx++)
+  {
+    if (servers[idx]->link != -1)
+      dl_disconnect (servers[idx]);
+  }
+
+  /* Flush output to storage before the final state is saved */
+  if (statefile && !outputfailed && sync_output (NULL))
+    outputfailed = 1;
+
+  framed_free (framer);
+  jsonout_free (jsonwriter);
+
   if (outfp)
     fclose (outfp);
 
-  if (statefile)
-    dl_savestate (dlconn, statefile);
+  /* Positions of packets not written are not saved, the last checkpoint is kept */
+  if (statefile && outputfailed)
+  {
+    dl_log (2, 0, "Output is incomplete, final state not saved\n");
+    retval = 1;
+  }
+  else if (statefile)
+  {
+    int64_t tstart = trace_start ();
+    DLCP **conns   = (DLCP **)malloc ((servercount + 1) * sizeof (DLCP *));
 
-  return 0;
+    /* Save all positions with a single replacement of the state file */
+    if (!conns)
+    {
+      dl_log (2, 0, "Cannot allocate memory for connection list\n");
+      retval = 1;
+    }
+    else
+    {
+      conns[0] = dlconn;
+      memcpy (conns + 1, servers, servercount * sizeof (DLCP *));
+
+      if (dl_savestates (conns, servercount + 1, statefile))
+        retval = 1;
+
+      free (conns);
+    }
+
+    trace_span ("state", tstart, NULL);
+  }
+
+  if (shardcount > 1)
+    shard_free (shardmatches, shardrejects, shardcount);
+
+  trace_close ();
+
+  return retval;
 } /* End of main() */
 
+/***************************************************************************
+ * connect_server:
+ *
+ * Connect to a server unless already connected, reposition the
+ * connection to any recovered state and send the match and reject
+ * patterns.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+connect_server (DLCP *conn, char *match, char *reject)
+{
+  /* Connect to server */
+  if (conn->link < 0 && dl_connect (conn) < 0)
+  {
+    dl_log (2, 0, "Error connecting to server\n");
+    return -1;
+  }
+
+  /* Reposition connection */
+  if (conn->pktid > 0)
+  {
+    if (dl_position (conn, conn->pktid, conn->pkttime) < 0)
+      return -1;
+  }
+
+  /* Send match pattern if supplied */
+  if (match)
+  {
+    if (dl_match (conn, match) < 0)
+      return -1;
+  }
+
+  /* Send reject pattern if supplied */
+  if (reject)
+  {
+    if (dl_reject (conn, reject) < 0)
+      return -1;
+  }
+
+  return 0;
+} /* End of connect_server() */
+
+/***************************************************************************
+ * collect_handler:
+ *
+ * Handle a packet collected in streaming mode: print, write to the
+ * output file and export samples as requested.
+ *
+ * If the packet cannot be written collection is stopped and the
+ * position is no longer advanced, so that the state file never refers
+ * to packets missing from the output.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+collect_handler (DLCP *conn, DLPacket *dlpacket, void *packetdata,
+                 void *handlerdata)
+{
+  Exporter *exporter = (Exporter *)handlerdata;
+  int64_t tstart;
+  int rv = 0;
+  int idx;
+
+  if (jsonwriter)
+    jsonout_packet (jsonwriter, dlpacket, packetdata, ppackets, stdout);
+  else
+    packet_handler (dlpacket, packetdata, ppackets, psamples, NULL);
+
+  if (outfile && outfp && !framer)
+  {
+    tstart = trace_start ();
+
+    if (fwrite (packetdata, dlpacket->datasize, 1, outfp) == 0)
+    {
+      dl_log (2, 0, "fwrite(): error writing packet data to output file\n");
+      rv = -1;
+    }
+
+    trace_span ("write", tstart, dlpacket);
+  }
+
+  if (framer)
+  {
+    tstart = trace_start ();
+
+    if (framed_write (framer, dlpacket, packetdata))
+      rv = -1;
+
+    trace_span ("write", tstart, dlpacket);
+  }
+
+  if (exporter && export_packet (exporter, dlpacket, packetdata))
+    rv = -1;
+
+  if (rv && !outputfailed)
+  {
+    dl_log (2, 0, "%s: Cannot write packet %lld, stopping collection\n",
+            dlpacket->streamid, (long long int)dlpacket->pktid);
+
+    outputfailed = 1;
+
+    dl_terminate (dlconn);
+
+    for (idx = 0; idx < servercount; idx++)
+      dl_terminate (servers[idx]);
+  }
+
+  if (shmring)
+  {
+    ShmPacket shmpacket;
+
+    memset (shmpacket.streamid, 0, sizeof (shmpacket.streamid));
+    memcpy (shmpacket.streamid, dlpacket->streamid, sizeof (dlpacket->streamid));
+    shmpacket.pktid     = dlpacket->pktid;
+    shmpacket.pkttime   = dlpacket->pkttime;
+    shmpacket.datastart = dlpacket->datastart;
+    shmpacket.dataend   = dlpacket->dataend;
+    shmpacket.recvtime  = dlpacket->recvtime;
+    shmpacket.datasize  = dlpacket->datasize;
+
+    if (shmring_publish (shmring, &shmpacket, packetdata))
+      dl_log (2, 0, "%s: Cannot publish packet to shared memory ring\n", dlpacket->streamid);
+  }
+
+  if (gaptracker)
+  {
+    gaps_packet (gaptracker, dlpacket, packetdata);
+
+    if (gapinterval > 0 && clock_ns () - gaplast >= (int64_t)(gapinterval * 1e9))
+    {
+      gaps_report (gaptracker, NULL, NULL);
+      gaplast = clock_ns ();
+    }
+  }
+
+  if (checkpointer && !outputfailed)
+    checkpoint_packet (checkpointer, conn, dlpacket);
+
+  return rv;
+} /* End of collect_handler() */
+
+/***************************************************************************
+ * sync_output:
+ *
+ * Flush the output file, framed output and exported samples to
+ * storage, the exporter may be NULL.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+sync_output (void *exporter)
+{
+  int rv = 0;
+
+  if (framer)
+  {
+    if (framed_sync (framer))
+      rv = -1;
+  }
+  else if (outfp && outfp != stdout)
+  {
+    if (fflush (outfp) || dlp_fsync (fileno (outfp)))
+    {
+      dl_log (2, 0, "Error syncing output file: %s\n", strerror (errno));
+      rv = -1;
+    }
+  }
+
+  if (exporter && export_sync ((Exporter *)exporter))
+    rv = -1;
+
+  return rv;
+} /* End of sync_output() */
+
 /***************************************************************************
  * parameter_proc:
  *
@@ -210,6 +833,7 @@ static int
 parameter_proc (int argcount, char **argvec)
 {
   char *address = 0;
+  char **addresses = 0;
   int keepalive = -1;
   int optind;
 
@@ -254,10 +878,22 @@ parameter_proc (int argcount, char **argvec)
     {
       outfile = getoptval (argcount, argvec, optind++);
     }
+    else if (strcmp (argvec[optind], "--framed") == 0)
+    {
+      framed = 1;
+    }
     else if (strcmp (argvec[optind], "-x") == 0)
     {
       statefile = getoptval (argcount, argvec, optind++);
     }
+    else if (strcmp (argvec[optind], "--checkpoint") == 0)
+    {
+      checkpointinterval = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--checkpoint-packets") == 0)
+    {
+      checkpointpackets = strtoll (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
     else if (strcmp (argvec[optind], "-m") == 0)
     {
       matchpattern = getoptval (argcount, argvec, optind++);
@@ -286,10 +922,208 @@ parameter_proc (int argcount, char **argvec)
       infotype   = "CONNECTIONS";
       formatinfo = 1;
     }
+    else if (strcmp (argvec[optind], "--top") == 0)
+    {
+      topmode = 1;
+    }
+    else if (strcmp (argvec[optind], "--top-sort") == 0)
+    {
+      topsort = getoptval (argcount, argvec, optind++);
+      topmode = 1;
+    }
+    else if (strcmp (argvec[optind], "--json") == 0)
+    {
+      json = 1;
+    }
     else if (strncmp (argvec[optind], "-f", 2) == 0)
     {
       formatlevel += strspn (&argvec[optind][1], "f");
     }
+    else if (strcmp (argvec[optind], "--bench") == 0)
+    {
+      bench = 1;
+    }
+    else if (strcmp (argvec[optind], "--bench-time") == 0)
+    {
+      benchtime = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--bench-count") == 0)
+    {
+      benchcount = strtoll (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--generate") == 0)
+    {
+      generate = 1;
+    }
+    else if (strcmp (argvec[optind], "--gen-streams") == 0)
+    {
+      genparams.streams = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--gen-connections") == 0)
+    {
+      genparams.connections = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--gen-rate") == 0)
+    {
+      genparams.rate = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--gen-time") == 0)
+    {
+      genparams.duration = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--gen-encoding") == 0)
+    {
+      genparams.encodings = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--gen-samprate") == 0)
+    {
+      genparams.samprates = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--gen-reclen") == 0)
+    {
+      genparams.reclens = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--gen-version") == 0)
+    {
+      genparams.formatversion = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--gen-noack") == 0)
+    {
+      genparams.ack = 0;
+    }
+    else if (strcmp (argvec[optind], "--replay") == 0)
+    {
+      replayparams.files = (char **)realloc (replayparams.files,
+                                             (replayparams.filecount + 1) * sizeof (char *));
+      if (!replayparams.files)
+      {
+        fprintf (stderr, "Cannot allocate memory for replay file list\n");
+        exit (1);
+      }
+
+      replayparams.files[replayparams.filecount++] = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--replay-speed") == 0)
+    {
+      replayparams.speed = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--replay-threads") == 0)
+    {
+      replayparams.threads = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--replay-select") == 0)
+    {
+      replayparams.selectpattern = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--replay-selectfile") == 0)
+    {
+      replayparams.selectfile = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--replay-noack") == 0)
+    {
+      replayparams.ack = 0;
+    }
+    else if (strcmp (argvec[optind], "--unique") == 0)
+    {
+      unique = 1;
+    }
+    else if (strcmp (argvec[optind], "--reorder") == 0)
+    {
+      reorderlatency = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--reorder-memory") == 0)
+    {
+      reordermemory = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--batch") == 0)
+    {
+      batchfile = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--buffer") == 0)
+    {
+      bufferminutes = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--buffer-memory") == 0)
+    {
+      buffermemory = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--shm") == 0)
+    {
+      shmname = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--shm-size") == 0)
+    {
+      shmsize = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--delta") == 0)
+    {
+      delta = 1;
+    }
+    else if (strcmp (argvec[optind], "--delta-latency") == 0)
+    {
+      deltalatency = strtod (getoptval (argcount, argvec, optind++), NULL);
+      delta        = 1;
+    }
+    else if (strcmp (argvec[optind], "--shards") == 0)
+    {
+      shardcount = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--metrics") == 0)
+    {
+      metricsaddr = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--metrics-interval") == 0)
+    {
+      metricsinterval = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--gaps") == 0)
+    {
+      gapinterval = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--lag") == 0)
+    {
+      laginterval = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--lag-warn") == 0)
+    {
+      lagwarn = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "--trace") == 0)
+    {
+      tracefile = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--trace-events") == 0)
+    {
+      traceevents = strtoll (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--dedup") == 0)
+    {
+      dedupwindow = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--dedup-crc") == 0)
+    {
+      dedupcrc = 1;
+    }
+    else if (strcmp (argvec[optind], "--relay") == 0)
+    {
+      relayparams.destination = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--relay-batch") == 0)
+    {
+      relayparams.batch = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "--relay-noack") == 0)
+    {
+      relayparams.ack = 0;
+    }
+    else if (strcmp (argvec[optind], "--export") == 0)
+    {
+      exportformat = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "--export-dir") == 0)
+    {
+      exportdir = getoptval (argcount, argvec, optind++);
+    }
     else if (strncmp (argvec[optind], "-", 1) == 0)
     {
       fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
@@ -299,9 +1133,22 @@ parameter_proc (int argcount, char **argvec)
     {
       address = argvec[optind];
     }
-    else if (!repeatint)
+    else if (!repeatint && strspn (argvec[optind], "0123456789.") == strlen (argvec[optind]) &&
+             strchr (argvec[optind], '.') == strrchr (argvec[optind], '.'))
+    {
+      repeatint = strtod (argvec[optind], NULL);
+    }
+    else if (strspn (argvec[optind], "0123456789") != strlen (argvec[optind]))
     {
-      repeatint = strtoul (argvec[optind], NULL, 10);
+      /* Additional server addresses for fan-in collection */
+      addresses = (char **)realloc (addresses, (servercount + 1) * sizeof (char *));
+      if (!addresses)
+      {
+        fprintf (stderr, "Cannot allocate memory for server list\n");
+        exit (1);
+      }
+
+      addresses[servercount++] = argvec[optind];
     }
     else
     {
@@ -327,6 +1174,66 @@ parameter_proc (int argcount, char **argvec)
   if (keepalive >= 0)
     dlconn->keepalive = keepalive;
 
+  /* Allocate and initialize additional server connections */
+  if (servercount > 0)
+  {
+    if (infotype || console || batchfile || bench || generate ||
+        replayparams.filecount > 0 || relayparams.destination)
+    {
+      fprintf (stderr, "Multiple servers are only supported when collecting packets\n");
+      exit (1);
+    }
+
+    if (!(servers = (DLCP **)malloc (servercount * sizeof (DLCP *))))
+    {
+      fprintf (stderr, "Cannot allocate memory for server list\n");
+      exit (1);
+    }
+
+    for (optind = 0; optind < servercount; optind++)
+    {
+      servers[optind] = dl_newdlcp (addresses[optind], argvec[0]);
+
+      if (keepalive >= 0)
+        servers[optind]->keepalive = keepalive;
+    }
+
+    free (addresses);
+  }
+
+  /* Allocate and initialize connections to split the match set across */
+  if (shardcount > 1)
+  {
+    if (servercount > 0 || infotype || console || batchfile || bench || generate ||
+        replayparams.filecount > 0 || relayparams.destination || metricsaddr)
+    {
+      fprintf (stderr, "Splitting streams across connections is only supported when collecting\n"
+                       "packets from a single server\n");
+      exit (1);
+    }
+
+    servercount = shardcount - 1;
+
+    if (!(servers = (DLCP **)malloc (servercount * sizeof (DLCP *))) ||
+        !(shardmatches = (char **)calloc (shardcount, sizeof (char *))) ||
+        !(shardrejects = (char **)calloc (shardcount, sizeof (char *))))
+    {
+      fprintf (stderr, "Cannot allocate memory for connection list\n");
+      exit (1);
+    }
+
+    /* Each connection keeps its own state file entry */
+    for (optind = 0; optind < servercount; optind++)
+    {
+      servers[optind] = dl_newdlcp (address, argvec[0]);
+      snprintf (servers[optind]->statekey, sizeof (servers[optind]->statekey),
+                "%s#%d", address, optind + 2);
+
+      if (keepalive >= 0)
+        servers[optind]->keepalive = keepalive;
+    }
+  }
+
   /* Initialize the verbosity for the dl_log function */
   dl_loginit (verbose, NULL, NULL, NULL, NULL);
 
@@ -337,24 +1244,59 @@ parameter_proc (int argcount, char **argvec)
     {
       /* Re-direct all messages to standard error */
       dl_loginit (verbose, &print_stderr, NULL, &print_stderr, NULL);
+      ms_loginit (&print_stderr, NULL, &print_stderr, NULL);
 
       outfp = stdout;
-      setvbuf (stdout, NULL, _IONBF, 0);
+      if (!framed)
+        setvbuf (stdout, NULL, _IONBF, 0);
     }
     else if ((outfp = fopen (outfile, "a+b")) != NULL)
     {
-      setvbuf (outfp, NULL, _IONBF, 0);
+      if (!framed)
+        setvbuf (outfp, NULL, _IONBF, 0);
     }
     else
     {
       dl_log (2, 0, "cannot open output file: %s\n", outfile);
       exit (1);
     }
+
+    /* Write framed packets, indexed unless written to standard output */
+    if (framed && !(framer = framed_new (outfp, (outfp == stdout) ? NULL : outfile)))
+    {
+      dl_log (2, 0, "cannot initialize framed output: %s\n", outfile);
+      exit (1);
+    }
+  }
+  else if (framed)
+  {
+    fprintf (stderr, "Framed output requires an output file (-o)\n");
+    exit (1);
+  }
+
+  /* Write INFO and packet summaries as JSON lines */
+  if (json && !(jsonwriter = jsonout_new ()))
+    exit (1);
+
+  if (framed && bench)
+  {
+    fprintf (stderr, "Framed output is only supported when collecting packets\n");
+    exit (1);
   }
 
   /* Report the program version */
   dl_log (1, 1, "%s version: %s\n", PACKAGE, VERSION);
 
+  /* Default benchmark duration when no limit is specified */
+  if (bench && benchtime <= 0 && benchcount <= 0)
+    benchtime = 10;
+
+  if (generate && genparams.formatversion != 2 && genparams.formatversion != 3)
+  {
+    dl_log (2, 0, "Unsupported miniSEED format version: %d\n", genparams.formatversion);
+    exit (1);
+  }
+
   /* Make sure we print basic packet details if printing samples */
   if (psamples && ppackets == 0)
     ppackets = 1;
@@ -393,11 +1335,34 @@ parameter_proc (int argcount, char **argvec)
   /* Recover from the state file and reposition */
   if (statefile)
   {
-    if (dl_recoverstate (dlconn, statefile) < 0)
+    if ((shardresume = dl_recoverstate (dlconn, statefile)) < 0)
     {
       dl_log (2, 0, "Error reading state file\n");
       exit (1);
     }
+
+    /* Positions are saved per connection, the assignment of streams is saved with them */
+    shardresume = (shardresume == 0);
+
+    if (shardcount > 1)
+    {
+      if (!(shardfile = (char *)malloc (strlen (statefile) + 8)))
+      {
+        dl_log (2, 0, "Cannot allocate memory for file name\n");
+        exit (1);
+      }
+
+      sprintf (shardfile, "%s.shards", statefile);
+    }
+
+    for (optind = 0; optind < servercount; optind++)
+    {
+      if (dl_recoverstate (servers[optind], statefile) < 0)
+      {
+        dl_log (2, 0, "Error reading state file\n");
+        exit (1);
+      }
+    }
   }
 
   return 0;
@@ -425,8 +1390,9 @@ getoptval (int argcount, char **argvec, int argopt)
     exit (1);
   }
 
-  /* Special case of '-o -' usage */
-  if ((argopt + 1) < argcount && strcmp (argvec[argopt], "-o") == 0)
+  /* Special case of '-o -' and '--batch -' usage */
+  if ((argopt + 1) < argcount &&
+      (strcmp (argvec[argopt], "-o") == 0 || strcmp (argvec[argopt], "--batch") == 0))
     if (strcmp (argvec[argopt + 1], "-") == 0)
       return argvec[argopt + 1];
 
@@ -460,7 +1426,12 @@ print_stderr (const char *message)
 static void
 term_handler (int sig)
 {
+  int idx;
+
   dl_terminate (dlconn);
+
+  for (idx = 0; idx < servercount; idx++)
+    dl_terminate (servers[idx]);
 }
 #endif
 
@@ -480,6 +1451,9 @@ usage (void)
            " -h              show this usage message\n"
            " -v              be more verbose, multiple flags can be used\n"
            " -c              console mode, provide an interactive prompt\n"
+           " --batch file    run console commands from file, '-' for stdin, pipelined\n"
+           " --buffer min    console sample buffer duration in minutes, default 10\n"
+           " --buffer-memory MB  console sample buffer memory limit, default 64\n"
            " -p              print details of data packets, multiple flags can be used\n"
            " -d              print first 6 samples of each data packet\n"
            " -D              print all samples of each data packet\n"
@@ -487,7 +1461,12 @@ usage (void)
            " -r reject       specify stream ID rejecting pattern\n"
            " -k interval     send keepalive packets this often (seconds)\n"
            " -x sfile        save/restore state information to this file\n"
+           " --checkpoint secs  save state at least this often while collecting, default 10\n"
+           " --checkpoint-packets N  also save state every N packets\n"
            " -o outfile      write all received packets to this file\n"
+           " --framed        write packets to outfile with headers and an index\n"
+           " --shm name      publish packets to a shared memory ring for local readers\n"
+           " --shm-size MB   shared memory ring size, default 64\n"
            "\n"
            " ## Data server information ##\n"
            " -i type         send info request, type is one of the following:\n"
@@ -497,9 +1476,73 @@ usage (void)
            " -S              print formatted stream list (if supported by server)\n"
            " -C              print formatted connection list (if supported by server)\n"
            " -f              increase level of details included in formatted output\n"
+           " --json          print INFO and packet summaries as JSON, one object per line\n"
+           " --delta         with -S or -C and a repeat interval print only changes\n"
+           " --delta-latency secs  also print entries crossing this latency\n"
+           " --top           with -S or -C show a live table, refreshed every second\n"
+           "                   unless a repeat interval is given\n"
+           " --top-sort key  sort the live table by latency, rate, lag or name\n"
+           " --metrics [host:]port  serve server and client metrics for Prometheus\n"
+           " --metrics-interval secs  poll the server this often, default 10\n"
+           "\n"
+           " ## Throughput benchmark ##\n"
+           " --bench              collect packets and report a throughput breakdown\n"
+           " --bench-time secs    benchmark duration in seconds, default 10\n"
+           " --bench-count count  stop benchmark after this number of packets\n"
+           "\n"
+           " ## Synthetic load generation ##\n"
+           " --generate           write synthetic miniSEED records to the server\n"
+           " --gen-streams N      number of streams to generate, default 10\n"
+           " --gen-connections M  number of connections to write with, default 1\n"
+           " --gen-rate rate      target aggregate rate in records/second, default unlimited\n"
+           " --gen-time secs      generation duration in seconds, default until interrupted\n"
+           " --gen-encoding list  encodings: INT16,INT32,FLOAT32,FLOAT64,STEIM1,STEIM2\n"
+           " --gen-samprate list  sample rates in Hz, default 100\n"
+           " --gen-reclen list    record lengths in bytes, default 512\n"
+           " --gen-version ver    miniSEED format version to generate, 2 or 3, default 2\n"
+           " --gen-noack          do not request acknowledgement of written records\n"
+           "                   lists are comma-separated and assigned to streams in turn\n"
+           "\n"
+           " ## File replay ##\n"
+           " --replay file        write records from a miniSEED file to the server,\n"
+           "                        can be repeated, files are merged by record time\n"
+           " --replay-speed N     replay speed relative to data time, default 1,\n"
+           "                        0 for as fast as possible\n"
+           " --replay-threads N   number of file reader threads, default 1\n"
+           " --replay-select pat  only replay records with source IDs matching pattern\n"
+           " --replay-selectfile file  only replay records matching selection file\n"
+           " --replay-noack       do not request acknowledgement of written records\n"
+           "\n"
+           " ## Relay ##\n"
+           " --relay address      write all received packets to another server\n"
+           " --relay-batch N      maximum packets written per batch, default 64\n"
+           " --relay-noack        do not request acknowledgement of written packets\n"
+           "\n"
+           " ## Sample export ##\n"
+           " --export format      write decoded samples to per-stream files, format is\n"
+           "                        binary, csv or npy\n"
+           " --export-dir dir     directory for export files, default current directory\n"
            "\n"
            " [host][:][port] Address of the DataLink server in host:port format\n"
            "                   Default host is 'localhost' and default port is '16000'\n"
+           "                   Multiple addresses may be given to collect from several\n"
+           "                   servers at once, additional port-only addresses need a ':'\n"
+           " --shards N      split the matching streams across N connections to the\n"
+           "                   server, collected concurrently\n"
+           " --unique        suppress packets from multiple servers that duplicate a\n"
+           "                   recent record of the same stream, as --dedup 256\n"
+           " --reorder secs  hold packets up to secs seconds to emit each stream in\n"
+           "                   order of data start time\n"
+           " --reorder-memory MB  limit memory used for reordering, default 64\n"
+           " --gaps secs     track gaps and overlaps, report every secs seconds, 0 at end\n"
+           " --lag secs      report how far each connection is behind the server every\n"
+           "                   secs seconds, warn when falling out of the server ring\n"
+           " --lag-warn pct  warn at pct percent of ring or socket buffer, default 50\n"
+           " --trace file    write spans of receiving, parsing, output and state saves\n"
+           "                   to file as Chrome trace event JSON\n"
+           " --trace-events N  spans kept for each thread, default 250000\n"
+           " --dedup N       drop packets matching one of the last N records of the stream\n"
+           " --dedup-crc     include a CRC of the packet data in duplicate detection\n"
            "\n"
            " [repeat]        Specify a repeat interval in seconds for INFO requests\n"
            "\n");
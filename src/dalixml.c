@@ -3,6 +3,11 @@
  *
  * Routines to print formatted INFO XML responses.
  *
+ * The STATUS response is small and parsed into a document with ezxml,
+ * the STREAMS and CONNECTIONS responses can list any number of
+ * entries and are parsed as a stream of elements with infoxml,
+ * printing each entry as it is parsed.
+ *
  * Written by:
  *   Chad Trabant, EarthScope Data Services
  ***************************************************************************/
@@ -13,6 +18,7 @@
 #include <libdali.h>
 
 #include "dalixml.h"
+#include "infoxml.h"
 
 /***************************************************************************
  * prtinfo_status():
@@ -126,206 +132,379 @@ prtinfo_status (ezxml_t xmldoc, int verbose, FILE *prtstream)
 
 } /* End of prtinfo_status() */
 
+/* State of a list printer while the INFO XML is parsed */
+typedef struct ListPrinter_s
+{
+  int connections;              /* Flag: printing connections, otherwise streams */
+  int verbose;                  /* Verbosity of output */
+  FILE *prtstream;              /* Output stream */
+  int listfound;                /* Flag: list element found */
+  int inlist;                   /* Flag: inside list element */
+  char totalcount[32];          /* Total count from list element */
+  char selectedcount[32];       /* Selected count from list element */
+} ListPrinter;
+
+static int prtinfo_start (void *data, const char *name, const char **attrs, int depth);
+static int prtinfo_end (void *data, const char *name, int depth);
+static int prtinfo_chunk (char *chunk, int chunklen, void *handlerdata);
+static void prtinfo_connection (ListPrinter *printer, const char **attrs);
+static void prtinfo_stream (ListPrinter *printer, const char **attrs);
+
 /***************************************************************************
- * prtinfo_connections():
+ * prtinfo_list():
  *
- * Format the specified XML document into a connection list.
+ * Format the specified STREAMS or CONNECTIONS XML document into a
+ * stream or connection list.  The document is parsed as a stream of
+ * elements, printing each entry as it is parsed.
+ *
+ * Returns 0 on success and -1 on error.
  ***************************************************************************/
-void
-prtinfo_connections (ezxml_t xmldoc, int verbose, FILE *prtstream)
+int
+prtinfo_list (const char *infotype, char *infodata, int infolen,
+              int verbose, FILE *prtstream)
 {
-  ezxml_t status, connectionlist, connection;
-  char *rootname = ezxml_name (xmldoc);
-  const char *selectedcount, *totalcount;
-  const char *type, *host, *ip, *port;
-  const char *clientid, *conntime;
-  const char *match, *reject;
-  const char *pktid, *pktdatastart;
-  const char *streamcount;
-  const char *txpackets, *txpacketrate, *txbytes, *txbyterate;
-  const char *rxpackets, *rxpacketrate, *rxbytes, *rxbyterate;
-  const char *latency, *percentlag;
-  char timestr[50];
+  ListPrinter printer;
+  InfoXML *parser;
+  int rv;
 
-  if (strcmp (rootname, "DataLink"))
-  {
-    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
-    return;
-  }
+  memset (&printer, 0, sizeof (printer));
+  printer.connections = !strncasecmp (infotype, "CONNECTIONS", 11);
+  printer.verbose     = verbose;
+  printer.prtstream   = prtstream;
 
-  dl_dltime2mdtimestr (dlp_time (), timestr, 0);
-  fprintf (prtstream, "Current time: %s UTC\n", timestr);
+  if (!(parser = infoxml_new (prtinfo_start, prtinfo_end, &printer)))
+    return -1;
 
-  fprintf (prtstream, "Server ID: %s (%s)\n",
-           ezxml_attr (xmldoc, "ServerID"),
-           ezxml_attr (xmldoc, "Version"));
+  rv = infoxml_feed (parser, infodata, infolen);
 
-  if (verbose >= 1)
-  {
-    if ((status = ezxml_child (xmldoc, "Status")))
-    {
-      fprintf (prtstream, "  Started: %s, %s connections, %s streams\n",
-               ezxml_attr (status, "StartTime"), ezxml_attr (status, "TotalConnections"),
-               ezxml_attr (status, "TotalStreams"));
-      fprintf (prtstream, "  Input: %s packets/sec, %s bytes/sec\n",
-               ezxml_attr (status, "RXPacketRate"), ezxml_attr (status, "RXByteRate"));
-      fprintf (prtstream, "  Output: %s packets/sec, %s bytes/sec\n",
-               ezxml_attr (status, "TXPacketRate"), ezxml_attr (status, "TXByteRate"));
-    }
-  }
+  if (!rv)
+    rv = infoxml_finish (parser);
 
-  fprintf (prtstream, "\n");
+  infoxml_free (parser);
 
-  if (!(connectionlist = ezxml_child (xmldoc, "ConnectionList")))
-  {
-    dl_log (1, 0, "Cannot find StreamList element in XML response\n");
-    return;
-  }
+  if (!rv && !printer.listfound)
+    dl_log (1, 0, "Cannot find %s element in XML response\n",
+            (printer.connections) ? "ConnectionList" : "StreamList");
+
+  return rv;
+} /* End of prtinfo_list() */
+
+/***************************************************************************
+ * prtinfo_fetch():
+ *
+ * Request a STREAMS or CONNECTIONS list from the server and format it
+ * as it is received, without holding the complete response in memory.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+prtinfo_fetch (DLCP *dlconn, const char *infotype, char *infomatch,
+               int verbose, FILE *prtstream)
+{
+  ListPrinter printer;
+  InfoXML *parser;
+  int rv = 0;
 
-  for (connection = ezxml_child (connectionlist, "Connection"); connection; connection = ezxml_next (connection))
+  memset (&printer, 0, sizeof (printer));
+  printer.connections = !strncasecmp (infotype, "CONNECTIONS", 11);
+  printer.verbose     = verbose;
+  printer.prtstream   = prtstream;
+
+  if (!(parser = infoxml_new (prtinfo_start, prtinfo_end, &printer)))
+    return -1;
+
+  if (dl_getinfochunks (dlconn, infotype, infomatch, prtinfo_chunk, parser) < 0)
+    rv = -1;
+  else
+    rv = infoxml_finish (parser);
+
+  infoxml_free (parser);
+
+  if (!rv && !printer.listfound)
+    dl_log (1, 0, "Cannot find %s element in XML response\n",
+            (printer.connections) ? "ConnectionList" : "StreamList");
+
+  return rv;
+} /* End of prtinfo_fetch() */
+
+/***************************************************************************
+ * prtinfo_recv():
+ *
+ * Receive the infosize bytes of a STREAMS or CONNECTIONS list from the
+ * server, after the INFO response header has been received, and
+ * format it as it is received in chunks, without holding the complete
+ * response in memory.  If the list cannot be formatted the rest of
+ * the response is received and discarded, keeping the connection
+ * usable.
+ *
+ * Returns 0 on success, -1 on error formatting the list and -2 if the
+ * response could not be received.
+ ***************************************************************************/
+int
+prtinfo_recv (DLCP *dlconn, const char *infotype, int infosize,
+              int verbose, FILE *prtstream)
+{
+  ListPrinter printer;
+  InfoXML *parser;
+  char chunk[DL_INFOCHUNKSIZE];
+  int received = 0;
+  int chunklen;
+  int rv = 0;
+
+  memset (&printer, 0, sizeof (printer));
+  printer.connections = !strncasecmp (infotype, "CONNECTIONS", 11);
+  printer.verbose     = verbose;
+  printer.prtstream   = prtstream;
+
+  if (!(parser = infoxml_new (prtinfo_start, prtinfo_end, &printer)))
+    rv = -1;
+
+  while (received < infosize)
   {
-    type     = ezxml_attr (connection, "Type");
-    host     = ezxml_attr (connection, "Host");
-    ip       = ezxml_attr (connection, "IP");
-    port     = ezxml_attr (connection, "Port");
-    clientid = ezxml_attr (connection, "ClientID");
-    conntime = ezxml_attr (connection, "ConnectionTime");
-
-    fprintf (prtstream, "%s [%s:%s]\n  [%s]  %s  %s\n",
-             (host) ? host : "-",
-             (ip) ? ip : "-",
-             (port) ? port : "-",
-             (type) ? type : "-",
-             (clientid) ? clientid : "-",
-             (conntime) ? conntime : "-");
-
-    pktid        = ezxml_attr (connection, "PacketID");
-    pktdatastart = ezxml_attr (connection, "PacketDataStartTime");
-    percentlag   = ezxml_attr (connection, "PercentLag");
-    latency      = ezxml_attr (connection, "Latency");
-
-    fprintf (prtstream, "  Packet %s (%s)  Lag %s%s, %s seconds\n",
-             (pktid) ? pktid : "-",
-             (pktdatastart) ? pktdatastart : "-",
-             (percentlag) ? percentlag : "-", (*percentlag != '-') ? "%" : "",
-             (latency) ? latency : "-");
+    chunklen = ((infosize - received) < (int)sizeof (chunk)) ? (infosize - received) : (int)sizeof (chunk);
 
-    if (verbose >= 1)
+    if (dl_recvdata (dlconn, chunk, chunklen, 1) != chunklen)
     {
-      streamcount = ezxml_attr (connection, "StreamCount");
-
-      txpackets    = ezxml_attr (connection, "TXPacketCount");
-      txpacketrate = ezxml_attr (connection, "TXPacketRate");
-      txbytes      = ezxml_attr (connection, "TXByteCount");
-      txbyterate   = ezxml_attr (connection, "TXByteRate");
-
-      rxpackets    = ezxml_attr (connection, "RXPacketCount");
-      rxpacketrate = ezxml_attr (connection, "RXPacketRate");
-      rxbytes      = ezxml_attr (connection, "RXByteCount");
-      rxbyterate   = ezxml_attr (connection, "RXByteRate");
-
-      fprintf (prtstream, "  TX %s packets %s packets/sec  %s bytes %s bytes/sec\n",
-               (txpackets) ? txpackets : "-",
-               (txpacketrate) ? txpacketrate : "-",
-               (txbytes) ? txbytes : "-",
-               (txbyterate) ? txbyterate : "-");
-
-      fprintf (prtstream, "  RX %s packets %s packets/sec  %s bytes %s bytes/sec\n",
-               (rxpackets) ? rxpackets : "-",
-               (rxpacketrate) ? rxpacketrate : "-",
-               (rxbytes) ? rxbytes : "-",
-               (rxbyterate) ? rxbyterate : "-");
-
-      fprintf (prtstream, "  Stream count: %s\n", (streamcount) ? streamcount : "-");
+      infoxml_free (parser);
+      return -2;
     }
 
-    if (verbose >= 2)
-    {
-      match  = ezxml_attr (connection, "Match");
-      reject = ezxml_attr (connection, "Reject");
-
-      fprintf (prtstream, "  Match:  %.60s\n", (match) ? match : "-");
-      fprintf (prtstream, "  Reject: %.60s\n", (reject) ? reject : "-");
-    }
+    received += chunklen;
 
-    fprintf (prtstream, "\n");
+    if (!rv && infoxml_feed (parser, chunk, chunklen))
+      rv = -1;
   }
 
-  totalcount    = ezxml_attr (connectionlist, "TotalConnections");
-  selectedcount = ezxml_attr (connectionlist, "SelectedConnections");
-  fprintf (prtstream, "%s of %s connections\n", (selectedcount) ? selectedcount : "-",
-           (totalcount) ? totalcount : "-");
+  if (!rv)
+    rv = infoxml_finish (parser);
+
+  infoxml_free (parser);
 
-} /* End of prtinfo_connections() */
+  if (!rv && !printer.listfound)
+    dl_log (1, 0, "Cannot find %s element in XML response\n",
+            (printer.connections) ? "ConnectionList" : "StreamList");
+
+  return rv;
+} /* End of prtinfo_recv() */
 
 /***************************************************************************
- * prtinfo_streams():
- * Format the specified XML document into a stream list.
+ * prtinfo_chunk():
+ *
+ * Feed a chunk of a received INFO response to the parser.
  ***************************************************************************/
-void
-prtinfo_streams (ezxml_t xmldoc, int verbose, FILE *prtstream)
+static int
+prtinfo_chunk (char *chunk, int chunklen, void *handlerdata)
 {
-  ezxml_t streamlist, stream;
-  char *rootname = ezxml_name (xmldoc);
-  const char *selectedcount, *totalcount;
-  const char *name;
-  const char *earliestid, *earlieststart;
-  const char *latestid, *lateststart;
-  const char *datalatency;
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of prtinfo_chunk() */
+
+/***************************************************************************
+ * prtinfo_start():
+ *
+ * Element start callback of the list printer: print the server
+ * identification, the header and each stream or connection.
+ ***************************************************************************/
+static int
+prtinfo_start (void *data, const char *name, const char **attrs, int depth)
+{
+  ListPrinter *printer = (ListPrinter *)data;
+  FILE *prtstream      = printer->prtstream;
+  const char *value;
   char timestr[50];
 
-  if (strcmp (rootname, "DataLink"))
+  if (depth == 0)
   {
-    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
-    return;
+    if (strcmp (name, "DataLink"))
+    {
+      dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+      return -1;
+    }
+
+    dl_dltime2mdtimestr (dlp_time (), timestr, 0);
+    fprintf (prtstream, "Current time: %s UTC\n", timestr);
+
+    value = infoxml_attr (attrs, "ServerID");
+    fprintf (prtstream, "Server ID: %s", (value) ? value : "-");
+    value = infoxml_attr (attrs, "Version");
+    fprintf (prtstream, " (%s)\n", (value) ? value : "-");
+  }
+  else if (depth == 1 && printer->connections && printer->verbose >= 1 &&
+           !strcmp (name, "Status"))
+  {
+    fprintf (prtstream, "  Started: %s, %s connections, %s streams\n",
+             infoxml_attr (attrs, "StartTime"), infoxml_attr (attrs, "TotalConnections"),
+             infoxml_attr (attrs, "TotalStreams"));
+    fprintf (prtstream, "  Input: %s packets/sec, %s bytes/sec\n",
+             infoxml_attr (attrs, "RXPacketRate"), infoxml_attr (attrs, "RXByteRate"));
+    fprintf (prtstream, "  Output: %s packets/sec, %s bytes/sec\n",
+             infoxml_attr (attrs, "TXPacketRate"), infoxml_attr (attrs, "TXByteRate"));
+  }
+  else if (depth == 1 && !strcmp (name, (printer->connections) ? "ConnectionList" : "StreamList"))
+  {
+    printer->listfound = 1;
+    printer->inlist    = 1;
+
+    value = infoxml_attr (attrs, (printer->connections) ? "TotalConnections" : "TotalStreams");
+    snprintf (printer->totalcount, sizeof (printer->totalcount), "%s", (value) ? value : "-");
+    value = infoxml_attr (attrs, (printer->connections) ? "SelectedConnections" : "SelectedStreams");
+    snprintf (printer->selectedcount, sizeof (printer->selectedcount), "%s", (value) ? value : "-");
+
+    if (printer->connections)
+      fprintf (prtstream, "\n");
+    else if (printer->verbose >= 1)
+      fprintf (prtstream, "    Stream ID                     Earliest Packet                       Latest Packet               Latency\n");
+    else
+      fprintf (prtstream, "    Stream ID                Earliest Packet             Latest Packet           Latency\n");
+  }
+  else if (depth == 2 && printer->inlist)
+  {
+    if (printer->connections && !strcmp (name, "Connection"))
+      prtinfo_connection (printer, attrs);
+    else if (!printer->connections && !strcmp (name, "Stream"))
+      prtinfo_stream (printer, attrs);
   }
 
-  dl_dltime2mdtimestr (dlp_time (), timestr, 0);
-  fprintf (prtstream, "Current time: %s UTC\n", timestr);
+  return 0;
+} /* End of prtinfo_start() */
 
-  fprintf (prtstream, "Server ID: %s (%s)\n",
-           ezxml_attr (xmldoc, "ServerID"),
-           ezxml_attr (xmldoc, "Version"));
+/***************************************************************************
+ * prtinfo_end():
+ *
+ * Element end callback of the list printer: print the list totals.
+ ***************************************************************************/
+static int
+prtinfo_end (void *data, const char *name, int depth)
+{
+  ListPrinter *printer = (ListPrinter *)data;
 
-  if (!(streamlist = ezxml_child (xmldoc, "StreamList")))
+  if (depth == 1 && printer->inlist)
   {
-    dl_log (1, 0, "Cannot find StreamList element in XML response\n");
-    return;
+    printer->inlist = 0;
+
+    fprintf (printer->prtstream, "%s of %s %s\n", printer->selectedcount,
+             printer->totalcount, (printer->connections) ? "connections" : "streams");
   }
 
-  if (verbose >= 1)
-    fprintf (prtstream, "    Stream ID                     Earliest Packet                       Latest Packet               Latency\n");
-  else
-    fprintf (prtstream, "    Stream ID                Earliest Packet             Latest Packet           Latency\n");
+  return 0;
+} /* End of prtinfo_end() */
+
+/***************************************************************************
+ * prtinfo_connection():
+ *
+ * Print the details of a connection from a <Connection> element.
+ ***************************************************************************/
+static void
+prtinfo_connection (ListPrinter *printer, const char **attrs)
+{
+  FILE *prtstream = printer->prtstream;
+  const char *type, *host, *ip, *port;
+  const char *clientid, *conntime;
+  const char *match, *reject;
+  const char *pktid, *pktdatastart;
+  const char *streamcount;
+  const char *txpackets, *txpacketrate, *txbytes, *txbyterate;
+  const char *rxpackets, *rxpacketrate, *rxbytes, *rxbyterate;
+  const char *latency, *percentlag;
 
-  for (stream = ezxml_child (streamlist, "Stream"); stream; stream = ezxml_next (stream))
+  type     = infoxml_attr (attrs, "Type");
+  host     = infoxml_attr (attrs, "Host");
+  ip       = infoxml_attr (attrs, "IP");
+  port     = infoxml_attr (attrs, "Port");
+  clientid = infoxml_attr (attrs, "ClientID");
+  conntime = infoxml_attr (attrs, "ConnectionTime");
+
+  fprintf (prtstream, "%s [%s:%s]\n  [%s]  %s  %s\n",
+           (host) ? host : "-",
+           (ip) ? ip : "-",
+           (port) ? port : "-",
+           (type) ? type : "-",
+           (clientid) ? clientid : "-",
+           (conntime) ? conntime : "-");
+
+  pktid        = infoxml_attr (attrs, "PacketID");
+  pktdatastart = infoxml_attr (attrs, "PacketDataStartTime");
+  percentlag   = infoxml_attr (attrs, "PercentLag");
+  latency      = infoxml_attr (attrs, "Latency");
+
+  fprintf (prtstream, "  Packet %s (%s)  Lag %s%s, %s seconds\n",
+           (pktid) ? pktid : "-",
+           (pktdatastart) ? pktdatastart : "-",
+           (percentlag) ? percentlag : "-", (percentlag && *percentlag != '-') ? "%" : "",
+           (latency) ? latency : "-");
+
+  if (printer->verbose >= 1)
   {
-    name          = ezxml_attr (stream, "Name");
-    earliestid    = ezxml_attr (stream, "EarliestPacketID");
-    earlieststart = ezxml_attr (stream, "EarliestPacketDataStartTime");
-    latestid      = ezxml_attr (stream, "LatestPacketID");
-    lateststart   = ezxml_attr (stream, "LatestPacketDataStartTime");
-    datalatency   = ezxml_attr (stream, "DataLatency");
+    streamcount = infoxml_attr (attrs, "StreamCount");
+
+    txpackets    = infoxml_attr (attrs, "TXPacketCount");
+    txpacketrate = infoxml_attr (attrs, "TXPacketRate");
+    txbytes      = infoxml_attr (attrs, "TXByteCount");
+    txbyterate   = infoxml_attr (attrs, "TXByteRate");
+
+    rxpackets    = infoxml_attr (attrs, "RXPacketCount");
+    rxpacketrate = infoxml_attr (attrs, "RXPacketRate");
+    rxbytes      = infoxml_attr (attrs, "RXByteCount");
+    rxbyterate   = infoxml_attr (attrs, "RXByteRate");
+
+    fprintf (prtstream, "  TX %s packets %s packets/sec  %s bytes %s bytes/sec\n",
+             (txpackets) ? txpackets : "-",
+             (txpacketrate) ? txpacketrate : "-",
+             (txbytes) ? txbytes : "-",
+             (txbyterate) ? txbyterate : "-");
+
+    fprintf (prtstream, "  RX %s packets %s packets/sec  %s bytes %s bytes/sec\n",
+             (rxpackets) ? rxpackets : "-",
+             (rxpacketrate) ? rxpacketrate : "-",
+             (rxbytes) ? rxbytes : "-",
+             (rxbyterate) ? rxbyterate : "-");
+
+    fprintf (prtstream, "  Stream count: %s\n", (streamcount) ? streamcount : "-");
+  }
 
-    if (verbose >= 1)
-      fprintf (prtstream, "%-22s %-26s (%s)  %-26s (%s)  %s seconds\n",
-               (name) ? name : "-",
-               (earlieststart) ? earlieststart : "-",
-               (earliestid) ? earliestid : "-",
-               (lateststart) ? lateststart : "-",
-               (latestid) ? latestid : "-",
-               (datalatency) ? datalatency : "-");
-    else
-      fprintf (prtstream, "%-22s %-26s  %-26s  %s seconds\n",
-               (name) ? name : "-",
-               (earlieststart) ? earlieststart : "-",
-               (lateststart) ? lateststart : "-",
-               (datalatency) ? datalatency : "-");
+  if (printer->verbose >= 2)
+  {
+    match  = infoxml_attr (attrs, "Match");
+    reject = infoxml_attr (attrs, "Reject");
+
+    fprintf (prtstream, "  Match:  %.60s\n", (match) ? match : "-");
+    fprintf (prtstream, "  Reject: %.60s\n", (reject) ? reject : "-");
   }
 
-  totalcount    = ezxml_attr (streamlist, "TotalStreams");
-  selectedcount = ezxml_attr (streamlist, "SelectedStreams");
-  fprintf (prtstream, "%s of %s streams\n", (selectedcount) ? selectedcount : "-",
-           (totalcount) ? totalcount : "-");
+  fprintf (prtstream, "\n");
+} /* End of prtinfo_connection() */
+
+/***************************************************************************
+ * prtinfo_stream():
+ *
+ * Print the details of a stream from a <Stream> element.
+ ***************************************************************************/
+static void
+prtinfo_stream (ListPrinter *printer, const char **attrs)
+{
+  const char *name;
+  const char *earliestid, *earlieststart;
+  const char *latestid, *lateststart;
+  const char *datalatency;
 
-} /* End of prtinfo_streams() */
+  name          = infoxml_attr (attrs, "Name");
+  earliestid    = infoxml_attr (attrs, "EarliestPacketID");
+  earlieststart = infoxml_attr (attrs, "EarliestPacketDataStartTime");
+  latestid      = infoxml_attr (attrs, "LatestPacketID");
+  lateststart   = infoxml_attr (attrs, "LatestPacketDataStartTime");
+  datalatency   = infoxml_attr (attrs, "DataLatency");
+
+  if (printer->verbose >= 1)
+    fprintf (printer->prtstream, "%-22s %-26s (%s)  %-26s (%s)  %s seconds\n",
+             (name) ? name : "-",
+             (earlieststart) ? earlieststart : "-",
+             (earliestid) ? earliestid : "-",
+             (lateststart) ? lateststart : "-",
+             (latestid) ? latestid : "-",
+             (datalatency) ? datalatency : "-");
+  else
+    fprintf (printer->prtstream, "%-22s %-26s  %-26s  %s seconds\n",
+             (name) ? name : "-",
+             (earlieststart) ? earlieststart : "-",
+             (lateststart) ? lateststart : "-",
+             (datalatency) ? datalatency : "-");
+} /* End of prtinfo_stream() */
@@ -2,7 +2,10 @@
 #ifndef DALIXML_H
 #define DALIXML_H
 
+#include <stdio.h>
+
 #include <ezxml.h>
+#include <libdali.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -10,8 +13,12 @@ extern "C"
 #endif
 
 extern void prtinfo_status (ezxml_t xmldoc, int verbose, FILE *prtstream);
-extern void prtinfo_connections (ezxml_t xmldoc, int verbose, FILE *prtstream);
-extern void prtinfo_streams (ezxml_t xmldoc, int verbose, FILE *prtstream);
+extern int prtinfo_list (const char *infotype, char *infodata, int infolen,
+                         int verbose, FILE *prtstream);
+extern int prtinfo_fetch (DLCP *dlconn, const char *infotype, char *infomatch,
+                          int verbose, FILE *prtstream);
+extern int prtinfo_recv (DLCP *dlconn, const char *infotype, int infosize,
+                         int verbose, FILE *prtstream);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,266 @@
+/***************************************************************************
+ * dedup.c
+ *
+ * A stage that drops duplicate packets before output.
+ *
+ * For each stream a fixed size index of the most recently seen
+ * records is kept, identified by a 64-bit fingerprint of the data
+ * start and end times, the data size and optionally the CRC-32C of
+ * the packet data.  The index is an open addressing hash set with
+ * linear probing, sized at twice the window so probes are short,
+ * combined with a ring of fingerprints in insertion order.  When the
+ * window is full the oldest fingerprint is removed from the set using
+ * backward shift deletion, so lookups, insertions and evictions are
+ * all O(1) and memory per stream is fixed.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "dedup.h"
+#include "strhash.h"
+
+/* Per-stream index of recent fingerprints */
+typedef struct DedupStream_s
+{
+  uint64_t *ring;               /* Fingerprints in insertion order */
+  uint64_t *set;                /* Hash set of fingerprints, 0 is empty */
+  int count;                    /* Number of fingerprints in ring */
+  int next;                     /* Next ring position to fill */
+} DedupStream;
+
+struct Dedup_s
+{
+  int window;                   /* Number of recent records per stream */
+  int setsize;                  /* Size of hash sets, a power of 2 */
+  int usecrc;                   /* Include the CRC-32C of packet data */
+  StrHash *streams;             /* DedupStream entries keyed by stream ID */
+  FaninHandler handler;         /* Handler for packets that are not duplicates */
+  void *handlerdata;            /* Data passed to handler */
+  int64_t packets;              /* Packets received */
+  int64_t duplicates;           /* Packets dropped */
+};
+
+static uint64_t dedup_fingerprint (Dedup *dedup, DLPacket *dlpacket, void *packetdata);
+static int set_find (Dedup *dedup, DedupStream *stream, uint64_t fingerprint);
+static void set_remove (Dedup *dedup, DedupStream *stream, uint64_t fingerprint);
+static void dedup_freestream (void *value);
+
+/***************************************************************************
+ * dedup_new:
+ *
+ * Create a new duplicate suppression stage remembering the last window
+ * records of each stream and passing other packets to the handler.
+ * If usecrc is true the CRC-32C of the packet data is included in the
+ * record identity.
+ *
+ * Returns a pointer to the stage on success and NULL on error.
+ ***************************************************************************/
+Dedup *
+dedup_new (int window, int usecrc, FaninHandler handler, void *handlerdata)
+{
+  Dedup *dedup;
+
+  if (!handler || window <= 0)
+    return NULL;
+
+  if (!(dedup = (Dedup *)calloc (1, sizeof (Dedup))) ||
+      !(dedup->streams = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for duplicate suppression\n");
+    free (dedup);
+    return NULL;
+  }
+
+  dedup->window = window;
+  dedup->setsize = 8;
+  while (dedup->setsize < window * 2)
+    dedup->setsize *= 2;
+
+  dedup->usecrc      = usecrc;
+  dedup->handler     = handler;
+  dedup->handlerdata = handlerdata;
+
+  return dedup;
+} /* End of dedup_new() */
+
+/***************************************************************************
+ * dedup_packet:
+ *
+ * Drop a packet if it was recently seen for its stream, otherwise
+ * remember it and pass it to the handler.  The arguments match
+ * FaninHandler so that the stage can be used as a collection handler.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dedup_packet (DLCP *dlconn, DLPacket *dlpacket, void *packetdata, void *data)
+{
+  Dedup *dedup = (Dedup *)data;
+  DedupStream *stream;
+  uint64_t fingerprint;
+  int slot;
+
+  if (!dedup || !dlpacket || !packetdata)
+    return -1;
+
+  dedup->packets++;
+
+  if (!(stream = (DedupStream *)strhash_get (dedup->streams, dlpacket->streamid)))
+  {
+    if (!(stream = (DedupStream *)calloc (1, sizeof (DedupStream))) ||
+        !(stream->ring = (uint64_t *)calloc (dedup->window, sizeof (uint64_t))) ||
+        !(stream->set = (uint64_t *)calloc (dedup->setsize, sizeof (uint64_t))) ||
+        strhash_put (dedup->streams, dlpacket->streamid, stream))
+    {
+      dl_log (2, 0, "Cannot allocate memory for duplicate suppression\n");
+      dedup_freestream (stream);
+      return -1;
+    }
+  }
+
+  fingerprint = dedup_fingerprint (dedup, dlpacket, packetdata);
+
+  slot = set_find (dedup, stream, fingerprint);
+
+  if (stream->set[slot] == fingerprint)
+  {
+    dedup->duplicates++;
+    dl_log (1, 2, "Dropping duplicate %s packet %lld\n", dlpacket->streamid,
+            (long long int)dlpacket->pktid);
+    return 0;
+  }
+
+  /* Evict the oldest fingerprint when the window is full */
+  if (stream->count == dedup->window)
+  {
+    set_remove (dedup, stream, stream->ring[stream->next]);
+    slot = set_find (dedup, stream, fingerprint);
+  }
+  else
+  {
+    stream->count++;
+  }
+
+  stream->set[slot]            = fingerprint;
+  stream->ring[stream->next++] = fingerprint;
+
+  if (stream->next == dedup->window)
+    stream->next = 0;
+
+  return dedup->handler (dlconn, dlpacket, packetdata, dedup->handlerdata);
+} /* End of dedup_packet() */
+
+/***************************************************************************
+ * dedup_free:
+ *
+ * Free a duplicate suppression stage.
+ ***************************************************************************/
+void
+dedup_free (Dedup *dedup)
+{
+  if (!dedup)
+    return;
+
+  dl_log (1, 1, "Dropped %lld duplicate packets of %lld\n",
+          (long long int)dedup->duplicates, (long long int)dedup->packets);
+
+  strhash_free (dedup->streams, dedup_freestream);
+  free (dedup);
+} /* End of dedup_free() */
+
+/***************************************************************************
+ * dedup_fingerprint:
+ *
+ * Return a non-zero 64-bit fingerprint of a packet's data times, size
+ * and, if enabled, data CRC-32C, mixed with the SplitMix64 finalizer.
+ ***************************************************************************/
+static uint64_t
+dedup_fingerprint (Dedup *dedup, DLPacket *dlpacket, void *packetdata)
+{
+  uint64_t hash;
+  uint32_t crc = 0;
+
+  if (dedup->usecrc)
+    crc = ms_crc32c ((const uint8_t *)packetdata, dlpacket->datasize, 0);
+
+  hash = (uint64_t)dlpacket->datastart;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL + (uint64_t)dlpacket->dataend;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL + (((uint64_t)crc << 32) | (uint32_t)dlpacket->datasize);
+  hash = (hash ^ (hash >> 31)) * 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 29;
+
+  return (hash) ? hash : 1;
+} /* End of dedup_fingerprint() */
+
+/***************************************************************************
+ * set_find:
+ *
+ * Return the slot of a fingerprint in the set of a stream, or the empty
+ * slot where it would be inserted.
+ ***************************************************************************/
+static int
+set_find (Dedup *dedup, DedupStream *stream, uint64_t fingerprint)
+{
+  int mask = dedup->setsize - 1;
+  int slot = (int)(fingerprint & mask);
+
+  while (stream->set[slot] && stream->set[slot] != fingerprint)
+    slot = (slot + 1) & mask;
+
+  return slot;
+} /* End of set_find() */
+
+/***************************************************************************
+ * set_remove:
+ *
+ * Remove a fingerprint from the set of a stream, shifting following
+ * entries of the probe sequence back so no tombstones are needed.
+ ***************************************************************************/
+static void
+set_remove (Dedup *dedup, DedupStream *stream, uint64_t fingerprint)
+{
+  int mask = dedup->setsize - 1;
+  int slot = set_find (dedup, stream, fingerprint);
+  int next;
+  int home;
+
+  if (stream->set[slot] != fingerprint)
+    return;
+
+  for (next = (slot + 1) & mask; stream->set[next]; next = (next + 1) & mask)
+  {
+    home = (int)(stream->set[next] & mask);
+
+    /* Move entry back if its home slot is not between the hole and its position */
+    if (((next - home) & mask) >= ((next - slot) & mask))
+    {
+      stream->set[slot] = stream->set[next];
+      slot              = next;
+    }
+  }
+
+  stream->set[slot] = 0;
+} /* End of set_remove() */
+
+/***************************************************************************
+ * dedup_freestream:
+ *
+ * Free a DedupStream.
+ ***************************************************************************/
+static void
+dedup_freestream (void *value)
+{
+  DedupStream *stream = (DedupStream *)value;
+
+  if (stream)
+  {
+    free (stream->ring);
+    free (stream->set);
+    free (stream);
+  }
+} /* End of dedup_freestream() */
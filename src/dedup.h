@@ -0,0 +1,26 @@
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <libdali.h>
+
+#include "fanin.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct Dedup_s Dedup;
+
+extern Dedup *dedup_new (int window, int usecrc,
+                         FaninHandler handler, void *handlerdata);
+extern int dedup_packet (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+                         void *dedup);
+extern void dedup_free (Dedup *dedup);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* DEDUP_H */
@@ -1,24 +1,70 @@
 /***************************************************************************
  * console routines.
  *
- * Routines for supporting an interactive console for DataLink.
+ * Routines for supporting an interactive console for DataLink and for
+ * running scripts of console commands in batch mode.
+ *
+ * Commands for the server are built as complete DataLink requests.
+ * The console sends each command as it is entered, batch mode sends
+ * consecutive commands for the server together and then reads the
+ * replies, which the server returns in the order of the commands.
  ***************************************************************************/
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include <libdali.h>
 #include <libmseed.h>
 
 #include "common.h"
+#include "dalixml.h"
 #include "dlconsole.h"
+#include "gaps.h"
 #include "linenoise.h"
 
+/* Limits of commands sent before reading replies.  While the server is
+ * blocked sending replies it does not read commands, so all commands
+ * sent must fit into the socket buffers to avoid a deadlock. */
+#define MAXBATCHCOUNT 256
+#define MAXBATCHBYTES 8192
+
+/* Types of commands sent to the server */
+#define CMD_ID     1
+#define CMD_PSET   2
+#define CMD_PAFTER 3
+#define CMD_MATCH  4
+#define CMD_REJECT 5
+#define CMD_INFO   6
+#define CMD_READ   7
+
+/* A command for the server, as DataLink request */
+typedef struct ConsoleCommand_s
+{
+  int type;                     /* Command type, one of CMD_* */
+  char arg[256];                /* Argument, for messages */
+  const char *infotype;         /* INFO type requested */
+  int formatlevel;              /* INFO format level */
+  char header[258];             /* "DL", header length and header */
+  int headerlen;                /* Length of request header */
+  char pattern[256];            /* MATCH or REJECT pattern */
+  int patternlen;               /* Length of pattern */
+} ConsoleCommand;
+
+static void checkconnection (DLCP *dlconn);
+static int parsecommand (DLCP *dlconn, const char *cmd, ConsoleCommand *command);
+static int sendcommands (DLCP *dlconn, ConsoleCommand *commands, int count,
+                         GapTracker *gaps, SampleBuffer *samples,
+                         DLPacket *dlpacket, void *packetdata, size_t maxdatasize);
+static int localcommand (DLCP *dlconn, const char *cmd, GapTracker *gaps,
+                         SampleBuffer *samples);
 static void completion (const char *buf, linenoiseCompletions *lc);
-static int fetchinfo (DLCP *dlconn, char *infotype,
-                      int formatlevel, char *clientpattern);
+static int parsewindow (SampleBuffer *samples, const char *sid,
+                        const char *startstr, const char *endstr,
+                        nstime_t *start, nstime_t *end);
 
 /***************************************************************************
  * runconsole:
@@ -39,27 +85,37 @@ static int fetchinfo (DLCP *dlconn, char *infotype,
  *  CONNECTIONS [pattern] [-v]
  *  READ <packetid>
  *  STREAM
+ *  GAPS [mingap] | GAPS RESET
+ *  BUFFERS
+ *  DUMP <sid> [start] [end]
+ *  STATS <sid> [start] [end]
+ *
+ * The continuity of packets received with READ and STREAM is tracked
+ * and reported with GAPS.  If a sample buffer is supplied the samples
+ * of the packets are kept and can be printed with DUMP and summarized
+ * with STATS without requesting the packets from the server again.
  *
  * Return 0 on success and non-zero on error or exit request.
  ***************************************************************************/
 int
 runconsole (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
-            size_t maxdatasize, int verbose)
+            size_t maxdatasize, int verbose, SampleBuffer *samples)
 {
   static char cmd[256] = "";
   static int cmdlen    = 0;
   char *line           = NULL;
   int linelen          = 0;
-  char cbuf            = '\0';
+  int rv;
 
-  char str1[256];
-  char str2[256];
-  char *strp[2] = {str1, str2};
-  int strc;
+  ConsoleCommand command;
+  GapTracker *gaps;
 
   if (!dlpacket || !dlconn)
     return -1;
 
+  if (!(gaps = gaps_new (0)))
+    return -1;
+
   /* Set the completion callback (invoked for <Tab>) and max history */
   linenoiseSetCompletionCallback (completion);
   linenoiseHistorySetMaxLen (100);
@@ -82,32 +138,8 @@ runconsole (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
 
     free (line);
 
-    /* Parse command options if specified */
-    strc = sscanf (cmd, "%*s %s %s", str1, str2);
-
-    /* Check for closed connection and re-connect if needed.
-       * Half-open (silently broken) connections cannot be detected
-       * until a command is issued. */
-    if (dlconn->link == -1 || recv (dlconn->link, &cbuf, 1, MSG_PEEK) == 0)
-    {
-      fprintf (stdout, "Re-connecting to server... ");
-
-      /* Close/cleanup existing connection if needed */
-      if (dlconn->link != -1)
-      {
-        dl_disconnect (dlconn);
-      }
-
-      /* Connect to server */
-      if (dl_connect (dlconn) < 0)
-      {
-        fprintf (stdout, "Error connecting to server\n");
-      }
-      else
-      {
-        fprintf (stdout, "Connected to %s\n", dlconn->addr);
-      }
-    }
+    /* Check for closed connection and re-connect if needed */
+    checkconnection (dlconn);
 
     /* Check for recognized commands and process */
     if (!strncasecmp (cmd, "EXIT", 4) ||
@@ -132,352 +164,776 @@ runconsole (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
       fprintf (stdout, "CONNECTIONS [pattern] [-v]  Print server connections\n");
       fprintf (stdout, "READ <packetid>             Read and print packet details\n");
       fprintf (stdout, "STREAM                      Collect packets in streaming mode\n");
+      fprintf (stdout, "GAPS [mingap]               Print gaps and overlaps in packets received\n");
+      fprintf (stdout, "GAPS RESET                  Clear gap and overlap tracking\n");
+      fprintf (stdout, "BUFFERS                     List streams in the sample buffer\n");
+      fprintf (stdout, "DUMP <sid> [start] [end]    Print buffered samples of a stream\n");
+      fprintf (stdout, "STATS <sid> [start] [end]   Print statistics of buffered samples\n");
+      fprintf (stdout, "  Times are absolute or seconds before the latest sample, e.g. -60\n");
       fprintf (stdout, "\n");
     } /* End of HELP */
-    else if (!strncasecmp (cmd, "ID", 2))
+    else if ((rv = parsecommand (dlconn, cmd, &command)) != 0)
     {
-      char sendstr[255]; /* Buffer for command strings */
-      char respstr[255]; /* Buffer for server response */
-      int respsize;
+      if (rv < 0)
+        continue;
+
+      sendcommands (dlconn, &command, 1, gaps, samples,
+                    dlpacket, packetdata, maxdatasize);
+    } /* End of commands sent to server */
+    else if (!strncasecmp (cmd, "STREAM", 6))
+    {
+      fd_set readset;         /* File descriptor set for select() */
+      struct timeval timeout; /* Timeout throttle for select() */
+      int endflag = 0;
+      int rv;
 
-      /* Send ID command including client ID and collect response */
-      snprintf (sendstr, sizeof (sendstr), "ID %s",
-                (dlconn->clientid[0] != '\0') ? dlconn->clientid : "");
+      timeout.tv_sec = 0;
 
-      respsize = dl_sendpacket (dlconn, sendstr, strlen (sendstr), NULL, 0,
-                                respstr, sizeof (respstr));
+      fprintf (stdout, "Streaming from current position (press Enter to stop)\n");
 
-      if (respsize > 11)
+      for (;;)
       {
-        /* Make sure the response string is terminated */
-        respstr[respsize] = '\0';
+        timeout.tv_usec = 0;
 
-        /* Print response without "ID " prefix */
-        fprintf (stdout, "%s\n", respstr + 3);
-      }
-      else
-      {
-        if (respsize > 0)
-          fprintf (stdout, "Unrecognized ID response from server: %255s\n", respstr);
+        /* Check for packet from DataLink server */
+        rv = dl_collect_nb (dlconn, dlpacket, packetdata, maxdatasize, endflag);
+
+        /* Forward any recieved packet to the client */
+        if (rv == DLPACKET)
+        {
+          packet_handler (dlpacket, packetdata, 0, 0, NULL);
+          gaps_packet (gaps, dlpacket, packetdata);
+
+          if (samples)
+            samplebuf_packet (samples, dlpacket, packetdata);
+        }
+        else if (rv == DLNOPACKET)
+        {
+          /* Timeout 1/10 second to throttle the loop */
+          timeout.tv_usec = 100000;
+        }
+        /* Otherwise the connection was shutdown or an error occurred */
         else
-          fprintf (stdout, "Error requesting ID from server\n");
-      }
-    } /* End of ID */
-    else if (!strncasecmp (cmd, "PSET", 4))
-    {
-      int64_t pktid;
+        {
+          break;
+        }
 
-      if (strc != 1)
-      {
-        fprintf (stdout, "Unrecognized usage, try PSET <value>\n");
+        /* Check for input on stdin, if any input is available break out of the loop.
+	       * Use select timeout to throttle connection when no packets received. */
 
-        continue;
-      }
-      else if (!strncasecmp (str1, "EARLIEST", 8))
-      {
-        pktid = LIBDALI_POSITION_EARLIEST;
-      }
-      else if (!strncasecmp (str1, "LATEST", 6))
-      {
-        pktid = LIBDALI_POSITION_LATEST;
-      }
-      else
-      {
-        pktid = strtoll (str1, NULL, 10);
+        FD_ZERO (&readset);
+        FD_SET (fileno (stdin), &readset);
+
+        rv = select (fileno (stdin) + 1, &readset, NULL, NULL, &timeout);
 
-        if (pktid == 0 && errno == EINVAL)
+        if (rv == -1)
         {
-          fprintf (stdout, "Unrecognized position value: %s\n", str1);
+          if (errno != EINTR)
+            fprintf (stdout, "Error with select: %s\n", strerror (errno));
 
-          continue;
+          break;
         }
-      }
 
-      pktid = dl_position (dlconn, pktid, DLTERROR);
+        /* If input is available on stdin, read/ignore a single character and set end flag */
+        if (rv > 0 && FD_ISSET (fileno (stdin), &readset))
+        {
+          getc (stdin);
+          endflag = 1;
+        }
+      } /* End of STREAM collection loop */
+    }   /* End of STREAM */
+    else if ((rv = localcommand (dlconn, cmd, gaps, samples)) < 0)
+    {
+      continue;
+    }
+    else if (rv > 0)
+    {
+      fprintf (stdout, "Unrecognized command: %s\n", cmd);
+      continue;
+    }
+
+    /* Add recognized command to history if not a repeat line */
+    if (linelen > 0)
+      linenoiseHistoryAdd (cmd);
 
-      if (pktid > 0)
-      {
-        fprintf (stdout, "Positioned to packet ID %lld\n", (long long int)pktid);
-      }
-      else if (pktid == 0)
-      {
-        fprintf (stdout, "Packet %s not found\n", str1);
-      }
-      else
-      {
-        fprintf (stdout, "Error requesting position %s\n", str1);
-      }
-    } /* End of PSET */
-    else if (!strncasecmp (cmd, "PAFTER", 4))
+    /* Print current time stamp if verbose */
+    if (verbose)
+    {
+      time_t now;
+      struct tm *tp;
+
+      now = time (NULL);
+      tp  = localtime (&now);
+      fprintf (stdout, "%04d-%02d-%02d %02d:%02d:%02d\n",
+               tp->tm_year + 1900, tp->tm_mon + 1, tp->tm_mday,
+               tp->tm_hour, tp->tm_min, tp->tm_sec);
+    }
+  }
+
+  gaps_free (gaps);
+
+  return 0;
+} /* End of consolecmd() */
+
+/***************************************************************************
+ * runbatch:
+ *
+ * Run the console commands of a script, one command per line.  Empty
+ * lines and lines starting with '#' are ignored.
+ *
+ * Consecutive commands for the server (ID, PSET, PAFTER, MATCH,
+ * REJECT, STATUS, STREAMS, CONNECTIONS and READ) are sent together and
+ * their replies are read and processed in order, so that a run of
+ * commands costs a single round trip to the server.  The commands that
+ * are not sent to the server (GAPS, BUFFERS, DUMP, STATS and CONNECT)
+ * are run after the replies of all earlier commands.  EXIT, QUIT and
+ * BYE end the script; STREAM is not supported.  Usage errors are
+ * reported as the script is read, before the replies to earlier
+ * commands that are not sent yet.  Lines with errors are skipped and
+ * the rest of the script is run.
+ *
+ * Return 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+runbatch (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+          size_t maxdatasize, int verbose, SampleBuffer *samples, FILE *script)
+{
+  ConsoleCommand *commands;
+  GapTracker *gaps;
+  char line[1024];
+  char *cmd;
+  size_t length;
+  int queuedbytes = 0;
+  int lineno      = 0;
+  int count       = 0;
+  int retval      = 0;
+  int rv          = 0;
+
+  if (!dlpacket || !dlconn || !script)
+    return -1;
+
+  if (!(commands = (ConsoleCommand *)malloc (MAXBATCHCOUNT * sizeof (ConsoleCommand))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for command batch\n");
+    return -1;
+  }
+
+  if (!(gaps = gaps_new (0)))
+  {
+    free (commands);
+    return -1;
+  }
+
+  for (;;)
+  {
+    if ((cmd = fgets (line, sizeof (line), script)))
     {
-      dltime_t datatime;
-      int64_t pktid;
+      lineno++;
+      length = strlen (line);
 
-      if (strc != 1)
+      /* Skip the rest of a line that is too long, and the line */
+      if (length == sizeof (line) - 1 && line[length - 1] != '\n')
       {
-        fprintf (stdout, "Unrecognized usage, try PAFTER <datatime>\n");
+        dl_log (2, 0, "Line %d of script is longer than %d characters, skipped\n",
+                lineno, (int)sizeof (line) - 2);
+        retval = -1;
 
+        while ((rv = fgetc (script)) != EOF && rv != '\n')
+          ;
+
+        rv = 0;
         continue;
       }
       else
       {
-        datatime = dl_timestr2dltime (str1);
+        /* Trim leading and trailing white space */
+        while (length > 0 && isspace ((unsigned char)line[length - 1]))
+          line[--length] = '\0';
 
-        if (datatime == DLTERROR)
-        {
-          fprintf (stdout, "Unrecognized data time: %s\n", str1);
+        cmd += strspn (cmd, " \t");
 
+        if (*cmd == '\0' || *cmd == '#')
           continue;
+
+        if (verbose > 1)
+          dl_log (1, 1, "Line %d: %s\n", lineno, cmd);
+
+        if ((rv = parsecommand (dlconn, cmd, &commands[count])) > 0)
+        {
+          queuedbytes += commands[count].headerlen + commands[count].patternlen;
+          count++;
         }
       }
+    }
 
-      pktid = dl_position_after (dlconn, datatime);
+    /* Send queued commands when full, at the end of the script and
+     * before commands that are not sent to the server */
+    if (count > 0 &&
+        (!cmd || rv == 0 || count >= MAXBATCHCOUNT || queuedbytes >= MAXBATCHBYTES))
+    {
+      dl_log (1, 1, "Sending %d commands in %d bytes\n", count, queuedbytes);
 
-      if (pktid > 0)
-      {
-        fprintf (stdout, "Positioned to packet ID %lld\n", (long long int)pktid);
-      }
-      else if (pktid == 0) // This may not be true
-      {
-        fprintf (stdout, "Packet %s not found\n", str1);
-      }
-      else
-      {
-        fprintf (stdout, "Error requesting position %s\n", str1);
-      }
-    } /* End of PAFTER */
-    else if (!strncasecmp (cmd, "MATCH", 5))
+      checkconnection (dlconn);
+
+      if (sendcommands (dlconn, commands, count, gaps, samples,
+                        dlpacket, packetdata, maxdatasize))
+        retval = -1;
+
+      count       = 0;
+      queuedbytes = 0;
+    }
+
+    if (!cmd)
+      break;
+
+    if (rv > 0)
+      continue;
+
+    if (rv < 0)
+    {
+      retval = -1;
+    }
+    else if (!strncasecmp (cmd, "EXIT", 4) ||
+             !strncasecmp (cmd, "QUIT", 4) ||
+             !strncasecmp (cmd, "BYE", 3))
+    {
+      break;
+    }
+    else if (!strncasecmp (cmd, "STREAM", 6) ||
+             !strncasecmp (cmd, "HELP", 4))
+    {
+      fprintf (stdout, "Command not supported in batch mode: %s\n", cmd);
+      retval = -1;
+    }
+    else if ((rv = localcommand (dlconn, cmd, gaps, samples)) != 0)
     {
-      int64_t count;
+      if (rv > 0)
+        fprintf (stdout, "Unrecognized command: %s\n", cmd);
+      retval = -1;
+    }
+  }
 
-      count = dl_match (dlconn, (strc > 0) ? str1 : NULL);
+  if (ferror (script))
+  {
+    dl_log (2, 0, "Error reading script: %s\n", strerror (errno));
+    retval = -1;
+  }
 
-      if (count >= 0)
-      {
-        fprintf (stdout, "Matched %lld streams\n", (long long int)count);
-      }
-      else
-      {
-        fprintf (stdout, "Error submitting match expression %s\n",
-                 (strc > 0) ? str1 : "<NONE>");
-      }
-    } /* End of MATCH */
-    else if (!strncasecmp (cmd, "REJECT", 5))
+  gaps_free (gaps);
+  free (commands);
+
+  return retval;
+} /* End of runbatch() */
+
+/***************************************************************************
+ * checkconnection:
+ *
+ * Check for a closed connection and re-connect if needed.  Half-open
+ * (silently broken) connections cannot be detected until a command is
+ * issued.
+ ***************************************************************************/
+static void
+checkconnection (DLCP *dlconn)
+{
+  char cbuf = '\0';
+
+  if (dlconn->link == -1 || recv (dlconn->link, &cbuf, 1, MSG_PEEK) == 0)
+  {
+    fprintf (stdout, "Re-connecting to server... ");
+
+    /* Close/cleanup existing connection if needed */
+    if (dlconn->link != -1)
     {
-      int64_t count;
+      dl_disconnect (dlconn);
+    }
 
-      count = dl_reject (dlconn, (strc > 0) ? str1 : NULL);
+    /* Connect to server */
+    if (dl_connect (dlconn) < 0)
+    {
+      fprintf (stdout, "Error connecting to server\n");
+    }
+    else
+    {
+      fprintf (stdout, "Connected to %s\n", dlconn->addr);
+    }
+  }
+} /* End of checkconnection() */
 
-      if (count >= 0)
-      {
-        fprintf (stdout, "Rejected %lld streams\n", (long long int)count);
-      }
-      else
-      {
-        fprintf (stdout, "Error submitting reject expression %s\n",
-                 (strc > 0) ? str1 : "<NONE>");
-      }
-    } /* End of REJECT */
-    else if (!strncasecmp (cmd, "STATUS", 6))
+/***************************************************************************
+ * parsecommand:
+ *
+ * Parse a console command sent to the server and build its DataLink
+ * request in command.
+ *
+ * Return 1 for a command sent to the server, 0 for other commands and
+ * -1 on usage errors.
+ ***************************************************************************/
+static int
+parsecommand (DLCP *dlconn, const char *cmd, ConsoleCommand *command)
+{
+  char str1[256] = "";
+  char str2[256] = "";
+  char *strp[2]  = {str1, str2};
+  char *header;
+  char *endptr;
+  int64_t pktid;
+  dltime_t datatime;
+  int headerlen;
+  int strc;
+  int si;
+
+  cmd += strspn (cmd, " \t");
+
+  /* Check for commands sent to the server, in the order the console
+   * always did as some are prefixes of others */
+  if (strncasecmp (cmd, "ID", 2) &&
+      strncasecmp (cmd, "PSET", 4) &&
+      strncasecmp (cmd, "PAFTER", 4) &&
+      strncasecmp (cmd, "MATCH", 5) &&
+      strncasecmp (cmd, "REJECT", 5) &&
+      strncasecmp (cmd, "STATUS", 6) &&
+      strncasecmp (cmd, "STREAMS", 7) &&
+      strncasecmp (cmd, "CONNECTIONS", 11) &&
+      strncasecmp (cmd, "READ", 4))
+    return 0;
+
+  memset (command, 0, sizeof (ConsoleCommand));
+  header = command->header + 3;
+
+  /* Parse command options if specified */
+  strc = sscanf (cmd, "%*s %255s %255s", str1, str2);
+
+  if (strc > 0)
+    strcpy (command->arg, str1);
+
+  if (!strncasecmp (cmd, "ID", 2))
+  {
+    command->type = CMD_ID;
+    headerlen     = snprintf (header, 256, "ID %s",
+                              (dlconn->clientid[0] != '\0') ? dlconn->clientid : "");
+  }
+  else if (!strncasecmp (cmd, "PSET", 4))
+  {
+    if (strc != 1)
     {
-      int formatlevel = 0;
+      fprintf (stdout, "Unrecognized usage, try PSET <value>\n");
+      return -1;
+    }
 
-      if (strc > 0)
-      {
-        if (strncmp (str1, "-v", 2) == 0)
-        {
-          formatlevel += strspn (str1 + 1, "v");
-        }
-      }
+    command->type = CMD_PSET;
 
-      if (fetchinfo (dlconn, "STATUS", formatlevel, NULL))
-      {
-        fprintf (stdout, "Error requesting STATUS\n");
-      }
-    } /* End of STATUS */
-    else if (!strncasecmp (cmd, "STREAMS", 7))
+    if (!strncasecmp (str1, "EARLIEST", 8))
     {
-      int formatlevel = 0;
+      headerlen = snprintf (header, 256, "POSITION SET EARLIEST");
+    }
+    else if (!strncasecmp (str1, "LATEST", 6))
+    {
+      headerlen = snprintf (header, 256, "POSITION SET LATEST");
+    }
+    else
+    {
+      pktid = strtoll (str1, &endptr, 10);
 
-      if (strc > 0)
+      if (*endptr != '\0' || pktid < 0)
       {
-        if (strncmp (str1, "-v", 2) == 0)
-        {
-          formatlevel += strspn (str1 + 1, "v");
-        }
+        fprintf (stdout, "Unrecognized position value: %s\n", str1);
+        return -1;
       }
 
-      if (fetchinfo (dlconn, "STREAMS", formatlevel, NULL))
-      {
-        fprintf (stdout, "Error requesting STREAMS\n");
-      }
-    } /* End of STREAMS */
-    else if (!strncasecmp (cmd, "CONNECTIONS", 11))
+      headerlen = snprintf (header, 256, "POSITION SET %lld %lld",
+                            (long long int)pktid, (long long int)DLTERROR);
+    }
+  }
+  else if (!strncasecmp (cmd, "PAFTER", 4))
+  {
+    if (strc != 1)
     {
-      int formatlevel = 0;
-      char *matchptr  = NULL;
-      int si;
+      fprintf (stdout, "Unrecognized usage, try PAFTER <datatime>\n");
+      return -1;
+    }
 
-      for (si = 0; si < strc; si++)
-      {
-        if (strncmp (strp[si], "-v", 2) == 0)
-        {
-          formatlevel += strspn (strp[si] + 1, "v");
-        }
-        else
-        {
-          matchptr = strp[si];
-        }
-      }
+    if ((datatime = dl_timestr2dltime (str1)) == DLTERROR)
+    {
+      fprintf (stdout, "Unrecognized data time: %s\n", str1);
+      return -1;
+    }
 
-      if (fetchinfo (dlconn, "CONNECTIONS", formatlevel, matchptr))
-      {
-        fprintf (stdout, "Error requesting CONNECTIONS\n");
-      }
-    } /* End of CONNECTIONS */
-    else if (!strncasecmp (cmd, "READ", 4))
+    command->type = CMD_PAFTER;
+    headerlen     = snprintf (header, 256, "POSITION AFTER %lld",
+                              (long long int)datatime);
+  }
+  else if (!strncasecmp (cmd, "MATCH", 5) ||
+           !strncasecmp (cmd, "REJECT", 5))
+  {
+    command->type       = (!strncasecmp (cmd, "MATCH", 5)) ? CMD_MATCH : CMD_REJECT;
+    command->patternlen = (strc > 0) ? (int)strlen (str1) : 0;
+    memcpy (command->pattern, str1, command->patternlen);
+
+    headerlen = snprintf (header, 256, "%s %d",
+                          (command->type == CMD_MATCH) ? "MATCH" : "REJECT",
+                          command->patternlen);
+  }
+  else if (!strncasecmp (cmd, "READ", 4))
+  {
+    if (strc != 1)
+    {
+      fprintf (stdout, "Unrecognized usage, try READ <packetID>\n");
+      return -1;
+    }
+
+    pktid = strtoll (str1, &endptr, 10);
+
+    if (*endptr != '\0' || pktid <= 0)
     {
-      int64_t pktid;
-      int datasize;
+      fprintf (stdout, "Unrecognized packet value: %s\n", str1);
+      return -1;
+    }
 
-      if (strc != 1)
-      {
-        fprintf (stdout, "Unrecognized usage, try READ <packetID>\n");
+    command->type = CMD_READ;
+    headerlen     = snprintf (header, 256, "READ %lld", (long long int)pktid);
+  }
+  else
+  {
+    char *matchptr = NULL;
 
-        continue;
+    command->type = CMD_INFO;
+
+    if (!strncasecmp (cmd, "STATUS", 6))
+      command->infotype = "STATUS";
+    else if (!strncasecmp (cmd, "STREAMS", 7))
+      command->infotype = "STREAMS";
+    else
+      command->infotype = "CONNECTIONS";
+
+    /* Only CONNECTIONS accepts a match pattern */
+    for (si = 0; si < strc; si++)
+    {
+      if (strncmp (strp[si], "-v", 2) == 0)
+      {
+        command->formatlevel += strspn (strp[si] + 1, "v");
       }
-      else
+      else if (command->infotype[0] == 'C')
       {
-        pktid = strtoll (str1, NULL, 10);
+        matchptr = strp[si];
+      }
+    }
 
-        if (pktid == 0 && errno == EINVAL)
-        {
-          fprintf (stdout, "Unrecognized packet value: %s\n", str1);
+    headerlen = snprintf (header, 256, "INFO %s %s", command->infotype,
+                          (matchptr) ? matchptr : "");
+  }
 
-          continue;
-        }
-      }
+  if (headerlen < 0 || headerlen > 255)
+  {
+    fprintf (stdout, "Command too long: %s\n", cmd);
+    return -1;
+  }
+
+  command->header[0] = 'D';
+  command->header[1] = 'L';
+  command->header[2] = (uint8_t)headerlen;
+  command->headerlen = headerlen + 3;
+
+  return 1;
+} /* End of parsecommand() */
+
+/***************************************************************************
+ * sendcommands:
+ *
+ * Send the requests of count commands to the server together, then
+ * receive the replies in the order of the commands and print them as
+ * the console does.  Packets read are tracked for gaps and added to
+ * the sample buffer, if supplied.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+sendcommands (DLCP *dlconn, ConsoleCommand *commands, int count,
+              GapTracker *gaps, SampleBuffer *samples,
+              DLPacket *dlpacket, void *packetdata, size_t maxdatasize)
+{
+  void *buffers[2 * MAXBATCHCOUNT];
+  size_t lengths[2 * MAXBATCHCOUNT];
+  ConsoleCommand *command;
+  char header[256];
+  char type[256];
+  char *infodata;
+  int64_t value;
+  int bufcount = 0;
+  int datasize;
+  int infosize;
+  int idx;
+  int rv;
+
+  if (count <= 0 || count > MAXBATCHCOUNT)
+    return -1;
+
+  if (dlconn->link == -1 || dlconn->streaming)
+  {
+    fprintf (stdout, "Not connected to server, %d commands not sent\n", count);
+    return -1;
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    buffers[bufcount]   = commands[idx].header;
+    lengths[bufcount++] = commands[idx].headerlen;
 
-      datasize = dl_read (dlconn, pktid, dlpacket, packetdata, maxdatasize);
+    if (commands[idx].patternlen > 0)
+    {
+      buffers[bufcount]   = commands[idx].pattern;
+      lengths[bufcount++] = commands[idx].patternlen;
+    }
+  }
+
+  if (dl_sendbuffers (dlconn, buffers, lengths, bufcount) < 0)
+  {
+    fprintf (stdout, "Error sending commands to server\n");
+    dl_disconnect (dlconn);
+    return -1;
+  }
+
+  /* Replies are returned in the order of the commands */
+  for (idx = 0; idx < count; idx++)
+  {
+    command = &commands[idx];
+
+    /* The reply to READ is a packet or an error, read by dl_read() */
+    if (command->type == CMD_READ)
+    {
+      datasize = dl_read (dlconn, 0, dlpacket, packetdata, maxdatasize);
 
       if (datasize > 0)
       {
         packet_handler (dlpacket, packetdata, 0, 0, NULL);
+        gaps_packet (gaps, dlpacket, packetdata);
+
+        if (samples)
+          samplebuf_packet (samples, dlpacket, packetdata);
       }
       else if (datasize == 0)
       {
         fprintf (stdout, "Packet data too large for buffer\n");
       }
-    } /* End of READ */
-    else if (!strncasecmp (cmd, "STREAM", 6))
-    {
-      fd_set readset;         /* File descriptor set for select() */
-      struct timeval timeout; /* Timeout throttle for select() */
-      int endflag = 0;
-      int rv;
 
-      timeout.tv_sec = 0;
-
-      fprintf (stdout, "Streaming from current position (press Enter to stop)\n");
+      continue;
+    }
 
-      for (;;)
-      {
-        timeout.tv_usec = 0;
+    if ((rv = dl_recvheader (dlconn, header, sizeof (header), 1)) < 0)
+    {
+      fprintf (stdout, "Error receiving reply from server, %d commands not completed\n",
+               count - idx);
+      dl_disconnect (dlconn);
+      return -1;
+    }
 
-        /* Check for packet from DataLink server */
-        rv = dl_collect_nb (dlconn, dlpacket, packetdata, maxdatasize, endflag);
+    if (command->type == CMD_ID)
+    {
+      /* Print response without "ID " prefix */
+      if (rv > 11 && !strncmp (header, "ID ", 3))
+        fprintf (stdout, "%s\n", header + 3);
+      else
+        fprintf (stdout, "Unrecognized ID response from server: %s\n", header);
+    }
+    else if (command->type == CMD_INFO)
+    {
+      infodata = NULL;
+      rv       = 0;
 
-        /* Forward any recieved packet to the client */
-        if (rv == DLPACKET)
+      if (!strncmp (header, "INFO", 4))
+      {
+        if (sscanf (header, "INFO %255s %d", type, &infosize) != 2 || infosize < 0)
         {
-          packet_handler (dlpacket, packetdata, 0, 0, NULL);
+          rv = -2;
         }
-        else if (rv == DLNOPACKET)
+        /* Lists are formatted as they are received, in chunks */
+        else if (strcmp (command->infotype, "STATUS"))
         {
-          /* Timeout 1/10 second to throttle the loop */
-          timeout.tv_usec = 100000;
+          rv = prtinfo_recv (dlconn, command->infotype, infosize,
+                             command->formatlevel, stdout);
+        }
+        else if (!(infodata = (char *)malloc (infosize + 1)) ||
+                 dl_recvdata (dlconn, infodata, infosize, 1) != infosize)
+        {
+          rv = -2;
         }
-        /* Otherwise the connection was shutdown or an error occurred */
         else
         {
-          break;
+          rv = info_handler ((char *)command->infotype, infodata, infosize, command->formatlevel);
         }
 
-        /* Check for input on stdin, if any input is available break out of the loop.
-	       * Use select timeout to throttle connection when no packets received. */
-
-        FD_ZERO (&readset);
-        FD_SET (fileno (stdin), &readset);
-
-        rv = select (fileno (stdin) + 1, &readset, NULL, NULL, &timeout);
+        free (infodata);
 
-        if (rv == -1)
+        if (rv == -2)
         {
-          if (errno != EINTR)
-            fprintf (stdout, "Error with select: %s\n", strerror (errno));
-
-          break;
+          fprintf (stdout, "Error receiving %s from server, %d commands not completed\n",
+                   command->infotype, count - idx);
+          dl_disconnect (dlconn);
+          return -1;
         }
 
-        /* If input is available on stdin, read/ignore a single character and set end flag */
-        if (rv > 0 && FD_ISSET (fileno (stdin), &readset))
-        {
-          getc (stdin);
-          endflag = 1;
-        }
-      } /* End of STREAM collection loop */
-    }   /* End of STREAM */
-    else if (!strncasecmp (cmd, "CONNECT", 7))
-    {
-      /* Use server address if specified */
-      if (strc >= 1)
-      {
-        strncpy (dlconn->addr, str1, sizeof (dlconn->addr) - 1);
-        dlconn->addr[sizeof (dlconn->addr) - 1] = '\0';
+        if (rv)
+          fprintf (stdout, "Error requesting %s\n", command->infotype);
       }
+      else
+      {
+        if (dl_handlereply (dlconn, header, sizeof (header) - 1, NULL) >= 0)
+          dl_log (2, 0, "[%s] %s\n", dlconn->addr, header);
 
-      /* Close existing connection if needed */
-      if (dlconn->link != -1)
+        fprintf (stdout, "Error requesting %s\n", command->infotype);
+      }
+    }
+    else
+    {
+      /* Reply message, if sent, will be placed into the header buffer */
+      if ((rv = dl_handlereply (dlconn, header, sizeof (header) - 1, &value)) < 0)
       {
+        fprintf (stdout, "Error receiving reply from server, %d commands not completed\n",
+                 count - idx);
         dl_disconnect (dlconn);
+        return -1;
       }
 
-      /* Connect to server */
-      if (dl_connect (dlconn) < 0)
+      dl_log (1, 1, "[%s] %s\n", dlconn->addr, header);
+
+      if (command->type == CMD_PSET || command->type == CMD_PAFTER)
+      {
+        if (command->type == CMD_PSET && value < 0)
+          value = -1;
+
+        if (value > 0)
+          fprintf (stdout, "Positioned to packet ID %lld\n", (long long int)value);
+        else if (value == 0)
+          fprintf (stdout, "Packet %s not found\n", command->arg);
+        else
+          fprintf (stdout, "Error requesting position %s\n", command->arg);
+      }
+      else if (value >= 0)
       {
-        fprintf (stdout, "Error connecting to server\n");
+        fprintf (stdout, "%s %lld streams\n",
+                 (command->type == CMD_MATCH) ? "Matched" : "Rejected",
+                 (long long int)value);
       }
       else
       {
-        fprintf (stdout, "Connected to %s\n", dlconn->addr);
+        fprintf (stdout, "Error submitting %s expression %s\n",
+                 (command->type == CMD_MATCH) ? "match" : "reject",
+                 (command->patternlen > 0) ? command->pattern : "<NONE>");
       }
-    } /* End of CONNECT */
-    else if (cmdlen > 0)
+    }
+  }
+
+  return 0;
+} /* End of sendcommands() */
+
+/***************************************************************************
+ * localcommand:
+ *
+ * Run a console command that is not sent to the server.
+ *
+ * Return 0 on success, 1 if the command is not recognized and -1 on
+ * usage errors.
+ ***************************************************************************/
+static int
+localcommand (DLCP *dlconn, const char *cmd, GapTracker *gaps,
+              SampleBuffer *samples)
+{
+  char str1[256];
+  int strc;
+
+  /* Parse command option if specified */
+  strc = sscanf (cmd, "%*s %255s", str1);
+
+  if (!strncasecmp (cmd, "GAPS", 4))
+  {
+    double mingap;
+
+    if (strc >= 1 && !strncasecmp (str1, "RESET", 5))
     {
-      fprintf (stdout, "Unrecognized command: %s\n", cmd);
-      continue;
+      gaps_reset (gaps);
+      fprintf (stdout, "Gap tracking cleared\n");
+    }
+    else if (strc >= 1)
+    {
+      mingap = strtod (str1, NULL);
+      gaps_report (gaps, &mingap, NULL);
     }
+    else
+    {
+      gaps_report (gaps, NULL, NULL);
+    }
+  } /* End of GAPS */
+  else if (!strncasecmp (cmd, "BUFFERS", 7) ||
+           !strncasecmp (cmd, "DUMP", 4) ||
+           !strncasecmp (cmd, "STATS", 5))
+  {
+    char sid[256];
+    char startstr[256] = "";
+    char endstr[256]   = "";
+    nstime_t start;
+    nstime_t end;
 
-    /* Add recognized command to history if not a repeat line */
-    if (linelen > 0)
-      linenoiseHistoryAdd (cmd);
+    if (!samples)
+    {
+      fprintf (stdout, "Sample buffer is not enabled\n");
+      return -1;
+    }
 
-    /* Print current time stamp if verbose */
-    if (verbose)
+    if (!strncasecmp (cmd, "BUFFERS", 7))
     {
-      time_t now;
-      struct tm *tp;
+      samplebuf_list (samples, stdout);
+    }
+    else if (sscanf (cmd, "%*s %255s %255s %255s", sid, startstr, endstr) < 1)
+    {
+      fprintf (stdout, "Unrecognized usage, try %s <sid> [start] [end]\n",
+               (!strncasecmp (cmd, "DUMP", 4)) ? "DUMP" : "STATS");
+      return -1;
+    }
+    else if (parsewindow (samples, sid, startstr, endstr, &start, &end))
+    {
+      return -1;
+    }
+    else if (!strncasecmp (cmd, "DUMP", 4))
+    {
+      if (samplebuf_dump (samples, sid, start, end, stdout) == 0)
+        fprintf (stdout, "No samples in window\n");
+    }
+    else
+    {
+      samplebuf_stats (samples, sid, start, end, stdout);
+    }
+  } /* End of BUFFERS, DUMP and STATS */
+  else if (!strncasecmp (cmd, "CONNECT", 7))
+  {
+    /* Use server address if specified */
+    if (strc >= 1)
+    {
+      strncpy (dlconn->addr, str1, sizeof (dlconn->addr) - 1);
+      dlconn->addr[sizeof (dlconn->addr) - 1] = '\0';
+    }
 
-      now = time (NULL);
-      tp  = localtime (&now);
-      fprintf (stdout, "%04d-%02d-%02d %02d:%02d:%02d\n",
-               tp->tm_year + 1900, tp->tm_mon + 1, tp->tm_mday,
-               tp->tm_hour, tp->tm_min, tp->tm_sec);
+    /* Close existing connection if needed */
+    if (dlconn->link != -1)
+    {
+      dl_disconnect (dlconn);
+    }
+
+    /* Connect to server */
+    if (dl_connect (dlconn) < 0)
+    {
+      fprintf (stdout, "Error connecting to server\n");
+    }
+    else
+    {
+      fprintf (stdout, "Connected to %s\n", dlconn->addr);
     }
+  } /* End of CONNECT */
+  else
+  {
+    return 1;
   }
 
   return 0;
-} /* End of consolecmd() */
+} /* End of localcommand() */
 
 /***************************************************************************
  * completion:
@@ -499,6 +955,7 @@ completion (const char *buf, linenoiseCompletions *lc)
   else if (buf[0] == 'b')
   {
     linenoiseAddCompletion (lc, "bye");
+    linenoiseAddCompletion (lc, "buffers");
   }
   else if (buf[0] == 'p')
   {
@@ -519,38 +976,72 @@ completion (const char *buf, linenoiseCompletions *lc)
     linenoiseAddCompletion (lc, "status");
     linenoiseAddCompletion (lc, "streams");
     linenoiseAddCompletion (lc, "stream");
+    linenoiseAddCompletion (lc, "stats ");
   }
   else if (buf[0] == 'c')
   {
     linenoiseAddCompletion (lc, "connections");
     linenoiseAddCompletion (lc, "connect");
   }
+  else if (buf[0] == 'g')
+  {
+    linenoiseAddCompletion (lc, "gaps");
+  }
+  else if (buf[0] == 'd')
+  {
+    linenoiseAddCompletion (lc, "dump ");
+  }
 }
 
 /***************************************************************************
- * fetchinfo:
+ * parsewindow:
  *
- * Submit INFO command and print formatted response.
+ * Parse the start and end of a time window for a buffered stream.
+ * Times are absolute or, if negative numbers, seconds before the
+ * latest sample buffered.  Empty strings select the earliest and
+ * latest samples buffered.
  *
  * Return 0 on success and non-zero on error.
  ***************************************************************************/
 static int
-fetchinfo (DLCP *dlconn, char *infotype, int formatlevel, char *clientpattern)
+parsewindow (SampleBuffer *samples, const char *sid,
+             const char *startstr, const char *endstr,
+             nstime_t *start, nstime_t *end)
 {
-  char *infodata = NULL;
-  int infolen    = 0;
-  int rv;
-
-  if (!dlconn || !infotype)
+  const char *timestr[2] = {startstr, endstr};
+  nstime_t *times[2]     = {start, end};
+  nstime_t earliest;
+  nstime_t latest;
+  char *endptr;
+  double offset;
+  int idx;
+
+  if (samplebuf_range (samples, sid, &earliest, &latest))
+  {
+    fprintf (stdout, "Stream %s is not buffered\n", sid);
     return -1;
+  }
 
-  if ((infolen = dl_getinfo (dlconn, infotype, clientpattern, &infodata, 0)) < 0)
-    return -1;
+  *start = earliest;
+  *end   = latest;
 
-  rv = info_handler (infotype, infodata, infolen, formatlevel);
+  for (idx = 0; idx < 2; idx++)
+  {
+    if (timestr[idx][0] == '\0')
+      continue;
 
-  if (infodata)
-    free (infodata);
+    offset = strtod (timestr[idx], &endptr);
 
-  return rv;
-} /* End of fetchinfo() */
+    if (timestr[idx][0] == '-' && *endptr == '\0')
+    {
+      *times[idx] = latest + (nstime_t)(offset * NSTMODULUS);
+    }
+    else if ((*times[idx] = ms_timestr2nstime (timestr[idx])) == NSTERROR)
+    {
+      fprintf (stdout, "Unrecognized time: %s\n", timestr[idx]);
+      return -1;
+    }
+  }
+
+  return 0;
+} /* End of parsewindow() */
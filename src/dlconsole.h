@@ -2,15 +2,23 @@
 #ifndef DLCONSOLE_H
 #define DLCONSOLE_H
 
+#include <stdio.h>
+
 #include <libdali.h>
 
+#include "samplebuf.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
 extern int runconsole (DLCP *dlconn, DLPacket *dlpacket,
-		       void *packetdata, size_t maxdatasize, int verbose);
+		       void *packetdata, size_t maxdatasize, int verbose,
+		       SampleBuffer *samples);
+extern int runbatch (DLCP *dlconn, DLPacket *dlpacket,
+		     void *packetdata, size_t maxdatasize, int verbose,
+		     SampleBuffer *samples, FILE *script);
 
 #ifdef __cplusplus
 }
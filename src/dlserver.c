@@ -0,0 +1,1780 @@
+/***************************************************************************
+ *
+ * A small stand-in DataLink server for testing and benchmarking
+ * DataLink clients without a production server.
+ *
+ * Packets are served from an in-memory ring that is preloaded from
+ * miniSEED files, or fed from those files at a fixed injection rate,
+ * and from packets written by clients.  Delivery to streaming clients
+ * can be delayed to simulate latency.  The ID, POSITION, MATCH,
+ * REJECT, READ, STREAM, ENDSTREAM, WRITE and INFO commands are
+ * supported over TCP and UNIX domain sockets.
+ *
+ * All connections are handled in a single thread using poll(), which
+ * keeps the behavior deterministic.  Windows is not supported.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+
+#define PACKAGE "dlserver"
+#define VERSION "2026.291"
+
+/* Maximum number of listening sockets */
+#define MAXLISTEN 4
+
+/* Bytes queued for a streaming client before waiting for it to drain */
+#define STREAMQUEUE 262144
+
+/* A packet in the ring */
+typedef struct RingPacket_s
+{
+  int64_t pktid;              /* Packet ID */
+  char streamid[MAXSTREAMID]; /* Stream ID */
+  dltime_t pkttime;           /* Packet creation time */
+  dltime_t datastart;         /* Data start time */
+  dltime_t dataend;           /* Data end time */
+  int datasize;               /* Size of packet data */
+  char *data;                 /* Packet data */
+} RingPacket;
+
+/* Summary of a stream in the ring */
+typedef struct StreamSummary_s
+{
+  RingPacket *earliest; /* Earliest packet of stream */
+  RingPacket *latest;   /* Latest packet of stream */
+} StreamSummary;
+
+/* A connected client */
+typedef struct Client_s
+{
+  int fd;                  /* Socket descriptor */
+  char ip[64];             /* Peer address */
+  char port[16];           /* Peer port */
+  char clientid[256];      /* Client ID from ID command */
+  dltime_t conntime;       /* Connection time */
+  char *inbuf;             /* Received data not yet processed */
+  size_t inlen;            /* Bytes in input buffer */
+  size_t insize;           /* Size of input buffer */
+  char *outbuf;            /* Data queued for sending */
+  size_t outlen;           /* Bytes in output buffer */
+  size_t outpos;           /* Offset of next byte to send */
+  size_t outsize;          /* Size of output buffer */
+  int streaming;           /* Flag indicating streaming mode */
+  int closing;             /* Flag to close after sending queued data */
+  int64_t nextpktid;       /* ID of next packet to send when streaming */
+  int64_t lastpktid;       /* ID of last packet sent */
+  char *matchstr;          /* Match expression */
+  char *rejectstr;         /* Reject expression */
+  regex_t match;           /* Compiled match expression */
+  regex_t reject;          /* Compiled reject expression */
+  uint64_t txpackets;      /* Packets sent */
+  uint64_t txbytes;        /* Packet bytes sent */
+  uint64_t rxpackets;      /* Packets written */
+  uint64_t rxbytes;        /* Packet bytes written */
+  double txpacketrate;     /* Rates over the last rate interval */
+  double txbyterate;
+  double rxpacketrate;
+  double rxbyterate;
+  uint64_t lasttxpackets;  /* Counts at the start of the rate interval */
+  uint64_t lasttxbytes;
+  uint64_t lastrxpackets;
+  uint64_t lastrxbytes;
+  struct Client_s *next;
+} Client;
+
+/* A growable text buffer for INFO responses */
+typedef struct TextBuf_s
+{
+  char *buf;
+  size_t len;
+  size_t size;
+} TextBuf;
+
+static int verbose         = 0;       /* Verbosity level */
+static char *tcpport       = "16000"; /* TCP port to listen on */
+static char *unixpath      = NULL;    /* UNIX domain socket path */
+static int64_t ringsize    = 100000;  /* Ring capacity in packets */
+static int packetsize      = MAXPACKETSIZE; /* Maximum packet size */
+static double injectrate   = 0.0;     /* Injection rate in packets/second */
+static dltime_t latency    = 0;       /* Delivery latency */
+static char startearliest  = 0;       /* Position new clients at earliest packet */
+static char **files        = NULL;    /* Input files */
+static int filecount       = 0;       /* Count of input files */
+
+static volatile sig_atomic_t shutdownsig = 0;
+
+static RingPacket *ring    = NULL;    /* Ring of packets, indexed by (pktid - 1) % ringsize */
+static int64_t ringcount   = 0;       /* Packets in ring */
+static int64_t ringnext    = 1;       /* ID of next packet added to ring */
+static RingPacket *sources = NULL;    /* Packets read from input files */
+static int64_t sourcecount = 0;       /* Count of source packets */
+static Client *clients     = NULL;    /* Connected clients */
+static int clientcount     = 0;       /* Count of connected clients */
+static dltime_t starttime;            /* Server start time */
+
+static uint64_t txpackets = 0;        /* Server totals and rates */
+static uint64_t txbytes   = 0;
+static uint64_t rxpackets = 0;
+static uint64_t rxbytes   = 0;
+static double txpacketrate = 0.0;
+static double txbyterate   = 0.0;
+static double rxpacketrate = 0.0;
+static double rxbyterate   = 0.0;
+
+static int parameter_proc (int argcount, char **argvec);
+static char *getoptval (int argcount, char **argvec, int argopt);
+static int loadfile (const char *path);
+static int64_t ring_insert (const char *streamid, dltime_t datastart, dltime_t dataend,
+                            const char *data, int datasize);
+static RingPacket *ring_get (int64_t pktid);
+static int64_t ring_earliest (void);
+static int getstreams (StreamSummary **streams);
+static int openlisteners (int *listenfds);
+static void acceptclient (int listenfd);
+static void closeclient (Client *client);
+static int readclient (Client *client);
+static int flushclient (Client *client);
+static dltime_t feedclient (Client *client, dltime_t now);
+static int handlecommand (Client *client, char *header, char *data, int datasize);
+static int handleposition (Client *client, char *header);
+static int handleselect (Client *client, char *header, char *data, int datasize);
+static int handleinfo (Client *client, char *header);
+static int selected (Client *client, const char *streamid);
+static int queueresponse (Client *client, const char *header, const char *data, size_t datasize);
+static int queuereply (Client *client, const char *status, int64_t value, const char *format, ...);
+static int queuepacket (Client *client, RingPacket *packet);
+static void updaterates (double interval);
+static void textappend (TextBuf *tb, const char *format, ...);
+static void textescape (TextBuf *tb, const char *string);
+static char *timestr (dltime_t time, char *buffer);
+static void term_handler (int sig);
+static void usage (void);
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  struct pollfd *pollfds = NULL;
+  Client **pollclients   = NULL;
+  Client *client;
+  Client *nextclient;
+  int listenfds[MAXLISTEN];
+  int listencount;
+  int pollcount;
+  int pollsize = 0;
+  int timeout;
+  int idx;
+
+  int64_t injectstart = 0;
+  int64_t injected    = 0;
+  int64_t due;
+  int64_t ratetime;
+  int64_t nowns;
+  dltime_t now;
+  dltime_t wait;
+
+  /* Signal handling, use POSIX calls with standardized semantics */
+  sa.sa_flags = SA_RESTART;
+  sigemptyset (&sa.sa_mask);
+
+  sa.sa_handler = term_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGQUIT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGHUP, &sa, NULL);
+  sigaction (SIGPIPE, &sa, NULL);
+
+  /* Process given parameters (command line and parameter file) */
+  if (parameter_proc (argc, argv) < 0)
+  {
+    dl_log (2, 0, "Parameter processing failed\n\n");
+    dl_log (2, 0, "Try '-h' for detailed help\n");
+    return -1;
+  }
+
+  if (!(ring = (RingPacket *)calloc (ringsize, sizeof (RingPacket))))
+  {
+    dl_log (2, 0, "Cannot allocate ring of %lld packets\n", (long long int)ringsize);
+    return -1;
+  }
+
+  starttime = dlp_time ();
+
+  /* Read all records from input files */
+  for (idx = 0; idx < filecount; idx++)
+  {
+    if (loadfile (files[idx]))
+      return -1;
+  }
+
+  /* Without an injection rate all records are added to the ring immediately */
+  if (injectrate <= 0.0)
+  {
+    for (idx = 0; idx < sourcecount; idx++)
+      ring_insert (sources[idx].streamid, sources[idx].datastart, sources[idx].dataend,
+                   sources[idx].data, sources[idx].datasize);
+
+    dl_log (1, 1, "Ring preloaded with %lld packets\n", (long long int)ringcount);
+  }
+  else if (sourcecount == 0)
+  {
+    dl_log (2, 0, "An injection rate requires input files\n");
+    return -1;
+  }
+
+  if ((listencount = openlisteners (listenfds)) <= 0)
+    return -1;
+
+  dl_log (1, 0, "%s version %s accepting connections\n", PACKAGE, VERSION);
+
+  nowns = clock_ns ();
+  injectstart = nowns;
+  ratetime = nowns;
+
+  while (!shutdownsig)
+  {
+    now   = dlp_time ();
+    nowns = clock_ns ();
+
+    /* Inject source packets at the configured rate, not catching up more than 1 second */
+    if (injectrate > 0.0)
+    {
+      due = (int64_t)((nowns - injectstart) / 1e9 * injectrate);
+
+      if (due - injected > injectrate)
+        injected = due - (int64_t)injectrate;
+
+      for (; injected < due; injected++)
+      {
+        RingPacket *source = &sources[injected % sourcecount];
+
+        ring_insert (source->streamid, source->datastart, source->dataend,
+                     source->data, source->datasize);
+      }
+    }
+
+    if ((nowns - ratetime) >= 1000000000)
+    {
+      updaterates ((nowns - ratetime) / 1e9);
+      ratetime = nowns;
+    }
+
+    /* Queue packets for streaming clients, tracking the shortest latency wait */
+    timeout = 1000;
+
+    if (injectrate > 0.0)
+    {
+      wait = (int64_t)(injectstart + (injected + 1) * 1e9 / injectrate - nowns) / 1000000;
+      if (wait < timeout)
+        timeout = (wait > 0) ? (int)wait : 0;
+    }
+
+    for (client = clients; client; client = client->next)
+    {
+      if (client->streaming && (wait = feedclient (client, now)) > 0)
+      {
+        if (wait / 1000 < timeout)
+          timeout = (int)(wait / 1000) + 1;
+      }
+    }
+
+    /* Build poll list: listening sockets followed by clients */
+    if (pollsize < listencount + clientcount)
+    {
+      pollsize    = listencount + clientcount + 16;
+      pollfds     = (struct pollfd *)realloc (pollfds, pollsize * sizeof (struct pollfd));
+      pollclients = (Client **)realloc (pollclients, pollsize * sizeof (Client *));
+
+      if (!pollfds || !pollclients)
+      {
+        dl_log (2, 0, "Cannot allocate memory for poll list\n");
+        break;
+      }
+    }
+
+    for (pollcount = 0; pollcount < listencount; pollcount++)
+    {
+      pollfds[pollcount].fd      = listenfds[pollcount];
+      pollfds[pollcount].events  = POLLIN;
+      pollclients[pollcount]     = NULL;
+    }
+
+    for (client = clients; client; client = client->next, pollcount++)
+    {
+      pollfds[pollcount].fd     = client->fd;
+      pollfds[pollcount].events = 0;
+      pollclients[pollcount]    = client;
+
+      /* Stop reading commands from clients that are not reading responses */
+      if (!client->closing && (client->outlen - client->outpos) < STREAMQUEUE)
+        pollfds[pollcount].events |= POLLIN;
+
+      if (client->outlen > client->outpos)
+        pollfds[pollcount].events |= POLLOUT;
+    }
+
+    if (poll (pollfds, pollcount, timeout) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      dl_log (2, 0, "poll(): %s\n", strerror (errno));
+      break;
+    }
+
+    for (idx = 0; idx < pollcount; idx++)
+    {
+      if (!pollfds[idx].revents)
+        continue;
+
+      if (!pollclients[idx])
+      {
+        acceptclient (pollfds[idx].fd);
+        continue;
+      }
+
+      client = pollclients[idx];
+
+      if ((pollfds[idx].revents & (POLLIN | POLLHUP | POLLERR)) && readclient (client))
+        client->closing = 2;
+
+      if ((pollfds[idx].revents & POLLOUT) && client->closing < 2 && flushclient (client))
+        client->closing = 2;
+    }
+
+    /* Remove closed clients and those that have been sent all queued data */
+    for (client = clients; client; client = nextclient)
+    {
+      nextclient = client->next;
+
+      if (client->closing == 2 || (client->closing && client->outlen == client->outpos))
+        closeclient (client);
+    }
+  }
+
+  dl_log (1, 1, "Shutting down\n");
+
+  while (clients)
+    closeclient (clients);
+
+  for (idx = 0; idx < listencount; idx++)
+    close (listenfds[idx]);
+
+  if (unixpath)
+    unlink (unixpath);
+
+  for (idx = 0; idx < ringsize; idx++)
+    free (ring[idx].data);
+  free (ring);
+
+  for (idx = 0; idx < sourcecount; idx++)
+    free (sources[idx].data);
+  free (sources);
+
+  free (pollfds);
+  free (pollclients);
+  free (files);
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * loadfile:
+ *
+ * Read all miniSEED records from a file and add them to the source
+ * packets.  Records larger than the maximum packet size are skipped.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+loadfile (const char *path)
+{
+  MS3Record *msr = NULL;
+  RingPacket *newsources;
+  RingPacket *source;
+  int64_t count = 0;
+  int rv;
+
+  while ((rv = ms3_readmsr (&msr, path, MSF_SKIPNOTDATA, verbose)) == MS_NOERROR)
+  {
+    if (msr->reclen > packetsize)
+    {
+      dl_log (1, 1, "Skipping %d byte record of %s, larger than packet size\n",
+              msr->reclen, msr->sid);
+      continue;
+    }
+
+    if (!(sourcecount % 1024))
+    {
+      if (!(newsources = (RingPacket *)realloc (sources, (sourcecount + 1024) * sizeof (RingPacket))))
+      {
+        dl_log (2, 0, "Cannot allocate memory for records\n");
+        break;
+      }
+
+      sources = newsources;
+    }
+
+    source = &sources[sourcecount];
+    memset (source, 0, sizeof (RingPacket));
+
+    if (sid2streamid (msr->sid, msr->formatversion, source->streamid, sizeof (source->streamid)))
+    {
+      dl_log (1, 1, "Skipping record with unsupported source ID: %s\n", msr->sid);
+      continue;
+    }
+
+    if (!(source->data = (char *)malloc (msr->reclen)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for records\n");
+      break;
+    }
+
+    memcpy (source->data, msr->record, msr->reclen);
+    source->datasize  = msr->reclen;
+    source->datastart = msr->starttime / (NSTMODULUS / DLTMODULUS);
+    source->dataend   = msr3_endtime (msr) / (NSTMODULUS / DLTMODULUS);
+
+    sourcecount++;
+    count++;
+  }
+
+  /* Cleanup memory and close file */
+  ms3_readmsr (&msr, NULL, 0, 0);
+
+  if (rv != MS_ENDOFFILE)
+  {
+    dl_log (2, 0, "Cannot read %s: %s\n", path, ms_errorstr (rv));
+    return -1;
+  }
+
+  dl_log (1, 1, "Read %lld records from %s\n", (long long int)count, path);
+
+  return 0;
+} /* End of loadfile() */
+
+/***************************************************************************
+ * ring_insert:
+ *
+ * Add a packet to the ring, replacing the oldest packet if the ring
+ * is full.  The packet data are copied.
+ *
+ * Returns the packet ID on success and -1 on error.
+ ***************************************************************************/
+static int64_t
+ring_insert (const char *streamid, dltime_t datastart, dltime_t dataend,
+             const char *data, int datasize)
+{
+  RingPacket *packet = &ring[(ringnext - 1) % ringsize];
+  char *copy;
+
+  if (!(copy = (char *)malloc ((datasize > 0) ? datasize : 1)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for packet\n");
+    return -1;
+  }
+
+  memcpy (copy, data, datasize);
+
+  free (packet->data);
+  packet->data      = copy;
+  packet->datasize  = datasize;
+  packet->pktid     = ringnext++;
+  packet->pkttime   = dlp_time ();
+  packet->datastart = datastart;
+  packet->dataend   = dataend;
+  dl_strncpclean (packet->streamid, streamid, sizeof (packet->streamid) - 1);
+
+  if (ringcount < ringsize)
+    ringcount++;
+
+  rxpackets++;
+  rxbytes += datasize;
+
+  return packet->pktid;
+} /* End of ring_insert() */
+
+/***************************************************************************
+ * ring_get:
+ *
+ * Return the packet with the specified ID or NULL if not in the ring.
+ ***************************************************************************/
+static RingPacket *
+ring_get (int64_t pktid)
+{
+  if (pktid < ring_earliest () || pktid >= ringnext)
+    return NULL;
+
+  return &ring[(pktid - 1) % ringsize];
+}
+
+/***************************************************************************
+ * ring_earliest:
+ *
+ * Return the ID of the earliest packet in the ring, equal to the ID
+ * of the next packet if the ring is empty.
+ ***************************************************************************/
+static int64_t
+ring_earliest (void)
+{
+  return ringnext - ringcount;
+}
+
+/***************************************************************************
+ * getstreams:
+ *
+ * Build a list of the streams in the ring, sorted by stream ID, with
+ * their earliest and latest packets.  The list must be freed by the
+ * caller.
+ *
+ * Returns the number of streams on success and -1 on error.
+ ***************************************************************************/
+static int
+cmppackets (const void *a, const void *b)
+{
+  const RingPacket *pa = *(const RingPacket **)a;
+  const RingPacket *pb = *(const RingPacket **)b;
+  int cmp = strcmp (pa->streamid, pb->streamid);
+
+  if (cmp)
+    return cmp;
+
+  return (pa->pktid > pb->pktid) - (pa->pktid < pb->pktid);
+}
+
+static int
+getstreams (StreamSummary **streams)
+{
+  RingPacket **packets;
+  int64_t idx;
+  int count = 0;
+
+  *streams = NULL;
+
+  if (ringcount == 0)
+    return 0;
+
+  if (!(packets = (RingPacket **)malloc (ringcount * sizeof (RingPacket *))) ||
+      !(*streams = (StreamSummary *)malloc (ringcount * sizeof (StreamSummary))))
+  {
+    free (packets);
+    return -1;
+  }
+
+  for (idx = 0; idx < ringcount; idx++)
+    packets[idx] = ring_get (ring_earliest () + idx);
+
+  qsort (packets, ringcount, sizeof (RingPacket *), cmppackets);
+
+  for (idx = 0; idx < ringcount; idx++)
+  {
+    if (count == 0 || strcmp ((*streams)[count - 1].latest->streamid, packets[idx]->streamid))
+    {
+      (*streams)[count].earliest = packets[idx];
+      count++;
+    }
+
+    (*streams)[count - 1].latest = packets[idx];
+  }
+
+  free (packets);
+
+  return count;
+} /* End of getstreams() */
+
+/***************************************************************************
+ * openlisteners:
+ *
+ * Open the TCP and UNIX domain sockets to listen on.
+ *
+ * Returns the number of sockets opened, or -1 on error.
+ ***************************************************************************/
+static int
+openlisteners (int *listenfds)
+{
+  struct addrinfo hints;
+  struct addrinfo *addr0 = NULL;
+  struct addrinfo *addr;
+  struct sockaddr_un unaddr;
+  int count = 0;
+  int one   = 1;
+  int fd;
+
+  if (strcmp (tcpport, "0"))
+  {
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family   = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    if (getaddrinfo (NULL, tcpport, &hints, &addr0))
+    {
+      dl_log (2, 0, "Cannot resolve listening port %s\n", tcpport);
+      return -1;
+    }
+
+    for (addr = addr0; addr && count < MAXLISTEN - 1; addr = addr->ai_next)
+    {
+      if ((fd = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0)
+        continue;
+
+      setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+      if (addr->ai_family == AF_INET6)
+        setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof (one));
+
+      if (bind (fd, addr->ai_addr, addr->ai_addrlen) || listen (fd, 64) ||
+          fcntl (fd, F_SETFL, O_NONBLOCK))
+      {
+        dl_log (2, 0, "Cannot listen on port %s: %s\n", tcpport, strerror (errno));
+        close (fd);
+        continue;
+      }
+
+      listenfds[count++] = fd;
+    }
+
+    freeaddrinfo (addr0);
+
+    if (count == 0)
+      return -1;
+
+    dl_log (1, 1, "Listening on TCP port %s\n", tcpport);
+  }
+
+  if (unixpath)
+  {
+    if (strlen (unixpath) >= sizeof (unaddr.sun_path))
+    {
+      dl_log (2, 0, "Socket path too long: %s\n", unixpath);
+      return -1;
+    }
+
+    memset (&unaddr, 0, sizeof (unaddr));
+    unaddr.sun_family = AF_UNIX;
+    strcpy (unaddr.sun_path, unixpath);
+
+    /* Remove a socket left by a previous instance */
+    unlink (unixpath);
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind (fd, (struct sockaddr *)&unaddr, sizeof (unaddr)) || listen (fd, 64) ||
+        fcntl (fd, F_SETFL, O_NONBLOCK))
+    {
+      dl_log (2, 0, "Cannot listen on %s: %s\n", unixpath, strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return -1;
+    }
+
+    listenfds[count++] = fd;
+
+    dl_log (1, 1, "Listening on UNIX domain socket %s\n", unixpath);
+  }
+
+  if (count == 0)
+    dl_log (2, 0, "No TCP port or UNIX domain socket to listen on\n");
+
+  return count;
+} /* End of openlisteners() */
+
+/***************************************************************************
+ * acceptclient:
+ *
+ * Accept a connection on a listening socket and add a client.
+ ***************************************************************************/
+static void
+acceptclient (int listenfd)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof (addr);
+  Client *client;
+  int one = 1;
+  int fd;
+
+  if ((fd = accept (listenfd, (struct sockaddr *)&addr, &addrlen)) < 0)
+  {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      dl_log (2, 0, "accept(): %s\n", strerror (errno));
+    return;
+  }
+
+  if (!(client = (Client *)calloc (1, sizeof (Client))) ||
+      !(client->inbuf = (char *)malloc (2 * (MAXPACKETSIZE + 258))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for client\n");
+    free (client);
+    close (fd);
+    return;
+  }
+
+  fcntl (fd, F_SETFL, O_NONBLOCK);
+
+  client->fd        = fd;
+  client->insize    = 2 * (MAXPACKETSIZE + 258);
+  client->conntime  = dlp_time ();
+  client->nextpktid = (startearliest) ? ring_earliest () : ringnext;
+  client->lastpktid = -1;
+
+  if (addr.ss_family == AF_UNIX)
+  {
+    strcpy (client->ip, "localhost");
+    strcpy (client->port, "unix");
+  }
+  else
+  {
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    getnameinfo ((struct sockaddr *)&addr, addrlen, client->ip, sizeof (client->ip),
+                 client->port, sizeof (client->port), NI_NUMERICHOST | NI_NUMERICSERV);
+  }
+
+  client->next = clients;
+  clients      = client;
+  clientcount++;
+
+  dl_log (1, 1, "Client connected from %s:%s\n", client->ip, client->port);
+} /* End of acceptclient() */
+
+/***************************************************************************
+ * closeclient:
+ *
+ * Close a client connection and remove it from the client list.
+ ***************************************************************************/
+static void
+closeclient (Client *client)
+{
+  Client **link;
+
+  for (link = &clients; *link; link = &(*link)->next)
+  {
+    if (*link == client)
+    {
+      *link = client->next;
+      break;
+    }
+  }
+
+  dl_log (1, 1, "Client %s:%s disconnected\n", client->ip, client->port);
+
+  close (client->fd);
+
+  if (client->matchstr)
+  {
+    regfree (&client->match);
+    free (client->matchstr);
+  }
+
+  if (client->rejectstr)
+  {
+    regfree (&client->reject);
+    free (client->rejectstr);
+  }
+
+  free (client->inbuf);
+  free (client->outbuf);
+  free (client);
+  clientcount--;
+} /* End of closeclient() */
+
+/***************************************************************************
+ * readclient:
+ *
+ * Read available data from a client and process all complete
+ * commands.  Each command is a "DL" preheader, a header length byte,
+ * the header and any data indicated by the header.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+readclient (Client *client)
+{
+  char header[256];
+  char *tail;
+  size_t offset = 0;
+  size_t headerlen;
+  int64_t datasize;
+  ssize_t nrecv;
+
+  nrecv = recv (client->fd, client->inbuf + client->inlen, client->insize - client->inlen, 0);
+
+  if (nrecv == 0)
+    return -1;
+
+  if (nrecv < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+  client->inlen += nrecv;
+
+  while (!client->closing && client->inlen - offset >= 3)
+  {
+    if (client->inbuf[offset] != 'D' || client->inbuf[offset + 1] != 'L')
+    {
+      dl_log (2, 0, "Client %s:%s sent invalid preheader\n", client->ip, client->port);
+      return -1;
+    }
+
+    headerlen = (uint8_t)client->inbuf[offset + 2];
+
+    if (client->inlen - offset < 3 + headerlen)
+      break;
+
+    memcpy (header, client->inbuf + offset + 3, headerlen);
+    header[headerlen] = '\0';
+
+    /* Determine size of data following the header */
+    datasize = 0;
+    if (!strncmp (header, "WRITE ", 6) && (tail = strrchr (header, ' ')))
+      datasize = strtoll (tail + 1, NULL, 10);
+    else if (!strncmp (header, "MATCH ", 6) || !strncmp (header, "REJECT ", 7))
+      datasize = strtoll (strchr (header, ' ') + 1, NULL, 10);
+
+    if (datasize < 0 || datasize > MAXPACKETSIZE)
+    {
+      queuereply (client, "ERROR", 0, "Data size %lld is not supported", (long long int)datasize);
+      client->closing = 1;
+      break;
+    }
+
+    if (client->inlen - offset < 3 + headerlen + datasize)
+      break;
+
+    if (handlecommand (client, header, client->inbuf + offset + 3 + headerlen, (int)datasize))
+      return -1;
+
+    offset += 3 + headerlen + datasize;
+  }
+
+  /* Shift remaining partial command to the beginning of the buffer */
+  if (offset > 0)
+  {
+    memmove (client->inbuf, client->inbuf + offset, client->inlen - offset);
+    client->inlen -= offset;
+  }
+
+  return 0;
+} /* End of readclient() */
+
+/***************************************************************************
+ * flushclient:
+ *
+ * Send as much queued data to a client as the socket accepts.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+flushclient (Client *client)
+{
+  ssize_t nsent;
+
+  while (client->outpos < client->outlen)
+  {
+    nsent = send (client->fd, client->outbuf + client->outpos,
+                  client->outlen - client->outpos, 0);
+
+    if (nsent < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    client->outpos += nsent;
+  }
+
+  client->outpos = 0;
+  client->outlen = 0;
+
+  return 0;
+} /* End of flushclient() */
+
+/***************************************************************************
+ * feedclient:
+ *
+ * Queue packets for a streaming client until its queue is full or it
+ * has been sent all available packets.  Packets are not sent until
+ * the delivery latency has passed since they were added to the ring.
+ *
+ * Returns the time to wait until the next packet may be sent when
+ * limited by latency, otherwise 0.
+ ***************************************************************************/
+static dltime_t
+feedclient (Client *client, dltime_t now)
+{
+  RingPacket *packet;
+  int scanned = 0;
+
+  /* Skip packets that were replaced before they could be sent */
+  if (client->nextpktid < ring_earliest ())
+    client->nextpktid = ring_earliest ();
+
+  while (client->nextpktid < ringnext && scanned < 10000 &&
+         (client->outlen - client->outpos) < STREAMQUEUE)
+  {
+    packet = ring_get (client->nextpktid);
+
+    if (latency && packet->pkttime + latency > now)
+      return packet->pkttime + latency - now;
+
+    client->nextpktid++;
+    scanned++;
+
+    if (selected (client, packet->streamid))
+      queuepacket (client, packet);
+  }
+
+  return 0;
+} /* End of feedclient() */
+
+/***************************************************************************
+ * handlecommand:
+ *
+ * Process a command from a client.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+handlecommand (Client *client, char *header, char *data, int datasize)
+{
+  char streamid[MAXSTREAMID];
+  char flags[16];
+  long long int datastart;
+  long long int dataend;
+  long long int pktid;
+  RingPacket *packet;
+  char response[255];
+
+  dl_log (1, 3, "Client %s:%s command: %s\n", client->ip, client->port, header);
+
+  if (!strncmp (header, "ID", 2))
+  {
+    if (header[2] == ' ')
+      dl_strncpclean (client->clientid, header + 3, sizeof (client->clientid) - 1);
+
+    snprintf (response, sizeof (response), "ID DataLink %s :: DLPROTO:1.0 PACKETSIZE:%d WRITE",
+              VERSION, packetsize);
+
+    return queueresponse (client, response, NULL, 0);
+  }
+  else if (!strncmp (header, "POSITION ", 9))
+  {
+    return handleposition (client, header);
+  }
+  else if (!strncmp (header, "MATCH ", 6) || !strncmp (header, "REJECT ", 7))
+  {
+    return handleselect (client, header, data, datasize);
+  }
+  else if (!strncmp (header, "READ ", 5))
+  {
+    pktid = strtoll (header + 5, NULL, 10);
+
+    if ((packet = ring_get (pktid)))
+      return queuepacket (client, packet);
+
+    return queuereply (client, "ERROR", 0, "Packet %lld not found", pktid);
+  }
+  else if (!strcmp (header, "STREAM"))
+  {
+    client->streaming = 1;
+  }
+  else if (!strcmp (header, "ENDSTREAM"))
+  {
+    client->streaming = 0;
+
+    return queueresponse (client, "ENDSTREAM", NULL, 0);
+  }
+  else if (!strncmp (header, "WRITE ", 6))
+  {
+    if (sscanf (header, "WRITE %59s %lld %lld %15s", streamid, &datastart, &dataend, flags) != 4)
+      return queuereply (client, "ERROR", 0, "Cannot parse WRITE command");
+
+    if (datasize > packetsize)
+      return queuereply (client, "ERROR", 0, "Packet size %d exceeds maximum of %d",
+                         datasize, packetsize);
+
+    if ((pktid = ring_insert (streamid, datastart, dataend, data, datasize)) < 0)
+      return queuereply (client, "ERROR", 0, "Cannot add packet to ring");
+
+    client->rxpackets++;
+    client->rxbytes += datasize;
+
+    if (strchr (flags, 'A'))
+      return queuereply (client, "OK", pktid, NULL);
+  }
+  else if (!strncmp (header, "INFO ", 5))
+  {
+    return handleinfo (client, header);
+  }
+  else
+  {
+    return queuereply (client, "ERROR", 0, "Unrecognized command");
+  }
+
+  return 0;
+} /* End of handlecommand() */
+
+/***************************************************************************
+ * handleposition:
+ *
+ * Process a POSITION command, setting the next packet to send.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+handleposition (Client *client, char *header)
+{
+  char position[32];
+  long long int pktid;
+  long long int pkttime = 0;
+  long long int datatime;
+  RingPacket *packet;
+  int64_t idx;
+
+  if (sscanf (header, "POSITION SET %31s %lld", position, &pkttime) >= 1)
+  {
+    if (!strcmp (position, "EARLIEST"))
+    {
+      client->nextpktid = ring_earliest ();
+    }
+    else if (!strcmp (position, "LATEST"))
+    {
+      client->nextpktid = (ringcount > 0) ? ringnext - 1 : ringnext;
+    }
+    else
+    {
+      pktid = strtoll (position, NULL, 10);
+
+      /* Clients without a packet time send 0 or DLTERROR, checked only when given */
+      if (!(packet = ring_get (pktid)) ||
+          (pkttime && pkttime != DLTERROR && packet->pkttime != pkttime))
+        return queuereply (client, "ERROR", 0, "Packet %lld not found", pktid);
+
+      /* Streaming continues after the positioned packet */
+      client->nextpktid = pktid + 1;
+
+      return queuereply (client, "OK", pktid, "Positioned to packet ID %lld", pktid);
+    }
+
+    return queuereply (client, "OK", client->nextpktid, "Positioned to packet ID %lld",
+                       (long long int)client->nextpktid);
+  }
+  else if (sscanf (header, "POSITION AFTER %lld", &datatime) == 1)
+  {
+    for (idx = ring_earliest (); idx < ringnext; idx++)
+    {
+      packet = ring_get (idx);
+
+      if (packet->dataend > datatime)
+      {
+        client->nextpktid = idx;
+
+        return queuereply (client, "OK", idx, "Positioned to packet ID %lld", (long long int)idx);
+      }
+    }
+
+    return queuereply (client, "ERROR", 0, "No packet with data after %lld", datatime);
+  }
+
+  return queuereply (client, "ERROR", 0, "Cannot parse POSITION command");
+} /* End of handleposition() */
+
+/***************************************************************************
+ * handleselect:
+ *
+ * Process a MATCH or REJECT command, replacing the client's match or
+ * reject expression.  An empty expression removes it.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+handleselect (Client *client, char *header, char *data, int datasize)
+{
+  StreamSummary *streams = NULL;
+  int ismatch            = (header[0] == 'M');
+  regex_t *regex         = (ismatch) ? &client->match : &client->reject;
+  char **regexstr        = (ismatch) ? &client->matchstr : &client->rejectstr;
+  char *pattern;
+  int streamcount;
+  int count = 0;
+  int idx;
+
+  if (*regexstr)
+  {
+    regfree (regex);
+    free (*regexstr);
+    *regexstr = NULL;
+  }
+
+  if (datasize > 0)
+  {
+    if (!(pattern = (char *)malloc (datasize + 1)))
+      return -1;
+
+    memcpy (pattern, data, datasize);
+    pattern[datasize] = '\0';
+
+    if (regcomp (regex, pattern, REG_EXTENDED | REG_NOSUB))
+    {
+      free (pattern);
+      return queuereply (client, "ERROR", 0, "Invalid %s expression", (ismatch) ? "match" : "reject");
+    }
+
+    *regexstr = pattern;
+  }
+
+  if ((streamcount = getstreams (&streams)) < 0)
+    return -1;
+
+  for (idx = 0; idx < streamcount; idx++)
+  {
+    if (selected (client, streams[idx].latest->streamid))
+      count++;
+  }
+
+  free (streams);
+
+  return queuereply (client, "OK", count, "%d streams selected after %s",
+                     count, (ismatch) ? "match" : "reject");
+} /* End of handleselect() */
+
+/***************************************************************************
+ * handleinfo:
+ *
+ * Process an INFO command, responding with an XML document for the
+ * STATUS, STREAMS or CONNECTIONS type.  An optional expression
+ * following the type limits the streams or connections listed.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+handleinfo (Client *client, char *header)
+{
+  TextBuf tb = {NULL, 0, 0};
+  StreamSummary *streams = NULL;
+  RingPacket *earliest;
+  RingPacket *latest;
+  RingPacket *packet;
+  Client *cl;
+  regex_t infomatch;
+  char *match = NULL;
+  char type[32];
+  char response[255];
+  char ts1[32], ts2[32], ts3[32], ts4[32];
+  int streamcount;
+  int selectcount;
+  int clientstreams;
+  int idx;
+  int rv;
+  dltime_t now = dlp_time ();
+
+  if (sscanf (header, "INFO %31s", type) != 1)
+    return queuereply (client, "ERROR", 0, "Cannot parse INFO command");
+
+  if (strcmp (type, "STATUS") && strcmp (type, "STREAMS") && strcmp (type, "CONNECTIONS"))
+    return queuereply (client, "ERROR", 0, "Unrecognized INFO type: %s", type);
+
+  /* Optional match expression following the type */
+  match = header + 5 + strlen (type);
+  while (*match == ' ')
+    match++;
+
+  if (*match == '\0')
+    match = NULL;
+  else if (regcomp (&infomatch, match, REG_EXTENDED | REG_NOSUB))
+    return queuereply (client, "ERROR", 0, "Invalid INFO match expression");
+
+  if ((streamcount = getstreams (&streams)) < 0)
+  {
+    if (match)
+      regfree (&infomatch);
+    return -1;
+  }
+
+  earliest = ring_get (ring_earliest ());
+  latest   = ring_get (ringnext - 1);
+
+  textappend (&tb, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+  textappend (&tb, "<DataLink Version=\"%s\" ServerID=\"%s\" Capabilities=\"DLPROTO:1.0 PACKETSIZE:%d WRITE\">\n",
+              VERSION, PACKAGE, packetsize);
+
+  textappend (&tb, "<Status StartTime=\"%s\" RingVersion=\"1\" RingSize=\"%lld\" PacketSize=\"%d\""
+                   " MaximumPacketID=\"%lld\" MaximumPackets=\"%lld\" MemoryMappedRing=\"FALSE\""
+                   " VolatileRing=\"TRUE\" TotalConnections=\"%d\" TotalStreams=\"%d\""
+                   " TXPacketRate=\"%.1f\" TXByteRate=\"%.1f\" RXPacketRate=\"%.1f\" RXByteRate=\"%.1f\"",
+              timestr (starttime, ts1), (long long int)ringsize * packetsize, packetsize,
+              (long long int)INT64_MAX, (long long int)ringsize, clientcount, streamcount,
+              txpacketrate, txbyterate, rxpacketrate, rxbyterate);
+
+  textappend (&tb, " EarliestPacketID=\"%lld\" EarliestPacketCreationTime=\"%s\""
+                   " EarliestPacketDataStartTime=\"%s\" EarliestPacketDataEndTime=\"%s\"",
+              (earliest) ? (long long int)earliest->pktid : -1LL,
+              timestr ((earliest) ? earliest->pkttime : 0, ts1),
+              timestr ((earliest) ? earliest->datastart : 0, ts2),
+              timestr ((earliest) ? earliest->dataend : 0, ts3));
+
+  textappend (&tb, " LatestPacketID=\"%lld\" LatestPacketCreationTime=\"%s\""
+                   " LatestPacketDataStartTime=\"%s\" LatestPacketDataEndTime=\"%s\" />\n",
+              (latest) ? (long long int)latest->pktid : -1LL,
+              timestr ((latest) ? latest->pkttime : 0, ts1),
+              timestr ((latest) ? latest->datastart : 0, ts2),
+              timestr ((latest) ? latest->dataend : 0, ts3));
+
+  if (!strcmp (type, "STREAMS"))
+  {
+    selectcount = 0;
+    for (idx = 0; idx < streamcount; idx++)
+    {
+      if (!match || !regexec (&infomatch, streams[idx].latest->streamid, 0, NULL, 0))
+        selectcount++;
+    }
+
+    textappend (&tb, "<StreamList TotalStreams=\"%d\" SelectedStreams=\"%d\">\n",
+                streamcount, selectcount);
+
+    for (idx = 0; idx < streamcount; idx++)
+    {
+      if (match && regexec (&infomatch, streams[idx].latest->streamid, 0, NULL, 0))
+        continue;
+
+      textappend (&tb, "<Stream Name=\"");
+      textescape (&tb, streams[idx].latest->streamid);
+      textappend (&tb, "\" EarliestPacketID=\"%lld\" EarliestPacketDataStartTime=\"%s\""
+                       " EarliestPacketDataEndTime=\"%s\" LatestPacketID=\"%lld\""
+                       " LatestPacketDataStartTime=\"%s\" LatestPacketDataEndTime=\"%s\""
+                       " DataLatency=\"%.1f\" />\n",
+                  (long long int)streams[idx].earliest->pktid,
+                  timestr (streams[idx].earliest->datastart, ts1),
+                  timestr (streams[idx].earliest->dataend, ts2),
+                  (long long int)streams[idx].latest->pktid,
+                  timestr (streams[idx].latest->datastart, ts3),
+                  timestr (streams[idx].latest->dataend, ts4),
+                  (double)(now - streams[idx].latest->dataend) / DLTMODULUS);
+    }
+
+    textappend (&tb, "</StreamList>\n");
+  }
+  else if (!strcmp (type, "CONNECTIONS"))
+  {
+    selectcount = 0;
+    for (cl = clients; cl; cl = cl->next)
+    {
+      if (!match || !regexec (&infomatch, cl->clientid, 0, NULL, 0) ||
+          !regexec (&infomatch, cl->ip, 0, NULL, 0))
+        selectcount++;
+    }
+
+    textappend (&tb, "<ConnectionList TotalConnections=\"%d\" SelectedConnections=\"%d\">\n",
+                clientcount, selectcount);
+
+    for (cl = clients; cl; cl = cl->next)
+    {
+      if (match && regexec (&infomatch, cl->clientid, 0, NULL, 0) &&
+          regexec (&infomatch, cl->ip, 0, NULL, 0))
+        continue;
+
+      clientstreams = 0;
+      for (idx = 0; idx < streamcount; idx++)
+      {
+        if (selected (cl, streams[idx].latest->streamid))
+          clientstreams++;
+      }
+
+      packet = ring_get (cl->lastpktid);
+
+      textappend (&tb, "<Connection Type=\"DataLink\" Host=\"%s\" IP=\"%s\" Port=\"%s\" ClientID=\"",
+                  cl->ip, cl->ip, cl->port);
+      textescape (&tb, cl->clientid);
+      textappend (&tb, "\" ConnectionTime=\"%s\" Match=\"", timestr (cl->conntime, ts1));
+      textescape (&tb, (cl->matchstr) ? cl->matchstr : "");
+      textappend (&tb, "\" Reject=\"");
+      textescape (&tb, (cl->rejectstr) ? cl->rejectstr : "");
+      textappend (&tb, "\" StreamCount=\"%d\" PacketID=\"%lld\" PacketCreationTime=\"%s\""
+                       " PacketDataStartTime=\"%s\" PacketDataEndTime=\"%s\"",
+                  clientstreams, (long long int)cl->lastpktid,
+                  timestr ((packet) ? packet->pkttime : 0, ts1),
+                  timestr ((packet) ? packet->datastart : 0, ts2),
+                  timestr ((packet) ? packet->dataend : 0, ts3));
+      textappend (&tb, " TXPacketCount=\"%llu\" TXPacketRate=\"%.1f\" TXByteCount=\"%llu\""
+                       " TXByteRate=\"%.1f\" RXPacketCount=\"%llu\" RXPacketRate=\"%.1f\""
+                       " RXByteCount=\"%llu\" RXByteRate=\"%.1f\" Latency=\"%.1f\" PercentLag=\"%d\" />\n",
+                  (unsigned long long int)cl->txpackets, cl->txpacketrate,
+                  (unsigned long long int)cl->txbytes, cl->txbyterate,
+                  (unsigned long long int)cl->rxpackets, cl->rxpacketrate,
+                  (unsigned long long int)cl->rxbytes, cl->rxbyterate,
+                  (packet) ? (double)(now - packet->pkttime) / DLTMODULUS : 0.0,
+                  (cl->streaming && ringcount > 0 && cl->nextpktid < ringnext)
+                      ? (int)(100 * (ringnext - cl->nextpktid) / ringcount)
+                      : 0);
+    }
+
+    textappend (&tb, "</ConnectionList>\n");
+  }
+
+  textappend (&tb, "</DataLink>\n");
+
+  free (streams);
+
+  if (match)
+    regfree (&infomatch);
+
+  if (!tb.buf)
+    return -1;
+
+  snprintf (response, sizeof (response), "INFO %s %zu", type, tb.len);
+  rv = queueresponse (client, response, tb.buf, tb.len);
+
+  free (tb.buf);
+
+  return rv;
+} /* End of handleinfo() */
+
+/***************************************************************************
+ * selected:
+ *
+ * Check a stream ID against the match and reject expressions of a
+ * client.
+ *
+ * Returns 1 if the stream is selected and 0 if not.
+ ***************************************************************************/
+static int
+selected (Client *client, const char *streamid)
+{
+  if (client->matchstr && regexec (&client->match, streamid, 0, NULL, 0))
+    return 0;
+
+  if (client->rejectstr && !regexec (&client->reject, streamid, 0, NULL, 0))
+    return 0;
+
+  return 1;
+}
+
+/***************************************************************************
+ * queueresponse:
+ *
+ * Queue a header and optional data for sending to a client.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+queueresponse (Client *client, const char *header, const char *data, size_t datasize)
+{
+  size_t headerlen = strlen (header);
+  size_t needed    = 3 + headerlen + datasize;
+  size_t newsize;
+  char *newbuf;
+
+  if (headerlen > 255)
+  {
+    dl_log (2, 0, "Response header too long: %s\n", header);
+    return -1;
+  }
+
+  /* Reclaim space of data already sent */
+  if (client->outpos > 0 && client->outlen + needed > client->outsize)
+  {
+    memmove (client->outbuf, client->outbuf + client->outpos, client->outlen - client->outpos);
+    client->outlen -= client->outpos;
+    client->outpos = 0;
+  }
+
+  if (client->outlen + needed > client->outsize)
+  {
+    newsize = (client->outsize) ? client->outsize * 2 : 65536;
+    while (newsize < client->outlen + needed)
+      newsize *= 2;
+
+    if (!(newbuf = (char *)realloc (client->outbuf, newsize)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for client output\n");
+      return -1;
+    }
+
+    client->outbuf  = newbuf;
+    client->outsize = newsize;
+  }
+
+  client->outbuf[client->outlen]     = 'D';
+  client->outbuf[client->outlen + 1] = 'L';
+  client->outbuf[client->outlen + 2] = (char)headerlen;
+  memcpy (client->outbuf + client->outlen + 3, header, headerlen);
+
+  if (datasize > 0)
+    memcpy (client->outbuf + client->outlen + 3 + headerlen, data, datasize);
+
+  client->outlen += needed;
+
+  return 0;
+} /* End of queueresponse() */
+
+/***************************************************************************
+ * queuereply:
+ *
+ * Queue an "OK|ERROR value size" reply with an optional message.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+queuereply (Client *client, const char *status, int64_t value, const char *format, ...)
+{
+  char message[200] = "";
+  char header[255];
+  va_list argptr;
+  int length = 0;
+
+  if (format)
+  {
+    va_start (argptr, format);
+    length = vsnprintf (message, sizeof (message), format, argptr);
+    va_end (argptr);
+
+    if (length >= (int)sizeof (message))
+      length = sizeof (message) - 1;
+  }
+
+  snprintf (header, sizeof (header), "%s %lld %d", status, (long long int)value, length);
+
+  return queueresponse (client, header, message, length);
+} /* End of queuereply() */
+
+/***************************************************************************
+ * queuepacket:
+ *
+ * Queue a PACKET response with packet data for a client.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+queuepacket (Client *client, RingPacket *packet)
+{
+  char header[255];
+
+  snprintf (header, sizeof (header), "PACKET %s %lld %lld %lld %lld %d",
+            packet->streamid, (long long int)packet->pktid, (long long int)packet->pkttime,
+            (long long int)packet->datastart, (long long int)packet->dataend, packet->datasize);
+
+  client->lastpktid = packet->pktid;
+  client->txpackets++;
+  client->txbytes += packet->datasize;
+  txpackets++;
+  txbytes += packet->datasize;
+
+  return queueresponse (client, header, packet->data, packet->datasize);
+} /* End of queuepacket() */
+
+/***************************************************************************
+ * updaterates:
+ *
+ * Update the server and client transfer rates from the counts
+ * accumulated over the interval in seconds.
+ ***************************************************************************/
+static void
+updaterates (double interval)
+{
+  static uint64_t lasttxpackets = 0;
+  static uint64_t lasttxbytes   = 0;
+  static uint64_t lastrxpackets = 0;
+  static uint64_t lastrxbytes   = 0;
+  Client *client;
+
+  txpacketrate  = (txpackets - lasttxpackets) / interval;
+  txbyterate    = (txbytes - lasttxbytes) / interval;
+  rxpacketrate  = (rxpackets - lastrxpackets) / interval;
+  rxbyterate    = (rxbytes - lastrxbytes) / interval;
+  lasttxpackets = txpackets;
+  lasttxbytes   = txbytes;
+  lastrxpackets = rxpackets;
+  lastrxbytes   = rxbytes;
+
+  for (client = clients; client; client = client->next)
+  {
+    client->txpacketrate  = (client->txpackets - client->lasttxpackets) / interval;
+    client->txbyterate    = (client->txbytes - client->lasttxbytes) / interval;
+    client->rxpacketrate  = (client->rxpackets - client->lastrxpackets) / interval;
+    client->rxbyterate    = (client->rxbytes - client->lastrxbytes) / interval;
+    client->lasttxpackets = client->txpackets;
+    client->lasttxbytes   = client->txbytes;
+    client->lastrxpackets = client->rxpackets;
+    client->lastrxbytes   = client->rxbytes;
+  }
+} /* End of updaterates() */
+
+/***************************************************************************
+ * textappend:
+ *
+ * Append formatted text to a text buffer.  On allocation failure the
+ * buffer is freed and further appends are ignored.
+ ***************************************************************************/
+static void
+textappend (TextBuf *tb, const char *format, ...)
+{
+  va_list argptr;
+  size_t newsize;
+  char *newbuf;
+  int length;
+
+  if (tb->size && !tb->buf)
+    return;
+
+  va_start (argptr, format);
+  length = vsnprintf (NULL, 0, format, argptr);
+  va_end (argptr);
+
+  if (tb->len + length + 1 > tb->size)
+  {
+    newsize = (tb->size) ? tb->size : 4096;
+    while (newsize < tb->len + length + 1)
+      newsize *= 2;
+
+    if (!(newbuf = (char *)realloc (tb->buf, newsize)))
+    {
+      free (tb->buf);
+      tb->buf = NULL;
+      return;
+    }
+
+    tb->buf  = newbuf;
+    tb->size = newsize;
+  }
+
+  va_start (argptr, format);
+  vsnprintf (tb->buf + tb->len, tb->size - tb->len, format, argptr);
+  va_end (argptr);
+
+  tb->len += length;
+} /* End of textappend() */
+
+/***************************************************************************
+ * textescape:
+ *
+ * Append a string to a text buffer, escaping XML special characters.
+ ***************************************************************************/
+static void
+textescape (TextBuf *tb, const char *string)
+{
+  const char *cp;
+
+  for (cp = string; *cp; cp++)
+  {
+    switch (*cp)
+    {
+    case '&':
+      textappend (tb, "&amp;");
+      break;
+    case '<':
+      textappend (tb, "&lt;");
+      break;
+    case '>':
+      textappend (tb, "&gt;");
+      break;
+    case '"':
+      textappend (tb, "&quot;");
+      break;
+    default:
+      textappend (tb, "%c", *cp);
+    }
+  }
+} /* End of textescape() */
+
+/***************************************************************************
+ * timestr:
+ *
+ * Format a time as "YYYY-MM-DD HH:MM:SS.FFFFFF", or as "-" if the
+ * time is not set.  The buffer must be at least 27 bytes.
+ ***************************************************************************/
+static char *
+timestr (dltime_t time, char *buffer)
+{
+  if (time == 0)
+    strcpy (buffer, "-");
+  else
+    dl_dltime2mdtimestr (time, buffer, 1);
+
+  return buffer;
+}
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  if (!(files = (char **)malloc (argcount * sizeof (char *))))
+    return -1;
+
+  /* Process all command line arguments */
+  for (optind = 1; optind < argcount; optind++)
+  {
+    if (strcmp (argvec[optind], "-V") == 0)
+    {
+      fprintf (stderr, "%s version: %s\n", PACKAGE, VERSION);
+      exit (0);
+    }
+    else if (strcmp (argvec[optind], "-h") == 0)
+    {
+      usage ();
+      exit (0);
+    }
+    else if (strncmp (argvec[optind], "-v", 2) == 0)
+    {
+      verbose += strspn (&argvec[optind][1], "v");
+    }
+    else if (strcmp (argvec[optind], "-p") == 0)
+    {
+      tcpport = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "-u") == 0)
+    {
+      unixpath = getoptval (argcount, argvec, optind++);
+    }
+    else if (strcmp (argvec[optind], "-R") == 0)
+    {
+      ringsize = strtoll (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "-P") == 0)
+    {
+      packetsize = strtol (getoptval (argcount, argvec, optind++), NULL, 10);
+    }
+    else if (strcmp (argvec[optind], "-r") == 0)
+    {
+      injectrate = strtod (getoptval (argcount, argvec, optind++), NULL);
+    }
+    else if (strcmp (argvec[optind], "-L") == 0)
+    {
+      latency = (dltime_t)(strtod (getoptval (argcount, argvec, optind++), NULL) * DLTMODULUS);
+    }
+    else if (strcmp (argvec[optind], "-E") == 0)
+    {
+      startearliest = 1;
+    }
+    else if (strncmp (argvec[optind], "-", 1) == 0)
+    {
+      fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+      exit (1);
+    }
+    else
+    {
+      files[filecount++] = argvec[optind];
+    }
+  }
+
+  /* Initialize the verbosity for the dl_log function */
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+
+  if (ringsize <= 0)
+  {
+    dl_log (2, 0, "Invalid ring size: %lld\n", (long long int)ringsize);
+    return -1;
+  }
+
+  if (packetsize <= 0 || packetsize > MAXPACKETSIZE)
+  {
+    dl_log (2, 0, "Packet size must be between 1 and %d\n", MAXPACKETSIZE);
+    return -1;
+  }
+
+  if (latency < 0 || injectrate < 0.0)
+  {
+    dl_log (2, 0, "Latency and injection rate cannot be negative\n");
+    return -1;
+  }
+
+  /* Report the program version */
+  dl_log (1, 1, "%s version: %s\n", PACKAGE, VERSION);
+
+  return 0;
+} /* End of parameter_proc() */
+
+/***************************************************************************
+ * getoptval:
+ * Return the value to a command line option; checking that the value is
+ * itself not an option (starting with '-') and is not past the end of
+ * the argument list.
+ *
+ * argcount: total arguments in argvec
+ * argvec: argument list
+ * argopt: index of option to process, value is expected to be at +1
+ *
+ * Returns value on success and exits with error message on failure
+ ***************************************************************************/
+static char *
+getoptval (int argcount, char **argvec, int argopt)
+{
+  if (argvec == NULL || argvec[argopt] == NULL)
+  {
+    fprintf (stderr, "getoptval(): NULL option requested\n");
+    exit (1);
+  }
+
+  if ((argopt + 1) < argcount && *argvec[argopt + 1] != '-')
+    return argvec[argopt + 1];
+
+  fprintf (stderr, "Option %s requires a value\n", argvec[argopt]);
+  exit (1);
+
+  return NULL; /* To stop compiler warnings about no return */
+} /* End of getoptval() */
+
+/***************************************************************************
+ * term_handler:
+ * Signal handler routine.
+ ***************************************************************************/
+static void
+term_handler (int sig)
+{
+  shutdownsig = 1;
+}
+
+/***************************************************************************
+ * usage:
+ * Print the usage message and exit.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "%s version %s\n\n", PACKAGE, VERSION);
+  fprintf (stderr, "Usage: %s [options] [file1] [file2] ...\n\n", PACKAGE);
+  fprintf (stderr,
+           " ## General program options ##\n"
+           " -V              report program version\n"
+           " -h              show this usage message\n"
+           " -v              be more verbose, multiple flags can be used\n"
+           " -p port         TCP port to listen on, default 16000, 0 to disable\n"
+           " -u path         UNIX domain socket path to listen on\n"
+           "\n"
+           " ## Ring and data options ##\n"
+           " -R packets      ring capacity in packets, default 100000\n"
+           " -P size         maximum packet size in bytes, default %d\n"
+           " -r rate         inject file records into the ring at this rate (packets/s),\n"
+           "                   looping over the files, default is to preload all records\n"
+           " -L latency      delay delivery to streaming clients by latency seconds\n"
+           " -E              start new connections at the earliest packet in the ring,\n"
+           "                   default is the next new packet\n"
+           "\n"
+           " [file1] ...     miniSEED files to serve\n"
+           "\n",
+           MAXPACKETSIZE);
+} /* End of usage() */
@@ -0,0 +1,934 @@
+/***************************************************************************
+ * export.c
+ *
+ * Routines for exporting decoded samples from received miniSEED
+ * packets to per-stream files.
+ *
+ * Three formats are supported:
+ *
+ * binary: raw little-endian samples appended to <stream>.bin
+ * csv:    "time_ns,value" rows appended to <stream>.csv
+ * npy:    NumPy arrays appended to <stream>.npy
+ *
+ * For the binary and npy formats the timing of each packet is
+ * appended to <stream>.times, a CSV file of packet ID, start time in
+ * nanoseconds since the epoch, sample rate, the offset of the first
+ * sample in the data file and the number of samples.
+ *
+ * The sample type of a binary or npy file is set by the first packet
+ * written to it, samples of a different type in later packets are
+ * converted.  Files are opened for appending so that collection can
+ * be restarted, the number of samples in existing npy files is
+ * determined from the file size and the NumPy header is rewritten at
+ * most once per second and when the file is closed.
+ *
+ * At most MAXOPENSTREAMS streams have open files, when a file for
+ * another stream is needed the files of the least recently used
+ * stream are closed.  Files are flushed to storage by export_sync(),
+ * including the files of streams closed since the last sync.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+#include "export.h"
+#include "strhash.h"
+#include "trace.h"
+
+/* Maximum number of streams with open files, the least recently used is
+ * closed when exceeded */
+#define MAXOPENSTREAMS 256
+
+/* Size of the fixed length NumPy header, a multiple of 64 */
+#define NPYHEADERLEN 128
+
+/* Size of the buffer used for formatting and converting samples */
+#define BUFFERSIZE 65536
+
+/* Per-stream export state */
+typedef struct ExportStream_s
+{
+  char *path;          /* Path of data file */
+  char *timepath;      /* Path of timing file */
+  FILE *fp;            /* Data file, NULL when closed */
+  FILE *timefp;        /* Timing file, NULL when closed */
+  char dtype;          /* Sample type of data file: i, f or d */
+  int64_t count;       /* Number of samples in data file */
+  int dirty;           /* NumPy header needs to be rewritten */
+  int unsynced;        /* Data written since last flushed to storage */
+  int failed;          /* File could not be opened, stream is skipped */
+  struct ExportStream_s *prev; /* More recently used stream with open files */
+  struct ExportStream_s *next; /* Less recently used stream with open files */
+} ExportStream;
+
+struct Exporter_s
+{
+  int format;          /* Export format */
+  char *directory;     /* Output directory */
+  StrHash *streams;    /* ExportStream entries keyed by stream ID */
+  int openstreams;     /* Number of streams with open files */
+  ExportStream *mru;   /* Most recently used stream with open files */
+  ExportStream *lru;   /* Least recently used stream with open files */
+  int64_t lastsync;    /* Time of last NumPy header update, nanoseconds */
+  MS3Record *msr;      /* Record reused for parsing */
+  char *buffer;        /* Formatting and conversion buffer */
+  int64_t packets;     /* Number of packets exported */
+  int64_t samples;     /* Number of samples exported */
+  int64_t unparsed;    /* Number of miniSEED packets that could not be parsed */
+};
+
+static ExportStream *export_getstream (Exporter *exporter, const char *streamid);
+static int export_open (Exporter *exporter, ExportStream *stream);
+static void export_close (Exporter *exporter, ExportStream *stream, int sync);
+static void export_closeall (Exporter *exporter);
+static int export_syncfile (const char *path, FILE *fp);
+static void export_unlink (Exporter *exporter, ExportStream *stream);
+static void export_freestream (void *value);
+static int export_data (Exporter *exporter, ExportStream *stream,
+                        DLPacket *dlpacket, MS3Record *msr);
+static int export_csv (Exporter *exporter, ExportStream *stream, MS3Record *msr);
+static int npy_readheader (FILE *fp, char *dtype);
+static int npy_writeheader (FILE *fp, char dtype, int64_t count);
+static int dtype_size (char dtype);
+static char *format_int64 (char *buf, int64_t value);
+
+/* Two digit lookup table for integer formatting */
+static const char digits2[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/***************************************************************************
+ * export_new:
+ *
+ * Create a new exporter for the specified format, one of "binary",
+ * "csv" or "npy", writing files in directory.  If directory is NULL
+ * files are written in the current directory.
+ *
+ * Returns a pointer to the exporter on success and NULL on error.
+ ***************************************************************************/
+Exporter *
+export_new (const char *format, const char *directory)
+{
+  Exporter *exporter;
+  int fmt;
+
+  if (!format)
+    return NULL;
+
+  if (!strcmp (format, "binary"))
+    fmt = EXPORT_BINARY;
+  else if (!strcmp (format, "csv"))
+    fmt = EXPORT_CSV;
+  else if (!strcmp (format, "npy"))
+    fmt = EXPORT_NPY;
+  else
+  {
+    dl_log (2, 0, "Unrecognized export format: %s\n", format);
+    return NULL;
+  }
+
+  if (!(exporter = (Exporter *)calloc (1, sizeof (Exporter))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for exporter\n");
+    return NULL;
+  }
+
+  exporter->format    = fmt;
+  exporter->directory = strdup ((directory) ? directory : ".");
+  exporter->streams   = strhash_new (0);
+  exporter->buffer    = (char *)malloc (BUFFERSIZE);
+  exporter->lastsync  = clock_ns ();
+
+  if (!exporter->directory || !exporter->streams || !exporter->buffer)
+  {
+    dl_log (2, 0, "Cannot allocate memory for exporter\n");
+    export_free (exporter);
+    return NULL;
+  }
+
+  return exporter;
+} /* End of export_new() */
+
+/***************************************************************************
+ * export_packet:
+ *
+ * Decode a miniSEED packet and append the samples to the export file
+ * for the stream.  Packets that are not miniSEED or do not contain
+ * integer or floating point samples are ignored, as are packets that
+ * cannot be parsed, which are logged and counted.
+ *
+ * Returns 0 on success or if the packet was ignored and -1 if the
+ * export file could not be written.
+ ***************************************************************************/
+int
+export_packet (Exporter *exporter, DLPacket *dlpacket, void *packetdata)
+{
+  ExportStream *stream;
+  ExportStream *entry;
+  StrHashEntry *hentry;
+  char type[10];
+  int64_t now;
+  int rv;
+
+  if (!exporter || !dlpacket || !packetdata)
+    return -1;
+
+  if (dl_splitstreamid (dlpacket->streamid, NULL, NULL, NULL, NULL, type) ||
+      strncmp (type, "MSEED", 5))
+    return 0;
+
+  if ((rv = trace_parse (packetdata, dlpacket->datasize, &exporter->msr, MSF_UNPACKDATA, 0, dlpacket)) != MS_NOERROR)
+  {
+    dl_log (2, 0, "%s: Error parsing miniSEED packet %lld for export, skipped: %s\n",
+            dlpacket->streamid, (long long int)dlpacket->pktid,
+            (rv < 0) ? ms_errorstr (rv) : "incomplete record");
+    exporter->unparsed++;
+    return 0;
+  }
+
+  if (exporter->msr->numsamples <= 0 ||
+      (exporter->msr->sampletype != 'i' && exporter->msr->sampletype != 'f' &&
+       exporter->msr->sampletype != 'd'))
+    return 0;
+
+  if (!(stream = export_getstream (exporter, dlpacket->streamid)))
+    return -1;
+
+  if (stream->failed)
+    return 0;
+
+  if (!stream->fp && export_open (exporter, stream))
+  {
+    stream->failed = 1;
+    return -1;
+  }
+
+  /* Move the stream to the front of the recently used list */
+  if (exporter->mru != stream)
+  {
+    export_unlink (exporter, stream);
+
+    stream->next = exporter->mru;
+    if (exporter->mru)
+      exporter->mru->prev = stream;
+    exporter->mru = stream;
+    if (!exporter->lru)
+      exporter->lru = stream;
+  }
+
+  if (exporter->format == EXPORT_CSV)
+    rv = export_csv (exporter, stream, exporter->msr);
+  else
+    rv = export_data (exporter, stream, dlpacket, exporter->msr);
+
+  if (rv)
+  {
+    dl_log (2, 0, "%s: Error writing export file: %s\n", stream->path, strerror (errno));
+    export_close (exporter, stream, 0);
+    stream->failed = 1;
+    return -1;
+  }
+
+  stream->unsynced = 1;
+
+  exporter->packets++;
+  exporter->samples += exporter->msr->numsamples;
+
+  /* Update the headers of NumPy files at most once per second */
+  if (exporter->format == EXPORT_NPY)
+  {
+    now = clock_ns ();
+
+    if ((now - exporter->lastsync) >= 1000000000)
+    {
+      hentry = NULL;
+      while ((hentry = strhash_next (exporter->streams, hentry)))
+      {
+        entry = (ExportStream *)hentry->value;
+
+        if (entry->fp && entry->dirty)
+        {
+          npy_writeheader (entry->fp, entry->dtype, entry->count);
+          entry->dirty = 0;
+        }
+      }
+
+      exporter->lastsync = now;
+    }
+  }
+
+  return 0;
+} /* End of export_packet() */
+
+/***************************************************************************
+ * export_sync:
+ *
+ * Update the headers of NumPy files and flush all export files with
+ * data written since the last sync to storage, so that all samples
+ * exported are durable.  Files closed since the last sync are
+ * reopened to flush them.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+export_sync (Exporter *exporter)
+{
+  StrHashEntry *hentry = NULL;
+  ExportStream *stream;
+  int rv = 0;
+
+  if (!exporter)
+    return -1;
+
+  while ((hentry = strhash_next (exporter->streams, hentry)))
+  {
+    stream = (ExportStream *)hentry->value;
+
+    if (!stream->unsynced)
+      continue;
+
+    if (stream->fp && exporter->format == EXPORT_NPY && stream->dirty)
+    {
+      npy_writeheader (stream->fp, stream->dtype, stream->count);
+      stream->dirty = 0;
+    }
+
+    if (export_syncfile (stream->path, stream->fp) ||
+        (exporter->format != EXPORT_CSV && export_syncfile (stream->timepath, stream->timefp)))
+    {
+      dl_log (2, 0, "%s: Error syncing export file: %s\n", stream->path, strerror (errno));
+      rv = -1;
+    }
+    else
+    {
+      stream->unsynced = 0;
+    }
+  }
+
+  exporter->lastsync = clock_ns ();
+
+  return rv;
+} /* End of export_sync() */
+
+/***************************************************************************
+ * export_free:
+ *
+ * Close all export files and free the exporter.
+ ***************************************************************************/
+void
+export_free (Exporter *exporter)
+{
+  if (!exporter)
+    return;
+
+  if (exporter->streams)
+  {
+    export_closeall (exporter);
+
+    dl_log (1, 1, "Exported %lld samples from %lld packets for %llu streams\n",
+            (long long int)exporter->samples, (long long int)exporter->packets,
+            (unsigned long long int)exporter->streams->count);
+
+    if (exporter->unparsed > 0)
+      dl_log (1, 0, "Skipped %lld packets that could not be parsed for export\n",
+              (long long int)exporter->unparsed);
+
+    strhash_free (exporter->streams, export_freestream);
+  }
+
+  if (exporter->msr)
+    msr3_free (&exporter->msr);
+
+  free (exporter->directory);
+  free (exporter->buffer);
+  free (exporter);
+} /* End of export_free() */
+
+/***************************************************************************
+ * export_getstream:
+ *
+ * Find or create the export state for a stream.  File names are
+ * derived from the stream ID, without any "FDSN:" prefix and packet
+ * type suffix, with characters other than letters, digits, '.', '-'
+ * and '_' replaced with '_'.
+ *
+ * Returns a pointer to the stream on success and NULL on error.
+ ***************************************************************************/
+static ExportStream *
+export_getstream (Exporter *exporter, const char *streamid)
+{
+  ExportStream *stream;
+  const char *key = streamid;
+  const char *suffix;
+  char name[100];
+  char *cp;
+  size_t length;
+  size_t pathlength;
+
+  if ((stream = (ExportStream *)strhash_get (exporter->streams, streamid)))
+    return stream;
+
+  if (!strncmp (streamid, "FDSN:", 5))
+    streamid += 5;
+
+  length = ((cp = strrchr (streamid, '/'))) ? (size_t)(cp - streamid) : strlen (streamid);
+  if (length >= sizeof (name))
+    length = sizeof (name) - 1;
+
+  memcpy (name, streamid, length);
+  name[length] = '\0';
+
+  for (cp = name; *cp; cp++)
+  {
+    if (!((*cp >= 'A' && *cp <= 'Z') || (*cp >= 'a' && *cp <= 'z') ||
+          (*cp >= '0' && *cp <= '9') || *cp == '.' || *cp == '-' || *cp == '_'))
+      *cp = '_';
+  }
+
+  suffix = (exporter->format == EXPORT_BINARY) ? "bin" :
+           (exporter->format == EXPORT_CSV) ? "csv" : "npy";
+
+  pathlength = strlen (exporter->directory) + length + 10;
+
+  if (!(stream = (ExportStream *)calloc (1, sizeof (ExportStream))) ||
+      !(stream->path = (char *)malloc (pathlength)) ||
+      !(stream->timepath = (char *)malloc (pathlength)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for export stream\n");
+    export_freestream (stream);
+    return NULL;
+  }
+
+  snprintf (stream->path, pathlength, "%s/%s.%s", exporter->directory, name, suffix);
+  snprintf (stream->timepath, pathlength, "%s/%s.times", exporter->directory, name);
+
+  if (strhash_put (exporter->streams, key, stream))
+  {
+    export_freestream (stream);
+    return NULL;
+  }
+
+  return stream;
+} /* End of export_getstream() */
+
+/***************************************************************************
+ * export_open:
+ *
+ * Open the data and timing files for a stream, creating them if they
+ * do not exist.  If the limit of streams with open files has been
+ * reached the files of the least recently used stream are closed
+ * first, without flushing them to storage.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+export_open (Exporter *exporter, ExportStream *stream)
+{
+  long size;
+
+  if (exporter->openstreams >= MAXOPENSTREAMS && exporter->lru)
+    export_close (exporter, exporter->lru, 0);
+
+  if (exporter->format == EXPORT_NPY)
+  {
+    /* Continue an existing file or create a new one */
+    if ((stream->fp = fopen (stream->path, "r+b")))
+    {
+      if (npy_readheader (stream->fp, &stream->dtype))
+      {
+        dl_log (2, 0, "%s: Not a NumPy file written by this program\n", stream->path);
+        fclose (stream->fp);
+        stream->fp = NULL;
+        return -1;
+      }
+
+      fseek (stream->fp, 0, SEEK_END);
+      size          = ftell (stream->fp);
+      stream->count = (size > NPYHEADERLEN) ? (size - NPYHEADERLEN) / dtype_size (stream->dtype) : 0;
+
+      /* Position after the last complete sample */
+      fseek (stream->fp, NPYHEADERLEN + stream->count * dtype_size (stream->dtype), SEEK_SET);
+    }
+    else if ((stream->fp = fopen (stream->path, "w+b")))
+    {
+      stream->dtype = exporter->msr->sampletype;
+      stream->count = 0;
+
+      if (npy_writeheader (stream->fp, stream->dtype, stream->count))
+      {
+        dl_log (2, 0, "%s: Cannot write NumPy header: %s\n", stream->path, strerror (errno));
+        fclose (stream->fp);
+        stream->fp = NULL;
+        return -1;
+      }
+
+      fseek (stream->fp, NPYHEADERLEN, SEEK_SET);
+    }
+  }
+  else
+  {
+    if ((stream->fp = fopen (stream->path, "ab")))
+    {
+      fseek (stream->fp, 0, SEEK_END);
+      size = ftell (stream->fp);
+
+      if (exporter->format == EXPORT_CSV)
+      {
+        if (size == 0)
+          fputs ("time_ns,value\n", stream->fp);
+      }
+      else
+      {
+        if (!stream->dtype)
+          stream->dtype = exporter->msr->sampletype;
+
+        stream->count = size / dtype_size (stream->dtype);
+      }
+    }
+  }
+
+  if (!stream->fp)
+  {
+    dl_log (2, 0, "%s: Cannot open export file: %s\n", stream->path, strerror (errno));
+    return -1;
+  }
+
+  /* Open timing file for binary and NumPy formats */
+  if (exporter->format != EXPORT_CSV)
+  {
+    if (!(stream->timefp = fopen (stream->timepath, "ab")))
+    {
+      dl_log (2, 0, "%s: Cannot open timing file: %s\n", stream->timepath, strerror (errno));
+      fclose (stream->fp);
+      stream->fp = NULL;
+      return -1;
+    }
+
+    fseek (stream->timefp, 0, SEEK_END);
+    if (ftell (stream->timefp) == 0)
+      fputs ("pktid,starttime_ns,samprate,offset,numsamples,dtype\n", stream->timefp);
+  }
+
+  exporter->openstreams++;
+
+  return 0;
+} /* End of export_open() */
+
+/***************************************************************************
+ * export_close:
+ *
+ * Close the files for a stream, updating the NumPy header if needed.
+ * If sync is non-zero the files are flushed to storage first,
+ * otherwise they are left for export_sync().
+ ***************************************************************************/
+static void
+export_close (Exporter *exporter, ExportStream *stream, int sync)
+{
+  if (!stream->fp)
+    return;
+
+  if (exporter->format == EXPORT_NPY && stream->dirty)
+  {
+    npy_writeheader (stream->fp, stream->dtype, stream->count);
+    stream->dirty = 0;
+  }
+
+  if (sync && stream->unsynced)
+  {
+    if (export_syncfile (stream->path, stream->fp) ||
+        (stream->timefp && export_syncfile (stream->timepath, stream->timefp)))
+      dl_log (2, 0, "%s: Error syncing export file: %s\n", stream->path, strerror (errno));
+    else
+      stream->unsynced = 0;
+  }
+
+  if (fclose (stream->fp))
+    dl_log (2, 0, "%s: Error closing export file: %s\n", stream->path, strerror (errno));
+
+  if (stream->timefp && fclose (stream->timefp))
+    dl_log (2, 0, "%s: Error closing timing file: %s\n", stream->timepath, strerror (errno));
+
+  stream->fp     = NULL;
+  stream->timefp = NULL;
+
+  export_unlink (exporter, stream);
+
+  exporter->openstreams--;
+} /* End of export_close() */
+
+/***************************************************************************
+ * export_closeall:
+ *
+ * Close the files of all streams, flushing them to storage.
+ ***************************************************************************/
+static void
+export_closeall (Exporter *exporter)
+{
+  StrHashEntry *hentry = NULL;
+
+  while ((hentry = strhash_next (exporter->streams, hentry)))
+    export_close (exporter, (ExportStream *)hentry->value, 1);
+} /* End of export_closeall() */
+
+/***************************************************************************
+ * export_syncfile:
+ *
+ * Flush a file to storage.  If fp is NULL the file is closed and is
+ * opened for appending to flush it.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+export_syncfile (const char *path, FILE *fp)
+{
+  FILE *syncfp;
+  int rv;
+
+  if (fp)
+    return (fflush (fp) || dlp_fsync (fileno (fp))) ? -1 : 0;
+
+  if (!(syncfp = fopen (path, "ab")))
+    return -1;
+
+  rv = dlp_fsync (fileno (syncfp));
+
+  if (fclose (syncfp))
+    rv = -1;
+
+  return (rv) ? -1 : 0;
+} /* End of export_syncfile() */
+
+/***************************************************************************
+ * export_unlink:
+ *
+ * Remove a stream from the list of recently used streams, if listed.
+ ***************************************************************************/
+static void
+export_unlink (Exporter *exporter, ExportStream *stream)
+{
+  if (stream->prev)
+    stream->prev->next = stream->next;
+  else if (exporter->mru == stream)
+    exporter->mru = stream->next;
+
+  if (stream->next)
+    stream->next->prev = stream->prev;
+  else if (exporter->lru == stream)
+    exporter->lru = stream->prev;
+
+  stream->prev = NULL;
+  stream->next = NULL;
+} /* End of export_unlink() */
+
+/***************************************************************************
+ * export_freestream:
+ *
+ * Free an ExportStream, files must already be closed.
+ ***************************************************************************/
+static void
+export_freestream (void *value)
+{
+  ExportStream *stream = (ExportStream *)value;
+
+  if (!stream)
+    return;
+
+  free (stream->path);
+  free (stream->timepath);
+  free (stream);
+} /* End of export_freestream() */
+
+/***************************************************************************
+ * export_data:
+ *
+ * Append the samples of a record to the data file of a stream as
+ * little-endian values of the file sample type, converting if needed,
+ * and append the packet timing to the timing file.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+export_data (Exporter *exporter, ExportStream *stream,
+             DLPacket *dlpacket, MS3Record *msr)
+{
+  int64_t idx;
+  int64_t chunk;
+  int64_t count;
+  int itemsize = dtype_size (stream->dtype);
+  int swap     = ms_bigendianhost ();
+  char *dst;
+  double value;
+
+  /* Write samples directly when no conversion is needed */
+  if (msr->sampletype == stream->dtype && !swap)
+  {
+    if (fwrite (msr->datasamples, itemsize, msr->numsamples, stream->fp) != (size_t)msr->numsamples)
+      return -1;
+  }
+  else
+  {
+    chunk = BUFFERSIZE / itemsize;
+
+    for (idx = 0; idx < msr->numsamples; idx += count)
+    {
+      count = (msr->numsamples - idx < chunk) ? msr->numsamples - idx : chunk;
+
+      if (msr->sampletype == stream->dtype)
+      {
+        memcpy (exporter->buffer, (char *)msr->datasamples + idx * itemsize, count * itemsize);
+      }
+      else
+      {
+        for (dst = exporter->buffer; dst < exporter->buffer + count * itemsize; dst += itemsize, idx++)
+        {
+          if (msr->sampletype == 'i')
+            value = ((int32_t *)msr->datasamples)[idx];
+          else if (msr->sampletype == 'f')
+            value = ((float *)msr->datasamples)[idx];
+          else
+            value = ((double *)msr->datasamples)[idx];
+
+          if (stream->dtype == 'i')
+            *(int32_t *)dst = (int32_t)((value < 0) ? value - 0.5 : value + 0.5);
+          else if (stream->dtype == 'f')
+            *(float *)dst = (float)value;
+          else
+            *(double *)dst = value;
+        }
+
+        idx -= count;
+      }
+
+      if (swap)
+      {
+        for (dst = exporter->buffer; dst < exporter->buffer + count * itemsize; dst += itemsize)
+        {
+          if (itemsize == 4)
+            ms_gswap4 (dst);
+          else
+            ms_gswap8 (dst);
+        }
+      }
+
+      if (fwrite (exporter->buffer, itemsize, count, stream->fp) != (size_t)count)
+        return -1;
+    }
+  }
+
+  fprintf (stream->timefp, "%lld,%lld,%.10g,%lld,%lld,%s\n",
+           (long long int)dlpacket->pktid, (long long int)msr->starttime,
+           msr3_sampratehz (msr), (long long int)stream->count,
+           (long long int)msr->numsamples,
+           (stream->dtype == 'i') ? "i4" : (stream->dtype == 'f') ? "f4" : "f8");
+
+  stream->count += msr->numsamples;
+  stream->dirty = 1;
+
+  return 0;
+} /* End of export_data() */
+
+/***************************************************************************
+ * export_csv:
+ *
+ * Append the samples of a record to the CSV file of a stream, one
+ * "time_ns,value" row per sample.  Rows are formatted into a buffer
+ * that is written when full, integers are formatted without stdio.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+export_csv (Exporter *exporter, ExportStream *stream, MS3Record *msr)
+{
+  char *cp    = exporter->buffer;
+  char *limit = exporter->buffer + BUFFERSIZE - 64;
+  double samprate = msr3_sampratehz (msr);
+  double period   = (samprate > 0.0) ? 1e9 / samprate : 0.0;
+  int64_t idx;
+
+  for (idx = 0; idx < msr->numsamples; idx++)
+  {
+    if (cp >= limit)
+    {
+      if (fwrite (exporter->buffer, 1, cp - exporter->buffer, stream->fp) != (size_t)(cp - exporter->buffer))
+        return -1;
+
+      cp = exporter->buffer;
+    }
+
+    cp    = format_int64 (cp, msr->starttime + (int64_t)(idx * period + 0.5));
+    *cp++ = ',';
+
+    if (msr->sampletype == 'i')
+      cp = format_int64 (cp, ((int32_t *)msr->datasamples)[idx]);
+    else if (msr->sampletype == 'f')
+      cp += snprintf (cp, 32, "%.9g", ((float *)msr->datasamples)[idx]);
+    else
+      cp += snprintf (cp, 32, "%.17g", ((double *)msr->datasamples)[idx]);
+
+    *cp++ = '\n';
+  }
+
+  if (cp > exporter->buffer &&
+      fwrite (exporter->buffer, 1, cp - exporter->buffer, stream->fp) != (size_t)(cp - exporter->buffer))
+    return -1;
+
+  stream->count += msr->numsamples;
+
+  return 0;
+} /* End of export_csv() */
+
+/***************************************************************************
+ * npy_readheader:
+ *
+ * Read and check the header of a NumPy file written by npy_writeheader()
+ * and set the sample type.
+ *
+ * Returns 0 on success and -1 on error or if the header is not recognized.
+ ***************************************************************************/
+static int
+npy_readheader (FILE *fp, char *dtype)
+{
+  char header[NPYHEADERLEN + 1];
+  char *descr;
+
+  if (fseek (fp, 0, SEEK_SET) || fread (header, NPYHEADERLEN, 1, fp) != 1)
+    return -1;
+
+  header[NPYHEADERLEN] = '\0';
+
+  if (memcmp (header, "\x93NUMPY\x01\x00", 8) ||
+      (uint8_t)header[8] != (NPYHEADERLEN - 10) || header[9] != 0)
+    return -1;
+
+  if (!(descr = strstr (header + 10, "'descr': '")))
+    return -1;
+
+  descr += 10;
+
+  if (!strncmp (descr, "<i4'", 4))
+    *dtype = 'i';
+  else if (!strncmp (descr, "<f4'", 4))
+    *dtype = 'f';
+  else if (!strncmp (descr, "<f8'", 4))
+    *dtype = 'd';
+  else
+    return -1;
+
+  if (!strstr (header + 10, "'fortran_order': False"))
+    return -1;
+
+  return 0;
+} /* End of npy_readheader() */
+
+/***************************************************************************
+ * npy_writeheader:
+ *
+ * Write a version 1.0 NumPy header describing a one dimensional array
+ * of count samples at the beginning of a file.  The header is always
+ * NPYHEADERLEN bytes so it can be rewritten in place as samples are
+ * appended.  The file position is restored.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+npy_writeheader (FILE *fp, char dtype, int64_t count)
+{
+  char header[NPYHEADERLEN + 1];
+  long position;
+  int length;
+
+  memcpy (header, "\x93NUMPY\x01\x00", 8);
+  header[8] = (char)(NPYHEADERLEN - 10);
+  header[9] = 0;
+
+  length = snprintf (header + 10, NPYHEADERLEN - 10,
+                     "{'descr': '%s', 'fortran_order': False, 'shape': (%lld,), }",
+                     (dtype == 'i') ? "<i4" : (dtype == 'f') ? "<f4" : "<f8",
+                     (long long int)count);
+
+  /* Pad with spaces and terminate with a newline */
+  memset (header + 10 + length, ' ', NPYHEADERLEN - 10 - length);
+  header[NPYHEADERLEN - 1] = '\n';
+
+  position = ftell (fp);
+
+  if (fseek (fp, 0, SEEK_SET) ||
+      fwrite (header, NPYHEADERLEN, 1, fp) != 1 ||
+      fseek (fp, position, SEEK_SET))
+    return -1;
+
+  return 0;
+} /* End of npy_writeheader() */
+
+/***************************************************************************
+ * dtype_size:
+ *
+ * Return the size in bytes of a sample type.
+ ***************************************************************************/
+static int
+dtype_size (char dtype)
+{
+  return (dtype == 'd') ? 8 : 4;
+} /* End of dtype_size() */
+
+/***************************************************************************
+ * format_int64:
+ *
+ * Format an integer in decimal at buf, two digits at a time.
+ *
+ * Returns a pointer to the character following the last digit.
+ ***************************************************************************/
+static char *
+format_int64 (char *buf, int64_t value)
+{
+  char digits[20];
+  char *cp = digits + sizeof (digits);
+  uint64_t uvalue;
+  size_t length;
+
+  if (value < 0)
+  {
+    *buf++ = '-';
+    uvalue = (uint64_t)0 - (uint64_t)value;
+  }
+  else
+  {
+    uvalue = (uint64_t)value;
+  }
+
+  while (uvalue >= 100)
+  {
+    cp -= 2;
+    memcpy (cp, digits2 + (uvalue % 100) * 2, 2);
+    uvalue /= 100;
+  }
+
+  if (uvalue >= 10)
+  {
+    cp -= 2;
+    memcpy (cp, digits2 + uvalue * 2, 2);
+  }
+  else
+  {
+    *--cp = (char)('0' + uvalue);
+  }
+
+  length = digits + sizeof (digits) - cp;
+  memcpy (buf, cp, length);
+
+  return buf + length;
+} /* End of format_int64() */
@@ -0,0 +1,28 @@
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Export formats */
+#define EXPORT_BINARY 1
+#define EXPORT_CSV    2
+#define EXPORT_NPY    3
+
+typedef struct Exporter_s Exporter;
+
+extern Exporter *export_new (const char *format, const char *directory);
+extern int export_packet (Exporter *exporter, DLPacket *dlpacket, void *packetdata);
+extern int export_sync (Exporter *exporter);
+extern void export_free (Exporter *exporter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* EXPORT_H */
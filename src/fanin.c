@@ -0,0 +1,221 @@
+/***************************************************************************
+ * fanin.c
+ *
+ * Routines for collecting packets from multiple DataLink servers
+ * concurrently.
+ *
+ * A thread is started for each connection, collecting packets in
+ * streaming mode.  Received packets are passed to a single handler,
+ * serialized by a mutex, so that output is unified.  Duplicates of
+ * streams that appear on several servers are removed by a duplicate
+ * suppression stage used as the handler, see dedup.c.
+ *
+ * An optional tick callback is called about every 1/10 second, also
+ * serialized with the handler, for stages that emit packets based on
+ * time rather than arrival.  An optional receive callback is called
+ * by each collection thread for every packet received, without
+ * holding the shared lock.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include <libdali.h>
+
+#include "fanin.h"
+#include "trace.h"
+
+#ifndef WIN32
+
+/* State shared by all collection threads */
+typedef struct FaninShared_s
+{
+  pthread_mutex_t lock;         /* Serializes handler calls */
+  FaninHandler handler;         /* Packet handler */
+  FaninTick tick;               /* Periodic callback, may be NULL */
+  FaninReceive receive;         /* Receive callback, may be NULL */
+  void *receivedata;            /* Data passed to receive callback */
+  int running;                  /* Number of threads still collecting */
+  void *handlerdata;            /* Data passed to handler */
+} FaninShared;
+
+/* Per-connection collection thread state */
+typedef struct FaninThread_s
+{
+  pthread_t thread;             /* Thread handle */
+  int started;                  /* Thread was started */
+  DLCP *dlconn;                 /* Connection to collect from */
+  FaninShared *shared;          /* Shared state */
+  int64_t packets;              /* Packets received */
+} FaninThread;
+
+static void *fanin_thread (void *arg);
+
+/***************************************************************************
+ * runfanin:
+ *
+ * Collect packets from count connections concurrently, each already
+ * connected and configured, until all connections are terminated or
+ * end.  The handler is called for each packet, never concurrently.  If
+ * tick is not NULL it is called periodically with tickdata.  If
+ * receive is not NULL it is called with receivedata by the thread of
+ * each connection for every packet received.
+ *
+ * Returns 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+runfanin (DLCP **conns, int count,
+          FaninHandler handler, void *handlerdata,
+          FaninTick tick, void *tickdata,
+          FaninReceive receive, void *receivedata)
+{
+  FaninShared shared;
+  FaninThread *threads;
+  int idx;
+  int retval = 0;
+
+  if (!conns || count <= 0 || !handler)
+    return -1;
+
+  if (!(threads = (FaninThread *)calloc (count, sizeof (FaninThread))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for collection threads\n");
+    return -1;
+  }
+
+  pthread_mutex_init (&shared.lock, NULL);
+  shared.handler     = handler;
+  shared.tick        = tick;
+  shared.receive     = receive;
+  shared.receivedata = receivedata;
+  shared.running     = 0;
+  shared.handlerdata = handlerdata;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    threads[idx].dlconn = conns[idx];
+    threads[idx].shared = &shared;
+
+    if (pthread_create (&threads[idx].thread, NULL, fanin_thread, &threads[idx]))
+    {
+      dl_log (2, 0, "[%s] Cannot start collection thread\n", conns[idx]->addr);
+
+      /* Stop threads already started */
+      while (--idx >= 0)
+        dl_terminate (conns[idx]);
+
+      retval = -1;
+      break;
+    }
+
+    threads[idx].started = 1;
+
+    pthread_mutex_lock (&shared.lock);
+    shared.running++;
+    pthread_mutex_unlock (&shared.lock);
+  }
+
+  /* Call the tick callback until all threads have finished */
+  while (tick)
+  {
+    dlp_usleep (100000);
+
+    pthread_mutex_lock (&shared.lock);
+
+    if (shared.running <= 0)
+    {
+      pthread_mutex_unlock (&shared.lock);
+      break;
+    }
+
+    tick (tickdata);
+
+    pthread_mutex_unlock (&shared.lock);
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (threads[idx].started)
+    {
+      pthread_join (threads[idx].thread, NULL);
+
+      dl_log (1, 1, "[%s] Collected %lld packets\n", conns[idx]->addr,
+              (long long int)threads[idx].packets);
+    }
+  }
+
+  pthread_mutex_destroy (&shared.lock);
+  free (threads);
+
+  return retval;
+} /* End of runfanin() */
+
+/***************************************************************************
+ * fanin_thread:
+ *
+ * Collect packets from a single connection and pass them to the
+ * shared handler.
+ ***************************************************************************/
+static void *
+fanin_thread (void *arg)
+{
+  FaninThread *ft      = (FaninThread *)arg;
+  FaninShared *shared  = ft->shared;
+  DLPacket dlpacket;
+  int64_t tstart;
+  char packetdata[MAXPACKETSIZE];
+
+  trace_thread ((ft->dlconn->statekey[0]) ? ft->dlconn->statekey : ft->dlconn->addr);
+
+  tstart = trace_start ();
+
+  while (dl_collect (ft->dlconn, &dlpacket, packetdata, sizeof (packetdata), 0) == DLPACKET)
+  {
+    trace_span ("receive", tstart, &dlpacket);
+
+    ft->packets++;
+
+    if (shared->receive)
+      shared->receive (ft->dlconn, &dlpacket, shared->receivedata);
+
+    tstart = trace_start ();
+    pthread_mutex_lock (&shared->lock);
+    trace_span ("lock", tstart, &dlpacket);
+
+    tstart = trace_start ();
+    shared->handler (ft->dlconn, &dlpacket, packetdata, shared->handlerdata);
+    trace_span ("handle", tstart, &dlpacket);
+
+    pthread_mutex_unlock (&shared->lock);
+
+    tstart = trace_start ();
+  }
+
+  if (!ft->dlconn->terminate)
+    dl_log (1, 0, "[%s] Collection ended\n", ft->dlconn->addr);
+
+  pthread_mutex_lock (&shared->lock);
+  shared->running--;
+  pthread_mutex_unlock (&shared->lock);
+
+  return NULL;
+} /* End of fanin_thread() */
+
+#else
+
+int
+runfanin (DLCP **conns, int count,
+          FaninHandler handler, void *handlerdata,
+          FaninTick tick, void *tickdata,
+          FaninReceive receive, void *receivedata)
+{
+  dl_log (2, 0, "Collection from multiple servers is not supported on this platform\n");
+  return -1;
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,31 @@
+
+#ifndef FANIN_H
+#define FANIN_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Handler for packets collected from any connection */
+typedef int (*FaninHandler) (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+                             void *handlerdata);
+
+/* Periodic callback while collecting */
+typedef void (*FaninTick) (void *tickdata);
+
+/* Callback for every packet received, called by the collecting thread */
+typedef void (*FaninReceive) (DLCP *dlconn, const DLPacket *dlpacket, void *receivedata);
+
+extern int runfanin (DLCP **conns, int count,
+                     FaninHandler handler, void *handlerdata,
+                     FaninTick tick, void *tickdata,
+                     FaninReceive receive, void *receivedata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* FANIN_H */
@@ -0,0 +1,311 @@
+/***************************************************************************
+ * framed.c
+ *
+ * Routines for writing received packets to an output file in a framed
+ * format, preserving the DataLink packet details, with a sidecar
+ * index of the packets written.
+ *
+ * Each packet is written as a fixed length header followed by the
+ * packet data.  The header is FRAMED_HEADERLEN bytes, all integers
+ * are little-endian and all times are microseconds since the epoch:
+ *
+ *   0  char[4]   "DLFR"
+ *   4  uint16    format version, currently 1
+ *   6  uint16    header length, offset of packet data
+ *   8  uint32    packet data size in bytes
+ *  12  uint32    CRC-32C of packet data
+ *  16  int64     packet ID
+ *  24  int64     packet time
+ *  32  int64     data start time
+ *  40  int64     data end time
+ *  48  int64     receive time
+ *  56  char[64]  stream ID, NUL padded
+ * 120  char[8]   reserved, zero
+ *
+ * Unless writing to standard output an index is appended to
+ * <file>.idx, a CSV file of the file offset of each frame, the packet
+ * ID, the stream ID and the data start and end times in nanoseconds
+ * since the epoch.  Index entries are only written after the frames
+ * they refer to have been flushed, so the index never refers to data
+ * not in the file.  Both files are flushed at most once per second
+ * and when closed.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+#include "framed.h"
+
+/* Size of the buffer for index entries not yet written */
+#define INDEXBUFSIZE 65536
+
+/* Interval between flushes of the output and index, nanoseconds */
+#define FLUSHINTERVAL 1000000000
+
+struct FramedWriter_s
+{
+  FILE *fp;                     /* Output file for frames */
+  FILE *indexfp;                /* Index file, NULL when not indexing */
+  char *indexpath;              /* Path of index file */
+  char indexbuf[INDEXBUFSIZE];  /* Index entries not yet written */
+  size_t indexlen;              /* Length of index entries in buffer */
+  int64_t offset;               /* Offset of next frame in output */
+  int64_t lastflush;            /* Time of last flush, nanoseconds */
+};
+
+static void pack16 (uint8_t *buffer, uint16_t value);
+static void pack32 (uint8_t *buffer, uint32_t value);
+static void pack64 (uint8_t *buffer, int64_t value);
+
+/***************************************************************************
+ * framed_new:
+ *
+ * Create a new framed writer for the output file fp, which must not
+ * have been written to.  When path is not NULL the index is appended
+ * to path with a ".idx" suffix, otherwise no index is written.
+ *
+ * Returns a pointer to the writer on success and NULL on error.
+ ***************************************************************************/
+FramedWriter *
+framed_new (FILE *fp, const char *path)
+{
+  FramedWriter *writer;
+  long indexsize;
+
+  if (!fp)
+    return NULL;
+
+  if (!(writer = (FramedWriter *)calloc (1, sizeof (FramedWriter))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for framed writer\n");
+    return NULL;
+  }
+
+  writer->fp        = fp;
+  writer->lastflush = clock_ns ();
+
+  /* Frames are small, buffer writes */
+  setvbuf (fp, NULL, _IOFBF, 65536);
+
+  if (path)
+  {
+    /* Frames are appended, the next offset is the file size */
+    if (fseek (fp, 0, SEEK_END) == 0)
+      writer->offset = ftell (fp);
+
+    if (!(writer->indexpath = (char *)malloc (strlen (path) + 5)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for framed writer\n");
+      framed_free (writer);
+      return NULL;
+    }
+
+    sprintf (writer->indexpath, "%s.idx", path);
+
+    if (!(writer->indexfp = fopen (writer->indexpath, "ab")))
+    {
+      dl_log (2, 0, "Cannot open index file %s\n", writer->indexpath);
+      framed_free (writer);
+      return NULL;
+    }
+
+    /* Add column names to a new index */
+    fseek (writer->indexfp, 0, SEEK_END);
+    indexsize = ftell (writer->indexfp);
+
+    if (indexsize == 0)
+      fprintf (writer->indexfp, "offset,pktid,streamid,starttime_ns,endtime_ns\n");
+  }
+
+  return writer;
+} /* End of framed_new() */
+
+/***************************************************************************
+ * framed_write:
+ *
+ * Write a packet as a frame and add it to the index.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+framed_write (FramedWriter *writer, DLPacket *dlpacket, void *packetdata)
+{
+  uint8_t header[FRAMED_HEADERLEN];
+  int64_t now;
+  int len;
+
+  if (!writer || !dlpacket || !packetdata || dlpacket->datasize < 0)
+    return -1;
+
+  memset (header, 0, sizeof (header));
+  memcpy (header, FRAMED_MAGIC, 4);
+  pack16 (header + 4, FRAMED_VERSION);
+  pack16 (header + 6, FRAMED_HEADERLEN);
+  pack32 (header + 8, (uint32_t)dlpacket->datasize);
+  pack32 (header + 12, ms_crc32c ((const uint8_t *)packetdata, dlpacket->datasize, 0));
+  pack64 (header + 16, dlpacket->pktid);
+  pack64 (header + 24, dlpacket->pkttime);
+  pack64 (header + 32, dlpacket->datastart);
+  pack64 (header + 40, dlpacket->dataend);
+  pack64 (header + 48, dlpacket->recvtime);
+  strncpy ((char *)header + 56, dlpacket->streamid, 63);
+
+  if (fwrite (header, sizeof (header), 1, writer->fp) != 1 ||
+      (dlpacket->datasize > 0 &&
+       fwrite (packetdata, dlpacket->datasize, 1, writer->fp) != 1))
+  {
+    dl_log (2, 0, "Error writing framed packet: %s\n", strerror (errno));
+    return -1;
+  }
+
+  if (writer->indexfp)
+  {
+    /* Write out buffered entries, after the frames, when the buffer is full */
+    if (writer->indexlen + MAXSTREAMID + 100 > sizeof (writer->indexbuf) &&
+        framed_flush (writer))
+      return -1;
+
+    len = snprintf (writer->indexbuf + writer->indexlen,
+                    sizeof (writer->indexbuf) - writer->indexlen,
+                    "%lld,%lld,%s,%lld,%lld\n",
+                    (long long int)writer->offset, (long long int)dlpacket->pktid,
+                    dlpacket->streamid,
+                    (long long int)dlpacket->datastart * (1000000000 / DLTMODULUS),
+                    (long long int)dlpacket->dataend * (1000000000 / DLTMODULUS));
+
+    if (len > 0)
+      writer->indexlen += len;
+  }
+
+  writer->offset += FRAMED_HEADERLEN + dlpacket->datasize;
+
+  /* Flush periodically so the output and index can be followed */
+  now = clock_ns ();
+  if (now - writer->lastflush >= FLUSHINTERVAL)
+  {
+    if (framed_flush (writer))
+      return -1;
+  }
+
+  return 0;
+} /* End of framed_write() */
+
+/***************************************************************************
+ * framed_flush:
+ *
+ * Flush the frames written to the output file and then write and
+ * flush the index entries for them.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+framed_flush (FramedWriter *writer)
+{
+  if (!writer)
+    return -1;
+
+  writer->lastflush = clock_ns ();
+
+  if (fflush (writer->fp))
+  {
+    dl_log (2, 0, "Error writing framed packets: %s\n", strerror (errno));
+    return -1;
+  }
+
+  if (writer->indexfp)
+  {
+    if ((writer->indexlen > 0 &&
+         fwrite (writer->indexbuf, writer->indexlen, 1, writer->indexfp) != 1) ||
+        fflush (writer->indexfp))
+    {
+      dl_log (2, 0, "Error writing index file %s: %s\n",
+              writer->indexpath, strerror (errno));
+      return -1;
+    }
+
+    writer->indexlen = 0;
+  }
+
+  return 0;
+} /* End of framed_flush() */
+
+/***************************************************************************
+ * framed_sync:
+ *
+ * Flush the output and index and, unless writing to standard output,
+ * flush them to storage so that all frames written are durable.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+framed_sync (FramedWriter *writer)
+{
+  if (framed_flush (writer))
+    return -1;
+
+  if (writer->indexfp &&
+      (dlp_fsync (fileno (writer->fp)) || dlp_fsync (fileno (writer->indexfp))))
+  {
+    dl_log (2, 0, "Error syncing framed output: %s\n", strerror (errno));
+    return -1;
+  }
+
+  return 0;
+} /* End of framed_sync() */
+
+/***************************************************************************
+ * framed_free:
+ *
+ * Flush and free a framed writer, closing the index.  The output file
+ * is not closed.
+ ***************************************************************************/
+void
+framed_free (FramedWriter *writer)
+{
+  if (!writer)
+    return;
+
+  framed_flush (writer);
+
+  if (writer->indexfp)
+    fclose (writer->indexfp);
+
+  free (writer->indexpath);
+  free (writer);
+} /* End of framed_free() */
+
+/***************************************************************************
+ * pack16, pack32, pack64:
+ *
+ * Store a value in a buffer in little-endian byte order.
+ ***************************************************************************/
+static void
+pack16 (uint8_t *buffer, uint16_t value)
+{
+  buffer[0] = (uint8_t)value;
+  buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void
+pack32 (uint8_t *buffer, uint32_t value)
+{
+  int idx;
+
+  for (idx = 0; idx < 4; idx++)
+    buffer[idx] = (uint8_t)(value >> (8 * idx));
+}
+
+static void
+pack64 (uint8_t *buffer, int64_t value)
+{
+  int idx;
+
+  for (idx = 0; idx < 8; idx++)
+    buffer[idx] = (uint8_t)((uint64_t)value >> (8 * idx));
+}
@@ -0,0 +1,31 @@
+
+#ifndef FRAMED_H
+#define FRAMED_H
+
+#include <stdio.h>
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Framed packet header identifier and length */
+#define FRAMED_MAGIC     "DLFR"
+#define FRAMED_VERSION   1
+#define FRAMED_HEADERLEN 128
+
+typedef struct FramedWriter_s FramedWriter;
+
+extern FramedWriter *framed_new (FILE *fp, const char *path);
+extern int framed_write (FramedWriter *writer, DLPacket *dlpacket, void *packetdata);
+extern int framed_flush (FramedWriter *writer);
+extern int framed_sync (FramedWriter *writer);
+extern void framed_free (FramedWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* FRAMED_H */
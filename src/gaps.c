@@ -0,0 +1,207 @@
+/***************************************************************************
+ * gaps.c
+ *
+ * Live tracking of the continuity of received miniSEED streams.
+ *
+ * The header of each received miniSEED record is parsed, without
+ * decoding the samples, and added to an MS3TraceList, which merges
+ * records into continuous segments for each source ID.  Gaps and
+ * overlaps between the segments are reported with
+ * mstl3_printgaplist().
+ *
+ * Segments hold no samples, only coverage, and the number kept for
+ * each source ID is limited: when exceeded the oldest segments are
+ * discarded.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "gaps.h"
+#include "trace.h"
+
+/* Default maximum number of segments kept for each source ID */
+#define DEFAULTMAXSEGMENTS 1000
+
+struct GapTracker_s
+{
+  MS3TraceList *mstl;           /* Trace list of record coverage */
+  MS3Record *msr;               /* Record reused for parsing */
+  int maxsegments;              /* Maximum segments kept per source ID */
+  int64_t records;              /* Records added */
+  int64_t skipped;              /* Packets that are not miniSEED */
+  int64_t errors;               /* Records that could not be parsed */
+  int64_t discarded;            /* Segments discarded due to the limit */
+};
+
+/***************************************************************************
+ * gaps_new:
+ *
+ * Create a new gap tracker keeping up to maxsegments segments for
+ * each source ID, or a default when maxsegments is 0.
+ *
+ * Returns a pointer to the tracker on success and NULL on error.
+ ***************************************************************************/
+GapTracker *
+gaps_new (int maxsegments)
+{
+  GapTracker *tracker;
+
+  if (!(tracker = (GapTracker *)calloc (1, sizeof (GapTracker))) ||
+      !(tracker->mstl = mstl3_init (NULL)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for gap tracking\n");
+    free (tracker);
+    return NULL;
+  }
+
+  tracker->maxsegments = (maxsegments > 0) ? maxsegments : DEFAULTMAXSEGMENTS;
+
+  return tracker;
+} /* End of gaps_new() */
+
+/***************************************************************************
+ * gaps_packet:
+ *
+ * Add the coverage of a miniSEED packet to the tracker, other packet
+ * types are ignored.
+ *
+ * Returns 0 on success, 1 if the packet is not miniSEED and -1 on error.
+ ***************************************************************************/
+int
+gaps_packet (GapTracker *tracker, DLPacket *dlpacket, void *packetdata)
+{
+  MS3TraceID *id;
+  MS3TraceSeg *seg;
+  char type[10];
+  int rv;
+
+  if (!tracker || !tracker->mstl || !dlpacket || !packetdata)
+    return -1;
+
+  if (dl_splitstreamid (dlpacket->streamid, NULL, NULL, NULL, NULL, type) ||
+      strncmp (type, "MSEED", 5))
+  {
+    tracker->skipped++;
+    return 1;
+  }
+
+  /* Parse header only, samples are not decoded */
+  if ((rv = trace_parse (packetdata, dlpacket->datasize, &tracker->msr, 0, 0, dlpacket)) != MS_NOERROR)
+  {
+    dl_log (2, 0, "%s: Error parsing record: %s\n", dlpacket->streamid,
+            (rv > 0) ? "incomplete record" : ms_errorstr (rv));
+    tracker->errors++;
+    return -1;
+  }
+
+  if (!mstl3_addmsr (tracker->mstl, tracker->msr, 0, 1, 0, NULL))
+  {
+    dl_log (2, 0, "%s: Error adding record to trace list\n", dlpacket->streamid);
+    tracker->errors++;
+    return -1;
+  }
+
+  tracker->records++;
+
+  /* Discard the oldest segments beyond the limit */
+  if ((id = mstl3_findID (tracker->mstl, tracker->msr->sid, 0, NULL)) &&
+      id->numsegments > (uint32_t)tracker->maxsegments)
+  {
+    while (id->numsegments > (uint32_t)tracker->maxsegments && id->first->next)
+    {
+      seg       = id->first;
+      id->first = seg->next;
+      id->first->prev = NULL;
+      id->numsegments--;
+
+      libmseed_memory.free (seg->datasamples);
+      libmseed_memory.free (seg);
+
+      tracker->discarded++;
+    }
+
+    id->earliest = id->first->starttime;
+  }
+
+  return 0;
+} /* End of gaps_packet() */
+
+/***************************************************************************
+ * gaps_report:
+ *
+ * Print a summary of the streams tracked and a list of the gaps and
+ * overlaps between segments, optionally limited to gaps between
+ * mingap and maxgap seconds, overlaps are negative gaps.
+ ***************************************************************************/
+void
+gaps_report (GapTracker *tracker, double *mingap, double *maxgap)
+{
+  MS3TraceID *id;
+  int64_t segments = 0;
+
+  if (!tracker || !tracker->mstl)
+    return;
+
+  for (id = tracker->mstl->traces.next[0]; id; id = id->next[0])
+    segments += id->numsegments;
+
+  ms_log (0, "Continuity of %u streams, %lld segments from %lld records",
+          tracker->mstl->numtraceids, (long long int)segments,
+          (long long int)tracker->records);
+
+  if (tracker->discarded > 0)
+    ms_log (0, ", %lld old segments discarded", (long long int)tracker->discarded);
+
+  if (tracker->errors > 0)
+    ms_log (0, ", %lld parsing errors", (long long int)tracker->errors);
+
+  ms_log (0, "\n");
+
+  mstl3_printgaplist (tracker->mstl, ISOMONTHDAY_Z, mingap, maxgap);
+} /* End of gaps_report() */
+
+/***************************************************************************
+ * gaps_reset:
+ *
+ * Discard all tracked coverage.
+ ***************************************************************************/
+void
+gaps_reset (GapTracker *tracker)
+{
+  if (!tracker)
+    return;
+
+  mstl3_free (&tracker->mstl, 0);
+  if (!(tracker->mstl = mstl3_init (NULL)))
+    dl_log (2, 0, "Cannot allocate memory for gap tracking\n");
+
+  tracker->records   = 0;
+  tracker->skipped   = 0;
+  tracker->errors    = 0;
+  tracker->discarded = 0;
+} /* End of gaps_reset() */
+
+/***************************************************************************
+ * gaps_free:
+ *
+ * Free the gap tracker.
+ ***************************************************************************/
+void
+gaps_free (GapTracker *tracker)
+{
+  if (!tracker)
+    return;
+
+  if (tracker->mstl)
+    mstl3_free (&tracker->mstl, 0);
+
+  if (tracker->msr)
+    msr3_free (&tracker->msr);
+
+  free (tracker);
+} /* End of gaps_free() */
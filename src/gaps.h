@@ -0,0 +1,24 @@
+
+#ifndef GAPS_H
+#define GAPS_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct GapTracker_s GapTracker;
+
+extern GapTracker *gaps_new (int maxsegments);
+extern int gaps_packet (GapTracker *tracker, DLPacket *dlpacket, void *packetdata);
+extern void gaps_report (GapTracker *tracker, double *mingap, double *maxgap);
+extern void gaps_reset (GapTracker *tracker);
+extern void gaps_free (GapTracker *tracker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* GAPS_H */
@@ -0,0 +1,772 @@
+/***************************************************************************
+ * generate.c
+ *
+ * Routines to generate synthetic miniSEED records and write them to a
+ * DataLink server at a target rate.
+ *
+ * Streams are distributed over one or more connections, each served
+ * by its own thread.  Records are created with msr3_pack() from a
+ * synthetic signal and written with dl_write(), optionally waiting
+ * for an acknowledgement from the server in order to measure the
+ * acknowledgement latency.
+ *
+ * Windows is not supported.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+#include "generate.h"
+
+#ifndef WIN32
+
+/* Number of bins in the acknowledgement latency histogram */
+#define LATBINS 128
+
+/* Encodings recognized in generator encoding lists */
+static const struct
+{
+  const char *name;
+  uint8_t encoding;
+} encodingnames[] = {
+    {"INT16", DE_INT16},
+    {"INT32", DE_INT32},
+    {"FLOAT32", DE_FLOAT32},
+    {"FLOAT64", DE_FLOAT64},
+    {"STEIM1", DE_STEIM1},
+    {"STEIM2", DE_STEIM2},
+    {NULL, 0}};
+
+/* A synthetic data stream */
+typedef struct GenStream_s
+{
+  char streamid[MAXSTREAMID]; /* DataLink stream ID */
+  MS3Record *msr;             /* Record template and sample buffer */
+  MS3Record *hdr;             /* Parsed header of record being written */
+  int64_t maxsamples;         /* Capacity of sample buffer */
+  int32_t level;              /* Current level of the synthetic signal */
+  uint32_t seed;              /* State of the noise generator */
+  char *records;              /* Packed records waiting to be written */
+  size_t recordsize;          /* Allocated size of records buffer */
+  size_t recordlen;           /* Bytes used in records buffer */
+  size_t recordpos;           /* Offset of next record to write */
+  int packerror;              /* Set when a packed record could not be kept */
+} GenStream;
+
+/* A writing connection and its results */
+typedef struct GenConn_s
+{
+  DLCP *dlconn;            /* Connection to write to */
+  DLCP *parent;            /* Controlling connection, for termination */
+  GenStream *streams;      /* Streams written with this connection */
+  int streamcount;         /* Count of streams */
+  double rate;             /* Target rate for this connection in records/second */
+  int64_t deadline;        /* Stop time, 0 for none */
+  int ack;                 /* Request acknowledgements */
+  int formatversion;       /* miniSEED format version */
+  pthread_t tid;           /* Thread writing to this connection */
+  volatile int done;       /* Flag set when the thread has finished */
+
+  uint64_t records;        /* Count of records written */
+  uint64_t bytes;          /* Count of bytes written */
+  uint64_t errors;         /* Count of errors */
+  uint64_t acks;           /* Count of acknowledgements received */
+  uint64_t latsum;         /* Sum of acknowledgement latencies in microseconds */
+  uint64_t latmin;         /* Minimum acknowledgement latency */
+  uint64_t latmax;         /* Maximum acknowledgement latency */
+  uint64_t lathist[LATBINS]; /* Histogram of acknowledgement latency */
+} GenConn;
+
+static int genstream_init (GenStream *gs, int index, uint8_t encoding,
+                           double samprate, int32_t reclen, int formatversion);
+static void genstream_free (GenStream *gs);
+static int genrecord (GenStream *gs, int formatversion, char **record,
+                      int *reclen, dltime_t *start, dltime_t *end);
+static void genhandler (char *record, int reclen, void *handlerdata);
+static void *genthread (void *arg);
+static int parseencoding (const char *name);
+static int latbin (uint64_t usec);
+static uint64_t binlower (int bin);
+static uint64_t latpercentile (uint64_t *hist, uint64_t count, double fraction);
+
+/***************************************************************************
+ * rungenerate:
+ *
+ * Generate synthetic records for the configured streams and write
+ * them to the server of dlconn using the specified number of
+ * connections.  The supplied connection is used as the first
+ * connection, additional connections to the same server are created
+ * as needed.
+ *
+ * Generation continues until the duration has elapsed or the
+ * termination flag of dlconn is set.  A summary of the achieved rate
+ * and acknowledgement latency is printed at the end.
+ *
+ * Returns 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+rungenerate (DLCP *dlconn, GenParams *params)
+{
+  DLstrlist *enclist  = NULL;
+  DLstrlist *ratelist = NULL;
+  DLstrlist *lenlist  = NULL;
+  DLstrlist *encp, *ratep, *lenp;
+  GenStream *streams = NULL;
+  GenConn *conns     = NULL;
+  int streamcount, conncount;
+  int encoding;
+  int idx, cidx;
+  int running;
+  int rv = 0;
+
+  uint64_t records, bytes, errors, acks, latsum, latmin, latmax;
+  uint64_t lathist[LATBINS];
+  uint64_t lastrecords = 0;
+  int64_t starttime;
+  int64_t lastreport;
+  int64_t now;
+  double elapsed;
+
+  if (!dlconn || !params)
+    return -1;
+
+  streamcount = (params->streams > 0) ? params->streams : 1;
+  conncount   = (params->connections > 0) ? params->connections : 1;
+
+  if (conncount > streamcount)
+    conncount = streamcount;
+
+  if (!dlconn->writeperm)
+  {
+    dl_log (2, 0, "[%s] Server does not grant write permission\n", dlconn->addr);
+    return -1;
+  }
+
+  if (dl_strparse ((params->encodings) ? params->encodings : "STEIM2", ",", &enclist) <= 0 ||
+      dl_strparse ((params->samprates) ? params->samprates : "100", ",", &ratelist) <= 0 ||
+      dl_strparse ((params->reclens) ? params->reclens : "512", ",", &lenlist) <= 0)
+  {
+    dl_log (2, 0, "Cannot parse generator lists\n");
+    rv = -1;
+    goto cleanup;
+  }
+
+  if (!(streams = (GenStream *)calloc (streamcount, sizeof (GenStream))) ||
+      !(conns = (GenConn *)calloc (conncount, sizeof (GenConn))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for generator\n");
+    rv = -1;
+    goto cleanup;
+  }
+
+  /* Configure streams, cycling through the encoding, rate and length lists */
+  encp  = enclist;
+  ratep = ratelist;
+  lenp  = lenlist;
+  for (idx = 0; idx < streamcount; idx++)
+  {
+    if ((encoding = parseencoding (encp->element)) < 0)
+    {
+      dl_log (2, 0, "Unsupported encoding: %s\n", encp->element);
+      rv = -1;
+      goto cleanup;
+    }
+
+    if (genstream_init (&streams[idx], idx, (uint8_t)encoding,
+                        strtod (ratep->element, NULL),
+                        (int32_t)strtol (lenp->element, NULL, 10),
+                        params->formatversion))
+    {
+      rv = -1;
+      goto cleanup;
+    }
+
+    encp  = (encp->next) ? encp->next : enclist;
+    ratep = (ratep->next) ? ratep->next : ratelist;
+    lenp  = (lenp->next) ? lenp->next : lenlist;
+  }
+
+  starttime = clock_ns ();
+
+  /* Configure connections, each with a contiguous group of streams */
+  for (cidx = 0; cidx < conncount; cidx++)
+  {
+    GenConn *gc = &conns[cidx];
+    int first   = (int)((int64_t)streamcount * cidx / conncount);
+    int last    = (int)((int64_t)streamcount * (cidx + 1) / conncount);
+
+    gc->parent        = dlconn;
+    gc->streams       = &streams[first];
+    gc->streamcount   = last - first;
+    gc->rate          = params->rate * gc->streamcount / streamcount;
+    gc->deadline      = (params->duration > 0) ? starttime + (int64_t)(params->duration * 1e9) : 0;
+    gc->ack           = params->ack;
+    gc->formatversion = params->formatversion;
+    gc->latmin        = UINT64_MAX;
+
+    if (cidx == 0)
+    {
+      gc->dlconn = dlconn;
+    }
+    else
+    {
+      if (!(gc->dlconn = dl_newdlcp (dlconn->addr, "dalitool")))
+      {
+        rv = -1;
+        goto cleanup;
+      }
+
+      memcpy (gc->dlconn->clientid, dlconn->clientid, sizeof (gc->dlconn->clientid));
+      gc->dlconn->keepalive = dlconn->keepalive;
+      gc->dlconn->iotimeout = dlconn->iotimeout;
+
+      if (dl_connect (gc->dlconn) < 0)
+      {
+        dl_log (2, 0, "Error connecting to server for connection %d\n", cidx + 1);
+        rv = -1;
+        goto cleanup;
+      }
+    }
+  }
+
+  dl_log (1, 1, "Generating %d streams over %d connections\n", streamcount, conncount);
+
+  for (cidx = 0; cidx < conncount; cidx++)
+  {
+    if (pthread_create (&conns[cidx].tid, NULL, genthread, &conns[cidx]))
+    {
+      dl_log (2, 0, "Cannot create generator thread: %s\n", strerror (errno));
+      conns[cidx].done = 1;
+      dl_terminate (dlconn);
+    }
+  }
+
+  /* Wait for writing threads, reporting progress each second if verbose */
+  lastreport = starttime;
+  do
+  {
+    dlp_usleep (100000);
+
+    running = 0;
+    records = 0;
+    for (cidx = 0; cidx < conncount; cidx++)
+    {
+      if (!conns[cidx].done)
+        running++;
+
+      records += conns[cidx].records;
+    }
+
+    now = clock_ns ();
+    if ((now - lastreport) >= 1000000000)
+    {
+      dl_log (1, 1, "Generated %llu records, %.1f records/sec\n",
+              (unsigned long long int)records,
+              (records - lastrecords) / ((now - lastreport) / 1e9));
+      lastrecords = records;
+      lastreport  = now;
+    }
+  } while (running);
+
+  for (cidx = 0; cidx < conncount; cidx++)
+  {
+    if (conns[cidx].tid)
+      pthread_join (conns[cidx].tid, NULL);
+  }
+
+  elapsed = (clock_ns () - starttime) / 1e9;
+
+  /* Combine results of all connections */
+  records = bytes = errors = acks = latsum = latmax = 0;
+  latmin = UINT64_MAX;
+  memset (lathist, 0, sizeof (lathist));
+  for (cidx = 0; cidx < conncount; cidx++)
+  {
+    GenConn *gc = &conns[cidx];
+
+    records += gc->records;
+    bytes += gc->bytes;
+    errors += gc->errors;
+    acks += gc->acks;
+    latsum += gc->latsum;
+
+    if (gc->latmin < latmin)
+      latmin = gc->latmin;
+    if (gc->latmax > latmax)
+      latmax = gc->latmax;
+
+    for (idx = 0; idx < LATBINS; idx++)
+      lathist[idx] += gc->lathist[idx];
+  }
+
+  dl_log (0, 0, "Generated %llu records, %llu bytes in %.3f seconds over %d connections\n",
+          (unsigned long long int)records, (unsigned long long int)bytes, elapsed, conncount);
+  if (params->rate > 0)
+    dl_log (0, 0, "  Achieved: %.1f records/sec (target %g), %.1f bytes/sec\n",
+            (elapsed > 0) ? records / elapsed : 0.0, params->rate,
+            (elapsed > 0) ? bytes / elapsed : 0.0);
+  else
+    dl_log (0, 0, "  Achieved: %.1f records/sec (unlimited), %.1f bytes/sec\n",
+            (elapsed > 0) ? records / elapsed : 0.0,
+            (elapsed > 0) ? bytes / elapsed : 0.0);
+
+  if (acks > 0)
+    dl_log (0, 0, "  Ack latency (usec): min %llu, avg %.1f, p50 %llu, p99 %llu, max %llu\n",
+            (unsigned long long int)latmin, (double)latsum / acks,
+            (unsigned long long int)latpercentile (lathist, acks, 0.50),
+            (unsigned long long int)latpercentile (lathist, acks, 0.99),
+            (unsigned long long int)latmax);
+
+  if (errors > 0)
+    dl_log (0, 0, "  Errors: %llu\n", (unsigned long long int)errors);
+
+cleanup:
+  if (conns)
+  {
+    for (cidx = 1; cidx < conncount; cidx++)
+    {
+      if (conns[cidx].dlconn)
+      {
+        if (conns[cidx].dlconn->link != -1)
+          dl_disconnect (conns[cidx].dlconn);
+
+        dl_freedlcp (conns[cidx].dlconn);
+      }
+    }
+
+    free (conns);
+  }
+
+  if (streams)
+  {
+    for (idx = 0; idx < streamcount; idx++)
+      genstream_free (&streams[idx]);
+
+    free (streams);
+  }
+
+  dl_strparse (NULL, NULL, &enclist);
+  dl_strparse (NULL, NULL, &ratelist);
+  dl_strparse (NULL, NULL, &lenlist);
+
+  return rv;
+} /* End of rungenerate() */
+
+/***************************************************************************
+ * genthread:
+ *
+ * Thread routine writing records for the streams of a connection,
+ * cycling through the streams and pacing writes to the target rate.
+ * A failed write is counted as an error and the connection is
+ * re-established.
+ ***************************************************************************/
+static void *
+genthread (void *arg)
+{
+  GenConn *gc = (GenConn *)arg;
+  GenStream *gs;
+  char *record;
+  int reclen;
+  dltime_t start;
+  dltime_t end;
+  int64_t interval;
+  int64_t next;
+  int64_t now;
+  int64_t t0;
+  uint64_t latency;
+  int sidx = 0;
+
+  interval = (gc->rate > 0) ? (int64_t)(1e9 / gc->rate) : 0;
+  next     = clock_ns ();
+
+  while (!gc->parent->terminate && !gc->dlconn->terminate)
+  {
+    now = clock_ns ();
+
+    if (gc->deadline && now >= gc->deadline)
+      break;
+
+    /* Pace writes, sleeping at most 1/10 second to check for termination */
+    if (interval)
+    {
+      if (now < next)
+      {
+        dlp_usleep ((next - now > 100000000) ? 100000 : (next - now) / 1000);
+        continue;
+      }
+
+      next += interval;
+
+      /* Do not try to catch up after a stall of more than a second */
+      if (next < now - 1000000000)
+        next = now;
+    }
+
+    gs   = &gc->streams[sidx];
+    sidx = (sidx + 1) % gc->streamcount;
+
+    if (genrecord (gs, gc->formatversion, &record, &reclen, &start, &end))
+    {
+      gc->errors++;
+      break;
+    }
+
+    t0 = clock_ns ();
+
+    if (dl_write (gc->dlconn, record, reclen, gs->streamid, start, end, gc->ack) < 0)
+    {
+      gc->errors++;
+
+      /* Re-connect and continue after a short pause */
+      if (gc->dlconn->link != -1)
+        dl_disconnect (gc->dlconn);
+
+      dlp_usleep (1000000);
+
+      if (!gc->parent->terminate)
+        dl_connect (gc->dlconn);
+
+      continue;
+    }
+
+    gc->records++;
+    gc->bytes += reclen;
+
+    if (gc->ack)
+    {
+      latency = (uint64_t)((clock_ns () - t0) / 1000);
+
+      gc->acks++;
+      gc->latsum += latency;
+      gc->lathist[latbin (latency)]++;
+
+      if (latency < gc->latmin)
+        gc->latmin = latency;
+      if (latency > gc->latmax)
+        gc->latmax = latency;
+    }
+  }
+
+  gc->done = 1;
+
+  return NULL;
+} /* End of genthread() */
+
+/***************************************************************************
+ * genstream_init:
+ *
+ * Initialize a synthetic stream with the specified parameters.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+genstream_init (GenStream *gs, int index, uint8_t encoding,
+                double samprate, int32_t reclen, int formatversion)
+{
+  char station[11];
+  char channel[4];
+  char sid[LM_SIDLEN];
+  int samplesize;
+
+  if (samprate <= 0.0)
+  {
+    dl_log (2, 0, "Invalid sample rate: %g\n", samprate);
+    return -1;
+  }
+
+  if (reclen < 128 || reclen > MAXRECLEN ||
+      (formatversion == 2 && (reclen & (reclen - 1)) != 0))
+  {
+    dl_log (2, 0, "Invalid record length: %d\n", reclen);
+    return -1;
+  }
+
+  /* Three components per station, band code follows the sample rate */
+  snprintf (station, sizeof (station), "G%04d", index / 3);
+  channel[0] = (samprate >= 80.0) ? 'H' : (samprate >= 10.0) ? 'B' : (samprate >= 1.0) ? 'L' : 'V';
+  channel[1] = 'H';
+  channel[2] = "ZNE"[index % 3];
+  channel[3] = '\0';
+
+  if (ms_nslc2sid (sid, sizeof (sid), 0, "XX", station, "00", channel) < 0 ||
+      sid2streamid (sid, formatversion, gs->streamid, sizeof (gs->streamid)))
+  {
+    dl_log (2, 0, "Cannot create stream identifiers for stream %d\n", index);
+    return -1;
+  }
+
+  if (!(gs->msr = msr3_init (NULL)))
+    return -1;
+
+  memcpy (gs->msr->sid, sid, sizeof (gs->msr->sid));
+  gs->msr->formatversion = (formatversion == 3) ? 3 : 2;
+  gs->msr->reclen        = reclen;
+  gs->msr->encoding      = encoding;
+  gs->msr->samprate      = samprate;
+  gs->msr->pubversion    = 1;
+  gs->msr->starttime     = (nstime_t)dlp_time () * (NSTMODULUS / DLTMODULUS);
+
+  if (encoding == DE_FLOAT32)
+    gs->msr->sampletype = 'f';
+  else if (encoding == DE_FLOAT64)
+    gs->msr->sampletype = 'd';
+  else
+    gs->msr->sampletype = 'i';
+
+  /* Enough samples for a few records of the least compressed encoding */
+  samplesize     = ms_samplesize (gs->msr->sampletype);
+  gs->maxsamples = 4 * reclen;
+
+  if (!(gs->msr->datasamples = malloc (gs->maxsamples * samplesize)))
+    return -1;
+
+  gs->msr->datasize = gs->maxsamples * samplesize;
+  gs->seed          = 2463534242u + index;
+
+  return 0;
+} /* End of genstream_init() */
+
+/***************************************************************************
+ * genstream_free:
+ *
+ * Free all memory associated with a synthetic stream.
+ ***************************************************************************/
+static void
+genstream_free (GenStream *gs)
+{
+  if (gs->msr)
+    msr3_free (&gs->msr);
+
+  if (gs->hdr)
+    msr3_free (&gs->hdr);
+
+  if (gs->records)
+    free (gs->records);
+} /* End of genstream_free() */
+
+/***************************************************************************
+ * genrecord:
+ *
+ * Return the next record of a synthetic stream, generating samples
+ * and packing records as needed.  The record buffer is owned by the
+ * stream and is valid until the next call.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+genrecord (GenStream *gs, int formatversion, char **record,
+           int *reclen, dltime_t *start, dltime_t *end)
+{
+  MS3Record *msr = gs->msr;
+  int64_t packedsamples;
+  int64_t idx;
+  int32_t value;
+
+  if (gs->recordpos >= gs->recordlen)
+  {
+    gs->recordpos = 0;
+    gs->recordlen = 0;
+
+    /* Fill sample buffer with a mean-reverting random walk */
+    for (idx = msr->numsamples; idx < gs->maxsamples; idx++)
+    {
+      gs->seed ^= gs->seed << 13;
+      gs->seed ^= gs->seed >> 17;
+      gs->seed ^= gs->seed << 5;
+
+      gs->level += (int32_t)(gs->seed % 257) - 128 - (gs->level / 64);
+
+      value = (gs->level > 32767) ? 32767 : (gs->level < -32768) ? -32768 : gs->level;
+
+      if (msr->sampletype == 'f')
+        ((float *)msr->datasamples)[idx] = (float)value / 8;
+      else if (msr->sampletype == 'd')
+        ((double *)msr->datasamples)[idx] = (double)value / 8;
+      else
+        ((int32_t *)msr->datasamples)[idx] = value;
+    }
+
+    msr->numsamples = gs->maxsamples;
+    msr->samplecnt  = gs->maxsamples;
+
+    /* Pack complete records only, leaving the remaining samples for the next */
+    gs->packerror = 0;
+    if (msr3_pack (msr, genhandler, gs, &packedsamples,
+                   (formatversion == 3) ? 0 : MSF_PACKVER2, 0) < 0 ||
+        packedsamples <= 0 || gs->packerror)
+    {
+      dl_log (2, 0, "Cannot pack records for %s\n", gs->streamid);
+      return -1;
+    }
+
+    memmove (msr->datasamples,
+             (char *)msr->datasamples + packedsamples * ms_samplesize (msr->sampletype),
+             (msr->numsamples - packedsamples) * ms_samplesize (msr->sampletype));
+    msr->numsamples -= packedsamples;
+    msr->starttime = ms_sampletime (msr->starttime, packedsamples, msr->samprate);
+  }
+
+  /* Records are stored with a leading length */
+  memcpy (reclen, gs->records + gs->recordpos, sizeof (int));
+  *record = gs->records + gs->recordpos + sizeof (int);
+  gs->recordpos += sizeof (int) + *reclen;
+
+  if (msr3_parse (*record, *reclen, &gs->hdr, 0, 0) != MS_NOERROR)
+  {
+    dl_log (2, 0, "Cannot parse generated record for %s\n", gs->streamid);
+    return -1;
+  }
+
+  *start = gs->hdr->starttime / (NSTMODULUS / DLTMODULUS);
+  *end   = msr3_endtime (gs->hdr) / (NSTMODULUS / DLTMODULUS);
+
+  return 0;
+} /* End of genrecord() */
+
+/***************************************************************************
+ * genhandler:
+ *
+ * Record handler for msr3_pack(), appends each record to the pending
+ * records of a stream.  On allocation failure the stream is flagged so
+ * that genrecord() fails instead of skipping the record.
+ ***************************************************************************/
+static void
+genhandler (char *record, int reclen, void *handlerdata)
+{
+  GenStream *gs = (GenStream *)handlerdata;
+  size_t needed = gs->recordlen + sizeof (int) + reclen;
+  char *newrecords;
+
+  if (gs->packerror)
+    return;
+
+  if (needed > gs->recordsize)
+  {
+    if (!(newrecords = (char *)realloc (gs->records, needed * 2)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for records of %s\n", gs->streamid);
+      gs->packerror = 1;
+      return;
+    }
+
+    gs->records    = newrecords;
+    gs->recordsize = needed * 2;
+  }
+
+  memcpy (gs->records + gs->recordlen, &reclen, sizeof (int));
+  memcpy (gs->records + gs->recordlen + sizeof (int), record, reclen);
+  gs->recordlen = needed;
+} /* End of genhandler() */
+
+/***************************************************************************
+ * parseencoding:
+ *
+ * Return the encoding value for an encoding name or number.
+ *
+ * Returns the encoding on success and -1 if not supported.
+ ***************************************************************************/
+static int
+parseencoding (const char *name)
+{
+  char *tail;
+  long value;
+  int idx;
+
+  for (idx = 0; encodingnames[idx].name; idx++)
+  {
+    if (!strcasecmp (name, encodingnames[idx].name))
+      return encodingnames[idx].encoding;
+  }
+
+  value = strtol (name, &tail, 10);
+
+  if (*tail == '\0')
+  {
+    for (idx = 0; encodingnames[idx].name; idx++)
+    {
+      if (value == encodingnames[idx].encoding)
+        return encodingnames[idx].encoding;
+    }
+  }
+
+  return -1;
+} /* End of parseencoding() */
+
+/***************************************************************************
+ * latbin, binlower:
+ *
+ * Map a latency in microseconds to a histogram bin and a bin to the
+ * lower bound of its range.  Bins are logarithmic with four bins per
+ * power of two, values below 8 have a bin each.
+ ***************************************************************************/
+static int
+latbin (uint64_t usec)
+{
+  int msb = 0;
+  int bin;
+
+  if (usec < 8)
+    return (int)usec;
+
+  while ((usec >> msb) > 1)
+    msb++;
+
+  bin = msb * 4 + (int)((usec >> (msb - 2)) & 3);
+
+  return (bin < LATBINS) ? bin : LATBINS - 1;
+}
+
+static uint64_t
+binlower (int bin)
+{
+  if (bin < 8)
+    return (uint64_t)bin;
+
+  return (uint64_t)(4 + (bin % 4)) << (bin / 4 - 2);
+}
+
+/***************************************************************************
+ * latpercentile:
+ *
+ * Return the latency at the specified fraction of a histogram as the
+ * upper bound of the bin containing it.
+ ***************************************************************************/
+static uint64_t
+latpercentile (uint64_t *hist, uint64_t count, double fraction)
+{
+  uint64_t target = (uint64_t)(count * fraction);
+  uint64_t cumulative = 0;
+  int bin;
+
+  for (bin = 0; bin < LATBINS - 1; bin++)
+  {
+    cumulative += hist[bin];
+
+    if (cumulative > target)
+      return binlower (bin + 1);
+  }
+
+  return binlower (LATBINS - 1);
+} /* End of latpercentile() */
+
+#else /* WIN32 */
+
+int
+rungenerate (DLCP *dlconn, GenParams *params)
+{
+  dl_log (2, 0, "Load generation is not supported on this platform\n");
+  return -1;
+}
+
+#endif /* WIN32 */
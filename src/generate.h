@@ -0,0 +1,32 @@
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Parameters for synthetic data generation */
+typedef struct GenParams_s
+{
+  int streams;          /* Number of streams to generate */
+  int connections;      /* Number of connections to write with */
+  double rate;          /* Target aggregate rate in records/second, 0 is unlimited */
+  double duration;      /* Duration to run in seconds, 0 is unlimited */
+  char *encodings;      /* Comma-separated list of encodings */
+  char *samprates;      /* Comma-separated list of sample rates */
+  char *reclens;        /* Comma-separated list of record lengths */
+  int formatversion;    /* miniSEED format version to generate */
+  int ack;              /* Request acknowledgement of each record */
+} GenParams;
+
+extern int rungenerate (DLCP *dlconn, GenParams *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* GENERATE_H */
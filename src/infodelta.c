@@ -0,0 +1,467 @@
+/***************************************************************************
+ * infodelta.c
+ *
+ * Incremental polling of the server stream or connection list.
+ *
+ * Each poll requests the STREAMS or CONNECTIONS list and parses it as
+ * a stream of elements, comparing each entry with the previous poll
+ * kept in a hash table keyed by stream name or connection.  Rates
+ * over the poll interval are computed on the client and only the
+ * entries that changed, appeared, disappeared or crossed the latency
+ * threshold are printed, followed by a one line summary.
+ *
+ * Streams change when their latest packet ID changes and are printed
+ * with the rate at which their data time advanced, in seconds of data
+ * per second, and the latency and its change.  Connections change
+ * when their packet or byte counts change and are printed with their
+ * transmit and receive rates.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "common.h"
+#include "infodelta.h"
+#include "infoxml.h"
+#include "strhash.h"
+
+/* Previous state of a stream or connection */
+typedef struct DeltaEntry_s
+{
+  char *key;                    /* Stream name or connection key */
+  uint32_t poll;                /* Poll the entry was last seen */
+  int64_t pktid;                /* Latest packet ID */
+  dltime_t dataend;             /* Latest packet data end time */
+  double latency;               /* Latency in seconds */
+  int lagging;                  /* Flag: latency over the threshold */
+  uint64_t txpackets;           /* Connection packets transmitted */
+  uint64_t txbytes;             /* Connection bytes transmitted */
+  uint64_t rxpackets;           /* Connection packets received */
+  uint64_t rxbytes;             /* Connection bytes received */
+} DeltaEntry;
+
+struct InfoDelta_s
+{
+  int connections;              /* Flag: polling connections, otherwise streams */
+  double threshold;             /* Latency threshold in seconds, 0 disables */
+  StrHash *entries;             /* Previous state, keyed by stream or connection */
+  uint32_t poll;                /* Poll count */
+  int64_t polltime;             /* Time of current poll, nanoseconds */
+  int64_t lasttime;             /* Time of previous poll, nanoseconds */
+  double interval;              /* Seconds since previous poll */
+  FILE *prtstream;              /* Output stream */
+  int seen;                     /* Entries in current poll */
+  int changed;                  /* Entries changed in current poll */
+  int added;                    /* Entries new in current poll */
+  int error;                    /* Flag: error during poll */
+};
+
+static int infodelta_start (void *data, const char *name, const char **attrs, int depth);
+static int infodelta_chunk (char *chunk, int chunklen, void *handlerdata);
+static void infodelta_stream (InfoDelta *delta, const char **attrs);
+static void infodelta_connection (InfoDelta *delta, const char **attrs);
+static DeltaEntry *infodelta_entry (InfoDelta *delta, const char *key, int *isnew);
+static int infodelta_remove (InfoDelta *delta);
+static void infodelta_freeentry (void *value);
+
+/***************************************************************************
+ * infodelta_new:
+ *
+ * Create a new delta poller for STREAMS or CONNECTIONS.  Entries
+ * whose latency crosses latencythreshold seconds, in either
+ * direction, are printed even if they did not otherwise change, 0
+ * disables the threshold.
+ *
+ * Returns a pointer to the poller on success and NULL on error.
+ ***************************************************************************/
+InfoDelta *
+infodelta_new (const char *infotype, double latencythreshold)
+{
+  InfoDelta *delta;
+
+  if (!infotype ||
+      (strncasecmp (infotype, "STREAMS", 7) && strncasecmp (infotype, "CONNECTIONS", 11)))
+  {
+    dl_log (2, 0, "Delta polling is only supported for STREAMS and CONNECTIONS\n");
+    return NULL;
+  }
+
+  if (!(delta = (InfoDelta *)calloc (1, sizeof (InfoDelta))) ||
+      !(delta->entries = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for delta polling\n");
+    free (delta);
+    return NULL;
+  }
+
+  delta->connections = !strncasecmp (infotype, "CONNECTIONS", 11);
+  delta->threshold   = latencythreshold;
+
+  return delta;
+} /* End of infodelta_new() */
+
+/***************************************************************************
+ * infodelta_poll:
+ *
+ * Request the stream or connection list from the server and print the
+ * entries that changed since the previous poll.  The first poll only
+ * records the state and prints the summary.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+infodelta_poll (InfoDelta *delta, DLCP *dlconn, char *infomatch, FILE *prtstream)
+{
+  InfoXML *parser;
+  char timestr[50];
+  int removed;
+  int rv;
+
+  if (!delta || !dlconn || !prtstream)
+    return -1;
+
+  delta->poll++;
+  delta->polltime  = clock_ns ();
+  delta->interval  = (delta->lasttime) ? (delta->polltime - delta->lasttime) / 1e9 : 0.0;
+  delta->prtstream = prtstream;
+  delta->seen      = 0;
+  delta->changed   = 0;
+  delta->added     = 0;
+  delta->error     = 0;
+
+  if (!(parser = infoxml_new (infodelta_start, NULL, delta)))
+    return -1;
+
+  if (dl_getinfochunks (dlconn, (delta->connections) ? "CONNECTIONS" : "STREAMS",
+                        infomatch, infodelta_chunk, parser) < 0)
+    rv = -1;
+  else
+    rv = infoxml_finish (parser);
+
+  infoxml_free (parser);
+
+  if (rv || delta->error)
+    return -1;
+
+  /* Entries not seen in this poll have gone */
+  if ((removed = infodelta_remove (delta)) < 0)
+    return -1;
+
+  dl_dltime2mdtimestr (dlp_time (), timestr, 0);
+
+  if (delta->poll == 1)
+    fprintf (prtstream, "%s UTC: tracking %d %s\n", timestr, delta->seen,
+             (delta->connections) ? "connections" : "streams");
+  else
+    fprintf (prtstream, "%s UTC: %d of %d %s changed, %d new, %d removed in %.3f seconds\n",
+             timestr, delta->changed, delta->seen,
+             (delta->connections) ? "connections" : "streams",
+             delta->added, removed, delta->interval);
+
+  fflush (prtstream);
+
+  delta->lasttime = delta->polltime;
+
+  return 0;
+} /* End of infodelta_poll() */
+
+/***************************************************************************
+ * infodelta_free:
+ *
+ * Free the delta poller and all recorded state.
+ ***************************************************************************/
+void
+infodelta_free (InfoDelta *delta)
+{
+  if (!delta)
+    return;
+
+  strhash_free (delta->entries, infodelta_freeentry);
+  free (delta);
+} /* End of infodelta_free() */
+
+/***************************************************************************
+ * infodelta_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+infodelta_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of infodelta_chunk() */
+
+/***************************************************************************
+ * infodelta_start:
+ *
+ * Element start callback: compare each stream or connection with its
+ * previous state.
+ ***************************************************************************/
+static int
+infodelta_start (void *data, const char *name, const char **attrs, int depth)
+{
+  InfoDelta *delta = (InfoDelta *)data;
+
+  if (depth == 0 && strcmp (name, "DataLink"))
+  {
+    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+    return -1;
+  }
+
+  if (depth != 2)
+    return 0;
+
+  if (delta->connections && !strcmp (name, "Connection"))
+    infodelta_connection (delta, attrs);
+  else if (!delta->connections && !strcmp (name, "Stream"))
+    infodelta_stream (delta, attrs);
+
+  return (delta->error) ? -1 : 0;
+} /* End of infodelta_start() */
+
+/***************************************************************************
+ * infodelta_stream:
+ *
+ * Compare a stream with its previous state and print it if changed.
+ ***************************************************************************/
+static void
+infodelta_stream (InfoDelta *delta, const char **attrs)
+{
+  DeltaEntry *entry;
+  const char *name;
+  const char *value;
+  char timestr[50];
+  dltime_t dataend = DLTERROR;
+  int64_t pktid;
+  double latency;
+  double datarate = 0.0;
+  int lagging;
+  int crossed;
+  int isnew;
+
+  if (!(name = infoxml_attr (attrs, "Name")))
+    return;
+
+  if (!(entry = infodelta_entry (delta, name, &isnew)))
+    return;
+
+  value   = infoxml_attr (attrs, "LatestPacketID");
+  pktid   = (value) ? strtoll (value, NULL, 10) : -1;
+  value   = infoxml_attr (attrs, "DataLatency");
+  latency = (value) ? strtod (value, NULL) : 0.0;
+  lagging = (delta->threshold > 0 && latency > delta->threshold);
+  crossed = (!isnew && lagging != entry->lagging);
+
+  if ((value = infoxml_attr (attrs, "LatestPacketDataEndTime")))
+  {
+    snprintf (timestr, sizeof (timestr), "%s", value);
+    dataend = dl_timestr2dltime (timestr);
+  }
+
+  if (!isnew && delta->interval > 0 && dataend != DLTERROR && entry->dataend != DLTERROR)
+    datarate = (double)(dataend - entry->dataend) / DLTMODULUS / delta->interval;
+
+  if (isnew || pktid != entry->pktid)
+    delta->changed++;
+
+  if (delta->poll > 1 && (isnew || pktid != entry->pktid || crossed))
+  {
+    if (isnew)
+      fprintf (delta->prtstream, "+ %-22s packet %lld  latency %.1f seconds\n",
+               name, (long long int)pktid, latency);
+    else
+      fprintf (delta->prtstream, "%c %-22s packet %lld  data %.2f sec/sec  latency %.1f (%+.1f) seconds\n",
+               (crossed) ? '!' : ' ', name, (long long int)pktid, datarate,
+               latency, latency - entry->latency);
+  }
+
+  entry->pktid   = pktid;
+  entry->dataend = dataend;
+  entry->latency = latency;
+  entry->lagging = lagging;
+} /* End of infodelta_stream() */
+
+/***************************************************************************
+ * infodelta_connection:
+ *
+ * Compare a connection with its previous state and print it if
+ * changed.  Connections are identified by address, port and
+ * connection time.
+ ***************************************************************************/
+static void
+infodelta_connection (InfoDelta *delta, const char **attrs)
+{
+  DeltaEntry *entry;
+  const char *host, *ip, *port, *clientid, *conntime;
+  const char *value;
+  char key[256];
+  uint64_t txpackets, txbytes, rxpackets, rxbytes;
+  double latency;
+  double interval;
+  int lagging;
+  int crossed;
+  int changed;
+  int isnew;
+
+  host     = infoxml_attr (attrs, "Host");
+  ip       = infoxml_attr (attrs, "IP");
+  port     = infoxml_attr (attrs, "Port");
+  clientid = infoxml_attr (attrs, "ClientID");
+  conntime = infoxml_attr (attrs, "ConnectionTime");
+
+  snprintf (key, sizeof (key), "%s:%s %s", (ip) ? ip : "-", (port) ? port : "-",
+            (conntime) ? conntime : "-");
+
+  if (!(entry = infodelta_entry (delta, key, &isnew)))
+    return;
+
+  value     = infoxml_attr (attrs, "TXPacketCount");
+  txpackets = (value) ? strtoull (value, NULL, 10) : 0;
+  value     = infoxml_attr (attrs, "TXByteCount");
+  txbytes   = (value) ? strtoull (value, NULL, 10) : 0;
+  value     = infoxml_attr (attrs, "RXPacketCount");
+  rxpackets = (value) ? strtoull (value, NULL, 10) : 0;
+  value     = infoxml_attr (attrs, "RXByteCount");
+  rxbytes   = (value) ? strtoull (value, NULL, 10) : 0;
+  value     = infoxml_attr (attrs, "Latency");
+  latency   = (value) ? strtod (value, NULL) : 0.0;
+  lagging   = (delta->threshold > 0 && latency > delta->threshold);
+  crossed   = (!isnew && lagging != entry->lagging);
+
+  changed = (isnew || txpackets != entry->txpackets || txbytes != entry->txbytes ||
+             rxpackets != entry->rxpackets || rxbytes != entry->rxbytes);
+
+  if (changed)
+    delta->changed++;
+
+  if (delta->poll > 1 && (changed || crossed))
+  {
+    fprintf (delta->prtstream, "%c %s [%s:%s]  %s\n",
+             (isnew) ? '+' : (crossed) ? '!' : ' ',
+             (host) ? host : "-", (ip) ? ip : "-", (port) ? port : "-",
+             (clientid) ? clientid : "-");
+
+    if (!isnew && delta->interval > 0)
+    {
+      interval = delta->interval;
+
+      fprintf (delta->prtstream, "  TX %.1f packets/sec %.1f bytes/sec  RX %.1f packets/sec %.1f bytes/sec  latency %.1f (%+.1f) seconds\n",
+               (txpackets - entry->txpackets) / interval, (txbytes - entry->txbytes) / interval,
+               (rxpackets - entry->rxpackets) / interval, (rxbytes - entry->rxbytes) / interval,
+               latency, latency - entry->latency);
+    }
+  }
+
+  entry->txpackets = txpackets;
+  entry->txbytes   = txbytes;
+  entry->rxpackets = rxpackets;
+  entry->rxbytes   = rxbytes;
+  entry->latency   = latency;
+  entry->lagging   = lagging;
+} /* End of infodelta_connection() */
+
+/***************************************************************************
+ * infodelta_entry:
+ *
+ * Find or add the entry for a key and mark it seen in this poll.
+ *
+ * Returns a pointer to the entry on success and NULL on error.
+ ***************************************************************************/
+static DeltaEntry *
+infodelta_entry (InfoDelta *delta, const char *key, int *isnew)
+{
+  DeltaEntry *entry;
+
+  *isnew = 0;
+
+  if (!(entry = (DeltaEntry *)strhash_get (delta->entries, key)))
+  {
+    if (!(entry = (DeltaEntry *)calloc (1, sizeof (DeltaEntry))) ||
+        !(entry->key = strdup (key)) ||
+        strhash_put (delta->entries, key, entry))
+    {
+      dl_log (2, 0, "Cannot allocate memory for delta polling\n");
+      infodelta_freeentry (entry);
+      delta->error = 1;
+      return NULL;
+    }
+
+    entry->dataend = DLTERROR;
+    *isnew         = 1;
+    delta->added++;
+  }
+
+  if (entry->poll != delta->poll)
+  {
+    entry->poll = delta->poll;
+    delta->seen++;
+  }
+
+  return entry;
+} /* End of infodelta_entry() */
+
+/***************************************************************************
+ * infodelta_remove:
+ *
+ * Print and remove the entries not seen in the current poll.
+ *
+ * Returns the number of entries removed on success and -1 on error.
+ ***************************************************************************/
+static int
+infodelta_remove (InfoDelta *delta)
+{
+  StrHashEntry *hentry = NULL;
+  DeltaEntry **gone    = NULL;
+  DeltaEntry *entry;
+  int count = 0;
+  int idx;
+
+  if (delta->entries->count == (size_t)delta->seen)
+    return 0;
+
+  if (!(gone = (DeltaEntry **)malloc ((delta->entries->count - delta->seen) * sizeof (DeltaEntry *))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for delta polling\n");
+    return -1;
+  }
+
+  while ((hentry = strhash_next (delta->entries, hentry)))
+  {
+    entry = (DeltaEntry *)hentry->value;
+
+    if (entry->poll != delta->poll)
+      gone[count++] = entry;
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    fprintf (delta->prtstream, "- %s\n", gone[idx]->key);
+
+    strhash_remove (delta->entries, gone[idx]->key);
+    infodelta_freeentry (gone[idx]);
+  }
+
+  free (gone);
+
+  return count;
+} /* End of infodelta_remove() */
+
+/***************************************************************************
+ * infodelta_freeentry:
+ *
+ * Free an entry.
+ ***************************************************************************/
+static void
+infodelta_freeentry (void *value)
+{
+  DeltaEntry *entry = (DeltaEntry *)value;
+
+  if (!entry)
+    return;
+
+  free (entry->key);
+  free (entry);
+} /* End of infodelta_freeentry() */
@@ -0,0 +1,24 @@
+
+#ifndef INFODELTA_H
+#define INFODELTA_H
+
+#include <stdio.h>
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct InfoDelta_s InfoDelta;
+
+extern InfoDelta *infodelta_new (const char *infotype, double latencythreshold);
+extern int infodelta_poll (InfoDelta *delta, DLCP *dlconn, char *infomatch, FILE *prtstream);
+extern void infodelta_free (InfoDelta *delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* INFODELTA_H */
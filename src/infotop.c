@@ -0,0 +1,751 @@
+/***************************************************************************
+ * infotop.c
+ *
+ * A live, "top" like table of the server streams or connections.
+ *
+ * Each poll requests the STREAMS or CONNECTIONS list, parsed as a
+ * stream of elements, and keeps the entries in a hash table keyed by
+ * stream name or connection so that stream data rates can be derived
+ * between polls.  The entries are sorted by latency, rate, lag or
+ * name and the table is rendered to fit the terminal.
+ *
+ * The rendered rows of the previous frame are kept and only the rows
+ * that differ are redrawn, using ANSI cursor positioning, with the
+ * whole frame written at once.  The table is drawn on the alternate
+ * screen of the terminal, which is restored when done.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#ifndef WIN32
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "infotop.h"
+#include "infoxml.h"
+#include "strhash.h"
+
+/* Limits of the rendered table width */
+#define TOP_MINCOLS 40
+#define TOP_MAXCOLS 512
+
+/* Rows before the table entries: status, summary, heading */
+#define TOP_HEADROWS 3
+
+/* Sort keys */
+enum
+{
+  TOP_SORT_LATENCY,
+  TOP_SORT_RATE,
+  TOP_SORT_LAG,
+  TOP_SORT_NAME
+};
+
+static const char *sortnames[] = {"latency", "rate", "lag", "name"};
+
+/* A stream or connection */
+typedef struct TopEntry_s
+{
+  char *key;                    /* Stream name or connection key */
+  char name[128];               /* Stream name or connection address */
+  char client[128];             /* Connection client ID */
+  uint32_t poll;                /* Poll the entry was last seen */
+  int64_t pktid;                /* Latest packet ID of stream */
+  dltime_t dataend;             /* Latest data end time of stream */
+  double datarate;              /* Stream data rate in seconds per second, negative if
+                                   unknown, or connection packet rate */
+  double txpacketrate;          /* Connection transmit packet rate */
+  double rxpacketrate;          /* Connection receive packet rate */
+  double txbyterate;            /* Connection transmit byte rate */
+  double rxbyterate;            /* Connection receive byte rate */
+  double latency;               /* Latency in seconds */
+  double lag;                   /* Connection lag in percent */
+} TopEntry;
+
+struct InfoTop_s
+{
+  int connections;              /* Flag: connections, otherwise streams */
+  int sortkey;                  /* Sort key */
+  StrHash *entries;             /* Entries keyed by stream or connection */
+  TopEntry **rows;              /* Entries of the current poll */
+  int rowcount;                 /* Number of rows */
+  int rowsize;                  /* Allocated entries of rows */
+  uint32_t poll;                /* Poll count */
+  int64_t polltime;             /* Time of current poll, nanoseconds */
+  int64_t lasttime;             /* Time of previous poll, nanoseconds */
+  double interval;              /* Seconds since previous poll */
+  char serverid[100];           /* Server ID */
+  int total;                    /* Total streams or connections of server */
+  int error;                    /* Flag: error during poll */
+  FILE *prtstream;              /* Output stream */
+  int started;                  /* Flag: terminal set up */
+  int screenrows;               /* Terminal rows of previous frame */
+  int screencols;               /* Terminal columns of previous frame */
+  char *screen;                 /* Rows of previous frame, screencols + 1 each */
+  char *frame;                  /* Output of the current frame */
+  size_t framelen;              /* Length of frame output */
+  size_t framesize;             /* Allocated size of frame */
+};
+
+static int infotop_start (void *data, const char *name, const char **attrs, int depth);
+static int infotop_chunk (char *chunk, int chunklen, void *handlerdata);
+static void infotop_stream (InfoTop *top, const char **attrs);
+static void infotop_connection (InfoTop *top, const char **attrs);
+static TopEntry *infotop_entry (InfoTop *top, const char *key);
+static int infotop_remove (InfoTop *top);
+static int infotop_compare (const void *a, const void *b);
+static int infotop_render (InfoTop *top);
+static int infotop_row (InfoTop *top, int row, const char *text, int heading);
+static int infotop_emit (InfoTop *top, const char *data, size_t length);
+static double infotop_number (const char **attrs, const char *name);
+static void infotop_freeentry (void *value);
+
+/* Sort key for infotop_compare(), qsort() has no user data */
+static int comparekey;
+
+/***************************************************************************
+ * infotop_new:
+ *
+ * Create a new table for STREAMS or CONNECTIONS sorted by sortkey,
+ * one of latency, rate, lag or name, default latency.
+ *
+ * Returns a pointer to the table on success and NULL on error.
+ ***************************************************************************/
+InfoTop *
+infotop_new (const char *infotype, const char *sortkey)
+{
+  InfoTop *top;
+  int key = TOP_SORT_LATENCY;
+
+  if (!infotype ||
+      (strncasecmp (infotype, "STREAMS", 7) && strncasecmp (infotype, "CONNECTIONS", 11)))
+  {
+    dl_log (2, 0, "The top table is only supported for STREAMS and CONNECTIONS\n");
+    return NULL;
+  }
+
+  if (sortkey)
+  {
+    for (key = 0; key < (int)(sizeof (sortnames) / sizeof (sortnames[0])); key++)
+    {
+      if (!strcasecmp (sortkey, sortnames[key]))
+        break;
+    }
+
+    if (key == (int)(sizeof (sortnames) / sizeof (sortnames[0])))
+    {
+      dl_log (2, 0, "Unrecognized sort key: %s, use latency, rate, lag or name\n", sortkey);
+      return NULL;
+    }
+  }
+
+  if (!(top = (InfoTop *)calloc (1, sizeof (InfoTop))) ||
+      !(top->entries = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for top table\n");
+    free (top);
+    return NULL;
+  }
+
+  top->connections = !strncasecmp (infotype, "CONNECTIONS", 11);
+  top->sortkey     = key;
+
+  return top;
+} /* End of infotop_new() */
+
+/***************************************************************************
+ * infotop_poll:
+ *
+ * Request the stream or connection list from the server and redraw
+ * the rows of the table that changed.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+infotop_poll (InfoTop *top, DLCP *dlconn, char *infomatch, FILE *prtstream)
+{
+  InfoXML *parser;
+  int rv;
+
+  if (!top || !dlconn || !prtstream)
+    return -1;
+
+  top->poll++;
+  top->polltime  = clock_ns ();
+  top->interval  = (top->lasttime) ? (top->polltime - top->lasttime) / 1e9 : 0.0;
+  top->prtstream = prtstream;
+  top->rowcount  = 0;
+  top->total     = 0;
+  top->error     = 0;
+
+  if (!(parser = infoxml_new (infotop_start, NULL, top)))
+    return -1;
+
+  if (dl_getinfochunks (dlconn, (top->connections) ? "CONNECTIONS" : "STREAMS",
+                        infomatch, infotop_chunk, parser) < 0)
+    rv = -1;
+  else
+    rv = infoxml_finish (parser);
+
+  infoxml_free (parser);
+
+  if (rv || top->error)
+    return -1;
+
+  /* Entries not seen in this poll have gone */
+  if (infotop_remove (top) < 0)
+    return -1;
+
+  comparekey = top->sortkey;
+  qsort (top->rows, top->rowcount, sizeof (TopEntry *), infotop_compare);
+
+  if (infotop_render (top) < 0)
+    return -1;
+
+  top->lasttime = top->polltime;
+
+  return 0;
+} /* End of infotop_poll() */
+
+/***************************************************************************
+ * infotop_free:
+ *
+ * Restore the terminal and free the table.
+ ***************************************************************************/
+void
+infotop_free (InfoTop *top)
+{
+  if (!top)
+    return;
+
+  /* Show the cursor and leave the alternate screen */
+  if (top->started)
+  {
+    fputs ("\033[?25h\033[?1049l", top->prtstream);
+    fflush (top->prtstream);
+  }
+
+  strhash_free (top->entries, infotop_freeentry);
+  free (top->rows);
+  free (top->screen);
+  free (top->frame);
+  free (top);
+} /* End of infotop_free() */
+
+/***************************************************************************
+ * infotop_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+infotop_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of infotop_chunk() */
+
+/***************************************************************************
+ * infotop_start:
+ *
+ * Element start callback: record the server ID, the list totals and
+ * each stream or connection.
+ ***************************************************************************/
+static int
+infotop_start (void *data, const char *name, const char **attrs, int depth)
+{
+  InfoTop *top = (InfoTop *)data;
+  const char *serverid;
+  const char *version;
+  const char *value;
+
+  if (depth == 0)
+  {
+    if (strcmp (name, "DataLink"))
+    {
+      dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+      return -1;
+    }
+
+    serverid = infoxml_attr (attrs, "ServerID");
+    version  = infoxml_attr (attrs, "Version");
+
+    snprintf (top->serverid, sizeof (top->serverid), "%s %s",
+              (serverid) ? serverid : "-", (version) ? version : "");
+  }
+  else if (depth == 1 && (!strcmp (name, "StreamList") || !strcmp (name, "ConnectionList")))
+  {
+    if ((value = infoxml_attr (attrs, (top->connections) ? "TotalConnections" : "TotalStreams")))
+      top->total = (int)strtol (value, NULL, 10);
+  }
+  else if (depth == 2)
+  {
+    if (top->connections && !strcmp (name, "Connection"))
+      infotop_connection (top, attrs);
+    else if (!top->connections && !strcmp (name, "Stream"))
+      infotop_stream (top, attrs);
+  }
+
+  return (top->error) ? -1 : 0;
+} /* End of infotop_start() */
+
+/***************************************************************************
+ * infotop_stream:
+ *
+ * Update a stream, deriving its data rate from the previous poll.
+ ***************************************************************************/
+static void
+infotop_stream (InfoTop *top, const char **attrs)
+{
+  TopEntry *entry;
+  const char *name;
+  const char *value;
+  char timestr[50];
+  dltime_t dataend = DLTERROR;
+
+  if (!(name = infoxml_attr (attrs, "Name")))
+    return;
+
+  if (!(entry = infotop_entry (top, name)))
+    return;
+
+  if ((value = infoxml_attr (attrs, "LatestPacketDataEndTime")))
+  {
+    snprintf (timestr, sizeof (timestr), "%s", value);
+    dataend = dl_timestr2dltime (timestr);
+  }
+
+  if (top->interval > 0 && dataend != DLTERROR && entry->dataend != DLTERROR)
+    entry->datarate = (double)(dataend - entry->dataend) / DLTMODULUS / top->interval;
+  else
+    entry->datarate = -1.0;
+
+  snprintf (entry->name, sizeof (entry->name), "%s", name);
+  value          = infoxml_attr (attrs, "LatestPacketID");
+  entry->pktid   = (value) ? strtoll (value, NULL, 10) : -1;
+  entry->dataend = dataend;
+  entry->latency = infotop_number (attrs, "DataLatency");
+  entry->lag     = entry->latency;
+} /* End of infotop_stream() */
+
+/***************************************************************************
+ * infotop_connection:
+ *
+ * Update a connection from the rates reported by the server.
+ * Connections are identified by address, port and connection time.
+ ***************************************************************************/
+static void
+infotop_connection (InfoTop *top, const char **attrs)
+{
+  TopEntry *entry;
+  const char *ip, *port, *clientid, *conntime;
+  char key[256];
+
+  ip       = infoxml_attr (attrs, "IP");
+  port     = infoxml_attr (attrs, "Port");
+  clientid = infoxml_attr (attrs, "ClientID");
+  conntime = infoxml_attr (attrs, "ConnectionTime");
+
+  snprintf (key, sizeof (key), "%s:%s %s", (ip) ? ip : "-", (port) ? port : "-",
+            (conntime) ? conntime : "-");
+
+  if (!(entry = infotop_entry (top, key)))
+    return;
+
+  snprintf (entry->name, sizeof (entry->name), "%s:%s", (ip) ? ip : "-", (port) ? port : "-");
+  snprintf (entry->client, sizeof (entry->client), "%s", (clientid) ? clientid : "-");
+  entry->txpacketrate = infotop_number (attrs, "TXPacketRate");
+  entry->rxpacketrate = infotop_number (attrs, "RXPacketRate");
+  entry->txbyterate   = infotop_number (attrs, "TXByteRate");
+  entry->rxbyterate   = infotop_number (attrs, "RXByteRate");
+  entry->latency      = infotop_number (attrs, "Latency");
+  entry->lag          = infotop_number (attrs, "PercentLag");
+  entry->datarate     = entry->txpacketrate + entry->rxpacketrate;
+} /* End of infotop_connection() */
+
+/***************************************************************************
+ * infotop_entry:
+ *
+ * Find or add the entry for a key and add it to the rows of this poll.
+ *
+ * Returns a pointer to the entry on success and NULL on error.
+ ***************************************************************************/
+static TopEntry *
+infotop_entry (InfoTop *top, const char *key)
+{
+  TopEntry **newrows;
+  TopEntry *entry;
+
+  if (!(entry = (TopEntry *)strhash_get (top->entries, key)))
+  {
+    if (!(entry = (TopEntry *)calloc (1, sizeof (TopEntry))) ||
+        !(entry->key = strdup (key)) ||
+        strhash_put (top->entries, key, entry))
+    {
+      dl_log (2, 0, "Cannot allocate memory for top table\n");
+      infotop_freeentry (entry);
+      top->error = 1;
+      return NULL;
+    }
+
+    entry->dataend = DLTERROR;
+  }
+
+  /* Duplicates are updated but listed once */
+  if (entry->poll == top->poll)
+    return entry;
+
+  if (top->rowcount >= top->rowsize)
+  {
+    if (!(newrows = (TopEntry **)realloc (top->rows, (top->rowsize + 64) * 2 * sizeof (TopEntry *))))
+    {
+      dl_log (2, 0, "Cannot allocate memory for top table\n");
+      top->error = 1;
+      return NULL;
+    }
+
+    top->rows    = newrows;
+    top->rowsize = (top->rowsize + 64) * 2;
+  }
+
+  top->rows[top->rowcount++] = entry;
+  entry->poll                = top->poll;
+
+  return entry;
+} /* End of infotop_entry() */
+
+/***************************************************************************
+ * infotop_remove:
+ *
+ * Remove the entries not seen in the current poll.
+ *
+ * Returns the number of entries removed on success and -1 on error.
+ ***************************************************************************/
+static int
+infotop_remove (InfoTop *top)
+{
+  StrHashEntry *hentry = NULL;
+  TopEntry **gone      = NULL;
+  TopEntry *entry;
+  int count = 0;
+  int idx;
+
+  if (top->entries->count == (size_t)top->rowcount)
+    return 0;
+
+  if (!(gone = (TopEntry **)malloc ((top->entries->count - top->rowcount) * sizeof (TopEntry *))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for top table\n");
+    return -1;
+  }
+
+  while ((hentry = strhash_next (top->entries, hentry)))
+  {
+    entry = (TopEntry *)hentry->value;
+
+    if (entry->poll != top->poll)
+      gone[count++] = entry;
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    strhash_remove (top->entries, gone[idx]->key);
+    infotop_freeentry (gone[idx]);
+  }
+
+  free (gone);
+
+  return count;
+} /* End of infotop_remove() */
+
+/***************************************************************************
+ * infotop_compare:
+ *
+ * Compare two entries for qsort() by the current sort key, largest
+ * values first and then by name.
+ ***************************************************************************/
+static int
+infotop_compare (const void *a, const void *b)
+{
+  const TopEntry *ea = *(const TopEntry **)a;
+  const TopEntry *eb = *(const TopEntry **)b;
+  double va = 0.0;
+  double vb = 0.0;
+
+  switch (comparekey)
+  {
+  case TOP_SORT_LATENCY:
+    va = ea->latency;
+    vb = eb->latency;
+    break;
+  case TOP_SORT_RATE:
+    va = ea->datarate;
+    vb = eb->datarate;
+    break;
+  case TOP_SORT_LAG:
+    va = ea->lag;
+    vb = eb->lag;
+    break;
+  }
+
+  if (va != vb)
+    return (va < vb) ? 1 : -1;
+
+  return strcmp (ea->key, eb->key);
+} /* End of infotop_compare() */
+
+/***************************************************************************
+ * infotop_render:
+ *
+ * Render the table to fit the terminal and write the rows that differ
+ * from the previous frame.  Everything is redrawn when the terminal
+ * size changes.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+infotop_render (InfoTop *top)
+{
+  TopEntry *entry;
+  char text[TOP_MAXCOLS + 1];
+  char timestr[50];
+  char datarate[20];
+  int rows = 24;
+  int cols = 80;
+  int namewidth;
+  int shown;
+  int row;
+  int idx;
+
+#ifndef WIN32
+  struct winsize ws;
+
+  if (ioctl (fileno (top->prtstream), TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0)
+  {
+    rows = ws.ws_row;
+    cols = ws.ws_col;
+  }
+#endif
+
+  if (rows < TOP_HEADROWS + 1)
+    rows = TOP_HEADROWS + 1;
+  if (cols < TOP_MINCOLS)
+    cols = TOP_MINCOLS;
+  else if (cols > TOP_MAXCOLS)
+    cols = TOP_MAXCOLS;
+
+  top->framelen = 0;
+
+  /* Set up the terminal or clear it after a resize */
+  if (!top->started || rows != top->screenrows || cols != top->screencols)
+  {
+    free (top->screen);
+
+    if (!(top->screen = (char *)calloc (rows, cols + 1)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for top table\n");
+      top->screenrows = 0;
+      return -1;
+    }
+
+    top->screenrows = rows;
+    top->screencols = cols;
+
+    if (!top->started)
+    {
+      top->started = 1;
+      infotop_emit (top, "\033[?1049h\033[?25l", 14);
+    }
+
+    infotop_emit (top, "\033[H\033[2J", 7);
+  }
+
+  shown = (top->rowcount < rows - TOP_HEADROWS) ? top->rowcount : rows - TOP_HEADROWS;
+
+  dl_dltime2mdtimestr (dlp_time (), timestr, 0);
+
+  snprintf (text, sizeof (text), "%s  %s UTC  sorted by %s  interval %.1f seconds",
+            top->serverid, timestr, sortnames[top->sortkey], top->interval);
+  infotop_row (top, 0, text, 0);
+
+  snprintf (text, sizeof (text), "%d of %d %s shown", shown,
+            (top->total > top->rowcount) ? top->total : top->rowcount,
+            (top->connections) ? "connections" : "streams");
+  infotop_row (top, 1, text, 0);
+
+  if (top->connections)
+  {
+    namewidth = cols - 82;
+    if (namewidth < 10)
+      namewidth = 10;
+
+    snprintf (text, sizeof (text), "%-21s %-*s %9s %9s %11s %11s %9s %5s",
+              "Address", namewidth, "Client", "TX pkt/s", "RX pkt/s",
+              "TX bytes/s", "RX bytes/s", "Latency", "Lag%");
+  }
+  else
+  {
+    namewidth = cols - 36;
+    if (namewidth < 10)
+      namewidth = 10;
+    else if (namewidth > 60)
+      namewidth = 60;
+
+    snprintf (text, sizeof (text), "%-*s %12s %10s %11s",
+              namewidth, "Stream", "Packet ID", "Data s/s", "Latency");
+  }
+  infotop_row (top, 2, text, 1);
+
+  for (idx = 0, row = TOP_HEADROWS; idx < shown; idx++, row++)
+  {
+    entry = top->rows[idx];
+
+    if (top->connections)
+    {
+      snprintf (text, sizeof (text), "%-21.21s %-*.*s %9.1f %9.1f %11.1f %11.1f %9.1f %5.0f",
+                entry->name, namewidth, namewidth, entry->client,
+                entry->txpacketrate, entry->rxpacketrate,
+                entry->txbyterate, entry->rxbyterate, entry->latency, entry->lag);
+    }
+    else
+    {
+      if (entry->datarate < 0)
+        snprintf (datarate, sizeof (datarate), "-");
+      else
+        snprintf (datarate, sizeof (datarate), "%.2f", entry->datarate);
+
+      snprintf (text, sizeof (text), "%-*.*s %12lld %10s %11.1f",
+                namewidth, namewidth, entry->name, (long long int)entry->pktid,
+                datarate, entry->latency);
+    }
+
+    infotop_row (top, row, text, 0);
+  }
+
+  /* Clear rows no longer used */
+  for (; row < rows; row++)
+    infotop_row (top, row, "", 0);
+
+  if (top->framelen > 0 &&
+      fwrite (top->frame, top->framelen, 1, top->prtstream) != 1)
+    return -1;
+
+  fflush (top->prtstream);
+
+  return 0;
+} /* End of infotop_render() */
+
+/***************************************************************************
+ * infotop_row:
+ *
+ * Add a row to the frame output if it differs from the previous frame,
+ * from the first character that differs.  The text is truncated to the
+ * terminal width, heading rows are drawn whole in reverse video.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+infotop_row (InfoTop *top, int row, const char *text, int heading)
+{
+  char *previous = top->screen + (size_t)row * (top->screencols + 1);
+  char position[24];
+  int length;
+  int start = 0;
+
+  length = (int)strlen (text);
+  if (length > top->screencols)
+    length = top->screencols;
+
+  while (start < length && previous[start] == text[start])
+    start++;
+
+  if (start == length && previous[start] == '\0')
+    return 0;
+
+  if (heading)
+    start = 0;
+
+  memcpy (previous + start, text + start, length - start);
+  previous[length] = '\0';
+
+  snprintf (position, sizeof (position), "\033[%d;%dH", row + 1, start + 1);
+
+  if (infotop_emit (top, position, strlen (position)) ||
+      (heading && infotop_emit (top, "\033[7m", 4)) ||
+      infotop_emit (top, text + start, length - start) ||
+      (heading && infotop_emit (top, "\033[0m", 4)) ||
+      infotop_emit (top, "\033[K", 3))
+    return -1;
+
+  return 0;
+} /* End of infotop_row() */
+
+/***************************************************************************
+ * infotop_emit:
+ *
+ * Append data to the frame output.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+infotop_emit (InfoTop *top, const char *data, size_t length)
+{
+  char *newframe;
+  size_t newsize;
+
+  if (top->framelen + length > top->framesize)
+  {
+    newsize = (top->framesize) ? top->framesize : 16384;
+
+    while (newsize < top->framelen + length)
+      newsize *= 2;
+
+    if (!(newframe = (char *)realloc (top->frame, newsize)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for top table\n");
+      return -1;
+    }
+
+    top->frame     = newframe;
+    top->framesize = newsize;
+  }
+
+  memcpy (top->frame + top->framelen, data, length);
+  top->framelen += length;
+
+  return 0;
+} /* End of infotop_emit() */
+
+/***************************************************************************
+ * infotop_number:
+ *
+ * Return the numeric value of an attribute, 0 if not present.
+ ***************************************************************************/
+static double
+infotop_number (const char **attrs, const char *name)
+{
+  const char *value;
+
+  return ((value = infoxml_attr (attrs, name))) ? strtod (value, NULL) : 0.0;
+} /* End of infotop_number() */
+
+/***************************************************************************
+ * infotop_freeentry:
+ *
+ * Free an entry.
+ ***************************************************************************/
+static void
+infotop_freeentry (void *value)
+{
+  TopEntry *entry = (TopEntry *)value;
+
+  if (!entry)
+    return;
+
+  free (entry->key);
+  free (entry);
+} /* End of infotop_freeentry() */
@@ -0,0 +1,24 @@
+
+#ifndef INFOTOP_H
+#define INFOTOP_H
+
+#include <stdio.h>
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct InfoTop_s InfoTop;
+
+extern InfoTop *infotop_new (const char *infotype, const char *sortkey);
+extern int infotop_poll (InfoTop *top, DLCP *dlconn, char *infomatch, FILE *prtstream);
+extern void infotop_free (InfoTop *top);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* INFOTOP_H */
@@ -0,0 +1,482 @@
+/***************************************************************************
+ * infoxml.c
+ *
+ * A streaming, callback driven parser for DataLink INFO XML.
+ *
+ * The XML is fed to the parser in chunks of any size, as received
+ * from the server, and a callback is called for the start and end of
+ * each element with the element name, attributes and depth.  Only
+ * the markup of the current tag is held in memory, so responses
+ * listing any number of streams or connections are processed with a
+ * small, fixed amount of memory.
+ *
+ * The parser handles the subset of XML used for INFO responses:
+ * elements with attributes, character and entity references in
+ * attribute values; text content, comments, processing instructions
+ * and declarations are skipped.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "infoxml.h"
+
+/* Maximum size of a single tag */
+#define MAXTAGSIZE 1048576
+
+struct InfoXML_s
+{
+  InfoXMLStart start;           /* Element start callback */
+  InfoXMLEnd end;               /* Element end callback */
+  void *data;                   /* Callback data */
+  char *tag;                    /* Markup of the current tag, after '<' */
+  size_t taglen;                /* Length of current tag */
+  size_t tagsize;               /* Allocated size of tag buffer */
+  int intag;                    /* Flag: inside a tag */
+  char quote;                   /* Quote character of current attribute value */
+  const char **attrs;           /* Attribute name, value pairs for callback */
+  int attrsize;                 /* Allocated entries of attrs */
+  int depth;                    /* Current element depth */
+  int elements;                 /* Elements started */
+  int error;                    /* Flag: parsing error or callback failure */
+};
+
+static int infoxml_tag (InfoXML *parser);
+static void infoxml_decode (char *value);
+
+/***************************************************************************
+ * infoxml_new:
+ *
+ * Create a new parser calling start and end, either of which may be
+ * NULL, for each element.  Callbacks return 0 to continue and
+ * non-zero to stop parsing.
+ *
+ * Returns a pointer to the parser on success and NULL on error.
+ ***************************************************************************/
+InfoXML *
+infoxml_new (InfoXMLStart start, InfoXMLEnd end, void *data)
+{
+  InfoXML *parser;
+
+  if (!(parser = (InfoXML *)calloc (1, sizeof (InfoXML))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for INFO parser\n");
+    return NULL;
+  }
+
+  parser->start = start;
+  parser->end   = end;
+  parser->data  = data;
+
+  return parser;
+} /* End of infoxml_new() */
+
+/***************************************************************************
+ * infoxml_feed:
+ *
+ * Parse the next chunk of XML, calling the element callbacks for each
+ * tag completed.  Tags may span any number of chunks.
+ *
+ * Returns 0 on success and -1 on error or if a callback stopped
+ * parsing.
+ ***************************************************************************/
+int
+infoxml_feed (InfoXML *parser, const char *chunk, int chunklen)
+{
+  char *newtag;
+  char c;
+  int idx;
+
+  if (!parser || parser->error)
+    return -1;
+
+  for (idx = 0; idx < chunklen; idx++)
+  {
+    c = chunk[idx];
+
+    /* Text content is skipped */
+    if (!parser->intag)
+    {
+      if (c == '<')
+      {
+        parser->intag  = 1;
+        parser->taglen = 0;
+        parser->quote  = 0;
+      }
+
+      continue;
+    }
+
+    if (parser->taglen + 1 >= parser->tagsize)
+    {
+      if (parser->tagsize >= MAXTAGSIZE)
+      {
+        dl_log (2, 0, "INFO XML tag larger than %d bytes\n", MAXTAGSIZE);
+        parser->error = 1;
+        return -1;
+      }
+
+      if (!(newtag = (char *)realloc (parser->tag, (parser->tagsize) ? parser->tagsize * 2 : 1024)))
+      {
+        dl_log (2, 0, "Cannot allocate memory for INFO parser\n");
+        parser->error = 1;
+        return -1;
+      }
+
+      parser->tag     = newtag;
+      parser->tagsize = (parser->tagsize) ? parser->tagsize * 2 : 1024;
+    }
+
+    parser->tag[parser->taglen++] = c;
+
+    /* Comments end with "-->", quotes are not special */
+    if (parser->taglen >= 3 && !strncmp (parser->tag, "!--", 3))
+    {
+      if (c != '>' || parser->taglen < 6 ||
+          parser->tag[parser->taglen - 2] != '-' || parser->tag[parser->taglen - 3] != '-')
+        continue;
+    }
+    else if (parser->quote)
+    {
+      if (c == parser->quote)
+        parser->quote = 0;
+      continue;
+    }
+    else if (c == '"' || c == '\'')
+    {
+      parser->quote = c;
+      continue;
+    }
+    else if (c != '>')
+    {
+      continue;
+    }
+
+    /* Tag complete, replace '>' with a terminator */
+    parser->tag[parser->taglen - 1] = '\0';
+    parser->intag = 0;
+
+    if (infoxml_tag (parser))
+    {
+      parser->error = 1;
+      return -1;
+    }
+  }
+
+  return 0;
+} /* End of infoxml_feed() */
+
+/***************************************************************************
+ * infoxml_finish:
+ *
+ * Check that the XML fed to the parser is complete.
+ *
+ * Returns 0 if the XML was complete and parsed without error and -1
+ * otherwise.
+ ***************************************************************************/
+int
+infoxml_finish (InfoXML *parser)
+{
+  if (!parser || parser->error)
+    return -1;
+
+  if (parser->intag || parser->depth != 0 || parser->elements == 0)
+  {
+    dl_log (2, 0, "INFO XML is incomplete\n");
+    return -1;
+  }
+
+  return 0;
+} /* End of infoxml_finish() */
+
+/***************************************************************************
+ * infoxml_free:
+ *
+ * Free the parser.
+ ***************************************************************************/
+void
+infoxml_free (InfoXML *parser)
+{
+  if (!parser)
+    return;
+
+  free (parser->tag);
+  free (parser->attrs);
+  free (parser);
+} /* End of infoxml_free() */
+
+/***************************************************************************
+ * infoxml_attr:
+ *
+ * Find an attribute in the list passed to an element start callback.
+ *
+ * Returns the attribute value or NULL if not present.
+ ***************************************************************************/
+const char *
+infoxml_attr (const char **attrs, const char *name)
+{
+  if (!attrs || !name)
+    return NULL;
+
+  for (; attrs[0]; attrs += 2)
+  {
+    if (!strcmp (attrs[0], name))
+      return attrs[1];
+  }
+
+  return NULL;
+} /* End of infoxml_attr() */
+
+/***************************************************************************
+ * infoxml_tag:
+ *
+ * Parse a complete tag and call the element callbacks.  The tag
+ * buffer is modified in place to terminate names and values.
+ *
+ * Returns 0 on success and -1 on error or if a callback stopped
+ * parsing.
+ ***************************************************************************/
+static int
+infoxml_tag (InfoXML *parser)
+{
+  const char **newattrs;
+  char *name;
+  char *value;
+  char *cp = parser->tag;
+  char *ep;
+  char quote;
+  int attrcount = 0;
+  int selfclose = 0;
+
+  /* Processing instructions, comments and declarations are skipped */
+  if (*cp == '?' || *cp == '!')
+    return 0;
+
+  /* End tag */
+  if (*cp == '/')
+  {
+    name = ++cp;
+    while (*cp && *cp != ' ' && *cp != '\t' && *cp != '\r' && *cp != '\n')
+      cp++;
+    *cp = '\0';
+
+    if (--parser->depth < 0)
+    {
+      dl_log (2, 0, "INFO XML end tag without start: %s\n", name);
+      return -1;
+    }
+
+    if (parser->end && parser->end (parser->data, name, parser->depth))
+      return -1;
+
+    return 0;
+  }
+
+  /* Empty element */
+  ep = cp + strlen (cp);
+  while (ep > cp && (ep[-1] == ' ' || ep[-1] == '\t' || ep[-1] == '\r' || ep[-1] == '\n'))
+    ep--;
+  if (ep > cp && ep[-1] == '/')
+  {
+    selfclose = 1;
+    ep--;
+  }
+  *ep = '\0';
+
+  name = cp;
+  while (*cp && *cp != ' ' && *cp != '\t' && *cp != '\r' && *cp != '\n')
+    cp++;
+
+  if (cp == name)
+  {
+    dl_log (2, 0, "INFO XML tag without name\n");
+    return -1;
+  }
+
+  /* Attributes */
+  if (*cp)
+    *cp++ = '\0';
+
+  for (;;)
+  {
+    while (*cp == ' ' || *cp == '\t' || *cp == '\r' || *cp == '\n')
+      cp++;
+
+    if (!*cp)
+      break;
+
+    value = NULL;
+    ep    = cp;
+    while (*ep && *ep != '=' && *ep != ' ' && *ep != '\t' && *ep != '\r' && *ep != '\n')
+      ep++;
+
+    if (*ep && *ep != '=')
+    {
+      *ep++ = '\0';
+      while (*ep == ' ' || *ep == '\t' || *ep == '\r' || *ep == '\n')
+        ep++;
+    }
+
+    if (*ep == '=')
+    {
+      *ep++ = '\0';
+      while (*ep == ' ' || *ep == '\t' || *ep == '\r' || *ep == '\n')
+        ep++;
+
+      if (*ep == '"' || *ep == '\'')
+      {
+        quote = *ep++;
+        value = ep;
+        while (*ep && *ep != quote)
+          ep++;
+      }
+    }
+
+    if (!value || !*ep)
+    {
+      dl_log (2, 0, "INFO XML malformed attribute in <%s>\n", name);
+      return -1;
+    }
+
+    *ep = '\0';
+    infoxml_decode (value);
+
+    if (attrcount * 2 + 3 > parser->attrsize)
+    {
+      if (!(newattrs = (const char **)realloc (parser->attrs, (parser->attrsize + 32) * sizeof (char *))))
+      {
+        dl_log (2, 0, "Cannot allocate memory for INFO parser\n");
+        return -1;
+      }
+
+      parser->attrs = newattrs;
+      parser->attrsize += 32;
+    }
+
+    parser->attrs[attrcount * 2]     = cp;
+    parser->attrs[attrcount * 2 + 1] = value;
+    attrcount++;
+
+    /* Continue after the closing quote */
+    cp = ep + 1;
+  }
+
+  if (!parser->attrs)
+  {
+    if (!(parser->attrs = (const char **)malloc (32 * sizeof (char *))))
+    {
+      dl_log (2, 0, "Cannot allocate memory for INFO parser\n");
+      return -1;
+    }
+
+    parser->attrsize = 32;
+  }
+
+  parser->attrs[attrcount * 2] = NULL;
+  parser->elements++;
+
+  if (parser->start && parser->start (parser->data, name, parser->attrs, parser->depth))
+    return -1;
+
+  if (selfclose)
+  {
+    if (parser->end && parser->end (parser->data, name, parser->depth))
+      return -1;
+  }
+  else
+  {
+    parser->depth++;
+  }
+
+  return 0;
+} /* End of infoxml_tag() */
+
+/***************************************************************************
+ * infoxml_decode:
+ *
+ * Decode the predefined entity and character references in an
+ * attribute value in place.  Unrecognized references are left as is.
+ ***************************************************************************/
+static void
+infoxml_decode (char *value)
+{
+  static const struct
+  {
+    const char *entity;
+    size_t length;
+    char c;
+  } entities[] = {{"&lt;", 4, '<'}, {"&gt;", 4, '>'}, {"&amp;", 5, '&'},
+                  {"&quot;", 6, '"'}, {"&apos;", 6, '\''}};
+  char *in  = value;
+  char *out = value;
+  char *end;
+  unsigned long code;
+  size_t idx;
+
+  if (!strchr (value, '&'))
+    return;
+
+  while (*in)
+  {
+    if (*in != '&')
+    {
+      *out++ = *in++;
+      continue;
+    }
+
+    for (idx = 0; idx < sizeof (entities) / sizeof (entities[0]); idx++)
+    {
+      if (!strncmp (in, entities[idx].entity, entities[idx].length))
+        break;
+    }
+
+    if (idx < sizeof (entities) / sizeof (entities[0]))
+    {
+      *out++ = entities[idx].c;
+      in += entities[idx].length;
+      continue;
+    }
+
+    /* Character references, encoded as UTF-8 */
+    if (in[1] == '#')
+    {
+      code = (in[2] == 'x') ? strtoul (in + 3, &end, 16) : strtoul (in + 2, &end, 10);
+
+      if (*end == ';' && end > in + 2 && code > 0 && code <= 0x10FFFF)
+      {
+        if (code < 0x80)
+        {
+          *out++ = (char)code;
+        }
+        else if (code < 0x800)
+        {
+          *out++ = (char)(0xC0 | (code >> 6));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+          *out++ = (char)(0xE0 | (code >> 12));
+          *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+          *out++ = (char)(0xF0 | (code >> 18));
+          *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+          *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+
+        in = end + 1;
+        continue;
+      }
+    }
+
+    *out++ = *in++;
+  }
+
+  *out = '\0';
+} /* End of infoxml_decode() */
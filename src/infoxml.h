@@ -0,0 +1,28 @@
+
+#ifndef INFOXML_H
+#define INFOXML_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Element callbacks, attrs is a NULL terminated list of name, value pairs */
+typedef int (*InfoXMLStart) (void *data, const char *name, const char **attrs, int depth);
+typedef int (*InfoXMLEnd) (void *data, const char *name, int depth);
+
+typedef struct InfoXML_s InfoXML;
+
+extern InfoXML *infoxml_new (InfoXMLStart start, InfoXMLEnd end, void *data);
+extern int infoxml_feed (InfoXML *parser, const char *chunk, int chunklen);
+extern int infoxml_finish (InfoXML *parser);
+extern void infoxml_free (InfoXML *parser);
+extern const char *infoxml_attr (const char **attrs, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* INFOXML_H */
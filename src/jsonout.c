@@ -0,0 +1,431 @@
+/***************************************************************************
+ * jsonout.c
+ *
+ * Newline-delimited JSON output of server information and packets.
+ *
+ * INFO responses are parsed as a stream of elements as they are
+ * received and each element is written as one JSON object holding
+ * its attributes, named by the "element" key, without building a
+ * document of the response.  Attribute values that are numbers are
+ * written as numbers, "TRUE" and "FALSE" as booleans and "-", used
+ * by the server for no value, as null.
+ *
+ * Packets are written as one JSON object with the packet details
+ * and optionally the header details of the miniSEED record.
+ *
+ * Each line is built and written with the yyjson bundled in libmseed,
+ * using a pool allocator over a buffer of the writer that is reused
+ * for every line.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+#include <yyjson.h>
+
+#include "infoxml.h"
+#include "jsonout.h"
+#include "trace.h"
+
+/* Initial and maximum size of the line buffer */
+#define JSONOUT_POOLSIZE (64 * 1024)
+#define JSONOUT_POOLMAX (64 * 1024 * 1024)
+
+struct JsonWriter_s
+{
+  char *pool;                   /* Allocation pool for a line */
+  size_t poolsize;              /* Size of pool */
+  FILE *prtstream;              /* Output stream */
+  int error;                    /* Flag: error writing */
+};
+
+/* Element passed to jsonout_element() */
+typedef struct JsonElement_s
+{
+  const char *name;             /* Element name */
+  const char **attrs;           /* Attribute name/value pairs */
+} JsonElement;
+
+/* Packet passed to jsonout_packetline() */
+typedef struct JsonPacket_s
+{
+  DLPacket *dlpacket;           /* Packet */
+  MS3Record *msr;               /* Parsed record, may be NULL */
+} JsonPacket;
+
+typedef int (*JsonBuild) (yyjson_mut_doc *doc, yyjson_mut_val *root, void *data);
+
+static int jsonout_write (JsonWriter *writer, JsonBuild build, void *data);
+static int jsonout_element (yyjson_mut_doc *doc, yyjson_mut_val *root, void *data);
+static int jsonout_packetline (yyjson_mut_doc *doc, yyjson_mut_val *root, void *data);
+static char *jsonout_timestr (dltime_t dltime, char *timestr);
+static int jsonout_start (void *data, const char *name, const char **attrs, int depth);
+static int jsonout_chunk (char *chunk, int chunklen, void *handlerdata);
+
+/***************************************************************************
+ * jsonout_new:
+ *
+ * Create a new JSON writer.
+ *
+ * Returns a pointer to the writer on success and NULL on error.
+ ***************************************************************************/
+JsonWriter *
+jsonout_new (void)
+{
+  JsonWriter *writer;
+
+  if (!(writer = (JsonWriter *)calloc (1, sizeof (JsonWriter))) ||
+      !(writer->pool = (char *)malloc (JSONOUT_POOLSIZE)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for JSON writer\n");
+    free (writer);
+    return NULL;
+  }
+
+  writer->poolsize = JSONOUT_POOLSIZE;
+
+  return writer;
+} /* End of jsonout_new() */
+
+/***************************************************************************
+ * jsonout_info:
+ *
+ * Request INFO from the server and write each element of the response
+ * as a JSON line as it is received.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+jsonout_info (JsonWriter *writer, DLCP *dlconn, char *infotype, char *infomatch,
+              FILE *prtstream)
+{
+  InfoXML *parser;
+  int rv = 0;
+
+  if (!writer || !dlconn || !infotype || !prtstream)
+    return -1;
+
+  writer->prtstream = prtstream;
+  writer->error     = 0;
+
+  if (!(parser = infoxml_new (jsonout_start, NULL, writer)))
+    return -1;
+
+  if (dl_getinfochunks (dlconn, infotype, infomatch, jsonout_chunk, parser) < 0 ||
+      infoxml_finish (parser) || writer->error)
+    rv = -1;
+
+  infoxml_free (parser);
+
+  fflush (prtstream);
+
+  return rv;
+} /* End of jsonout_info() */
+
+/***************************************************************************
+ * jsonout_packet:
+ *
+ * Write a JSON line for a packet.  If details is non-zero and the
+ * packet is miniSEED the record header is parsed and included.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+jsonout_packet (JsonWriter *writer, DLPacket *dlpacket, void *packetdata,
+                int details, FILE *prtstream)
+{
+  JsonPacket packet;
+  char type[10];
+  int rv;
+
+  if (!writer || !dlpacket || !prtstream)
+    return -1;
+
+  writer->prtstream = prtstream;
+  writer->error     = 0;
+
+  packet.dlpacket = dlpacket;
+  packet.msr      = NULL;
+
+  if (details && packetdata &&
+      !dl_splitstreamid (dlpacket->streamid, NULL, NULL, NULL, NULL, type) &&
+      !strncmp (type, "MSEED", sizeof (type)))
+  {
+    if ((rv = trace_parse (packetdata, dlpacket->datasize, &packet.msr, 0, 0, dlpacket)) != MS_NOERROR)
+      dl_log (2, 0, "Cannot parse Mini-SEED record: %s\n", ms_errorstr (rv));
+  }
+
+  rv = jsonout_write (writer, jsonout_packetline, &packet);
+
+  msr3_free (&packet.msr);
+
+  return rv;
+} /* End of jsonout_packet() */
+
+/***************************************************************************
+ * jsonout_free:
+ *
+ * Free a JSON writer.
+ ***************************************************************************/
+void
+jsonout_free (JsonWriter *writer)
+{
+  if (!writer)
+    return;
+
+  free (writer->pool);
+  free (writer);
+} /* End of jsonout_free() */
+
+/***************************************************************************
+ * jsonout_write:
+ *
+ * Build a JSON object with the build callback and write it as a line.
+ * The object is built in the pool of the writer, which is grown and
+ * the object built again when too small.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+jsonout_write (JsonWriter *writer, JsonBuild build, void *data)
+{
+  yyjson_mut_doc *doc;
+  yyjson_mut_val *root;
+  yyjson_write_err err;
+  yyjson_alc alc;
+  char *newpool;
+  char *line;
+  size_t length;
+
+  for (;;)
+  {
+    line = NULL;
+
+    if (yyjson_alc_pool_init (&alc, writer->pool, writer->poolsize) &&
+        (doc = yyjson_mut_doc_new (&alc)) &&
+        (root = yyjson_mut_obj (doc)))
+    {
+      yyjson_mut_doc_set_root (doc, root);
+
+      if (build (doc, root, data))
+        line = yyjson_mut_write_opts (doc, YYJSON_WRITE_ALLOW_INVALID_UNICODE,
+                                      &alc, &length, &err);
+    }
+
+    if (line)
+      break;
+
+    if (writer->poolsize >= JSONOUT_POOLMAX ||
+        !(newpool = (char *)realloc (writer->pool, writer->poolsize * 2)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for JSON output\n");
+      writer->error = 1;
+      return -1;
+    }
+
+    writer->pool = newpool;
+    writer->poolsize *= 2;
+  }
+
+  line[length++] = '\n';
+
+  if (fwrite (line, length, 1, writer->prtstream) != 1)
+  {
+    dl_log (2, 0, "Error writing JSON output: %s\n", strerror (errno));
+    writer->error = 1;
+    return -1;
+  }
+
+  return 0;
+} /* End of jsonout_write() */
+
+/***************************************************************************
+ * jsonout_element:
+ *
+ * Build the JSON object of an INFO element from its attributes.
+ *
+ * Returns non-zero on success and zero when out of memory.
+ ***************************************************************************/
+static int
+jsonout_element (yyjson_mut_doc *doc, yyjson_mut_val *root, void *data)
+{
+  JsonElement *element = (JsonElement *)data;
+  const char **attr;
+  const char *value;
+  char *endptr;
+  int64_t integer;
+  double number;
+  int ok;
+
+  ok = yyjson_mut_obj_add_str (doc, root, "element", element->name);
+
+  for (attr = element->attrs; ok && attr && attr[0]; attr += 2)
+  {
+    value = attr[1];
+
+    if (!strcmp (value, "-"))
+    {
+      ok = yyjson_mut_obj_add_null (doc, root, attr[0]);
+      continue;
+    }
+
+    /* Versions are not numbers, e.g. 2020.100 */
+    if (!strcmp (attr[0], "Version"))
+    {
+      ok = yyjson_mut_obj_add_str (doc, root, attr[0], value);
+      continue;
+    }
+
+    if (!strcmp (value, "TRUE") || !strcmp (value, "FALSE"))
+    {
+      ok = yyjson_mut_obj_add_bool (doc, root, attr[0], (value[0] == 'T'));
+      continue;
+    }
+
+    /* Numbers start with a digit or a sign followed by a digit */
+    if ((*value >= '0' && *value <= '9') ||
+        (*value == '-' && value[1] >= '0' && value[1] <= '9'))
+    {
+      errno   = 0;
+      integer = strtoll (value, &endptr, 10);
+
+      if (!*endptr && !errno)
+      {
+        ok = yyjson_mut_obj_add_sint (doc, root, attr[0], integer);
+        continue;
+      }
+
+      number = strtod (value, &endptr);
+
+      if (!*endptr && !errno)
+      {
+        ok = yyjson_mut_obj_add_real (doc, root, attr[0], number);
+        continue;
+      }
+    }
+
+    ok = yyjson_mut_obj_add_str (doc, root, attr[0], value);
+  }
+
+  return ok;
+} /* End of jsonout_element() */
+
+/***************************************************************************
+ * jsonout_packetline:
+ *
+ * Build the JSON object of a packet.  Latencies are relative to the
+ * time the packet was received.
+ *
+ * Returns non-zero on success and zero when out of memory.
+ ***************************************************************************/
+static int
+jsonout_packetline (yyjson_mut_doc *doc, yyjson_mut_val *root, void *data)
+{
+  JsonPacket *packet   = (JsonPacket *)data;
+  DLPacket *dlpacket   = packet->dlpacket;
+  MS3Record *msr       = packet->msr;
+  yyjson_mut_val *record;
+  char pkttime[32];
+  char datastart[32];
+  char dataend[32];
+  char starttime[40];
+  char endtime[40];
+  dltime_t now;
+  int ok;
+
+  now = (dlpacket->recvtime) ? dlpacket->recvtime : dlp_time ();
+
+  jsonout_timestr (dlpacket->pkttime, pkttime);
+  jsonout_timestr (dlpacket->datastart, datastart);
+  jsonout_timestr (dlpacket->dataend, dataend);
+
+  ok = yyjson_mut_obj_add_str (doc, root, "streamid", dlpacket->streamid) &&
+       yyjson_mut_obj_add_sint (doc, root, "pktid", dlpacket->pktid) &&
+       yyjson_mut_obj_add_strcpy (doc, root, "pkttime", pkttime) &&
+       yyjson_mut_obj_add_strcpy (doc, root, "datastart", datastart) &&
+       yyjson_mut_obj_add_strcpy (doc, root, "dataend", dataend) &&
+       yyjson_mut_obj_add_int (doc, root, "datasize", dlpacket->datasize) &&
+       yyjson_mut_obj_add_real (doc, root, "datalatency",
+                                (double)(now - dlpacket->dataend) / DLTMODULUS) &&
+       yyjson_mut_obj_add_real (doc, root, "feedlatency",
+                                (double)(now - dlpacket->pkttime) / DLTMODULUS);
+
+  if (ok && msr)
+  {
+    ms_nstime2timestr (msr->starttime, starttime, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+    ms_nstime2timestr (msr3_endtime (msr), endtime, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+
+    ok = (record = yyjson_mut_obj (doc)) &&
+         yyjson_mut_obj_add_val (doc, root, "record", record) &&
+         yyjson_mut_obj_add_str (doc, record, "sid", msr->sid) &&
+         yyjson_mut_obj_add_uint (doc, record, "formatversion", msr->formatversion) &&
+         yyjson_mut_obj_add_int (doc, record, "reclen", msr->reclen) &&
+         yyjson_mut_obj_add_uint (doc, record, "pubversion", msr->pubversion) &&
+         yyjson_mut_obj_add_strcpy (doc, record, "starttime", starttime) &&
+         yyjson_mut_obj_add_strcpy (doc, record, "endtime", endtime) &&
+         yyjson_mut_obj_add_real (doc, record, "samprate", msr3_sampratehz (msr)) &&
+         yyjson_mut_obj_add_sint (doc, record, "samplecnt", msr->samplecnt) &&
+         yyjson_mut_obj_add_int (doc, record, "encoding", msr->encoding) &&
+         yyjson_mut_obj_add_uint (doc, record, "extralength", msr->extralength);
+  }
+
+  return ok;
+} /* End of jsonout_packetline() */
+
+/***************************************************************************
+ * jsonout_timestr:
+ *
+ * Generate an ISO time string with a trailing Z, like the record times,
+ * in a buffer of at least 28 characters.  The string is empty when the
+ * time cannot be converted.
+ *
+ * Returns a pointer to the time string.
+ ***************************************************************************/
+static char *
+jsonout_timestr (dltime_t dltime, char *timestr)
+{
+  if (dl_dltime2isotimestr (dltime, timestr, 1))
+    strcat (timestr, "Z");
+  else
+    timestr[0] = '\0';
+
+  return timestr;
+} /* End of jsonout_timestr() */
+
+/***************************************************************************
+ * jsonout_start:
+ *
+ * Element start callback: write the element as a JSON line.
+ ***************************************************************************/
+static int
+jsonout_start (void *data, const char *name, const char **attrs, int depth)
+{
+  JsonWriter *writer = (JsonWriter *)data;
+  JsonElement element;
+
+  if (depth == 0 && strcmp (name, "DataLink"))
+  {
+    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+    return -1;
+  }
+
+  element.name  = name;
+  element.attrs = attrs;
+
+  return jsonout_write (writer, jsonout_element, &element);
+} /* End of jsonout_start() */
+
+/***************************************************************************
+ * jsonout_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+jsonout_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of jsonout_chunk() */
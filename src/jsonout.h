@@ -0,0 +1,27 @@
+
+#ifndef JSONOUT_H
+#define JSONOUT_H
+
+#include <stdio.h>
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct JsonWriter_s JsonWriter;
+
+extern JsonWriter *jsonout_new (void);
+extern int jsonout_info (JsonWriter *writer, DLCP *dlconn, char *infotype, char *infomatch,
+                         FILE *prtstream);
+extern int jsonout_packet (JsonWriter *writer, DLPacket *dlpacket, void *packetdata,
+                           int details, FILE *prtstream);
+extern void jsonout_free (JsonWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONOUT_H */
@@ -0,0 +1,597 @@
+/***************************************************************************
+ * lagmon.c
+ *
+ * Monitoring of how far collecting connections are behind their
+ * servers.
+ *
+ * Two measures are reported for each connection: the bytes received
+ * by the kernel and not yet read, from dl_getbacklog(), and the
+ * distance of the last packet received from the latest packet in the
+ * server's ring.  The latest packet ID is requested with INFO STATUS
+ * over a separate connection to each server, as a streaming
+ * connection cannot make requests.  Packets are lost when the
+ * position of a client is overwritten in the ring, a warning is logged
+ * when the distance reaches a percentage of the ring, or the receive
+ * queue the same percentage of the receive buffer, before that happens.
+ *
+ * The checks run on a thread of their own, so that requests to the
+ * servers do not delay collection and a stalled connection is still
+ * reported.  The thread collecting from a connection records the last
+ * packet received with lagmon_packet() in a snapshot protected by a
+ * lock of that connection, and samples the receive queue of its own
+ * connection when the monitor has asked for it.  The monitor only
+ * reads the snapshots and never uses the collecting connections.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include <libdali.h>
+
+#include "common.h"
+#include "infoxml.h"
+#include "lagmon.h"
+
+#ifndef WIN32
+
+/* Ring status of a server */
+typedef struct LagServer_s
+{
+  DLCP *dlconn;                 /* Connection for INFO requests */
+  int64_t latest;               /* Latest packet ID in ring, -1 if unknown */
+  int64_t earliest;             /* Earliest packet ID in ring, -1 if unknown */
+  int64_t maxpackets;           /* Capacity of ring in packets, 0 if unknown */
+  int64_t maxpktid;             /* Maximum packet ID before wrapping, 0 if unknown */
+} LagServer;
+
+/* Backlog of a collecting connection */
+typedef struct LagConn_s
+{
+  DLCP *dlconn;                 /* Collecting connection, only used by its own thread */
+  char label[256];              /* Connection label for reports */
+  int server;                   /* Index of server entry */
+  pthread_mutex_t lock;         /* Protects the snapshot */
+  DLBacklog backlog;            /* Snapshot: receive backlog */
+  int64_t backlogtime;          /* Snapshot: time receive queue was sampled, nanoseconds */
+  int64_t packettime;           /* Snapshot: time of last packet, nanoseconds, 0 if none */
+  int sample;                   /* Snapshot: receive queue sample requested */
+  int64_t behind;               /* Packets behind the server at last check, -1 if unknown */
+  int64_t checktime;            /* Time of last check, nanoseconds */
+} LagConn;
+
+struct LagMonitor_s
+{
+  LagServer *servers;           /* Status of each distinct server */
+  int servercount;              /* Number of servers */
+  LagConn *conns;               /* Backlog of each connection */
+  int count;                    /* Number of connections */
+  int64_t interval;             /* Time between checks, nanoseconds */
+  double warnpercent;           /* Warning threshold in percent */
+  pthread_t thread;             /* Monitor thread */
+  int started;                  /* Monitor thread was started */
+  pthread_mutex_t lock;         /* Protects stop */
+  pthread_cond_t wake;          /* Signalled to stop */
+  int stop;                     /* Flag: monitor thread should stop */
+};
+
+static void *lagmon_thread (void *arg);
+static void lagmon_check (LagMonitor *monitor);
+static int lagmon_status (LagServer *server);
+static int lagmon_start (void *data, const char *name, const char **attrs, int depth);
+static int lagmon_chunk (char *chunk, int chunklen, void *handlerdata);
+static int64_t lagmon_behind (LagServer *server, int64_t pktid);
+
+/***************************************************************************
+ * lagmon_new:
+ *
+ * Create a monitor for the backlog of the connections, checked every
+ * interval seconds, logging a warning when the backlog reaches
+ * warnpercent of the server ring or socket receive buffer.  A
+ * separate connection is made to each distinct server address when
+ * first checked.
+ *
+ * The connections must be connected and positioned but not collecting
+ * yet, their positions are the initial snapshots.  The monitor thread
+ * is started and runs until lagmon_free().
+ *
+ * Returns a pointer to the monitor on success and NULL on error.
+ ***************************************************************************/
+LagMonitor *
+lagmon_new (DLCP **conns, int count, double interval, double warnpercent)
+{
+  LagMonitor *monitor;
+  LagServer *server;
+  int idx;
+  int sidx;
+
+  if (!conns || count <= 0 || interval <= 0)
+    return NULL;
+
+  if (!(monitor = (LagMonitor *)calloc (1, sizeof (LagMonitor))) ||
+      !(monitor->conns = (LagConn *)calloc (count, sizeof (LagConn))) ||
+      !(monitor->servers = (LagServer *)calloc (count, sizeof (LagServer))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for backlog monitoring\n");
+    lagmon_free (monitor);
+    return NULL;
+  }
+
+  monitor->count       = count;
+  monitor->interval    = (int64_t)(interval * 1e9);
+  monitor->warnpercent = warnpercent;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    /* Connections to the same server share the INFO connection */
+    for (sidx = 0; sidx < monitor->servercount; sidx++)
+    {
+      if (!strcmp (monitor->servers[sidx].dlconn->addr, conns[idx]->addr))
+        break;
+    }
+
+    if (sidx == monitor->servercount)
+    {
+      server = &monitor->servers[sidx];
+
+      if (!(server->dlconn = dl_newdlcp (conns[idx]->addr, "dalitool")))
+      {
+        lagmon_free (monitor);
+        return NULL;
+      }
+
+      memcpy (server->dlconn->clientid, conns[idx]->clientid, sizeof (server->dlconn->clientid));
+      server->dlconn->keepalive = conns[idx]->keepalive;
+      server->dlconn->iotimeout = conns[idx]->iotimeout;
+      server->latest            = -1;
+      server->earliest          = -1;
+
+      monitor->servercount++;
+    }
+
+    monitor->conns[idx].dlconn = conns[idx];
+    monitor->conns[idx].server = sidx;
+    monitor->conns[idx].behind = -1;
+
+    snprintf (monitor->conns[idx].label, sizeof (monitor->conns[idx].label), "%s",
+              (conns[idx]->statekey[0]) ? conns[idx]->statekey : conns[idx]->addr);
+
+    /* Initial snapshot, taken before collection starts */
+    dl_getbacklog (conns[idx], &monitor->conns[idx].backlog);
+    monitor->conns[idx].backlogtime = clock_ns ();
+
+    pthread_mutex_init (&monitor->conns[idx].lock, NULL);
+  }
+
+  pthread_mutex_init (&monitor->lock, NULL);
+  pthread_cond_init (&monitor->wake, NULL);
+
+  if (pthread_create (&monitor->thread, NULL, lagmon_thread, monitor))
+  {
+    dl_log (2, 0, "Cannot start backlog monitoring thread\n");
+    lagmon_free (monitor);
+    return NULL;
+  }
+
+  monitor->started = 1;
+
+  return monitor;
+} /* End of lagmon_new() */
+
+/***************************************************************************
+ * lagmon_packet:
+ *
+ * Record a packet received on a connection, called by the thread
+ * collecting from the connection for every packet received.  If the
+ * monitor has asked for it the receive queue of the connection is
+ * sampled.
+ ***************************************************************************/
+void
+lagmon_packet (DLCP *dlconn, const DLPacket *dlpacket, void *data)
+{
+  LagMonitor *monitor = (LagMonitor *)data;
+  LagConn *lc         = NULL;
+  int idx;
+
+  if (!monitor || !dlconn || !dlpacket)
+    return;
+
+  for (idx = 0; idx < monitor->count; idx++)
+  {
+    if (monitor->conns[idx].dlconn == dlconn)
+    {
+      lc = &monitor->conns[idx];
+      break;
+    }
+  }
+
+  if (!lc)
+    return;
+
+  pthread_mutex_lock (&lc->lock);
+
+  lc->packettime = clock_ns ();
+
+  if (lc->sample)
+  {
+    dl_getbacklog (dlconn, &lc->backlog);
+    lc->backlogtime = lc->packettime;
+    lc->sample      = 0;
+  }
+  else
+  {
+    lc->backlog.pktid   = dlpacket->pktid;
+    lc->backlog.pkttime = dlpacket->pkttime;
+  }
+
+  pthread_mutex_unlock (&lc->lock);
+} /* End of lagmon_packet() */
+
+/***************************************************************************
+ * lagmon_thread:
+ *
+ * Check and report the backlog of all connections every interval
+ * until asked to stop.
+ ***************************************************************************/
+static void *
+lagmon_thread (void *arg)
+{
+  LagMonitor *monitor = (LagMonitor *)arg;
+  struct timespec deadline;
+  int64_t wakeup;
+
+  pthread_mutex_lock (&monitor->lock);
+
+  while (!monitor->stop)
+  {
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    wakeup           = (int64_t)deadline.tv_sec * 1000000000 + deadline.tv_nsec + monitor->interval;
+    deadline.tv_sec  = wakeup / 1000000000;
+    deadline.tv_nsec = wakeup % 1000000000;
+
+    while (!monitor->stop &&
+           pthread_cond_timedwait (&monitor->wake, &monitor->lock, &deadline) == 0)
+      ;
+
+    if (monitor->stop)
+      break;
+
+    pthread_mutex_unlock (&monitor->lock);
+    lagmon_check (monitor);
+    pthread_mutex_lock (&monitor->lock);
+  }
+
+  pthread_mutex_unlock (&monitor->lock);
+
+  return NULL;
+} /* End of lagmon_thread() */
+
+/***************************************************************************
+ * lagmon_check:
+ *
+ * Check and report the backlog of all connections.  The receive queue
+ * of each connection is reported as sampled after the last check, or
+ * as not sampled if no packet has been received since then.
+ ***************************************************************************/
+static void
+lagmon_check (LagMonitor *monitor)
+{
+  LagConn *lc;
+  LagServer *server;
+  DLBacklog *backlogs;
+  int64_t *packettimes;
+  int64_t *backlogtimes;
+  char queuestr[64];
+  char behindstr[96];
+  char idlestr[64];
+  const char *label;
+  double percent;
+  double rate;
+  int64_t now;
+  int64_t ringsize;
+  int idx;
+
+  if (!(backlogs = (DLBacklog *)malloc (monitor->count * sizeof (DLBacklog))) ||
+      !(packettimes = (int64_t *)malloc (2 * monitor->count * sizeof (int64_t))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for backlog monitoring\n");
+    free (backlogs);
+    return;
+  }
+
+  backlogtimes = packettimes + monitor->count;
+
+  /* Snapshot the connections before the servers, a packet ID received
+   * is then never later than the latest reported by its server.  The
+   * receive queues are sampled by the collecting threads with their
+   * next packet. */
+  for (idx = 0; idx < monitor->count; idx++)
+  {
+    lc = &monitor->conns[idx];
+
+    pthread_mutex_lock (&lc->lock);
+    backlogs[idx]     = lc->backlog;
+    packettimes[idx]  = lc->packettime;
+    backlogtimes[idx] = lc->backlogtime;
+    lc->sample        = 1;
+    pthread_mutex_unlock (&lc->lock);
+  }
+
+  for (idx = 0; idx < monitor->servercount; idx++)
+    lagmon_status (&monitor->servers[idx]);
+
+  now = clock_ns ();
+
+  for (idx = 0; idx < monitor->count; idx++)
+  {
+    lc     = &monitor->conns[idx];
+    server = &monitor->servers[lc->server];
+    label  = lc->label;
+
+    if (backlogs[idx].socketqueued < 0)
+      snprintf (queuestr, sizeof (queuestr), "socket queue unknown");
+    else if (lc->checktime > 0 && backlogtimes[idx] < lc->checktime)
+      snprintf (queuestr, sizeof (queuestr), "socket queue not sampled");
+    else
+      snprintf (queuestr, sizeof (queuestr), "socket queue %lld of %lld bytes",
+                (long long int)backlogs[idx].socketqueued, (long long int)backlogs[idx].socketsize);
+
+    if (packettimes[idx] > 0)
+      snprintf (idlestr, sizeof (idlestr), "last packet %.1f seconds ago",
+                (now - packettimes[idx]) / 1e9);
+    else
+      snprintf (idlestr, sizeof (idlestr), "no packets received");
+
+    ringsize = (server->maxpackets > 0) ? server->maxpackets
+                                        : server->latest - server->earliest + 1;
+    percent  = 0.0;
+    rate     = 0.0;
+
+    if (server->latest < 0 || backlogs[idx].pktid < 0)
+    {
+      snprintf (behindstr, sizeof (behindstr), "position unknown");
+      lc->behind = -1;
+    }
+    else
+    {
+      int64_t behind = lagmon_behind (server, backlogs[idx].pktid);
+
+      if (ringsize > 0)
+        percent = 100.0 * behind / ringsize;
+
+      /* Change of the distance since the last check, positive when falling behind */
+      if (lc->behind >= 0 && now > lc->checktime)
+      {
+        rate = (behind - lc->behind) / ((now - lc->checktime) / 1e9);
+
+        snprintf (behindstr, sizeof (behindstr), "%lld packets behind (%.1f%% of ring, %+.1f packets/s)",
+                  (long long int)behind, percent, rate);
+      }
+      else
+      {
+        snprintf (behindstr, sizeof (behindstr), "%lld packets behind (%.1f%% of ring)",
+                  (long long int)behind, percent);
+      }
+
+      lc->behind = behind;
+    }
+
+    lc->checktime = now;
+
+    dl_log (0, 0, "Backlog %s: %s, %s, %s\n", label, behindstr, queuestr, idlestr);
+
+    if (lc->behind >= 0 && percent >= 100.0)
+    {
+      dl_log (1, 0, "%s: %lld packets behind, more than the server ring holds, packets have been lost\n",
+              label, (long long int)lc->behind);
+    }
+    else if (lc->behind >= 0 && percent >= monitor->warnpercent)
+    {
+      if (rate > 0)
+        dl_log (1, 0, "%s: %.1f%% of the server ring behind, position will be overwritten in about %.0f seconds\n",
+                label, percent, (ringsize - lc->behind) / rate);
+      else
+        dl_log (1, 0, "%s: %.1f%% of the server ring behind, position will be overwritten if not collected faster\n",
+                label, percent);
+    }
+
+    if (backlogs[idx].socketqueued >= 0 && backlogs[idx].socketsize > 0 &&
+        100.0 * backlogs[idx].socketqueued / backlogs[idx].socketsize >= monitor->warnpercent)
+      dl_log (1, 0, "%s: socket receive queue %.1f%% full, packets are not collected as fast as they are sent\n",
+              label, 100.0 * backlogs[idx].socketqueued / backlogs[idx].socketsize);
+  }
+
+  free (backlogs);
+  free (packettimes);
+} /* End of lagmon_check() */
+
+/***************************************************************************
+ * lagmon_free:
+ *
+ * Stop the monitor thread, disconnect the INFO connections and free
+ * the monitor.
+ ***************************************************************************/
+void
+lagmon_free (LagMonitor *monitor)
+{
+  int idx;
+
+  if (!monitor)
+    return;
+
+  if (monitor->started)
+  {
+    pthread_mutex_lock (&monitor->lock);
+    monitor->stop = 1;
+    pthread_cond_signal (&monitor->wake);
+    pthread_mutex_unlock (&monitor->lock);
+
+    pthread_join (monitor->thread, NULL);
+
+    pthread_cond_destroy (&monitor->wake);
+    pthread_mutex_destroy (&monitor->lock);
+  }
+
+  if (monitor->servers)
+  {
+    for (idx = 0; idx < monitor->servercount; idx++)
+    {
+      if (monitor->servers[idx].dlconn->link != -1)
+        dl_disconnect (monitor->servers[idx].dlconn);
+
+      dl_freedlcp (monitor->servers[idx].dlconn);
+    }
+
+    free (monitor->servers);
+  }
+
+  if (monitor->conns)
+  {
+    for (idx = 0; idx < monitor->count; idx++)
+    {
+      if (monitor->conns[idx].dlconn)
+        pthread_mutex_destroy (&monitor->conns[idx].lock);
+    }
+
+    free (monitor->conns);
+  }
+
+  free (monitor);
+} /* End of lagmon_free() */
+
+/***************************************************************************
+ * lagmon_status:
+ *
+ * Request the ring status of a server, connecting if needed.  On
+ * failure the connection is closed to be re-established at the next
+ * check and the status is unknown.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+lagmon_status (LagServer *server)
+{
+  InfoXML *parser;
+  int rv = 0;
+
+  server->latest   = -1;
+  server->earliest = -1;
+
+  if (server->dlconn->link == -1 && dl_connect (server->dlconn) < 0)
+  {
+    dl_log (2, 0, "[%s] Cannot connect to request ring status\n", server->dlconn->addr);
+    return -1;
+  }
+
+  if (!(parser = infoxml_new (lagmon_start, NULL, server)))
+    return -1;
+
+  if (dl_getinfochunks (server->dlconn, "STATUS", NULL, lagmon_chunk, parser) < 0 ||
+      infoxml_finish (parser))
+  {
+    dl_log (2, 0, "[%s] Cannot request ring status\n", server->dlconn->addr);
+
+    if (server->dlconn->link != -1)
+      dl_disconnect (server->dlconn);
+
+    server->latest = -1;
+    rv             = -1;
+  }
+
+  infoxml_free (parser);
+
+  return rv;
+} /* End of lagmon_status() */
+
+/***************************************************************************
+ * lagmon_start:
+ *
+ * Element start callback: collect the ring status.
+ ***************************************************************************/
+static int
+lagmon_start (void *data, const char *name, const char **attrs, int depth)
+{
+  LagServer *server = (LagServer *)data;
+  const char *value;
+
+  if (depth == 0 && strcmp (name, "DataLink"))
+  {
+    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+    return -1;
+  }
+
+  if (depth != 1 || strcmp (name, "Status"))
+    return 0;
+
+  if ((value = infoxml_attr (attrs, "LatestPacketID")))
+    server->latest = strtoll (value, NULL, 10);
+  if ((value = infoxml_attr (attrs, "EarliestPacketID")))
+    server->earliest = strtoll (value, NULL, 10);
+  if ((value = infoxml_attr (attrs, "MaximumPackets")))
+    server->maxpackets = strtoll (value, NULL, 10);
+  if ((value = infoxml_attr (attrs, "MaximumPacketID")))
+    server->maxpktid = strtoll (value, NULL, 10);
+
+  return 0;
+} /* End of lagmon_start() */
+
+/***************************************************************************
+ * lagmon_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+lagmon_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of lagmon_chunk() */
+
+/***************************************************************************
+ * lagmon_behind:
+ *
+ * Calculate the number of packets between pktid and the latest
+ * packet of the server, allowing for packet IDs wrapping at the
+ * maximum packet ID.
+ *
+ * Returns the number of packets behind.
+ ***************************************************************************/
+static int64_t
+lagmon_behind (LagServer *server, int64_t pktid)
+{
+  if (pktid <= server->latest)
+    return server->latest - pktid;
+
+  /* Packet IDs have wrapped since the packet was received */
+  if (server->maxpktid > 0 && pktid - server->latest > server->maxpktid / 2)
+    return (server->maxpktid - pktid) + server->latest + 1;
+
+  return 0;
+} /* End of lagmon_behind() */
+
+#else /* WIN32 */
+
+/* Backlog monitoring is not supported on Windows */
+
+LagMonitor *
+lagmon_new (DLCP **conns, int count, double interval, double warnpercent)
+{
+  dl_log (2, 0, "Backlog monitoring is not supported on this platform\n");
+  return NULL;
+}
+
+void
+lagmon_packet (DLCP *dlconn, const DLPacket *dlpacket, void *data)
+{
+}
+
+void
+lagmon_free (LagMonitor *monitor)
+{
+}
+
+#endif /* WIN32 */
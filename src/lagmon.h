@@ -0,0 +1,22 @@
+
+#ifndef LAGMON_H
+#define LAGMON_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct LagMonitor_s LagMonitor;
+
+extern LagMonitor *lagmon_new (DLCP **conns, int count, double interval, double warnpercent);
+extern void lagmon_packet (DLCP *dlconn, const DLPacket *dlpacket, void *data);
+extern void lagmon_free (LagMonitor *monitor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LAGMON_H */
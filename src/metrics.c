@@ -0,0 +1,866 @@
+/***************************************************************************
+ * metrics.c
+ *
+ * A Prometheus exporter for DataLink server and client metrics.
+ *
+ * The server STATUS, STREAMS and CONNECTIONS lists are polled at an
+ * interval, parsed as they are received, and their values exposed on
+ * an HTTP /metrics endpoint in the Prometheus text format, together
+ * with counters of the polling connection itself.
+ *
+ * Each metric family keeps its series in a hash table keyed by label
+ * set, with the text line of each series rendered when it is created
+ * and re-rendered only when its value changes.  Series not seen in a
+ * complete poll, streams and connections that are gone, are removed.
+ * The response body is assembled from the rendered lines only after
+ * a change and served unchanged to all scrapes until the next change,
+ * so neither polling nor scraping formats more than what changed.
+ *
+ * The HTTP server handles one request at a time between polls, which
+ * is all a scraper needs.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "common.h"
+#include "infoxml.h"
+#include "metrics.h"
+#include "strhash.h"
+
+#ifndef WIN32
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Metric families */
+enum
+{
+  M_SERVER_INFO,
+  M_SERVER_CONNECTIONS,
+  M_SERVER_STREAMS,
+  M_SERVER_RX_PACKETS,
+  M_SERVER_RX_BYTES,
+  M_SERVER_TX_PACKETS,
+  M_SERVER_TX_BYTES,
+  M_SERVER_EARLIEST_PKTID,
+  M_SERVER_LATEST_PKTID,
+  M_STREAM_LATEST_PKTID,
+  M_STREAM_DATA_END,
+  M_STREAM_LATENCY,
+  M_CONNECTION_TX_PACKETS,
+  M_CONNECTION_TX_BYTES,
+  M_CONNECTION_RX_PACKETS,
+  M_CONNECTION_RX_BYTES,
+  M_CONNECTION_LATENCY,
+  M_CONNECTION_LAG,
+  M_POLLS,
+  M_POLL_ERRORS,
+  M_POLL_DURATION,
+  M_CLIENT_PACKETS,
+  M_CLIENT_BYTES,
+  M_CLIENT_RECVCALLS,
+  M_CLIENT_SENDCALLS,
+  M_CLIENT_SYSCALLS,
+  M_COUNT
+};
+
+static const struct
+{
+  const char *name;
+  const char *type;
+  const char *help;
+} metricdefs[M_COUNT] = {
+    {"datalink_server_info", "gauge", "Server identification"},
+    {"datalink_server_connections", "gauge", "Connections to the server"},
+    {"datalink_server_streams", "gauge", "Streams in the server ring"},
+    {"datalink_server_rx_packets_per_second", "gauge", "Server input packet rate"},
+    {"datalink_server_rx_bytes_per_second", "gauge", "Server input byte rate"},
+    {"datalink_server_tx_packets_per_second", "gauge", "Server output packet rate"},
+    {"datalink_server_tx_bytes_per_second", "gauge", "Server output byte rate"},
+    {"datalink_server_earliest_packet_id", "gauge", "Earliest packet ID in the server ring"},
+    {"datalink_server_latest_packet_id", "gauge", "Latest packet ID in the server ring"},
+    {"datalink_stream_latest_packet_id", "gauge", "Latest packet ID of the stream"},
+    {"datalink_stream_latest_data_end_seconds", "gauge", "Data end time of the latest packet of the stream"},
+    {"datalink_stream_data_latency_seconds", "gauge", "Data latency of the stream"},
+    {"datalink_connection_tx_packets_total", "counter", "Packets sent by the server to the connection"},
+    {"datalink_connection_tx_bytes_total", "counter", "Bytes sent by the server to the connection"},
+    {"datalink_connection_rx_packets_total", "counter", "Packets received by the server from the connection"},
+    {"datalink_connection_rx_bytes_total", "counter", "Bytes received by the server from the connection"},
+    {"datalink_connection_latency_seconds", "gauge", "Latency of the last packet sent to the connection"},
+    {"datalink_connection_lag_percent", "gauge", "Position of the connection behind the head of the ring"},
+    {"dalitool_info_polls_total", "counter", "INFO polls of the server"},
+    {"dalitool_info_poll_errors_total", "counter", "INFO polls that failed"},
+    {"dalitool_info_poll_duration_seconds", "gauge", "Duration of the last INFO poll"},
+    {"dalitool_received_packets_total", "counter", "Packets received by the polling connection"},
+    {"dalitool_received_bytes_total", "counter", "Packet data bytes received by the polling connection"},
+    {"dalitool_recv_calls_total", "counter", "Socket receive calls of the polling connection"},
+    {"dalitool_send_calls_total", "counter", "Socket send calls of the polling connection"},
+    {"dalitool_network_syscalls_total", "counter", "Network system calls of the polling connection"},
+};
+
+/* A series of a metric family, identified by its label set */
+typedef struct Series_s
+{
+  char *labels;                 /* Rendered label set, may be empty */
+  char *line;                   /* Rendered text line */
+  size_t linelen;               /* Length of line */
+  double value;                 /* Current value */
+  uint32_t poll;                /* Poll the series was last set */
+} Series;
+
+/* A metric family */
+typedef struct Family_s
+{
+  StrHash *index;               /* Series keyed by label set */
+  Series **series;              /* Series in order of creation */
+  int count;                    /* Number of series */
+  int size;                     /* Allocated entries of series */
+} Family;
+
+struct MetricsExporter_s
+{
+  int listenfd;                 /* Listening socket */
+  Family families[M_COUNT];     /* Metric families */
+  uint32_t poll;                /* Poll count */
+  int polltype;                 /* INFO type being parsed, a metric family */
+  char *body;                   /* Assembled response body */
+  size_t bodylen;               /* Length of response body */
+  size_t bodysize;              /* Allocated size of body */
+  int dirty;                    /* Flag: series changed since body assembled */
+  int error;                    /* Flag: error during poll */
+  uint64_t polls;               /* Polls made */
+  uint64_t pollerrors;          /* Polls failed */
+};
+
+static int metrics_poll (MetricsExporter *exporter, DLCP *dlconn, char *infomatch);
+static int metrics_start (void *data, const char *name, const char **attrs, int depth);
+static int metrics_chunk (char *chunk, int chunklen, void *handlerdata);
+static void metrics_set (MetricsExporter *exporter, int family, const char *labels, double value);
+static void metrics_setattr (MetricsExporter *exporter, int family, const char *labels,
+                             const char **attrs, const char *attr);
+static void metrics_sweep (MetricsExporter *exporter);
+static int metrics_assemble (MetricsExporter *exporter);
+static void metrics_serve (MetricsExporter *exporter);
+static int metrics_send (int fd, const char *buffer, size_t length);
+static size_t metrics_label (char *buffer, size_t size, const char *name, const char *value);
+static void metrics_freeseries (void *value);
+
+/***************************************************************************
+ * metrics_new:
+ *
+ * Create a new exporter listening for HTTP requests on listenaddr,
+ * "[host:]port", the host defaults to the loopback address.
+ *
+ * Returns a pointer to the exporter on success and NULL on error.
+ ***************************************************************************/
+MetricsExporter *
+metrics_new (const char *listenaddr)
+{
+  MetricsExporter *exporter;
+  struct addrinfo hints;
+  struct addrinfo *addr;
+  char host[256];
+  const char *port;
+  int optval = 1;
+  int idx;
+  int rv;
+
+  if (!listenaddr)
+    return NULL;
+
+  if ((port = strrchr (listenaddr, ':')))
+  {
+    snprintf (host, sizeof (host), "%.*s", (int)(port - listenaddr), listenaddr);
+    port++;
+  }
+  else
+  {
+    host[0] = '\0';
+    port    = listenaddr;
+  }
+
+  if (!(exporter = (MetricsExporter *)calloc (1, sizeof (MetricsExporter))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for metrics exporter\n");
+    return NULL;
+  }
+
+  exporter->listenfd = -1;
+  exporter->dirty    = 1;
+
+  for (idx = 0; idx < M_COUNT; idx++)
+  {
+    if (!(exporter->families[idx].index = strhash_new (0)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for metrics exporter\n");
+      metrics_free (exporter);
+      return NULL;
+    }
+  }
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+
+  if ((rv = getaddrinfo ((host[0]) ? host : "127.0.0.1", port, &hints, &addr)))
+  {
+    dl_log (2, 0, "Cannot resolve metrics address %s: %s\n", listenaddr, gai_strerror (rv));
+    metrics_free (exporter);
+    return NULL;
+  }
+
+  if ((exporter->listenfd = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0 ||
+      setsockopt (exporter->listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof (optval)) ||
+      bind (exporter->listenfd, addr->ai_addr, addr->ai_addrlen) ||
+      listen (exporter->listenfd, 16))
+  {
+    dl_log (2, 0, "Cannot listen for metrics requests on %s: %s\n", listenaddr, strerror (errno));
+    freeaddrinfo (addr);
+    metrics_free (exporter);
+    return NULL;
+  }
+
+  freeaddrinfo (addr);
+
+  return exporter;
+} /* End of metrics_new() */
+
+/***************************************************************************
+ * metrics_run:
+ *
+ * Poll the server every interval seconds and serve metrics requests
+ * in between, until the connection is terminated.  The connection is
+ * re-established when lost.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+metrics_run (MetricsExporter *exporter, DLCP *dlconn, char *infomatch, double interval)
+{
+  struct pollfd pfd;
+  int64_t next;
+  int64_t now;
+  int64_t wait;
+
+  if (!exporter || !dlconn)
+    return -1;
+
+  if (interval <= 0)
+    interval = 10;
+
+  next = clock_ns ();
+
+  while (!dlconn->terminate)
+  {
+    now = clock_ns ();
+
+    if (now >= next)
+    {
+      metrics_poll (exporter, dlconn, infomatch);
+
+      next += (int64_t)(interval * 1e9);
+
+      if (next < now)
+        next = now + (int64_t)(interval * 1e9);
+    }
+
+    /* Wait for a request until the next poll, at most 1 second */
+    wait = (next - clock_ns ()) / 1000000;
+    if (wait < 0)
+      wait = 0;
+    else if (wait > 1000)
+      wait = 1000;
+
+    pfd.fd      = exporter->listenfd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    if (poll (&pfd, 1, (int)wait) > 0 && (pfd.revents & POLLIN))
+      metrics_serve (exporter);
+  }
+
+  return 0;
+} /* End of metrics_run() */
+
+/***************************************************************************
+ * metrics_free:
+ *
+ * Close the listening socket and free the exporter.
+ ***************************************************************************/
+void
+metrics_free (MetricsExporter *exporter)
+{
+  int idx;
+
+  if (!exporter)
+    return;
+
+  if (exporter->listenfd >= 0)
+    close (exporter->listenfd);
+
+  for (idx = 0; idx < M_COUNT; idx++)
+  {
+    if (exporter->families[idx].index)
+      strhash_free (exporter->families[idx].index, metrics_freeseries);
+    free (exporter->families[idx].series);
+  }
+
+  free (exporter->body);
+  free (exporter);
+} /* End of metrics_free() */
+
+/***************************************************************************
+ * metrics_poll:
+ *
+ * Request STATUS, STREAMS and CONNECTIONS from the server and update
+ * the series.  Series are only removed after a complete poll.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+metrics_poll (MetricsExporter *exporter, DLCP *dlconn, char *infomatch)
+{
+  static const struct
+  {
+    const char *infotype;
+    int family;
+  } requests[] = {{"STATUS", M_SERVER_INFO},
+                  {"STREAMS", M_STREAM_LATEST_PKTID},
+                  {"CONNECTIONS", M_CONNECTION_TX_PACKETS}};
+  InfoXML *parser;
+  int64_t start = clock_ns ();
+  int idx;
+  int rv = 0;
+
+  exporter->poll++;
+  exporter->polls++;
+
+  /* Reconnect if the connection was lost */
+  if (dlconn->link < 0 && dl_connect (dlconn) < 0)
+  {
+    dl_log (2, 0, "Error connecting to server\n");
+    rv = -1;
+  }
+
+  for (idx = 0; rv == 0 && idx < (int)(sizeof (requests) / sizeof (requests[0])); idx++)
+  {
+    exporter->polltype = requests[idx].family;
+    exporter->error    = 0;
+
+    if (!(parser = infoxml_new (metrics_start, NULL, exporter)))
+      return -1;
+
+    if (dl_getinfochunks (dlconn, requests[idx].infotype, infomatch, metrics_chunk, parser) < 0 ||
+        infoxml_finish (parser) || exporter->error)
+    {
+      dl_log (2, 0, "Problem requesting %s from server\n", requests[idx].infotype);
+      rv = -1;
+    }
+
+    infoxml_free (parser);
+  }
+
+  if (rv)
+  {
+    exporter->pollerrors++;
+
+    /* Reset the connection unless terminated */
+    if (!dlconn->terminate)
+      dl_disconnect (dlconn);
+  }
+
+  /* Set before the sweep so these series are kept rather than re-created */
+  metrics_set (exporter, M_POLLS, "", (double)exporter->polls);
+  metrics_set (exporter, M_POLL_ERRORS, "", (double)exporter->pollerrors);
+  metrics_set (exporter, M_POLL_DURATION, "", (clock_ns () - start) / 1e9);
+  metrics_set (exporter, M_CLIENT_PACKETS, "", (double)dlconn->stats.pktrecv);
+  metrics_set (exporter, M_CLIENT_BYTES, "", (double)dlconn->stats.byterecv);
+  metrics_set (exporter, M_CLIENT_RECVCALLS, "", (double)dlconn->stats.recvcalls);
+  metrics_set (exporter, M_CLIENT_SENDCALLS, "", (double)dlconn->stats.sendcalls);
+  metrics_set (exporter, M_CLIENT_SYSCALLS, "", (double)dlconn->stats.syscalls);
+
+  if (rv == 0)
+    metrics_sweep (exporter);
+
+  return rv;
+} /* End of metrics_poll() */
+
+/***************************************************************************
+ * metrics_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+metrics_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of metrics_chunk() */
+
+/***************************************************************************
+ * metrics_start:
+ *
+ * Element start callback: set the series of each element of interest.
+ ***************************************************************************/
+static int
+metrics_start (void *data, const char *name, const char **attrs, int depth)
+{
+  MetricsExporter *exporter = (MetricsExporter *)data;
+  const char *value;
+  char labels[1024];
+  char timestr[50];
+  dltime_t dataend;
+  size_t length;
+
+  if (depth == 0)
+  {
+    if (strcmp (name, "DataLink"))
+    {
+      dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+      return -1;
+    }
+
+    if (exporter->polltype == M_SERVER_INFO)
+    {
+      length = metrics_label (labels, sizeof (labels), "server_id", infoxml_attr (attrs, "ServerID"));
+      labels[length++] = ',';
+      metrics_label (labels + length, sizeof (labels) - length, "version", infoxml_attr (attrs, "Version"));
+      metrics_set (exporter, M_SERVER_INFO, labels, 1);
+    }
+  }
+  else if (depth == 1 && exporter->polltype == M_SERVER_INFO && !strcmp (name, "Status"))
+  {
+    metrics_setattr (exporter, M_SERVER_CONNECTIONS, "", attrs, "TotalConnections");
+    metrics_setattr (exporter, M_SERVER_STREAMS, "", attrs, "TotalStreams");
+    metrics_setattr (exporter, M_SERVER_RX_PACKETS, "", attrs, "RXPacketRate");
+    metrics_setattr (exporter, M_SERVER_RX_BYTES, "", attrs, "RXByteRate");
+    metrics_setattr (exporter, M_SERVER_TX_PACKETS, "", attrs, "TXPacketRate");
+    metrics_setattr (exporter, M_SERVER_TX_BYTES, "", attrs, "TXByteRate");
+    metrics_setattr (exporter, M_SERVER_EARLIEST_PKTID, "", attrs, "EarliestPacketID");
+    metrics_setattr (exporter, M_SERVER_LATEST_PKTID, "", attrs, "LatestPacketID");
+  }
+  else if (depth == 2 && exporter->polltype == M_STREAM_LATEST_PKTID && !strcmp (name, "Stream"))
+  {
+    if (!(value = infoxml_attr (attrs, "Name")))
+      return 0;
+
+    metrics_label (labels, sizeof (labels), "stream", value);
+
+    metrics_setattr (exporter, M_STREAM_LATEST_PKTID, labels, attrs, "LatestPacketID");
+    metrics_setattr (exporter, M_STREAM_LATENCY, labels, attrs, "DataLatency");
+
+    if ((value = infoxml_attr (attrs, "LatestPacketDataEndTime")))
+    {
+      snprintf (timestr, sizeof (timestr), "%s", value);
+
+      if ((dataend = dl_timestr2dltime (timestr)) != DLTERROR)
+        metrics_set (exporter, M_STREAM_DATA_END, labels, (double)dataend / DLTMODULUS);
+    }
+  }
+  else if (depth == 2 && exporter->polltype == M_CONNECTION_TX_PACKETS && !strcmp (name, "Connection"))
+  {
+    length = metrics_label (labels, sizeof (labels), "ip", infoxml_attr (attrs, "IP"));
+    labels[length++] = ',';
+    length += metrics_label (labels + length, sizeof (labels) - length, "port", infoxml_attr (attrs, "Port"));
+    labels[length++] = ',';
+    metrics_label (labels + length, sizeof (labels) - length, "client_id", infoxml_attr (attrs, "ClientID"));
+
+    metrics_setattr (exporter, M_CONNECTION_TX_PACKETS, labels, attrs, "TXPacketCount");
+    metrics_setattr (exporter, M_CONNECTION_TX_BYTES, labels, attrs, "TXByteCount");
+    metrics_setattr (exporter, M_CONNECTION_RX_PACKETS, labels, attrs, "RXPacketCount");
+    metrics_setattr (exporter, M_CONNECTION_RX_BYTES, labels, attrs, "RXByteCount");
+    metrics_setattr (exporter, M_CONNECTION_LATENCY, labels, attrs, "Latency");
+    metrics_setattr (exporter, M_CONNECTION_LAG, labels, attrs, "PercentLag");
+  }
+
+  return (exporter->error) ? -1 : 0;
+} /* End of metrics_start() */
+
+/***************************************************************************
+ * metrics_setattr:
+ *
+ * Set a series to the numeric value of an attribute, if present.
+ ***************************************************************************/
+static void
+metrics_setattr (MetricsExporter *exporter, int family, const char *labels,
+                 const char **attrs, const char *attr)
+{
+  const char *value;
+  char *endptr;
+  double number;
+
+  if (!(value = infoxml_attr (attrs, attr)))
+    return;
+
+  number = strtod (value, &endptr);
+
+  if (endptr != value)
+    metrics_set (exporter, family, labels, number);
+} /* End of metrics_setattr() */
+
+/***************************************************************************
+ * metrics_set:
+ *
+ * Set the value of a series, creating it if needed.  The text line of
+ * the series is rendered only when the value changes.
+ ***************************************************************************/
+static void
+metrics_set (MetricsExporter *exporter, int family, const char *labels, double value)
+{
+  Family *fam = &exporter->families[family];
+  Series **newseries;
+  Series *series;
+  char line[2048];
+  int length;
+
+  if (!(series = (Series *)strhash_get (fam->index, labels)))
+  {
+    if (fam->count >= fam->size)
+    {
+      if (!(newseries = (Series **)realloc (fam->series, (fam->size + 64) * 2 * sizeof (Series *))))
+      {
+        dl_log (2, 0, "Cannot allocate memory for metrics\n");
+        exporter->error = 1;
+        return;
+      }
+
+      fam->series = newseries;
+      fam->size   = (fam->size + 64) * 2;
+    }
+
+    if (!(series = (Series *)calloc (1, sizeof (Series))) ||
+        !(series->labels = strdup (labels)) ||
+        strhash_put (fam->index, labels, series))
+    {
+      dl_log (2, 0, "Cannot allocate memory for metrics\n");
+      metrics_freeseries (series);
+      exporter->error = 1;
+      return;
+    }
+
+    fam->series[fam->count++] = series;
+  }
+
+  series->poll = exporter->poll;
+
+  if (series->line && series->value == value)
+    return;
+
+  if (labels[0])
+    length = snprintf (line, sizeof (line), "%s{%s} %.15g\n", metricdefs[family].name, labels, value);
+  else
+    length = snprintf (line, sizeof (line), "%s %.15g\n", metricdefs[family].name, value);
+
+  if (length <= 0 || length >= (int)sizeof (line))
+    return;
+
+  free (series->line);
+
+  if (!(series->line = strdup (line)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for metrics\n");
+    exporter->error = 1;
+    return;
+  }
+
+  series->linelen  = length;
+  series->value    = value;
+  exporter->dirty  = 1;
+} /* End of metrics_set() */
+
+/***************************************************************************
+ * metrics_sweep:
+ *
+ * Remove the series not set in the current poll.
+ ***************************************************************************/
+static void
+metrics_sweep (MetricsExporter *exporter)
+{
+  Family *fam;
+  int family;
+  int idx;
+  int keep;
+
+  for (family = 0; family < M_COUNT; family++)
+  {
+    fam = &exporter->families[family];
+
+    for (idx = 0, keep = 0; idx < fam->count; idx++)
+    {
+      if (fam->series[idx]->poll == exporter->poll)
+      {
+        fam->series[keep++] = fam->series[idx];
+        continue;
+      }
+
+      strhash_remove (fam->index, fam->series[idx]->labels);
+      metrics_freeseries (fam->series[idx]);
+      exporter->dirty = 1;
+    }
+
+    fam->count = keep;
+  }
+} /* End of metrics_sweep() */
+
+/***************************************************************************
+ * metrics_assemble:
+ *
+ * Assemble the response body from the rendered series if any changed.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+metrics_assemble (MetricsExporter *exporter)
+{
+  Family *fam;
+  char header[512];
+  char *newbody;
+  size_t needed = 0;
+  int headerlen;
+  int family;
+  int idx;
+
+  if (!exporter->dirty)
+    return 0;
+
+  for (family = 0; family < M_COUNT; family++)
+  {
+    fam = &exporter->families[family];
+
+    for (idx = 0; idx < fam->count; idx++)
+      needed += fam->series[idx]->linelen;
+
+    needed += sizeof (header);
+  }
+
+  if (needed > exporter->bodysize)
+  {
+    if (!(newbody = (char *)realloc (exporter->body, needed)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for metrics\n");
+      return -1;
+    }
+
+    exporter->body     = newbody;
+    exporter->bodysize = needed;
+  }
+
+  exporter->bodylen = 0;
+
+  for (family = 0; family < M_COUNT; family++)
+  {
+    fam = &exporter->families[family];
+
+    if (fam->count == 0)
+      continue;
+
+    headerlen = snprintf (header, sizeof (header), "# HELP %s %s\n# TYPE %s %s\n",
+                          metricdefs[family].name, metricdefs[family].help,
+                          metricdefs[family].name, metricdefs[family].type);
+
+    memcpy (exporter->body + exporter->bodylen, header, headerlen);
+    exporter->bodylen += headerlen;
+
+    for (idx = 0; idx < fam->count; idx++)
+    {
+      memcpy (exporter->body + exporter->bodylen, fam->series[idx]->line, fam->series[idx]->linelen);
+      exporter->bodylen += fam->series[idx]->linelen;
+    }
+  }
+
+  exporter->dirty = 0;
+
+  return 0;
+} /* End of metrics_assemble() */
+
+/***************************************************************************
+ * metrics_serve:
+ *
+ * Accept a connection and answer one HTTP request: GET /metrics
+ * returns the metrics, other paths are not found.
+ ***************************************************************************/
+static void
+metrics_serve (MetricsExporter *exporter)
+{
+  struct timeval timeout = {5, 0};
+  char request[4096];
+  char header[256];
+  const char *status = NULL;
+  size_t received = 0;
+  ssize_t nrecv;
+  int headerlen;
+  int fd;
+
+  if ((fd = accept (exporter->listenfd, NULL, NULL)) < 0)
+    return;
+
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+  /* Read the request header */
+  while (received < sizeof (request) - 1)
+  {
+    if ((nrecv = recv (fd, request + received, sizeof (request) - 1 - received, 0)) <= 0)
+      break;
+
+    received += nrecv;
+    request[received] = '\0';
+
+    if (strstr (request, "\r\n\r\n") || strstr (request, "\n\n"))
+      break;
+  }
+
+  request[received] = '\0';
+
+  if (strncmp (request, "GET ", 4))
+    status = "405 Method Not Allowed";
+  else if (strncmp (request + 4, "/metrics", 8) ||
+           (request[12] != ' ' && request[12] != '?'))
+    status = "404 Not Found";
+  else if (metrics_assemble (exporter))
+    status = "500 Internal Server Error";
+
+  if (status)
+  {
+    headerlen = snprintf (header, sizeof (header),
+                          "HTTP/1.1 %s\r\nContent-Type: text/plain\r\n"
+                          "Content-Length: %d\r\nConnection: close\r\n\r\n%s\n",
+                          status, (int)strlen (status) + 1, status);
+    metrics_send (fd, header, headerlen);
+  }
+  else
+  {
+    headerlen = snprintf (header, sizeof (header),
+                          "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %llu\r\nConnection: close\r\n\r\n",
+                          (unsigned long long int)exporter->bodylen);
+
+    if (!metrics_send (fd, header, headerlen))
+      metrics_send (fd, exporter->body, exporter->bodylen);
+  }
+
+  close (fd);
+} /* End of metrics_serve() */
+
+/***************************************************************************
+ * metrics_send:
+ *
+ * Send a buffer to a socket.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+metrics_send (int fd, const char *buffer, size_t length)
+{
+  ssize_t nsent;
+
+  while (length > 0)
+  {
+    if ((nsent = send (fd, buffer, length, MSG_NOSIGNAL)) <= 0)
+      return -1;
+
+    buffer += nsent;
+    length -= nsent;
+  }
+
+  return 0;
+} /* End of metrics_send() */
+
+/***************************************************************************
+ * metrics_label:
+ *
+ * Render a label as name="value", escaping backslash, double quote
+ * and newline in the value.  A missing value is rendered empty.
+ *
+ * Returns the length of the rendered label.
+ ***************************************************************************/
+static size_t
+metrics_label (char *buffer, size_t size, const char *name, const char *value)
+{
+  size_t length;
+
+  if (size < 16)
+    return 0;
+
+  length = snprintf (buffer, size - 2, "%s=\"", name);
+
+  if (length >= size - 2)
+    length = size - 3;
+
+  for (; value && *value && length < size - 4; value++)
+  {
+    if (*value == '\\' || *value == '"')
+    {
+      buffer[length++] = '\\';
+      buffer[length++] = *value;
+    }
+    else if (*value == '\n')
+    {
+      buffer[length++] = '\\';
+      buffer[length++] = 'n';
+    }
+    else
+    {
+      buffer[length++] = *value;
+    }
+  }
+
+  buffer[length++] = '"';
+  buffer[length]   = '\0';
+
+  return length;
+} /* End of metrics_label() */
+
+/***************************************************************************
+ * metrics_freeseries:
+ *
+ * Free a series.
+ ***************************************************************************/
+static void
+metrics_freeseries (void *value)
+{
+  Series *series = (Series *)value;
+
+  if (!series)
+    return;
+
+  free (series->labels);
+  free (series->line);
+  free (series);
+} /* End of metrics_freeseries() */
+
+#else /* WIN32 */
+
+/* The metrics exporter is not supported on Windows */
+
+MetricsExporter *
+metrics_new (const char *listenaddr)
+{
+  dl_log (2, 0, "The metrics exporter is not supported on this platform\n");
+  return NULL;
+}
+
+int
+metrics_run (MetricsExporter *exporter, DLCP *dlconn, char *infomatch, double interval)
+{
+  return -1;
+}
+
+void
+metrics_free (MetricsExporter *exporter)
+{
+}
+
+#endif /* WIN32 */
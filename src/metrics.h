@@ -0,0 +1,23 @@
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct MetricsExporter_s MetricsExporter;
+
+extern MetricsExporter *metrics_new (const char *listenaddr);
+extern int metrics_run (MetricsExporter *exporter, DLCP *dlconn, char *infomatch,
+                        double interval);
+extern void metrics_free (MetricsExporter *exporter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* METRICS_H */
@@ -0,0 +1,299 @@
+/***************************************************************************
+ * relay.c
+ *
+ * Routines for relaying packets streamed from one DataLink server to
+ * another.
+ *
+ * Packets are received directly into the buffers of a batch, as many
+ * as are immediately available up to the batch size, and the batch is
+ * written to the destination with dl_writebatch(), which sends the
+ * packet data from the receive buffers with vectored sends and
+ * collects all acknowledgements with a single round trip.  Stream IDs
+ * and data times are preserved.
+ *
+ * If the destination connection fails it is re-established and the
+ * packets of the batch that were not acknowledged are written again.
+ * Packets sent but not acknowledged before the failure may already
+ * have been stored, so delivery is at least once: a packet may be
+ * written to the destination twice, but never skipped.  Without
+ * acknowledgements the whole batch is written again.  Attempts are
+ * spaced by a delay that doubles up to MAXBACKOFF seconds.
+ *
+ * Packets larger than the destination accepts can never be written
+ * and are skipped and counted rather than retried.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "common.h"
+#include "relay.h"
+
+/* Limit on the batch size, keeping the unread replies to a batch small */
+#define MAXBATCH 1024
+
+/* Limit on the delay between attempts to write a batch, in seconds */
+#define MAXBACKOFF 32
+
+static int relay_connect (DLCP *dest, DLCP *dlconn);
+
+/***************************************************************************
+ * runrelay:
+ *
+ * Stream packets from the server of dlconn and write them to the
+ * destination server until the source connection is terminated.
+ *
+ * When finished the position of dlconn is set to the last packet
+ * written to the destination, so that a saved state file does not
+ * include packets that were not relayed.
+ *
+ * Returns 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+runrelay (DLCP *dlconn, RelayParams *params)
+{
+  DLCP *dest = NULL;
+  DLPacket *packets = NULL;
+  DLWriteItem *items = NULL;
+  int *origins = NULL;
+  char *buffers = NULL;
+  int batch;
+  int count;
+  int itemcount;
+  int written;
+  int start;
+  int accepted;
+  int backoff;
+  int delay;
+  int idx;
+  int rv;
+  int retval = 0;
+
+  int64_t lastpktid   = -1;
+  dltime_t lastpkttime = 0;
+  int64_t relayed     = 0;
+  int64_t rejected    = 0;
+  int64_t skipped     = 0;
+  int64_t bytes       = 0;
+  int64_t batches     = 0;
+  int64_t reconnects  = 0;
+  int64_t starttime;
+  double elapsed;
+
+  if (!dlconn || !params || !params->destination)
+    return -1;
+
+  batch = (params->batch > 0) ? params->batch : 1;
+  if (batch > MAXBATCH)
+    batch = MAXBATCH;
+
+  packets = (DLPacket *)malloc (batch * sizeof (DLPacket));
+  items   = (DLWriteItem *)malloc (batch * sizeof (DLWriteItem));
+  origins = (int *)malloc (batch * sizeof (int));
+  buffers = (char *)malloc ((size_t)batch * MAXPACKETSIZE);
+
+  if (!packets || !items || !origins || !buffers)
+  {
+    dl_log (2, 0, "Cannot allocate memory for relay batch\n");
+    retval = -1;
+    goto cleanup;
+  }
+
+  if (!(dest = dl_newdlcp (params->destination, "dalitool")))
+  {
+    dl_log (2, 0, "Cannot create connection to %s\n", params->destination);
+    retval = -1;
+    goto cleanup;
+  }
+
+  dest->keepalive = dlconn->keepalive;
+
+  if (relay_connect (dest, dlconn))
+  {
+    retval = -1;
+    goto cleanup;
+  }
+
+  dl_log (1, 1, "Relaying to %s in batches of up to %d packets\n", dest->addr, batch);
+
+  starttime = clock_ns ();
+
+  while (!dlconn->terminate)
+  {
+    /* Wait for a packet, then take whatever else is immediately available */
+    if (dl_collect (dlconn, &packets[0], buffers, MAXPACKETSIZE, 0) != DLPACKET)
+      break;
+
+    for (count = 1; count < batch; count++)
+    {
+      rv = dl_collect_nb (dlconn, &packets[count], buffers + (size_t)count * MAXPACKETSIZE,
+                          MAXPACKETSIZE, 0);
+
+      if (rv != DLPACKET)
+        break;
+    }
+
+    /* Stream IDs are shorter than MAXSTREAMID, so only the size can make a packet invalid */
+    for (idx = 0, itemcount = 0; idx < count; idx++)
+    {
+      if (dest->maxpktsize > 0 && packets[idx].datasize > dest->maxpktsize)
+      {
+        dl_log (1, 0, "%s: Packet %lld of %d bytes is larger than the destination limit of %d, skipped\n",
+                packets[idx].streamid, (long long int)packets[idx].pktid,
+                packets[idx].datasize, dest->maxpktsize);
+        skipped++;
+        continue;
+      }
+
+      origins[itemcount]         = idx;
+      items[itemcount].streamid  = packets[idx].streamid;
+      items[itemcount].datastart = packets[idx].datastart;
+      items[itemcount].dataend   = packets[idx].dataend;
+      items[itemcount].packet    = buffers + (size_t)idx * MAXPACKETSIZE;
+      items[itemcount].packetlen = packets[idx].datasize;
+      itemcount++;
+    }
+
+    /* Write batch, reconnecting to the destination until successful */
+    start   = 0;
+    backoff = 1;
+    while ((accepted = dl_writebatch (dest, items + start, itemcount - start, params->ack)) < 0)
+    {
+      /* Packets acknowledged before the failure are not written again */
+      while (params->ack && start < itemcount && items[start].reply != DLNOREPLY)
+        start++;
+
+      dl_log (2, 0, "[%s] Error writing to destination, retrying %d of %d packets in %d seconds\n",
+              dest->addr, itemcount - start, itemcount, backoff);
+
+      if (dest->link != -1)
+        dl_disconnect (dest);
+
+      for (delay = 0; delay < backoff && !dlconn->terminate; delay++)
+        dlp_usleep (1000000);
+
+      if (backoff < MAXBACKOFF)
+        backoff *= 2;
+
+      while (!dlconn->terminate && relay_connect (dest, dlconn))
+        dlp_usleep (1000000);
+
+      if (dlconn->terminate)
+        break;
+
+      reconnects++;
+
+      /* The destination may have been reconfigured */
+      for (idx = start; idx < itemcount; idx++)
+      {
+        if (dest->maxpktsize > 0 && items[idx].packetlen > dest->maxpktsize)
+          break;
+      }
+
+      if (idx < itemcount)
+      {
+        dl_log (2, 0, "[%s] Destination packet size limit reduced to %d, cannot continue\n",
+                dest->addr, dest->maxpktsize);
+        dlconn->terminate = 1;
+        retval = -1;
+        break;
+      }
+    }
+
+    /* Only the packets acknowledged before termination were written */
+    if (accepted < 0)
+      itemcount = start;
+
+    for (idx = 0; idx < itemcount; idx++)
+    {
+      if (items[idx].reply < 0)
+      {
+        rejected++;
+      }
+      else
+      {
+        bytes += items[idx].packetlen;
+        relayed++;
+      }
+    }
+
+    /* Packets handled, either written or skipped, are those before the first unwritten */
+    written = (accepted >= 0) ? count : (start < count) ? origins[start] : count;
+
+    if (written > 0)
+    {
+      batches++;
+
+      lastpktid   = packets[written - 1].pktid;
+      lastpkttime = packets[written - 1].pkttime;
+    }
+
+    if (accepted < 0)
+      break;
+  }
+
+  elapsed = (double)(clock_ns () - starttime) / 1e9;
+
+  dl_log (0, 0, "Relayed %lld packets, %lld bytes in %.3f seconds, %.1f packets/sec\n",
+          (long long int)relayed, (long long int)bytes, elapsed,
+          (elapsed > 0) ? relayed / elapsed : 0.0);
+  dl_log (0, 0, "  Batches: %lld, average size %.1f packets\n",
+          (long long int)batches, (batches > 0) ? (double)(relayed + rejected + skipped) / batches : 0.0);
+
+  if (rejected || skipped || reconnects)
+    dl_log (0, 0, "  Rejected by destination: %lld, too large for destination: %lld, reconnections: %lld\n",
+            (long long int)rejected, (long long int)skipped, (long long int)reconnects);
+
+  /* Set source position to the last packet written for state saving */
+  if (lastpktid >= 0)
+  {
+    dlconn->pktid   = lastpktid;
+    dlconn->pkttime = lastpkttime;
+  }
+
+cleanup:
+  if (dest)
+  {
+    if (dest->link != -1)
+      dl_disconnect (dest);
+
+    dl_freedlcp (dest);
+  }
+
+  free (packets);
+  free (items);
+  free (origins);
+  free (buffers);
+
+  return retval;
+} /* End of runrelay() */
+
+/***************************************************************************
+ * relay_connect:
+ *
+ * Connect to the destination server and check for write permission.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+relay_connect (DLCP *dest, DLCP *dlconn)
+{
+  if (dl_connect (dest) < 0)
+  {
+    dl_log (2, 0, "[%s] Error connecting to destination server\n", dest->addr);
+    return -1;
+  }
+
+  if (!dest->writeperm)
+  {
+    dl_log (2, 0, "[%s] Destination server did not grant write permission\n", dest->addr);
+    dl_disconnect (dest);
+    dlconn->terminate = 1;
+    return -1;
+  }
+
+  return 0;
+} /* End of relay_connect() */
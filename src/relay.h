@@ -0,0 +1,26 @@
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Parameters for relaying packets to another server */
+typedef struct RelayParams_s
+{
+  char *destination;    /* Address of destination server */
+  int batch;            /* Maximum number of packets written per batch */
+  int ack;              /* Request acknowledgement of each packet */
+} RelayParams;
+
+extern int runrelay (DLCP *dlconn, RelayParams *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* RELAY_H */
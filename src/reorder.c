@@ -0,0 +1,497 @@
+/***************************************************************************
+ * reorder.c
+ *
+ * A reorder stage that holds received packets for a limited time and
+ * emits the packets of each stream in order of data start time.
+ *
+ * Each stream has a binary min-heap of held packets keyed on data
+ * start time and all held packets are also kept in a single queue in
+ * order of arrival.  As every packet is held for the same latency
+ * budget, the front of the arrival queue is always the next packet to
+ * expire.  When it expires the packets of its stream are emitted from
+ * the heap up to and including its data start time.  Each packet
+ * costs one hash lookup and O(log n) heap operations for n packets
+ * held for its stream, independent of the number of streams.
+ *
+ * Memory is bounded: when the packets held exceed the limit the
+ * oldest are expired early.  Packets arriving with a data start time
+ * before that of the last packet emitted for their stream cannot be
+ * put in order and are emitted immediately.
+ *
+ * For each held packet the packet received before it on the same
+ * connection is recorded, so that the position up to which all
+ * packets from a connection have been emitted can be determined for
+ * saving connection state.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "common.h"
+#include "reorder.h"
+#include "strhash.h"
+
+typedef struct ReorderStream_s ReorderStream;
+
+/* A held packet, the packet data follows the structure */
+typedef struct Held_s
+{
+  DLPacket dlpacket;            /* Packet header details */
+  DLCP *dlconn;                 /* Connection the packet was received on */
+  ReorderStream *stream;        /* Stream of packet */
+  int64_t deadline;             /* Time to emit by, nanoseconds */
+  int emitted;                  /* Packet has been emitted */
+  int64_t prevpktid;            /* Packet ID of previous packet from connection */
+  dltime_t prevpkttime;         /* Packet time of previous packet from connection */
+  struct Held_s *next;          /* Next packet in arrival order */
+} Held;
+
+/* Per-stream state */
+struct ReorderStream_s
+{
+  Held **heap;                  /* Min-heap of held packets by data start */
+  int count;                    /* Number of packets in heap */
+  int size;                     /* Allocated size of heap */
+  dltime_t lastemitted;         /* Data start of last packet emitted */
+  int haveemitted;              /* A packet has been emitted */
+  dltime_t latestarrived;       /* Latest data start of packets received */
+};
+
+/* Last packet received on a connection */
+typedef struct ReorderConn_s
+{
+  DLCP *dlconn;                 /* Connection */
+  int64_t pktid;                /* Packet ID of last packet received */
+  dltime_t pkttime;             /* Packet time of last packet received */
+} ReorderConn;
+
+struct Reorder_s
+{
+  int64_t latency;              /* Latency budget, nanoseconds */
+  size_t maxmemory;             /* Maximum bytes held */
+  size_t memory;                /* Bytes currently held */
+  StrHash *streams;             /* ReorderStream entries keyed by stream ID */
+  Held *head;                   /* Oldest held packet */
+  Held *tail;                   /* Newest held packet */
+  ReorderConn *conns;           /* Last packet received for each connection */
+  int conncount;                /* Number of connections */
+  FaninHandler handler;         /* Handler for emitted packets */
+  void *handlerdata;            /* Data passed to handler */
+  int64_t packets;              /* Packets received */
+  int64_t reordered;            /* Packets received out of order and put in order */
+  int64_t late;                 /* Packets emitted immediately, too late to order */
+  int64_t forced;               /* Packets expired early due to the memory limit */
+  int64_t maxheld;              /* Maximum number of packets held */
+  int64_t held;                 /* Number of packets held */
+};
+
+static void reorder_expire (Reorder *reorder, int64_t now, int flush);
+static void reorder_emit (Reorder *reorder, ReorderStream *stream, dltime_t upto);
+static int heap_push (ReorderStream *stream, Held *held);
+static Held *heap_pop (ReorderStream *stream);
+static ReorderConn *reorder_getconn (Reorder *reorder, DLCP *dlconn);
+static void reorder_freestream (void *value);
+
+/***************************************************************************
+ * reorder_new:
+ *
+ * Create a new reorder stage holding packets for up to latency
+ * seconds and up to maxmemory bytes of packet data, emitting packets
+ * to the handler.
+ *
+ * Returns a pointer to the reorder stage on success and NULL on error.
+ ***************************************************************************/
+Reorder *
+reorder_new (double latency, size_t maxmemory,
+             FaninHandler handler, void *handlerdata)
+{
+  Reorder *reorder;
+
+  if (!handler)
+    return NULL;
+
+  if (!(reorder = (Reorder *)calloc (1, sizeof (Reorder))) ||
+      !(reorder->streams = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for reorder stage\n");
+    free (reorder);
+    return NULL;
+  }
+
+  reorder->latency     = (int64_t)(latency * 1e9);
+  reorder->maxmemory   = maxmemory;
+  reorder->handler     = handler;
+  reorder->handlerdata = handlerdata;
+
+  return reorder;
+} /* End of reorder_new() */
+
+/***************************************************************************
+ * reorder_packet:
+ *
+ * Add a packet to the reorder stage, emitting it immediately if it is
+ * too late to be put in order, and emit any packets that have expired.
+ * The arguments match FaninHandler so that the stage can be used as
+ * the handler for collection, with the reorder stage as handler data.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+reorder_packet (DLCP *dlconn, DLPacket *dlpacket, void *packetdata, void *data)
+{
+  Reorder *reorder = (Reorder *)data;
+  ReorderStream *stream;
+  ReorderConn *conn;
+  Held *held;
+  int64_t prevpktid;
+  dltime_t prevpkttime;
+  int64_t now = clock_ns ();
+
+  if (!reorder || !dlpacket || !packetdata)
+    return -1;
+
+  reorder->packets++;
+
+  /* Track the packet received before this one on the connection */
+  if (!(conn = reorder_getconn (reorder, dlconn)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for reorder connection\n");
+    return -1;
+  }
+
+  prevpktid     = conn->pktid;
+  prevpkttime   = conn->pkttime;
+  conn->pktid   = dlpacket->pktid;
+  conn->pkttime = dlpacket->pkttime;
+
+  if (!(stream = (ReorderStream *)strhash_get (reorder->streams, dlpacket->streamid)))
+  {
+    if (!(stream = (ReorderStream *)calloc (1, sizeof (ReorderStream))) ||
+        strhash_put (reorder->streams, dlpacket->streamid, stream))
+    {
+      dl_log (2, 0, "Cannot allocate memory for reorder stream\n");
+      free (stream);
+      return -1;
+    }
+  }
+
+  /* Emit immediately when too late to be put in order */
+  if (stream->haveemitted && dlpacket->datastart < stream->lastemitted)
+  {
+    reorder->late++;
+    reorder->handler (dlconn, dlpacket, packetdata, reorder->handlerdata);
+    reorder_expire (reorder, now, 0);
+    return 0;
+  }
+
+  if (!(held = (Held *)malloc (sizeof (Held) + dlpacket->datasize)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for reorder packet\n");
+    return -1;
+  }
+
+  memcpy (&held->dlpacket, dlpacket, sizeof (DLPacket));
+  memcpy (held + 1, packetdata, dlpacket->datasize);
+  held->dlconn   = dlconn;
+  held->stream   = stream;
+  held->deadline = now + reorder->latency;
+  held->emitted  = 0;
+  held->next     = NULL;
+
+  held->prevpktid   = prevpktid;
+  held->prevpkttime = prevpkttime;
+
+  if (heap_push (stream, held))
+  {
+    dl_log (2, 0, "Cannot allocate memory for reorder heap\n");
+    free (held);
+    return -1;
+  }
+
+  if (dlpacket->datastart < stream->latestarrived)
+    reorder->reordered++;
+  else
+    stream->latestarrived = dlpacket->datastart;
+
+  /* Append to arrival queue */
+  if (reorder->tail)
+    reorder->tail->next = held;
+  else
+    reorder->head = held;
+  reorder->tail = held;
+
+  reorder->memory += sizeof (Held) + dlpacket->datasize;
+  reorder->held++;
+
+  if (reorder->held > reorder->maxheld)
+    reorder->maxheld = reorder->held;
+
+  reorder_expire (reorder, now, 0);
+
+  return 0;
+} /* End of reorder_packet() */
+
+/***************************************************************************
+ * reorder_tick:
+ *
+ * Emit packets that have expired, to be called periodically when no
+ * packets are being received.
+ ***************************************************************************/
+void
+reorder_tick (void *data)
+{
+  if (data)
+    reorder_expire ((Reorder *)data, clock_ns (), 0);
+} /* End of reorder_tick() */
+
+/***************************************************************************
+ * reorder_position:
+ *
+ * Determine the position up to which all packets received on a
+ * connection have been emitted.  If any packets from the connection
+ * are held, pktid and pkttime are set to those of the packet received
+ * before the earliest held packet, or 0 if there is none.
+ *
+ * Returns 1 if packets from the connection are held, otherwise 0 and
+ * all packets received on the connection have been emitted.
+ ***************************************************************************/
+int
+reorder_position (Reorder *reorder, DLCP *dlconn, int64_t *pktid, dltime_t *pkttime)
+{
+  Held *held;
+
+  if (!reorder)
+    return 0;
+
+  for (held = reorder->head; held; held = held->next)
+  {
+    if (!held->emitted && held->dlconn == dlconn)
+    {
+      if (pktid)
+        *pktid = held->prevpktid;
+      if (pkttime)
+        *pkttime = held->prevpkttime;
+
+      return 1;
+    }
+  }
+
+  return 0;
+} /* End of reorder_position() */
+
+/***************************************************************************
+ * reorder_free:
+ *
+ * Emit all held packets and free the reorder stage.
+ ***************************************************************************/
+void
+reorder_free (Reorder *reorder)
+{
+  if (!reorder)
+    return;
+
+  reorder_expire (reorder, 0, 1);
+
+  dl_log (1, 1, "Reorder: %lld packets, %lld reordered, %lld late, %lld expired early, max held %lld\n",
+          (long long int)reorder->packets, (long long int)reorder->reordered,
+          (long long int)reorder->late, (long long int)reorder->forced,
+          (long long int)reorder->maxheld);
+
+  strhash_free (reorder->streams, reorder_freestream);
+  free (reorder->conns);
+  free (reorder);
+} /* End of reorder_free() */
+
+/***************************************************************************
+ * reorder_expire:
+ *
+ * Process the arrival queue, emitting the packets of each stream up to
+ * and including each packet that has expired, has to be expired to
+ * stay within the memory limit, or all packets if flush is true.
+ * Packets that have already been emitted are removed from the queue
+ * and freed.
+ ***************************************************************************/
+static void
+reorder_expire (Reorder *reorder, int64_t now, int flush)
+{
+  Held *held;
+
+  while ((held = reorder->head))
+  {
+    if (!held->emitted)
+    {
+      if (flush || now >= held->deadline)
+      {
+        reorder_emit (reorder, held->stream, held->dlpacket.datastart);
+      }
+      else if (reorder->maxmemory && reorder->memory > reorder->maxmemory)
+      {
+        reorder->forced++;
+        reorder_emit (reorder, held->stream, held->dlpacket.datastart);
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    reorder->head = held->next;
+    if (!reorder->head)
+      reorder->tail = NULL;
+
+    reorder->memory -= sizeof (Held) + held->dlpacket.datasize;
+    reorder->held--;
+    free (held);
+  }
+} /* End of reorder_expire() */
+
+/***************************************************************************
+ * reorder_emit:
+ *
+ * Emit the held packets of a stream with data start times up to and
+ * including upto, in order of data start time.
+ ***************************************************************************/
+static void
+reorder_emit (Reorder *reorder, ReorderStream *stream, dltime_t upto)
+{
+  Held *held;
+
+  while (stream->count > 0 && stream->heap[0]->dlpacket.datastart <= upto)
+  {
+    held = heap_pop (stream);
+
+    reorder->handler (held->dlconn, &held->dlpacket, held + 1, reorder->handlerdata);
+
+    held->emitted       = 1;
+    stream->lastemitted = held->dlpacket.datastart;
+    stream->haveemitted = 1;
+  }
+} /* End of reorder_emit() */
+
+/***************************************************************************
+ * heap_push:
+ *
+ * Add a packet to the heap of a stream.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+heap_push (ReorderStream *stream, Held *held)
+{
+  Held **heap;
+  int idx;
+  int parent;
+
+  if (stream->count >= stream->size)
+  {
+    if (!(heap = (Held **)realloc (stream->heap, (stream->size ? stream->size * 2 : 8) * sizeof (Held *))))
+      return -1;
+
+    stream->heap = heap;
+    stream->size = (stream->size) ? stream->size * 2 : 8;
+  }
+
+  /* Sift up */
+  for (idx = stream->count++; idx > 0; idx = parent)
+  {
+    parent = (idx - 1) / 2;
+
+    if (stream->heap[parent]->dlpacket.datastart <= held->dlpacket.datastart)
+      break;
+
+    stream->heap[idx] = stream->heap[parent];
+  }
+
+  stream->heap[idx] = held;
+
+  return 0;
+} /* End of heap_push() */
+
+/***************************************************************************
+ * heap_pop:
+ *
+ * Remove and return the packet with the earliest data start time from
+ * the heap of a stream.
+ ***************************************************************************/
+static Held *
+heap_pop (ReorderStream *stream)
+{
+  Held *top;
+  Held *last;
+  int idx = 0;
+  int child;
+
+  if (stream->count <= 0)
+    return NULL;
+
+  top  = stream->heap[0];
+  last = stream->heap[--stream->count];
+
+  /* Sift down */
+  while ((child = 2 * idx + 1) < stream->count)
+  {
+    if (child + 1 < stream->count &&
+        stream->heap[child + 1]->dlpacket.datastart < stream->heap[child]->dlpacket.datastart)
+      child++;
+
+    if (last->dlpacket.datastart <= stream->heap[child]->dlpacket.datastart)
+      break;
+
+    stream->heap[idx] = stream->heap[child];
+    idx               = child;
+  }
+
+  if (stream->count > 0)
+    stream->heap[idx] = last;
+
+  return top;
+} /* End of heap_pop() */
+
+/***************************************************************************
+ * reorder_getconn:
+ *
+ * Find or add the entry for a connection, there are few connections.
+ *
+ * Returns a pointer to the entry on success and NULL on error.
+ ***************************************************************************/
+static ReorderConn *
+reorder_getconn (Reorder *reorder, DLCP *dlconn)
+{
+  ReorderConn *conns;
+  int idx;
+
+  for (idx = 0; idx < reorder->conncount; idx++)
+  {
+    if (reorder->conns[idx].dlconn == dlconn)
+      return &reorder->conns[idx];
+  }
+
+  if (!(conns = (ReorderConn *)realloc (reorder->conns, (reorder->conncount + 1) * sizeof (ReorderConn))))
+    return NULL;
+
+  reorder->conns = conns;
+  memset (&conns[reorder->conncount], 0, sizeof (ReorderConn));
+  conns[reorder->conncount].dlconn = dlconn;
+
+  return &conns[reorder->conncount++];
+} /* End of reorder_getconn() */
+
+/***************************************************************************
+ * reorder_freestream:
+ *
+ * Free a ReorderStream, all packets must already be emitted.
+ ***************************************************************************/
+static void
+reorder_freestream (void *value)
+{
+  ReorderStream *stream = (ReorderStream *)value;
+
+  if (stream)
+  {
+    free (stream->heap);
+    free (stream);
+  }
+} /* End of reorder_freestream() */
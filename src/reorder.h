@@ -0,0 +1,29 @@
+
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <libdali.h>
+
+#include "fanin.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct Reorder_s Reorder;
+
+extern Reorder *reorder_new (double latency, size_t maxmemory,
+                             FaninHandler handler, void *handlerdata);
+extern int reorder_packet (DLCP *dlconn, DLPacket *dlpacket, void *packetdata,
+                           void *reorder);
+extern void reorder_tick (void *reorder);
+extern int reorder_position (Reorder *reorder, DLCP *dlconn,
+                             int64_t *pktid, dltime_t *pkttime);
+extern void reorder_free (Reorder *reorder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* REORDER_H */
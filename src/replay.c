@@ -0,0 +1,516 @@
+/***************************************************************************
+ * replay.c
+ *
+ * Routines to replay miniSEED files into a DataLink server.
+ *
+ * Records are read from each file by reader threads into a small
+ * queue per file.  The main thread merges the queues by record start
+ * time and writes each record with dl_write(), pacing the writes by
+ * the data start times at a configurable speed.
+ *
+ * Windows is not supported.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+#include "replay.h"
+
+#ifndef WIN32
+
+/* Number of records queued per file */
+#define QUEUELEN 16
+
+/* A queued record */
+typedef struct ReplayRecord_s
+{
+  char streamid[MAXSTREAMID]; /* DataLink stream ID */
+  dltime_t datastart;         /* Data start time */
+  dltime_t dataend;           /* Data end time */
+  int reclen;                 /* Record length */
+  int bufsize;                /* Allocated size of record buffer */
+  char *record;               /* Record buffer */
+} ReplayRecord;
+
+/* A file being replayed and its queue of records */
+typedef struct ReplayFile_s
+{
+  const char *path;               /* File path */
+  ReplayRecord queue[QUEUELEN];   /* Queue of records read */
+  int head;                       /* Index of first queued record */
+  int count;                      /* Count of queued records */
+  int finished;                   /* Flag set when no more records will be queued */
+} ReplayFile;
+
+/* State shared by reader threads and the writer */
+typedef struct ReplayShared_s
+{
+  ReplayFile *files;              /* Files being replayed */
+  int filecount;                  /* Count of files */
+  int threads;                    /* Count of reader threads */
+  const MS3Selections *selections; /* Record selections, NULL for all */
+  volatile int stop;              /* Flag to stop reader threads */
+  pthread_mutex_t lock;           /* Protects queues and flags */
+  pthread_cond_t space;           /* Signaled when a queue has space */
+  pthread_cond_t data;            /* Signaled when a queue has a record */
+} ReplayShared;
+
+/* Reader thread arguments */
+typedef struct ReplayReader_s
+{
+  ReplayShared *shared;           /* Shared state */
+  int index;                      /* Index of this reader, reads files index + n * threads */
+  pthread_t tid;                  /* Thread ID */
+  int started;                    /* Flag indicating the thread was started */
+} ReplayReader;
+
+static void *readerthread (void *arg);
+static int queuerecord (ReplayShared *shared, ReplayFile *file, MS3Record *msr);
+
+/***************************************************************************
+ * runreplay:
+ *
+ * Replay the records in the files to the server of dlconn.  Records
+ * are written in order of start time across all files, which are
+ * assumed to be individually in time order.  With a speed greater
+ * than 0 records are written when the elapsed time since the first
+ * record multiplied by the speed reaches their start time relative
+ * to the first record, otherwise as fast as possible.
+ *
+ * Returns 0 on success and non-zero on error.
+ ***************************************************************************/
+int
+runreplay (DLCP *dlconn, ReplayParams *params)
+{
+  MS3Selections *selections = NULL;
+  ReplayShared shared;
+  ReplayReader *readers = NULL;
+  ReplayFile *file;
+  ReplayRecord current;
+  ReplayRecord *head;
+  char timestr[30];
+  char *swap;
+  int swapsize;
+  int idx;
+  int next;
+  int waiting;
+  int rv = 0;
+
+  uint64_t records = 0;
+  uint64_t bytes   = 0;
+  uint64_t errors  = 0;
+  dltime_t firststart = 0;
+  dltime_t laststart  = 0;
+  int64_t startns     = 0;
+  int64_t reportns    = 0;
+  int64_t targetns;
+  int64_t nowns;
+  int64_t maxlate = 0;
+  double elapsed;
+
+  if (!dlconn || !params || params->filecount <= 0)
+    return -1;
+
+  if (!dlconn->writeperm)
+  {
+    dl_log (2, 0, "[%s] Server does not grant write permission\n", dlconn->addr);
+    return -1;
+  }
+
+  /* Build selections from a pattern and/or file */
+  if (params->selectpattern &&
+      ms3_addselect (&selections, params->selectpattern, NSTUNSET, NSTUNSET, 0))
+  {
+    dl_log (2, 0, "Cannot add selection: %s\n", params->selectpattern);
+    return -1;
+  }
+
+  if (params->selectfile && ms3_readselectionsfile (&selections, params->selectfile) < 0)
+  {
+    dl_log (2, 0, "Cannot read selection file: %s\n", params->selectfile);
+    ms3_freeselections (selections);
+    return -1;
+  }
+
+  memset (&shared, 0, sizeof (shared));
+  memset (&current, 0, sizeof (current));
+  shared.filecount  = params->filecount;
+  shared.threads    = (params->threads > 0) ? params->threads : 1;
+  shared.selections = selections;
+
+  if (shared.threads > shared.filecount)
+    shared.threads = shared.filecount;
+
+  if (!(shared.files = (ReplayFile *)calloc (shared.filecount, sizeof (ReplayFile))) ||
+      !(readers = (ReplayReader *)calloc (shared.threads, sizeof (ReplayReader))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for replay\n");
+    free (shared.files);
+    ms3_freeselections (selections);
+    return -1;
+  }
+
+  for (idx = 0; idx < shared.filecount; idx++)
+    shared.files[idx].path = params->files[idx];
+
+  pthread_mutex_init (&shared.lock, NULL);
+  pthread_cond_init (&shared.space, NULL);
+  pthread_cond_init (&shared.data, NULL);
+
+  for (idx = 0; idx < shared.threads; idx++)
+  {
+    readers[idx].shared = &shared;
+    readers[idx].index  = idx;
+
+    if (pthread_create (&readers[idx].tid, NULL, readerthread, &readers[idx]))
+    {
+      dl_log (2, 0, "Cannot create reader thread: %s\n", strerror (errno));
+      rv = -1;
+      break;
+    }
+
+    readers[idx].started = 1;
+  }
+
+  dl_log (1, 1, "Replaying %d files with %d reader threads at %s%g speed\n",
+          shared.filecount, shared.threads,
+          (params->speed > 0) ? "" : "maximum ", params->speed);
+
+  pthread_mutex_lock (&shared.lock);
+
+  while (rv == 0 && !dlconn->terminate)
+  {
+    /* Select the queued record with the earliest start, waiting until all files have one */
+    next    = -1;
+    waiting = 0;
+    for (idx = 0; idx < shared.filecount; idx++)
+    {
+      file = &shared.files[idx];
+
+      if (file->count == 0)
+      {
+        if (!file->finished)
+          waiting = 1;
+        continue;
+      }
+
+      if (next < 0 ||
+          file->queue[file->head].datastart < shared.files[next].queue[shared.files[next].head].datastart)
+        next = idx;
+    }
+
+    if (waiting)
+    {
+      pthread_cond_wait (&shared.data, &shared.lock);
+      continue;
+    }
+
+    if (next < 0)
+      break;
+
+    /* Take the record by swapping buffers with the queue entry */
+    file = &shared.files[next];
+    head = &file->queue[file->head];
+
+    swap          = current.record;
+    swapsize      = current.bufsize;
+    current       = *head;
+    head->record  = swap;
+    head->bufsize = swapsize;
+
+    file->head = (file->head + 1) % QUEUELEN;
+    file->count--;
+
+    pthread_cond_broadcast (&shared.space);
+    pthread_mutex_unlock (&shared.lock);
+
+    nowns = clock_ns ();
+
+    if (records == 0)
+    {
+      firststart = current.datastart;
+      startns    = nowns;
+      reportns   = nowns;
+    }
+
+    /* Wait until the record is due, sleeping at most 1/10 second to check for termination */
+    if (params->speed > 0)
+    {
+      targetns = startns + (int64_t)((current.datastart - firststart) * (1000.0 / params->speed));
+
+      while (nowns < targetns && !dlconn->terminate)
+      {
+        dlp_usleep ((targetns - nowns > 100000000) ? 100000 : (targetns - nowns) / 1000);
+        nowns = clock_ns ();
+      }
+
+      if (nowns - targetns > maxlate)
+        maxlate = nowns - targetns;
+    }
+
+    if (!dlconn->terminate)
+    {
+      if (dl_write (dlconn, current.record, current.reclen, current.streamid,
+                    current.datastart, current.dataend, params->ack) < 0)
+      {
+        dl_log (2, 0, "Error writing record for %s\n", current.streamid);
+        errors++;
+        rv = -1;
+      }
+      else
+      {
+        records++;
+        bytes += current.reclen;
+        laststart = current.datastart;
+      }
+    }
+
+    if ((nowns - reportns) >= 10000000000LL)
+    {
+      dl_log (1, 1, "Replayed %llu records, data time %s\n",
+              (unsigned long long int)records,
+              dl_dltime2isotimestr (laststart, timestr, 1));
+      reportns = nowns;
+    }
+
+    pthread_mutex_lock (&shared.lock);
+  }
+
+  /* Stop and join reader threads */
+  shared.stop = 1;
+  pthread_cond_broadcast (&shared.space);
+  pthread_mutex_unlock (&shared.lock);
+
+  for (idx = 0; idx < shared.threads; idx++)
+  {
+    if (readers[idx].started)
+      pthread_join (readers[idx].tid, NULL);
+  }
+
+  elapsed = (records > 0) ? (clock_ns () - startns) / 1e9 : 0.0;
+
+  dl_log (0, 0, "Replayed %llu records, %llu bytes in %.3f seconds\n",
+          (unsigned long long int)records, (unsigned long long int)bytes, elapsed);
+
+  if (records > 0)
+  {
+    dl_log (0, 0, "  Data time span: %.3f seconds, %.2fx real time\n",
+            (double)(laststart - firststart) / DLTMODULUS,
+            (elapsed > 0) ? (double)(laststart - firststart) / DLTMODULUS / elapsed : 0.0);
+    dl_log (0, 0, "  Rate: %.1f records/sec, %.1f bytes/sec\n",
+            (elapsed > 0) ? records / elapsed : 0.0, (elapsed > 0) ? bytes / elapsed : 0.0);
+
+    if (params->speed > 0)
+      dl_log (0, 0, "  Maximum delay behind schedule: %.3f seconds\n", maxlate / 1e9);
+  }
+
+  if (errors > 0)
+    dl_log (0, 0, "  Errors: %llu\n", (unsigned long long int)errors);
+
+  for (idx = 0; idx < shared.filecount; idx++)
+  {
+    for (next = 0; next < QUEUELEN; next++)
+      free (shared.files[idx].queue[next].record);
+  }
+
+  free (current.record);
+  free (shared.files);
+  free (readers);
+  ms3_freeselections (selections);
+
+  pthread_mutex_destroy (&shared.lock);
+  pthread_cond_destroy (&shared.space);
+  pthread_cond_destroy (&shared.data);
+
+  return rv;
+} /* End of runreplay() */
+
+/***************************************************************************
+ * readerthread:
+ *
+ * Thread routine reading the files assigned to a reader.  The files
+ * are read concurrently, each time reading a record from the next
+ * file with space in its queue, so that every file always has queued
+ * records for the merge.
+ ***************************************************************************/
+static void *
+readerthread (void *arg)
+{
+  ReplayReader *reader = (ReplayReader *)arg;
+  ReplayShared *shared = reader->shared;
+  MS3FileParam **msfps;
+  MS3Record **msrs;
+  ReplayFile *file;
+  int filecount;
+  int active;
+  int next = 0;
+  int idx;
+  int fidx;
+  int rv;
+
+  /* Count of files assigned to this reader */
+  filecount = (shared->filecount - reader->index + shared->threads - 1) / shared->threads;
+
+  msfps = (MS3FileParam **)calloc (filecount, sizeof (MS3FileParam *));
+  msrs  = (MS3Record **)calloc (filecount, sizeof (MS3Record *));
+
+  if (!msfps || !msrs)
+  {
+    dl_log (2, 0, "Cannot allocate memory for reader\n");
+    filecount = 0;
+  }
+
+  pthread_mutex_lock (&shared->lock);
+
+  /* Without memory all assigned files are finished */
+  if (filecount == 0)
+  {
+    for (fidx = reader->index; fidx < shared->filecount; fidx += shared->threads)
+      shared->files[fidx].finished = 1;
+
+    pthread_cond_broadcast (&shared->data);
+  }
+
+  while (!shared->stop && filecount > 0)
+  {
+    /* Find the next unfinished file with queue space, round-robin */
+    file   = NULL;
+    active = 0;
+    for (idx = 0; idx < filecount; idx++)
+    {
+      fidx = reader->index + ((next + idx) % filecount) * shared->threads;
+
+      if (shared->files[fidx].finished)
+        continue;
+
+      active++;
+
+      if (shared->files[fidx].count < QUEUELEN)
+      {
+        file = &shared->files[fidx];
+        next = (next + idx) % filecount;
+        break;
+      }
+    }
+
+    if (!active)
+      break;
+
+    if (!file)
+    {
+      pthread_cond_wait (&shared->space, &shared->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock (&shared->lock);
+
+    rv = ms3_readmsr_selection (&msfps[next], &msrs[next], file->path,
+                                MSF_SKIPNOTDATA, shared->selections, 0);
+
+    pthread_mutex_lock (&shared->lock);
+
+    if (rv == MS_NOERROR)
+    {
+      queuerecord (shared, file, msrs[next]);
+    }
+    else
+    {
+      if (rv != MS_ENDOFFILE)
+        dl_log (2, 0, "Error reading %s: %s\n", file->path, ms_errorstr (rv));
+
+      file->finished = 1;
+      pthread_cond_broadcast (&shared->data);
+    }
+
+    next = (next + 1) % filecount;
+  }
+
+  /* Mark any remaining files finished when stopping */
+  for (idx = 0; idx < filecount; idx++)
+    shared->files[reader->index + idx * shared->threads].finished = 1;
+
+  pthread_cond_broadcast (&shared->data);
+  pthread_mutex_unlock (&shared->lock);
+
+  /* Cleanup memory and close files */
+  for (idx = 0; idx < filecount; idx++)
+    ms3_readmsr_r (&msfps[idx], &msrs[idx], NULL, 0, 0);
+
+  free (msfps);
+  free (msrs);
+
+  return NULL;
+} /* End of readerthread() */
+
+/***************************************************************************
+ * queuerecord:
+ *
+ * Add a record to the queue of a file, called with the lock held.
+ * Records that are too large for a packet or without a usable source
+ * ID are skipped.
+ *
+ * Returns 0 on success and -1 if the record was skipped.
+ ***************************************************************************/
+static int
+queuerecord (ReplayShared *shared, ReplayFile *file, MS3Record *msr)
+{
+  ReplayRecord *entry = &file->queue[(file->head + file->count) % QUEUELEN];
+  char *newrecord;
+
+  if (msr->reclen > MAXPACKETSIZE)
+  {
+    dl_log (1, 1, "Skipping %d byte record of %s, too large for a packet\n",
+            msr->reclen, msr->sid);
+    return -1;
+  }
+
+  if (sid2streamid (msr->sid, msr->formatversion, entry->streamid, sizeof (entry->streamid)))
+  {
+    dl_log (1, 1, "Skipping record with unsupported source ID: %s\n", msr->sid);
+    return -1;
+  }
+
+  if (entry->bufsize < msr->reclen)
+  {
+    if (!(newrecord = (char *)realloc (entry->record, msr->reclen)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for record\n");
+      return -1;
+    }
+
+    entry->record  = newrecord;
+    entry->bufsize = msr->reclen;
+  }
+
+  memcpy (entry->record, msr->record, msr->reclen);
+  entry->reclen    = msr->reclen;
+  entry->datastart = msr->starttime / (NSTMODULUS / DLTMODULUS);
+  entry->dataend   = msr3_endtime (msr) / (NSTMODULUS / DLTMODULUS);
+
+  file->count++;
+  pthread_cond_broadcast (&shared->data);
+
+  return 0;
+} /* End of queuerecord() */
+
+#else /* WIN32 */
+
+int
+runreplay (DLCP *dlconn, ReplayParams *params)
+{
+  dl_log (2, 0, "File replay is not supported on this platform\n");
+  return -1;
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,30 @@
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Parameters for file replay */
+typedef struct ReplayParams_s
+{
+  char **files;         /* miniSEED files to replay */
+  int filecount;        /* Number of files */
+  double speed;         /* Replay speed relative to data time, 0 is as fast as possible */
+  int threads;          /* Number of reader threads */
+  char *selectpattern;  /* Source ID selection pattern */
+  char *selectfile;     /* Selection file */
+  int ack;              /* Request acknowledgement of each record */
+} ReplayParams;
+
+extern int runreplay (DLCP *dlconn, ReplayParams *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* REPLAY_H */
@@ -0,0 +1,608 @@
+/***************************************************************************
+ * samplebuf.c
+ *
+ * A rolling in-memory buffer of the most recent decoded samples of
+ * each received miniSEED stream.
+ *
+ * The samples of each stream, identified by source ID, are kept as
+ * double precision values in a fixed size ring holding the configured
+ * duration at the stream's sample rate.  The timing of the samples is
+ * described by a short list of continuous segments, as in an
+ * MS3TraceSeg, each covering a range of sample positions in the ring.
+ * When the ring is full the oldest samples are overwritten and the
+ * segments covering them are trimmed or dropped.
+ *
+ * Records that overlap data already buffered only contribute their
+ * samples after the end of the buffered data, records that start a
+ * gap begin a new segment.
+ *
+ * The memory for a stream is allocated when its first record is
+ * received.  Streams that would exceed the memory limit are not
+ * buffered, so memory use is bounded regardless of the number of
+ * streams.
+ ***************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "samplebuf.h"
+#include "strhash.h"
+#include "trace.h"
+
+/* Maximum number of segments kept for each stream */
+#define MAXSEGMENTS 256
+
+/* A continuous segment of samples */
+typedef struct BufferSegment_s
+{
+  int64_t first;                /* Position of first sample */
+  int64_t count;                /* Number of samples */
+  nstime_t starttime;           /* Time of first sample */
+} BufferSegment;
+
+/* Per-stream sample ring */
+typedef struct BufferStream_s
+{
+  char sid[LM_SIDLEN];          /* Source ID */
+  double samprate;              /* Sample rate in Hz */
+  double *samples;              /* Ring of samples, position modulo capacity */
+  int64_t capacity;             /* Number of samples in ring */
+  int64_t total;                /* Position of next sample */
+  nstime_t nexttime;            /* Expected time of next sample */
+  BufferSegment segments[MAXSEGMENTS]; /* Segments, oldest first */
+  int segcount;                 /* Number of segments */
+  size_t memory;                /* Bytes allocated for stream */
+} BufferStream;
+
+struct SampleBuffer_s
+{
+  double seconds;               /* Duration buffered for each stream */
+  size_t maxmemory;             /* Maximum bytes for all streams */
+  size_t memory;                /* Bytes allocated for all streams */
+  StrHash *streams;             /* BufferStream entries keyed by source ID */
+  MS3Record *msr;               /* Record reused for parsing */
+  int64_t records;              /* Records buffered */
+  int64_t refused;              /* Records not buffered due to the memory limit */
+};
+
+/* Accumulated statistics of a window */
+typedef struct WindowStats_s
+{
+  int64_t count;
+  double min;
+  double max;
+  double sum;
+  double sumsq;
+  nstime_t first;
+  nstime_t last;
+} WindowStats;
+
+typedef void (*SampleVisitor) (nstime_t time, double value, void *data);
+
+static BufferStream *samplebuf_getstream (SampleBuffer *buffer, MS3Record *msr);
+static BufferStream *samplebuf_findstream (SampleBuffer *buffer, const char *sid);
+static void samplebuf_freestream (SampleBuffer *buffer, BufferStream *stream);
+static void samplebuf_evict (BufferStream *stream);
+static int64_t samplebuf_scan (BufferStream *stream, nstime_t start, nstime_t end,
+                               SampleVisitor visitor, void *data);
+static void print_sample (nstime_t time, double value, void *data);
+static void accumulate_sample (nstime_t time, double value, void *data);
+
+/***************************************************************************
+ * samplebuf_new:
+ *
+ * Create a new sample buffer keeping the last seconds of samples of
+ * each stream and using up to maxmemory bytes for all streams.
+ *
+ * Returns a pointer to the buffer on success and NULL on error.
+ ***************************************************************************/
+SampleBuffer *
+samplebuf_new (double seconds, size_t maxmemory)
+{
+  SampleBuffer *buffer;
+
+  if (seconds <= 0)
+    return NULL;
+
+  if (!(buffer = (SampleBuffer *)calloc (1, sizeof (SampleBuffer))) ||
+      !(buffer->streams = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for sample buffer\n");
+    free (buffer);
+    return NULL;
+  }
+
+  buffer->seconds   = seconds;
+  buffer->maxmemory = maxmemory;
+
+  return buffer;
+} /* End of samplebuf_new() */
+
+/***************************************************************************
+ * samplebuf_packet:
+ *
+ * Decode the samples of a miniSEED packet and add them to the buffer
+ * of its stream, other packet types and records without samples are
+ * ignored.
+ *
+ * Returns 0 on success, 1 if the packet was not buffered and -1 on error.
+ ***************************************************************************/
+int
+samplebuf_packet (SampleBuffer *buffer, DLPacket *dlpacket, void *packetdata)
+{
+  BufferStream *stream;
+  BufferSegment *segment;
+  MS3Record *msr;
+  nstime_t period;
+  nstime_t start;
+  int64_t skip = 0;
+  int64_t idx;
+  int64_t pos;
+  char type[10];
+  int rv;
+
+  if (!buffer || !dlpacket || !packetdata)
+    return -1;
+
+  if (dl_splitstreamid (dlpacket->streamid, NULL, NULL, NULL, NULL, type) ||
+      strncmp (type, "MSEED", 5))
+    return 1;
+
+  if ((rv = trace_parse (packetdata, dlpacket->datasize, &buffer->msr, MSF_UNPACKDATA, 0, dlpacket)) != MS_NOERROR)
+  {
+    dl_log (2, 0, "%s: Error parsing record: %s\n", dlpacket->streamid,
+            (rv > 0) ? "incomplete record" : ms_errorstr (rv));
+    return -1;
+  }
+
+  msr = buffer->msr;
+
+  if (msr->samprate <= 0.0 || msr->numsamples <= 0 ||
+      (msr->sampletype != 'i' && msr->sampletype != 'f' && msr->sampletype != 'd'))
+    return 1;
+
+  if (!(stream = samplebuf_getstream (buffer, msr)))
+    return 1;
+
+  period = (nstime_t)(NSTMODULUS / stream->samprate);
+  start  = msr->starttime;
+
+  if (stream->segcount > 0 && start < stream->nexttime + period / 2)
+  {
+    /* Skip samples overlapping buffered data */
+    if (start < stream->nexttime - period / 2)
+    {
+      skip = (stream->nexttime - start + period / 2) / period;
+
+      if (skip >= msr->numsamples)
+        return 0;
+    }
+
+    segment = &stream->segments[stream->segcount - 1];
+  }
+  else
+  {
+    /* Start a new segment, dropping the oldest if needed */
+    if (stream->segcount >= MAXSEGMENTS)
+    {
+      memmove (&stream->segments[0], &stream->segments[1],
+               (MAXSEGMENTS - 1) * sizeof (BufferSegment));
+      stream->segcount--;
+    }
+
+    segment            = &stream->segments[stream->segcount++];
+    segment->first     = stream->total;
+    segment->count     = 0;
+    segment->starttime = start;
+    stream->nexttime   = start;
+  }
+
+  for (idx = skip; idx < msr->numsamples; idx++)
+  {
+    pos = stream->total++ % stream->capacity;
+
+    if (msr->sampletype == 'i')
+      stream->samples[pos] = ((int32_t *)msr->datasamples)[idx];
+    else if (msr->sampletype == 'f')
+      stream->samples[pos] = ((float *)msr->datasamples)[idx];
+    else
+      stream->samples[pos] = ((double *)msr->datasamples)[idx];
+  }
+
+  segment->count += msr->numsamples - skip;
+  stream->nexttime = segment->starttime +
+                     (nstime_t)((double)segment->count * NSTMODULUS / stream->samprate);
+
+  samplebuf_evict (stream);
+
+  buffer->records++;
+
+  return 0;
+} /* End of samplebuf_packet() */
+
+/***************************************************************************
+ * samplebuf_range:
+ *
+ * Determine the time range of the samples buffered for a stream.
+ *
+ * Returns 0 on success and -1 if the stream is not buffered.
+ ***************************************************************************/
+int
+samplebuf_range (SampleBuffer *buffer, const char *sid,
+                 nstime_t *earliest, nstime_t *latest)
+{
+  BufferStream *stream;
+  BufferSegment *last;
+
+  if (!(stream = samplebuf_findstream (buffer, sid)) || stream->segcount == 0)
+    return -1;
+
+  last = &stream->segments[stream->segcount - 1];
+
+  if (earliest)
+    *earliest = stream->segments[0].starttime;
+  if (latest)
+    *latest = last->starttime +
+              (nstime_t)((double)(last->count - 1) * NSTMODULUS / stream->samprate);
+
+  return 0;
+} /* End of samplebuf_range() */
+
+/***************************************************************************
+ * samplebuf_dump:
+ *
+ * Print the time and value of the samples buffered for a stream from
+ * start to end inclusive.
+ *
+ * Returns the number of samples printed or -1 if the stream is not buffered.
+ ***************************************************************************/
+int64_t
+samplebuf_dump (SampleBuffer *buffer, const char *sid,
+                nstime_t start, nstime_t end, FILE *fp)
+{
+  BufferStream *stream;
+
+  if (!(stream = samplebuf_findstream (buffer, sid)) || !fp)
+    return -1;
+
+  return samplebuf_scan (stream, start, end, print_sample, fp);
+} /* End of samplebuf_dump() */
+
+/***************************************************************************
+ * samplebuf_stats:
+ *
+ * Print summary statistics of the samples buffered for a stream from
+ * start to end inclusive: count, minimum, maximum, mean, standard
+ * deviation and RMS.
+ *
+ * Returns the number of samples or -1 if the stream is not buffered.
+ ***************************************************************************/
+int64_t
+samplebuf_stats (SampleBuffer *buffer, const char *sid,
+                 nstime_t start, nstime_t end, FILE *fp)
+{
+  BufferStream *stream;
+  WindowStats stats;
+  char time1[40];
+  char time2[40];
+  double mean;
+  double variance;
+
+  if (!(stream = samplebuf_findstream (buffer, sid)) || !fp)
+    return -1;
+
+  memset (&stats, 0, sizeof (stats));
+
+  if (samplebuf_scan (stream, start, end, accumulate_sample, &stats) <= 0)
+  {
+    fprintf (fp, "%s: no samples in window\n", stream->sid);
+    return 0;
+  }
+
+  mean     = stats.sum / stats.count;
+  variance = stats.sumsq / stats.count - mean * mean;
+
+  ms_nstime2timestr (stats.first, time1, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+  ms_nstime2timestr (stats.last, time2, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+
+  fprintf (fp, "%s: %s to %s, %lld samples at %g Hz\n",
+           stream->sid, time1, time2, (long long int)stats.count, stream->samprate);
+  fprintf (fp, "  min: %g, max: %g, mean: %g, stddev: %g, rms: %g\n",
+           stats.min, stats.max, mean, (variance > 0) ? sqrt (variance) : 0.0,
+           sqrt (stats.sumsq / stats.count));
+
+  return stats.count;
+} /* End of samplebuf_stats() */
+
+/***************************************************************************
+ * samplebuf_list:
+ *
+ * Print the streams buffered with their time ranges and memory use.
+ ***************************************************************************/
+void
+samplebuf_list (SampleBuffer *buffer, FILE *fp)
+{
+  StrHashEntry *hentry = NULL;
+  BufferStream *stream;
+  nstime_t earliest;
+  nstime_t latest;
+  char time1[40];
+  char time2[40];
+  int64_t count;
+
+  if (!buffer || !fp)
+    return;
+
+  while ((hentry = strhash_next (buffer->streams, hentry)))
+  {
+    stream = (BufferStream *)hentry->value;
+
+    if (samplebuf_range (buffer, stream->sid, &earliest, &latest))
+      continue;
+
+    count = (stream->total < stream->capacity) ? stream->total : stream->capacity;
+
+    ms_nstime2timestr (earliest, time1, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+    ms_nstime2timestr (latest, time2, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+
+    fprintf (fp, "%-24s %s  %s  %g Hz, %lld samples, %d segments\n",
+             stream->sid, time1, time2, stream->samprate,
+             (long long int)count, stream->segcount);
+  }
+
+  fprintf (fp, "%llu streams buffered for %g seconds, %.1f of %.1f MB used",
+           (unsigned long long int)buffer->streams->count, buffer->seconds,
+           (double)buffer->memory / 1048576, (double)buffer->maxmemory / 1048576);
+
+  if (buffer->refused > 0)
+    fprintf (fp, ", %lld records not buffered due to memory limit", (long long int)buffer->refused);
+
+  fprintf (fp, "\n");
+} /* End of samplebuf_list() */
+
+/***************************************************************************
+ * samplebuf_free:
+ *
+ * Free the sample buffer.
+ ***************************************************************************/
+void
+samplebuf_free (SampleBuffer *buffer)
+{
+  StrHashEntry *hentry = NULL;
+
+  if (!buffer)
+    return;
+
+  /* Streams are freed here to release their memory from the total */
+  while ((hentry = strhash_next (buffer->streams, hentry)))
+    samplebuf_freestream (buffer, (BufferStream *)hentry->value);
+
+  strhash_free (buffer->streams, NULL);
+
+  if (buffer->msr)
+    msr3_free (&buffer->msr);
+
+  free (buffer);
+} /* End of samplebuf_free() */
+
+/***************************************************************************
+ * samplebuf_getstream:
+ *
+ * Find or create the buffer for the stream of a record, recreating
+ * it if the sample rate has changed.
+ *
+ * Returns a pointer to the stream or NULL if it is not buffered.
+ ***************************************************************************/
+static BufferStream *
+samplebuf_getstream (SampleBuffer *buffer, MS3Record *msr)
+{
+  BufferStream *stream;
+  int64_t capacity;
+  size_t memory;
+
+  if ((stream = (BufferStream *)strhash_get (buffer->streams, msr->sid)))
+  {
+    if (ms_dabs (stream->samprate - msr->samprate) <= stream->samprate * 0.0001)
+      return stream;
+
+    strhash_remove (buffer->streams, msr->sid);
+    samplebuf_freestream (buffer, stream);
+  }
+
+  capacity = (int64_t)ceil (buffer->seconds * msr->samprate) + 1;
+  memory   = sizeof (BufferStream) + capacity * sizeof (double);
+
+  if (buffer->maxmemory && buffer->memory + memory > buffer->maxmemory)
+  {
+    if (buffer->refused++ == 0)
+      dl_log (1, 0, "Sample buffer memory limit reached, %s not buffered\n", msr->sid);
+    return NULL;
+  }
+
+  if (!(stream = (BufferStream *)calloc (1, sizeof (BufferStream))) ||
+      !(stream->samples = (double *)malloc (capacity * sizeof (double))) ||
+      strhash_put (buffer->streams, msr->sid, stream))
+  {
+    dl_log (2, 0, "Cannot allocate memory for sample buffer of %s\n", msr->sid);
+    if (stream)
+      free (stream->samples);
+    free (stream);
+    return NULL;
+  }
+
+  memcpy (stream->sid, msr->sid, sizeof (stream->sid));
+  stream->samprate = msr->samprate;
+  stream->capacity = capacity;
+  stream->memory   = memory;
+
+  buffer->memory += memory;
+
+  return stream;
+} /* End of samplebuf_getstream() */
+
+/***************************************************************************
+ * samplebuf_findstream:
+ *
+ * Find a buffered stream by source ID, the "FDSN:" prefix is optional.
+ ***************************************************************************/
+static BufferStream *
+samplebuf_findstream (SampleBuffer *buffer, const char *sid)
+{
+  BufferStream *stream;
+  char fdsnsid[LM_SIDLEN];
+
+  if (!buffer || !sid)
+    return NULL;
+
+  if ((stream = (BufferStream *)strhash_get (buffer->streams, sid)))
+    return stream;
+
+  snprintf (fdsnsid, sizeof (fdsnsid), "FDSN:%s", sid);
+
+  return (BufferStream *)strhash_get (buffer->streams, fdsnsid);
+} /* End of samplebuf_findstream() */
+
+/***************************************************************************
+ * samplebuf_freestream:
+ *
+ * Free a stream buffer and release its memory from the total.
+ ***************************************************************************/
+static void
+samplebuf_freestream (SampleBuffer *buffer, BufferStream *stream)
+{
+  if (!stream)
+    return;
+
+  buffer->memory -= stream->memory;
+
+  free (stream->samples);
+  free (stream);
+} /* End of samplebuf_freestream() */
+
+/***************************************************************************
+ * samplebuf_evict:
+ *
+ * Trim or drop the oldest segments covering samples that have been
+ * overwritten in the ring.
+ ***************************************************************************/
+static void
+samplebuf_evict (BufferStream *stream)
+{
+  BufferSegment *segment;
+  int64_t oldest = stream->total - stream->capacity;
+  int64_t trim;
+  int drop = 0;
+
+  while (drop < stream->segcount)
+  {
+    segment = &stream->segments[drop];
+
+    if (segment->first >= oldest)
+      break;
+
+    if (segment->first + segment->count <= oldest)
+    {
+      drop++;
+      continue;
+    }
+
+    trim = oldest - segment->first;
+    segment->first = oldest;
+    segment->count -= trim;
+    segment->starttime += (nstime_t)((double)trim * NSTMODULUS / stream->samprate);
+    break;
+  }
+
+  if (drop > 0)
+  {
+    memmove (&stream->segments[0], &stream->segments[drop],
+             (stream->segcount - drop) * sizeof (BufferSegment));
+    stream->segcount -= drop;
+  }
+} /* End of samplebuf_evict() */
+
+/***************************************************************************
+ * samplebuf_scan:
+ *
+ * Call the visitor for each sample of a stream from start to end
+ * inclusive, in time order.
+ *
+ * Returns the number of samples visited.
+ ***************************************************************************/
+static int64_t
+samplebuf_scan (BufferStream *stream, nstime_t start, nstime_t end,
+                SampleVisitor visitor, void *data)
+{
+  BufferSegment *segment;
+  double period = NSTMODULUS / stream->samprate;
+  nstime_t time;
+  int64_t first;
+  int64_t idx;
+  int64_t count = 0;
+  int segidx;
+
+  for (segidx = 0; segidx < stream->segcount; segidx++)
+  {
+    segment = &stream->segments[segidx];
+
+    /* First sample at or after the start of the window */
+    first = 0;
+    if (start > segment->starttime)
+      first = (int64_t)ceil ((double)(start - segment->starttime) / period);
+
+    for (idx = first; idx < segment->count; idx++)
+    {
+      time = segment->starttime + (nstime_t)(idx * period);
+
+      if (time > end)
+        break;
+
+      visitor (time, stream->samples[(segment->first + idx) % stream->capacity], data);
+      count++;
+    }
+  }
+
+  return count;
+} /* End of samplebuf_scan() */
+
+/***************************************************************************
+ * print_sample:
+ *
+ * Print the time and value of a sample to a FILE.
+ ***************************************************************************/
+static void
+print_sample (nstime_t time, double value, void *data)
+{
+  char timestr[40];
+
+  ms_nstime2timestr (time, timestr, ISOMONTHDAY_Z, NANO_MICRO_NONE);
+  fprintf ((FILE *)data, "%s  %.10g\n", timestr, value);
+} /* End of print_sample() */
+
+/***************************************************************************
+ * accumulate_sample:
+ *
+ * Add a sample to the statistics of a window.
+ ***************************************************************************/
+static void
+accumulate_sample (nstime_t time, double value, void *data)
+{
+  WindowStats *stats = (WindowStats *)data;
+
+  if (stats->count == 0 || value < stats->min)
+    stats->min = value;
+  if (stats->count == 0 || value > stats->max)
+    stats->max = value;
+  if (stats->count == 0)
+    stats->first = time;
+
+  stats->last = time;
+  stats->sum += value;
+  stats->sumsq += value * value;
+  stats->count++;
+} /* End of accumulate_sample() */
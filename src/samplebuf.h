@@ -0,0 +1,32 @@
+
+#ifndef SAMPLEBUF_H
+#define SAMPLEBUF_H
+
+#include <stdio.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct SampleBuffer_s SampleBuffer;
+
+extern SampleBuffer *samplebuf_new (double seconds, size_t maxmemory);
+extern int samplebuf_packet (SampleBuffer *buffer, DLPacket *dlpacket, void *packetdata);
+extern int samplebuf_range (SampleBuffer *buffer, const char *sid,
+                            nstime_t *earliest, nstime_t *latest);
+extern int64_t samplebuf_dump (SampleBuffer *buffer, const char *sid,
+                               nstime_t start, nstime_t end, FILE *fp);
+extern int64_t samplebuf_stats (SampleBuffer *buffer, const char *sid,
+                                nstime_t start, nstime_t end, FILE *fp);
+extern void samplebuf_list (SampleBuffer *buffer, FILE *fp);
+extern void samplebuf_free (SampleBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SAMPLEBUF_H */
@@ -0,0 +1,611 @@
+/***************************************************************************
+ * shard.c
+ *
+ * Splitting of the stream match set across multiple connections to
+ * the same server.
+ *
+ * The streams of the server selected by the match pattern are listed
+ * and assigned to groups by a hash of the stream name.  Every group
+ * but the last matches its streams by exact name.  The last group
+ * matches the original pattern and rejects the streams of all other
+ * groups, so that it also collects streams that appear after the
+ * split.  Each stream is therefore matched by exactly one group.
+ *
+ * The position of each group is saved separately, so a stream must
+ * stay in its group when collection resumes.  The assignment is saved
+ * to a file and reused on the next run: streams already assigned keep
+ * their group and all others, which were either collected by the last
+ * group or not at all, are assigned to the last group.
+ *
+ * The names of a group are sorted and written as an alternation with
+ * common prefixes factored out, e.g. "XX_STA__BH(E|N|Z)/MSEED", which
+ * keeps the patterns of large groups within MAXREGEXSIZE.
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "infoxml.h"
+#include "shard.h"
+#include "strhash.h"
+
+/* A growing string */
+typedef struct ShardString_s
+{
+  char *data;                   /* String */
+  size_t length;                /* Length of string */
+  size_t size;                  /* Allocated size */
+} ShardString;
+
+/* Stream names collected from the server */
+typedef struct ShardStreams_s
+{
+  StrHash *names;               /* Names seen, to skip duplicates */
+  char **list;                  /* Names in order received */
+  int count;                    /* Number of names */
+  int size;                     /* Allocated entries of list */
+  int error;                    /* Flag: error while collecting */
+} ShardStreams;
+
+static int shard_load (const char *path, int count, StrHash **assigned);
+static int shard_store (const char *path, int count, ShardStreams *streams, int *assignments);
+static int shard_start (void *data, const char *name, const char **attrs, int depth);
+static int shard_chunk (char *chunk, int chunklen, void *handlerdata);
+static int shard_append (ShardString *string, const char *data, size_t length);
+static int shard_appendnames (ShardString *string, char **names, int count, size_t offset);
+static int shard_appendname (ShardString *string, const char *name, size_t length);
+static int shard_compare (const void *a, const void *b);
+
+/***************************************************************************
+ * shard_split:
+ *
+ * Split the streams of the server matching matchpattern, or all
+ * streams if NULL, into count groups and generate the match and reject
+ * patterns of each group in the matches and rejects arrays, which
+ * must have count entries.  The original rejectpattern, if any, is
+ * included in the reject pattern of every group.  The patterns are
+ * allocated and should be freed with shard_free().
+ *
+ * If assignfile is not NULL the assignment is saved to it, and if
+ * resume is set the assignment previously saved to it is continued.
+ *
+ * The connection must be connected and not streaming.
+ *
+ * Returns the number of streams split on success and -1 on error.
+ ***************************************************************************/
+int
+shard_split (DLCP *dlconn, char *matchpattern, char *rejectpattern,
+             int count, const char *assignfile, int resume,
+             char **matches, char **rejects)
+{
+  ShardStreams streams;
+  StrHash *assigned = NULL;
+  InfoXML *parser;
+  void *value;
+  char **names     = NULL;
+  int *assignments = NULL;
+  int *members     = NULL;
+  int namecount;
+  int group;
+  int idx;
+  int rv = -1;
+
+  if (!dlconn || count < 1 || !matches || !rejects)
+    return -1;
+
+  memset (&streams, 0, sizeof (streams));
+
+  for (idx = 0; idx < count; idx++)
+  {
+    matches[idx] = NULL;
+    rejects[idx] = NULL;
+  }
+
+  if (!(streams.names = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for stream list\n");
+    return -1;
+  }
+
+  /* List the streams selected by the match pattern */
+  if (!(parser = infoxml_new (shard_start, NULL, &streams)))
+  {
+    strhash_free (streams.names, NULL);
+    return -1;
+  }
+
+  if (dl_getinfochunks (dlconn, "STREAMS", matchpattern, shard_chunk, parser) < 0 ||
+      infoxml_finish (parser) || streams.error)
+  {
+    dl_log (2, 0, "Cannot list streams of server to split across connections\n");
+    goto cleanup;
+  }
+
+  if (!(members = (int *)calloc (count, sizeof (int))) ||
+      (streams.count > 0 &&
+       (!(assignments = (int *)malloc (streams.count * sizeof (int))) ||
+        !(names = (char **)malloc (streams.count * sizeof (char *))))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for stream groups\n");
+    goto cleanup;
+  }
+
+  if (assignfile && resume && shard_load (assignfile, count, &assigned) < 0)
+    goto cleanup;
+
+  /* Assign streams to groups, continuing a previous assignment */
+  for (idx = 0; idx < streams.count; idx++)
+  {
+    if (!assigned)
+      group = strhash_hash (streams.list[idx]) % count;
+    else if ((value = strhash_get (assigned, streams.list[idx])))
+      group = (int)(intptr_t)value - 1;
+    else
+      group = count - 1;
+
+    assignments[idx] = group;
+    members[group]++;
+  }
+
+  for (group = 0; group < count; group++)
+  {
+    ShardString match;
+    ShardString reject;
+
+    memset (&match, 0, sizeof (match));
+    memset (&reject, 0, sizeof (reject));
+
+    /* Names of this group, or of all other groups for the last */
+    for (idx = 0, namecount = 0; idx < streams.count; idx++)
+    {
+      if ((group < count - 1) ? assignments[idx] == group : assignments[idx] < count - 1)
+        names[namecount++] = streams.list[idx];
+    }
+
+    if (namecount > 1)
+      qsort (names, namecount, sizeof (char *), shard_compare);
+
+    if (group < count - 1)
+    {
+      /* A stream name is never empty, an empty group matches nothing */
+      if (shard_append (&match, "^", 1) ||
+          (namecount > 0 && shard_appendnames (&match, names, namecount, 0)) ||
+          shard_append (&match, "$", 1) ||
+          (rejectpattern && shard_append (&reject, rejectpattern, strlen (rejectpattern))))
+      {
+        free (match.data);
+        free (reject.data);
+        goto cleanup;
+      }
+    }
+    else
+    {
+      /* The last group takes all other streams, including new ones */
+      if ((matchpattern && shard_append (&match, matchpattern, strlen (matchpattern))) ||
+          (rejectpattern && shard_append (&reject, rejectpattern, strlen (rejectpattern))) ||
+          (namecount > 0 &&
+           ((reject.length > 0 && shard_append (&reject, "|", 1)) ||
+            shard_append (&reject, "^(", 2) ||
+            shard_appendnames (&reject, names, namecount, 0) ||
+            shard_append (&reject, ")$", 2))))
+      {
+        free (match.data);
+        free (reject.data);
+        goto cleanup;
+      }
+    }
+
+    matches[group] = match.data;
+    rejects[group] = reject.data;
+
+    dl_log (1, 1, "Connection %d: %d streams, match %d and reject %d bytes\n",
+            group + 1, members[group], (int)match.length, (int)reject.length);
+
+    if (match.length > MAXREGEXSIZE || reject.length > MAXREGEXSIZE)
+    {
+      dl_log (2, 0, "Connection %d: %s pattern of %d bytes is larger than the limit of %d bytes\n",
+              group + 1, (match.length > MAXREGEXSIZE) ? "match" : "reject",
+              (int)((match.length > MAXREGEXSIZE) ? match.length : reject.length),
+              MAXREGEXSIZE);
+      dl_log (2, 0, "Select fewer streams to split across connections\n");
+      goto cleanup;
+    }
+  }
+
+  if (assignfile && shard_store (assignfile, count, &streams, assignments))
+    goto cleanup;
+
+  dl_log (1, 1, "Split %d streams across %d connections\n", streams.count, count);
+
+  rv = streams.count;
+
+cleanup:
+  if (rv < 0)
+    shard_free (matches, rejects, count);
+
+  infoxml_free (parser);
+  strhash_free (streams.names, NULL);
+  strhash_free (assigned, NULL);
+
+  for (idx = 0; idx < streams.count; idx++)
+    free (streams.list[idx]);
+  free (streams.list);
+
+  free (names);
+  free (assignments);
+  free (members);
+
+  return rv;
+} /* End of shard_split() */
+
+/***************************************************************************
+ * shard_free:
+ *
+ * Free the patterns generated by shard_split().
+ ***************************************************************************/
+void
+shard_free (char **matches, char **rejects, int count)
+{
+  int idx;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (matches)
+    {
+      free (matches[idx]);
+      matches[idx] = NULL;
+    }
+
+    if (rejects)
+    {
+      free (rejects[idx]);
+      rejects[idx] = NULL;
+    }
+  }
+} /* End of shard_free() */
+
+/***************************************************************************
+ * shard_load:
+ *
+ * Read the assignment of streams to groups saved by shard_store() into
+ * a table of group numbers plus one, keyed by stream name.  The table
+ * is allocated and should be freed with strhash_free().
+ *
+ * Returns 0 on success, 1 if there is no saved assignment and -1 on
+ * error, including a saved assignment to a different number of
+ * groups.
+ ***************************************************************************/
+static int
+shard_load (const char *path, int count, StrHash **assigned)
+{
+  FILE *fp;
+  char line[MAXSTREAMID + 32];
+  char name[MAXSTREAMID];
+  int savedcount;
+  int group;
+  int linenum = 1;
+  int rv      = 0;
+
+  *assigned = NULL;
+
+  if (!(fp = fopen (path, "r")))
+  {
+    dl_log (1, 1, "No saved assignment of streams to connections in %s\n", path);
+    return 1;
+  }
+
+  if (!fgets (line, sizeof (line), fp) ||
+      sscanf (line, "shards %d", &savedcount) != 1)
+  {
+    dl_log (2, 0, "Cannot parse assignment of streams to connections in %s\n", path);
+    fclose (fp);
+    return -1;
+  }
+
+  if (savedcount != count)
+  {
+    dl_log (2, 0, "Streams were split across %d connections, the saved state cannot be resumed with %d\n",
+            savedcount, count);
+    fclose (fp);
+    return -1;
+  }
+
+  if (!(*assigned = strhash_new (0)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for stream assignment\n");
+    fclose (fp);
+    return -1;
+  }
+
+  while (fgets (line, sizeof (line), fp))
+  {
+    linenum++;
+
+    if (sscanf (line, "%d %59s", &group, name) != 2 ||
+        group < 0 || group >= count)
+    {
+      dl_log (2, 0, "Cannot parse line %d of %s\n", linenum, path);
+      rv = -1;
+      break;
+    }
+
+    if (strhash_put (*assigned, name, (void *)(intptr_t)(group + 1)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for stream assignment\n");
+      rv = -1;
+      break;
+    }
+  }
+
+  fclose (fp);
+
+  if (rv)
+  {
+    strhash_free (*assigned, NULL);
+    *assigned = NULL;
+  }
+  else
+  {
+    dl_log (1, 1, "Continuing assignment of %d streams from %s\n",
+            (int)(*assigned)->count, path);
+  }
+
+  return rv;
+} /* End of shard_load() */
+
+/***************************************************************************
+ * shard_store:
+ *
+ * Save the assignment of streams to groups, as lines of "shards
+ * <count>" followed by "<group> <stream name>" for each stream.  The
+ * file is written to "<path>.tmp", flushed to storage and renamed.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+shard_store (const char *path, int count, ShardStreams *streams, int *assignments)
+{
+  FILE *fp;
+  char *temppath;
+  int rv = 0;
+  int idx;
+
+  if (!(temppath = (char *)malloc (strlen (path) + 5)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for file name\n");
+    return -1;
+  }
+
+  sprintf (temppath, "%s.tmp", path);
+
+  if (!(fp = fopen (temppath, "w")))
+  {
+    dl_log (2, 0, "Cannot open %s for writing\n", temppath);
+    free (temppath);
+    return -1;
+  }
+
+  if (fprintf (fp, "shards %d\n", count) < 0)
+    rv = -1;
+
+  for (idx = 0; rv == 0 && idx < streams->count; idx++)
+  {
+    if (fprintf (fp, "%d %s\n", assignments[idx], streams->list[idx]) < 0)
+      rv = -1;
+  }
+
+  if (rv || fflush (fp) || dlp_fsync (fileno (fp)))
+    rv = -1;
+
+  if (fclose (fp))
+    rv = -1;
+
+  if (rv == 0 && dlp_renamefile (temppath, path))
+    rv = -1;
+
+  if (rv)
+  {
+    dl_log (2, 0, "Cannot save assignment of streams to connections to %s\n", path);
+    remove (temppath);
+  }
+
+  free (temppath);
+
+  return rv;
+} /* End of shard_store() */
+
+/***************************************************************************
+ * shard_chunk:
+ *
+ * Feed a chunk of a received INFO response to the parser.
+ ***************************************************************************/
+static int
+shard_chunk (char *chunk, int chunklen, void *handlerdata)
+{
+  return infoxml_feed ((InfoXML *)handlerdata, chunk, chunklen);
+} /* End of shard_chunk() */
+
+/***************************************************************************
+ * shard_start:
+ *
+ * Element start callback: collect the name of each stream.
+ ***************************************************************************/
+static int
+shard_start (void *data, const char *name, const char **attrs, int depth)
+{
+  ShardStreams *streams = (ShardStreams *)data;
+  const char *streamname;
+  char **newlist;
+  char *copy;
+
+  if (depth == 0 && strcmp (name, "DataLink"))
+  {
+    dl_log (1, 0, "XML INFO root tag is not <DataLink>, invalid data\n");
+    return -1;
+  }
+
+  if (depth != 2 || strcmp (name, "Stream") ||
+      !(streamname = infoxml_attr (attrs, "Name")) ||
+      strhash_get (streams->names, streamname))
+    return 0;
+
+  if (streams->count >= streams->size)
+  {
+    if (!(newlist = (char **)realloc (streams->list, (streams->size + 64) * 2 * sizeof (char *))))
+    {
+      dl_log (2, 0, "Cannot allocate memory for stream list\n");
+      streams->error = 1;
+      return -1;
+    }
+
+    streams->list = newlist;
+    streams->size = (streams->size + 64) * 2;
+  }
+
+  if (!(copy = strdup (streamname)) ||
+      strhash_put (streams->names, copy, copy))
+  {
+    dl_log (2, 0, "Cannot allocate memory for stream list\n");
+    free (copy);
+    streams->error = 1;
+    return -1;
+  }
+
+  streams->list[streams->count++] = copy;
+
+  return 0;
+} /* End of shard_start() */
+
+/***************************************************************************
+ * shard_append:
+ *
+ * Append data to a growing string, keeping it terminated.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+shard_append (ShardString *string, const char *data, size_t length)
+{
+  char *newdata;
+  size_t newsize;
+
+  if (string->length + length + 1 > string->size)
+  {
+    newsize = (string->size) ? string->size : 256;
+
+    while (newsize < string->length + length + 1)
+      newsize *= 2;
+
+    if (!(newdata = (char *)realloc (string->data, newsize)))
+    {
+      dl_log (2, 0, "Cannot allocate memory for stream pattern\n");
+      return -1;
+    }
+
+    string->data = newdata;
+    string->size = newsize;
+  }
+
+  memcpy (string->data + string->length, data, length);
+  string->length += length;
+  string->data[string->length] = '\0';
+
+  return 0;
+} /* End of shard_append() */
+
+/***************************************************************************
+ * shard_appendnames:
+ *
+ * Append an expression matching exactly the sorted, unique names
+ * beyond their first offset characters, which all names share.  The
+ * longest common prefix is written once followed by an alternation
+ * of the remainders, grouped by their next character.  A name ending
+ * at the prefix makes the alternation optional.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+shard_appendnames (ShardString *string, char **names, int count, size_t offset)
+{
+  const char *first = names[0] + offset;
+  const char *last  = names[count - 1] + offset;
+  size_t prefix     = 0;
+  int optional      = 0;
+  int start;
+  int idx;
+
+  /* The names are sorted, the common prefix of all is that of the first and last */
+  while (first[prefix] && first[prefix] == last[prefix])
+    prefix++;
+
+  if (shard_appendname (string, first, prefix))
+    return -1;
+
+  offset += prefix;
+
+  /* A name ending here sorts first */
+  if (names[0][offset] == '\0')
+  {
+    optional = 1;
+    names++;
+    count--;
+  }
+
+  if (count == 0)
+    return 0;
+
+  if (shard_append (string, "(", 1))
+    return -1;
+
+  for (start = 0, idx = 1; idx <= count; idx++)
+  {
+    if (idx < count && names[idx][offset] == names[start][offset])
+      continue;
+
+    if ((start > 0 && shard_append (string, "|", 1)) ||
+        shard_appendnames (string, names + start, idx - start, offset))
+      return -1;
+
+    start = idx;
+  }
+
+  return shard_append (string, (optional) ? ")?" : ")", (optional) ? 2 : 1);
+} /* End of shard_appendnames() */
+
+/***************************************************************************
+ * shard_appendname:
+ *
+ * Append length characters of a stream name to a string, escaping the
+ * characters special in extended regular expressions.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+shard_appendname (ShardString *string, const char *name, size_t length)
+{
+  for (; length > 0; name++, length--)
+  {
+    if (strchr (".[]{}()\\*+?^$|", *name) && shard_append (string, "\\", 1))
+      return -1;
+
+    if (shard_append (string, name, 1))
+      return -1;
+  }
+
+  return 0;
+} /* End of shard_appendname() */
+
+/***************************************************************************
+ * shard_compare:
+ *
+ * Compare two stream names for qsort().
+ ***************************************************************************/
+static int
+shard_compare (const void *a, const void *b)
+{
+  return strcmp (*(char *const *)a, *(char *const *)b);
+} /* End of shard_compare() */
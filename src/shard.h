@@ -0,0 +1,21 @@
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <libdali.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+extern int shard_split (DLCP *dlconn, char *matchpattern, char *rejectpattern,
+                        int count, const char *assignfile, int resume,
+                        char **matches, char **rejects);
+extern void shard_free (char **matches, char **rejects, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SHARD_H */
@@ -0,0 +1,537 @@
+/***************************************************************************
+ * shmring.c
+ *
+ * A shared memory ring of DataLink packets with a lock-free single
+ * producer, multiple consumer protocol.
+ *
+ * The ring is a POSIX shared memory object: a fixed header followed
+ * by the data area.  Packets are written to the data area as entries,
+ * an entry header followed by the packet data, padded to a multiple
+ * of 8 bytes.  An entry never wraps around the end of the data area,
+ * a padding entry fills the space at the end when needed.
+ *
+ * Positions are byte offsets that only increase, the offset in the
+ * data area is the position modulo its size.  The producer maintains
+ * two positions in the header:
+ *
+ * writepos: the end of the last complete entry, stored with release
+ * semantics after the entry is written.
+ *
+ * tailpos: the start of the oldest entry that is intact.  Before an
+ * entry is written over older entries, tailpos is advanced past them
+ * and a memory fence is issued.
+ *
+ * A consumer reads entries between its position and writepos,
+ * copying each out of the ring and then, after a memory fence,
+ * checking that tailpos has not moved past the entry; if it has the
+ * copy may have been overwritten while reading and is discarded, and
+ * the consumer continues from tailpos.  Each entry carries a sequence
+ * number so that consumers can count the packets they have missed.
+ * The producer never waits for consumers and consumers never write to
+ * the ring, any number of consumers can attach and detach at any
+ * time.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shmring.h"
+
+#ifndef WIN32
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHMRING_MAGIC   "DLSHMRG1"
+#define HEADERLEN       256     /* Size of ring header, offset of data area */
+#define ENTRYHEADERLEN  128     /* Size of entry header */
+#define ENTRY_PADDING   1       /* Entry flag: padding to the end of the data area */
+
+/* Ring header at the start of the shared memory object */
+typedef struct RingHeader_s
+{
+  char magic[8];                /* SHMRING_MAGIC when initialized */
+  uint32_t headerlen;           /* Offset of data area */
+  uint32_t entryheaderlen;      /* Size of entry header */
+  uint64_t datasize;            /* Size of data area in bytes */
+  _Atomic uint64_t nextseq;     /* Sequence number of next packet */
+  char reserved1[32];
+  _Atomic uint64_t writepos;    /* End of last complete entry */
+  char reserved2[56];
+  _Atomic uint64_t tailpos;     /* Start of oldest intact entry */
+  char reserved3[56];
+} RingHeader;
+
+/* Entry header, followed by packet data */
+typedef struct EntryHeader_s
+{
+  uint32_t length;              /* Length of entry including header and padding */
+  uint32_t flags;               /* Entry flags */
+  uint64_t seq;                 /* Packet sequence number */
+  uint32_t datasize;            /* Packet data size */
+  uint32_t reserved;
+  int64_t pktid;
+  int64_t pkttime;
+  int64_t datastart;
+  int64_t dataend;
+  int64_t recvtime;
+  char streamid[SHMRING_STREAMIDLEN];
+  char padding[ENTRYHEADERLEN - 64 - SHMRING_STREAMIDLEN];
+} EntryHeader;
+
+struct ShmRing_s
+{
+  RingHeader *header;           /* Mapped ring header */
+  uint8_t *data;                /* Mapped data area */
+  uint64_t datasize;            /* Size of data area */
+  size_t mapsize;               /* Size of mapping */
+  int producer;                 /* Ring is opened for writing */
+  uint64_t pos;                 /* Consumer read position */
+  uint64_t nextseq;             /* Consumer expected sequence number */
+  int haveseq;                  /* Consumer has read a packet */
+  uint64_t lost;                /* Consumer packets missed */
+};
+
+static ShmRing *shmring_map (int fd, size_t mapsize, int producer);
+static void shmring_makename (const char *name, char *shmname, size_t size);
+
+/***************************************************************************
+ * shmring_create:
+ *
+ * Create or open the shared memory ring name for writing with a data
+ * area of size bytes, rounded to a multiple of 8.  An existing ring
+ * of the same size is continued so that attached consumers are not
+ * disrupted, otherwise it is initialized.
+ *
+ * Returns a pointer to the ring on success and NULL on error with
+ * errno set.
+ ***************************************************************************/
+ShmRing *
+shmring_create (const char *name, size_t size)
+{
+  ShmRing *ring;
+  char shmname[256];
+  struct stat sb;
+  int fd;
+
+  size &= ~(size_t)7;
+
+  if (!name || size < 65536)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  shmring_makename (name, shmname, sizeof (shmname));
+
+  if ((fd = shm_open (shmname, O_RDWR | O_CREAT, 0644)) < 0)
+    return NULL;
+
+  if (fstat (fd, &sb) || (sb.st_size != (off_t)(HEADERLEN + size) &&
+                          ftruncate (fd, HEADERLEN + size)))
+  {
+    close (fd);
+    return NULL;
+  }
+
+  ring = shmring_map (fd, HEADERLEN + size, 1);
+  close (fd);
+
+  if (!ring)
+    return NULL;
+
+  /* Continue an existing ring or initialize */
+  if (memcmp (ring->header->magic, SHMRING_MAGIC, 8) ||
+      ring->header->headerlen != HEADERLEN ||
+      ring->header->entryheaderlen != ENTRYHEADERLEN ||
+      ring->header->datasize != size)
+  {
+    memset (ring->header, 0, HEADERLEN);
+    ring->header->headerlen      = HEADERLEN;
+    ring->header->entryheaderlen = ENTRYHEADERLEN;
+    ring->header->datasize       = size;
+    atomic_store (&ring->header->writepos, 0);
+    atomic_store (&ring->header->tailpos, 0);
+    atomic_store (&ring->header->nextseq, 0);
+    memcpy (ring->header->magic, SHMRING_MAGIC, 8);
+  }
+
+  ring->data     = (uint8_t *)ring->header + HEADERLEN;
+  ring->datasize = size;
+
+  return ring;
+} /* End of shmring_create() */
+
+/***************************************************************************
+ * shmring_publish:
+ *
+ * Write a packet to the ring, overwriting the oldest packets as
+ * needed.  Packets larger than a quarter of the ring are rejected.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+shmring_publish (ShmRing *ring, const ShmPacket *packet, const void *data)
+{
+  RingHeader *header;
+  EntryHeader entry;
+  uint64_t writepos;
+  uint64_t tailpos;
+  uint64_t offset;
+  uint64_t need;
+  uint64_t pad = 0;
+  uint32_t length;
+
+  if (!ring || !ring->producer || !packet || (packet->datasize && !data))
+    return -1;
+
+  header = ring->header;
+  need   = (ENTRYHEADERLEN + (uint64_t)packet->datasize + 7) & ~(uint64_t)7;
+
+  if (need > ring->datasize / 4)
+    return -1;
+
+  writepos = atomic_load_explicit (&header->writepos, memory_order_relaxed);
+  tailpos  = atomic_load_explicit (&header->tailpos, memory_order_relaxed);
+  offset   = writepos % ring->datasize;
+
+  /* Pad to the end of the data area if the entry does not fit */
+  if (offset + need > ring->datasize)
+    pad = ring->datasize - offset;
+
+  /* Advance the tail past entries that will be overwritten */
+  if (writepos + pad + need - tailpos > ring->datasize)
+  {
+    while (writepos + pad + need - tailpos > ring->datasize)
+    {
+      memcpy (&length, ring->data + (tailpos % ring->datasize), sizeof (length));
+      tailpos += length;
+    }
+
+    atomic_store_explicit (&header->tailpos, tailpos, memory_order_relaxed);
+    atomic_thread_fence (memory_order_seq_cst);
+  }
+
+  if (pad)
+  {
+    memset (&entry, 0, 8);
+    entry.length = (uint32_t)pad;
+    entry.flags  = ENTRY_PADDING;
+    memcpy (ring->data + offset, &entry, 8);
+
+    writepos += pad;
+    offset = 0;
+  }
+
+  memset (&entry, 0, sizeof (entry));
+  entry.length    = (uint32_t)need;
+  entry.seq       = atomic_fetch_add_explicit (&header->nextseq, 1, memory_order_relaxed);
+  entry.datasize  = packet->datasize;
+  entry.pktid     = packet->pktid;
+  entry.pkttime   = packet->pkttime;
+  entry.datastart = packet->datastart;
+  entry.dataend   = packet->dataend;
+  entry.recvtime  = packet->recvtime;
+  memcpy (entry.streamid, packet->streamid, SHMRING_STREAMIDLEN);
+  entry.streamid[SHMRING_STREAMIDLEN - 1] = '\0';
+
+  memcpy (ring->data + offset, &entry, ENTRYHEADERLEN);
+  if (packet->datasize)
+    memcpy (ring->data + offset + ENTRYHEADERLEN, data, packet->datasize);
+
+  atomic_store_explicit (&header->writepos, writepos + need, memory_order_release);
+
+  return 0;
+} /* End of shmring_publish() */
+
+/***************************************************************************
+ * shmring_attach:
+ *
+ * Attach to the shared memory ring name for reading, starting with
+ * the next packet written or, if fromoldest is true, the oldest
+ * packet in the ring.
+ *
+ * Returns a pointer to the ring on success and NULL on error with
+ * errno set.
+ ***************************************************************************/
+ShmRing *
+shmring_attach (const char *name, int fromoldest)
+{
+  ShmRing *ring;
+  char shmname[256];
+  struct stat sb;
+  int fd;
+
+  if (!name)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  shmring_makename (name, shmname, sizeof (shmname));
+
+  if ((fd = shm_open (shmname, O_RDONLY, 0)) < 0)
+    return NULL;
+
+  if (fstat (fd, &sb) || sb.st_size <= HEADERLEN)
+  {
+    close (fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ring = shmring_map (fd, (size_t)sb.st_size, 0);
+  close (fd);
+
+  if (!ring)
+    return NULL;
+
+  if (memcmp (ring->header->magic, SHMRING_MAGIC, 8) ||
+      ring->header->headerlen != HEADERLEN ||
+      ring->header->entryheaderlen != ENTRYHEADERLEN ||
+      ring->header->datasize + HEADERLEN != (uint64_t)sb.st_size)
+  {
+    shmring_close (ring);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ring->data     = (uint8_t *)ring->header + HEADERLEN;
+  ring->datasize = ring->header->datasize;
+
+  /* Starting from the latest packet, missed packets are counted from
+   * the next sequence number of the producer */
+  if (fromoldest)
+  {
+    ring->pos = atomic_load (&ring->header->tailpos);
+  }
+  else
+  {
+    ring->pos     = atomic_load (&ring->header->writepos);
+    ring->nextseq = atomic_load (&ring->header->nextseq);
+    ring->haveseq = 1;
+  }
+
+  return ring;
+} /* End of shmring_attach() */
+
+/***************************************************************************
+ * shmring_read:
+ *
+ * Read the next packet from the ring, waiting up to timeoutms
+ * milliseconds for a packet to be written, or indefinitely if
+ * timeoutms is negative.  The packet data is copied to data.
+ *
+ * Returns 1 when a packet is read, 0 on timeout, -1 on error and -2
+ * when the packet data is larger than maxdatasize, in which case the
+ * packet details are returned and the packet is skipped.
+ ***************************************************************************/
+int
+shmring_read (ShmRing *ring, ShmPacket *packet, void *data,
+              size_t maxdatasize, int timeoutms)
+{
+  RingHeader *header;
+  EntryHeader entry;
+  struct timespec delay = {0, 1000000};
+  uint64_t writepos;
+  uint64_t offset;
+  int waited = 0;
+  int rv;
+
+  if (!ring || ring->producer || !packet)
+    return -1;
+
+  header = ring->header;
+
+  for (;;)
+  {
+    writepos = atomic_load_explicit (&header->writepos, memory_order_acquire);
+
+    /* Wait for a packet, polling every millisecond */
+    if (ring->pos >= writepos)
+    {
+      if (timeoutms >= 0 && waited >= timeoutms)
+        return 0;
+
+      nanosleep (&delay, NULL);
+      waited++;
+      continue;
+    }
+
+    /* Skip to the oldest intact entry if overrun */
+    if (ring->pos < atomic_load_explicit (&header->tailpos, memory_order_acquire))
+      ring->pos = atomic_load_explicit (&header->tailpos, memory_order_acquire);
+
+    offset = ring->pos % ring->datasize;
+
+    memcpy (&entry, ring->data + offset, 8);
+
+    if (entry.flags & ENTRY_PADDING)
+    {
+      atomic_thread_fence (memory_order_acquire);
+      if (ring->pos < atomic_load_explicit (&header->tailpos, memory_order_acquire))
+        continue;
+
+      ring->pos += entry.length;
+      continue;
+    }
+
+    memcpy (&entry, ring->data + offset, ENTRYHEADERLEN);
+
+    rv = 1;
+
+    if (entry.length < ENTRYHEADERLEN || offset + entry.length > ring->datasize ||
+        entry.datasize > entry.length - ENTRYHEADERLEN)
+      rv = -1;
+    else if (entry.datasize > maxdatasize || (entry.datasize && !data))
+      rv = -2;
+    else if (entry.datasize)
+      memcpy (data, ring->data + offset + ENTRYHEADERLEN, entry.datasize);
+
+    /* Discard the copy if the entry was overwritten while reading */
+    atomic_thread_fence (memory_order_acquire);
+    if (ring->pos < atomic_load_explicit (&header->tailpos, memory_order_acquire))
+      continue;
+
+    if (rv == -1)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (ring->haveseq && entry.seq > ring->nextseq)
+      ring->lost += entry.seq - ring->nextseq;
+
+    ring->nextseq = entry.seq + 1;
+    ring->haveseq = 1;
+    ring->pos += entry.length;
+
+    memcpy (packet->streamid, entry.streamid, SHMRING_STREAMIDLEN);
+    packet->pktid     = entry.pktid;
+    packet->pkttime   = entry.pkttime;
+    packet->datastart = entry.datastart;
+    packet->dataend   = entry.dataend;
+    packet->recvtime  = entry.recvtime;
+    packet->datasize  = entry.datasize;
+
+    return rv;
+  }
+} /* End of shmring_read() */
+
+/***************************************************************************
+ * shmring_lost:
+ *
+ * Returns the number of packets a consumer has missed because the
+ * producer overwrote them before they were read.
+ ***************************************************************************/
+uint64_t
+shmring_lost (ShmRing *ring)
+{
+  return (ring) ? ring->lost : 0;
+} /* End of shmring_lost() */
+
+/***************************************************************************
+ * shmring_close:
+ *
+ * Detach from a ring, the shared memory object is not removed.
+ ***************************************************************************/
+void
+shmring_close (ShmRing *ring)
+{
+  if (!ring)
+    return;
+
+  munmap (ring->header, ring->mapsize);
+  free (ring);
+} /* End of shmring_close() */
+
+/***************************************************************************
+ * shmring_map:
+ *
+ * Map a shared memory object and allocate the ring description.
+ ***************************************************************************/
+static ShmRing *
+shmring_map (int fd, size_t mapsize, int producer)
+{
+  ShmRing *ring;
+  void *map;
+
+  if (!(ring = (ShmRing *)calloc (1, sizeof (ShmRing))))
+    return NULL;
+
+  map = mmap (NULL, mapsize, (producer) ? (PROT_READ | PROT_WRITE) : PROT_READ,
+              MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+  {
+    free (ring);
+    return NULL;
+  }
+
+  ring->header   = (RingHeader *)map;
+  ring->mapsize  = mapsize;
+  ring->producer = producer;
+
+  return ring;
+} /* End of shmring_map() */
+
+/***************************************************************************
+ * shmring_makename:
+ *
+ * Create a shared memory object name, which must start with '/'.
+ ***************************************************************************/
+static void
+shmring_makename (const char *name, char *shmname, size_t size)
+{
+  snprintf (shmname, size, "%s%s", (name[0] == '/') ? "" : "/", name);
+} /* End of shmring_makename() */
+
+#else /* WIN32 */
+
+/* Shared memory rings are not supported on Windows */
+
+ShmRing *
+shmring_create (const char *name, size_t size)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+shmring_publish (ShmRing *ring, const ShmPacket *packet, const void *data)
+{
+  return -1;
+}
+
+ShmRing *
+shmring_attach (const char *name, int fromoldest)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+shmring_read (ShmRing *ring, ShmPacket *packet, void *data,
+              size_t maxdatasize, int timeoutms)
+{
+  return -1;
+}
+
+uint64_t
+shmring_lost (ShmRing *ring)
+{
+  return 0;
+}
+
+void
+shmring_close (ShmRing *ring)
+{
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,69 @@
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+/***************************************************************************
+ * A shared memory ring of DataLink packets, written by one producer
+ * and read by any number of local consumer processes.
+ *
+ * This header and shmring.c depend only on the C library (and on some
+ * systems -lrt) and can be built into consumer programs directly.  A
+ * consumer attaches to a ring by name and reads packets in order:
+ *
+ *   ShmRing *ring = shmring_attach ("/dalitool", 0);
+ *   ShmPacket packet;
+ *   char data[16384];
+ *
+ *   while ((rv = shmring_read (ring, &packet, data, sizeof (data), 1000)) >= 0)
+ *     if (rv == 1)
+ *       ...
+ *
+ *   shmring_close (ring);
+ *
+ * The producer never waits for consumers: a consumer that falls more
+ * than the ring size behind skips to the oldest packet available and
+ * the number of packets skipped is returned by shmring_lost().
+ ***************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Maximum stream ID length, including terminator */
+#define SHMRING_STREAMIDLEN 64
+
+/* Packet description, times are microseconds since the epoch */
+typedef struct ShmPacket_s
+{
+  char streamid[SHMRING_STREAMIDLEN]; /* Stream ID */
+  int64_t pktid;                /* Packet ID */
+  int64_t pkttime;              /* Packet time */
+  int64_t datastart;            /* Data start time */
+  int64_t dataend;              /* Data end time */
+  int64_t recvtime;             /* Receive time */
+  uint32_t datasize;            /* Data size in bytes */
+} ShmPacket;
+
+typedef struct ShmRing_s ShmRing;
+
+/* Producer */
+extern ShmRing *shmring_create (const char *name, size_t size);
+extern int shmring_publish (ShmRing *ring, const ShmPacket *packet, const void *data);
+
+/* Consumers */
+extern ShmRing *shmring_attach (const char *name, int fromoldest);
+extern int shmring_read (ShmRing *ring, ShmPacket *packet, void *data,
+                         size_t maxdatasize, int timeoutms);
+extern uint64_t shmring_lost (ShmRing *ring);
+
+extern void shmring_close (ShmRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SHMRING_H */
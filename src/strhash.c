@@ -0,0 +1,266 @@
+/***************************************************************************
+ * strhash.c
+ *
+ * A simple hash table keyed by strings, used to track per-stream and
+ * per-server state.
+ *
+ * Keys are hashed with 32-bit FNV-1a and entries are chained in a
+ * power of 2 number of buckets, which is doubled when the number of
+ * entries exceeds the number of buckets.
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "strhash.h"
+
+static int strhash_grow (StrHash *table);
+
+/***************************************************************************
+ * strhash_new:
+ *
+ * Create a new hash table with at least the specified number of
+ * buckets.
+ *
+ * Returns a pointer to the table on success and NULL on error.
+ ***************************************************************************/
+StrHash *
+strhash_new (size_t size)
+{
+  StrHash *table;
+  size_t buckets = 16;
+
+  while (buckets < size)
+    buckets *= 2;
+
+  if (!(table = (StrHash *)calloc (1, sizeof (StrHash))))
+    return NULL;
+
+  if (!(table->buckets = (StrHashEntry **)calloc (buckets, sizeof (StrHashEntry *))))
+  {
+    free (table);
+    return NULL;
+  }
+
+  table->size = buckets;
+
+  return table;
+} /* End of strhash_new() */
+
+/***************************************************************************
+ * strhash_free:
+ *
+ * Free a hash table and all entries, calling freevalue, if not NULL,
+ * for each value.
+ ***************************************************************************/
+void
+strhash_free (StrHash *table, void (*freevalue) (void *))
+{
+  StrHashEntry *entry;
+  StrHashEntry *next;
+  size_t idx;
+
+  if (!table)
+    return;
+
+  for (idx = 0; idx < table->size; idx++)
+  {
+    for (entry = table->buckets[idx]; entry; entry = next)
+    {
+      next = entry->next;
+
+      if (freevalue)
+        freevalue (entry->value);
+
+      free (entry->key);
+      free (entry);
+    }
+  }
+
+  free (table->buckets);
+  free (table);
+} /* End of strhash_free() */
+
+/***************************************************************************
+ * strhash_get:
+ *
+ * Return the value for a key or NULL if the key is not in the table.
+ ***************************************************************************/
+void *
+strhash_get (StrHash *table, const char *key)
+{
+  StrHashEntry *entry;
+  uint32_t hash = strhash_hash (key);
+
+  for (entry = table->buckets[hash & (table->size - 1)]; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && !strcmp (entry->key, key))
+      return entry->value;
+  }
+
+  return NULL;
+} /* End of strhash_get() */
+
+/***************************************************************************
+ * strhash_put:
+ *
+ * Set the value for a key, replacing any existing value.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+strhash_put (StrHash *table, const char *key, void *value)
+{
+  StrHashEntry *entry;
+  uint32_t hash = strhash_hash (key);
+  size_t bucket = hash & (table->size - 1);
+
+  for (entry = table->buckets[bucket]; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && !strcmp (entry->key, key))
+    {
+      entry->value = value;
+      return 0;
+    }
+  }
+
+  if (table->count >= table->size && strhash_grow (table) == 0)
+    bucket = hash & (table->size - 1);
+
+  if (!(entry = (StrHashEntry *)malloc (sizeof (StrHashEntry))))
+    return -1;
+
+  if (!(entry->key = strdup (key)))
+  {
+    free (entry);
+    return -1;
+  }
+
+  entry->value = value;
+  entry->hash  = hash;
+  entry->next  = table->buckets[bucket];
+
+  table->buckets[bucket] = entry;
+  table->count++;
+
+  return 0;
+} /* End of strhash_put() */
+
+/***************************************************************************
+ * strhash_remove:
+ *
+ * Remove a key from the table.
+ *
+ * Returns the value of the removed entry or NULL if not found.
+ ***************************************************************************/
+void *
+strhash_remove (StrHash *table, const char *key)
+{
+  StrHashEntry **link;
+  StrHashEntry *entry;
+  uint32_t hash = strhash_hash (key);
+  void *value;
+
+  for (link = &table->buckets[hash & (table->size - 1)]; *link; link = &(*link)->next)
+  {
+    entry = *link;
+
+    if (entry->hash == hash && !strcmp (entry->key, key))
+    {
+      *link = entry->next;
+      value = entry->value;
+
+      free (entry->key);
+      free (entry);
+      table->count--;
+
+      return value;
+    }
+  }
+
+  return NULL;
+} /* End of strhash_remove() */
+
+/***************************************************************************
+ * strhash_next:
+ *
+ * Iterate over the entries of a table, in no particular order.  Pass
+ * NULL to get the first entry and the previous entry to get the next.
+ * The table must not be modified during iteration.
+ *
+ * Returns the next entry or NULL when there are no more.
+ ***************************************************************************/
+StrHashEntry *
+strhash_next (StrHash *table, StrHashEntry *entry)
+{
+  size_t idx;
+
+  if (entry && entry->next)
+    return entry->next;
+
+  idx = (entry) ? (entry->hash & (table->size - 1)) + 1 : 0;
+
+  for (; idx < table->size; idx++)
+  {
+    if (table->buckets[idx])
+      return table->buckets[idx];
+  }
+
+  return NULL;
+} /* End of strhash_next() */
+
+/***************************************************************************
+ * strhash_hash:
+ *
+ * Return the 32-bit FNV-1a hash of a string.
+ ***************************************************************************/
+uint32_t
+strhash_hash (const char *key)
+{
+  uint32_t hash = 2166136261u;
+
+  while (*key)
+  {
+    hash ^= (uint8_t)*key++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+} /* End of strhash_hash() */
+
+/***************************************************************************
+ * strhash_grow:
+ *
+ * Double the number of buckets of a table, redistributing entries.
+ *
+ * Returns 0 on success and -1 on error, the table is unchanged on error.
+ ***************************************************************************/
+static int
+strhash_grow (StrHash *table)
+{
+  StrHashEntry **buckets;
+  StrHashEntry *entry;
+  StrHashEntry *next;
+  size_t size = table->size * 2;
+  size_t idx;
+
+  if (!(buckets = (StrHashEntry **)calloc (size, sizeof (StrHashEntry *))))
+    return -1;
+
+  for (idx = 0; idx < table->size; idx++)
+  {
+    for (entry = table->buckets[idx]; entry; entry = next)
+    {
+      next        = entry->next;
+      entry->next = buckets[entry->hash & (size - 1)];
+
+      buckets[entry->hash & (size - 1)] = entry;
+    }
+  }
+
+  free (table->buckets);
+  table->buckets = buckets;
+  table->size    = size;
+
+  return 0;
+} /* End of strhash_grow() */
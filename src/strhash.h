@@ -0,0 +1,42 @@
+
+#ifndef STRHASH_H
+#define STRHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* An entry in a string keyed hash table */
+typedef struct StrHashEntry_s
+{
+  char *key;                    /* Key string, owned by the table */
+  void *value;                  /* Value pointer, owned by the caller */
+  uint32_t hash;                /* Hash of key */
+  struct StrHashEntry_s *next;  /* Next entry in bucket */
+} StrHashEntry;
+
+/* A string keyed hash table with chained buckets */
+typedef struct StrHash_s
+{
+  StrHashEntry **buckets;       /* Bucket array, size is a power of 2 */
+  size_t size;                  /* Number of buckets */
+  size_t count;                 /* Number of entries */
+} StrHash;
+
+extern StrHash *strhash_new (size_t size);
+extern void strhash_free (StrHash *table, void (*freevalue) (void *));
+extern void *strhash_get (StrHash *table, const char *key);
+extern int strhash_put (StrHash *table, const char *key, void *value);
+extern void *strhash_remove (StrHash *table, const char *key);
+extern StrHashEntry *strhash_next (StrHash *table, StrHashEntry *entry);
+extern uint32_t strhash_hash (const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* STRHASH_H */
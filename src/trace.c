@@ -0,0 +1,486 @@
+/***************************************************************************
+ * trace.c
+ *
+ * Opt-in tracing of the packet path as timestamped spans, written as
+ * Chrome trace event JSON for viewing in Perfetto or chrome://tracing.
+ *
+ * Spans are recorded around receiving packets, record header parsing
+ * (msr3_parse), sample decoding (msr3_unpack_data), output writes and
+ * state saves, each with the stream ID and packet ID and the age of
+ * the packet since the kernel received it, for a per-packet timeline.
+ *
+ * Each thread records into its own fixed-size buffer, allocated on its
+ * first span and registered once under a lock; recording itself takes
+ * no lock.  When a buffer is full the oldest spans are overwritten, so
+ * the most recent activity is kept.  When tracing is not enabled a
+ * span costs a test of a flag.  The buffers are written with the
+ * yyjson bundled in libmseed, one event at a time using a pool
+ * allocator, when tracing is closed.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <libmseed.h>
+#include <yyjson.h>
+
+#include "common.h"
+#include "trace.h"
+
+/* Flag: tracing enabled, tested by trace_start() */
+int traceenabled = 0;
+
+#ifndef WIN32
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Size of the pool used to build each event */
+#define TRACE_POOLSIZE 4096
+
+/* A recorded span */
+typedef struct TraceEvent_s
+{
+  const char *name;             /* Span name, static string */
+  int64_t start;                /* Start time, nanoseconds */
+  int64_t duration;             /* Duration, nanoseconds */
+  int64_t pktid;                /* Packet ID, -1 if none */
+  int64_t age;                  /* Time since kernel receive of packet at end, nanoseconds, -1 if unknown */
+  char streamid[MAXSTREAMID];   /* Stream ID, empty if none */
+} TraceEvent;
+
+/* Span buffer of a thread */
+typedef struct TraceBuffer_s
+{
+  TraceEvent *events;           /* Ring of events */
+  int64_t count;                /* Total events recorded */
+  int tid;                      /* Thread number in trace */
+  char name[100];               /* Thread name */
+  struct TraceBuffer_s *next;   /* Next buffer in list */
+} TraceBuffer;
+
+static char *tracefile       = NULL; /* Output file */
+static int64_t tracesize     = 0;    /* Events in each buffer */
+static int64_t tracebase     = 0;    /* Time of trace start, nanoseconds */
+static int64_t tracewall     = 0;    /* Wall clock minus clock_ns(), nanoseconds */
+static TraceBuffer *buffers  = NULL; /* All thread buffers */
+static int threads           = 0;    /* Number of thread buffers */
+static pthread_mutex_t tracelock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceBuffer *threadbuffer = NULL;
+
+static TraceBuffer *trace_buffer (void);
+static int trace_event (yyjson_mut_doc *doc, yyjson_mut_val *root,
+                        TraceBuffer *buffer, TraceEvent *event);
+static int trace_meta (yyjson_mut_doc *doc, yyjson_mut_val *root, TraceBuffer *buffer);
+static int trace_write (FILE *fp, char *pool, int first, TraceBuffer *buffer, TraceEvent *event);
+
+/***************************************************************************
+ * trace_open:
+ *
+ * Enable tracing, keeping up to maxevents spans for each thread, to
+ * be written to file by trace_close().
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+trace_open (const char *file, int64_t maxevents)
+{
+  if (!file || maxevents <= 0)
+    return -1;
+
+  if (!(tracefile = strdup (file)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for tracing\n");
+    return -1;
+  }
+
+  tracesize = maxevents;
+  tracebase = clock_ns ();
+  tracewall = dlp_time () * (1000000000 / DLTMODULUS) - tracebase;
+
+  trace_thread ("main");
+
+  traceenabled = 1;
+
+  return 0;
+} /* End of trace_open() */
+
+/***************************************************************************
+ * trace_thread:
+ *
+ * Name the calling thread in the trace.
+ ***************************************************************************/
+void
+trace_thread (const char *name)
+{
+  TraceBuffer *buffer;
+
+  if (!tracefile || !name || !(buffer = trace_buffer ()))
+    return;
+
+  strncpy (buffer->name, name, sizeof (buffer->name) - 1);
+  buffer->name[sizeof (buffer->name) - 1] = '\0';
+} /* End of trace_thread() */
+
+/***************************************************************************
+ * trace_span:
+ *
+ * Record a span named name from start, returned by trace_start(), to
+ * now for the calling thread.  The name must be a static string.  The
+ * packet, if not NULL, identifies the stream and packet of the span.
+ ***************************************************************************/
+void
+trace_span (const char *name, int64_t start, const DLPacket *dlpacket)
+{
+  TraceBuffer *buffer;
+  TraceEvent *event;
+  int64_t end;
+
+  if (!start || !traceenabled || !(buffer = trace_buffer ()))
+    return;
+
+  end   = clock_ns ();
+  event = &buffer->events[buffer->count % tracesize];
+
+  event->name     = name;
+  event->start    = start;
+  event->duration = end - start;
+
+  if (dlpacket)
+  {
+    event->pktid = dlpacket->pktid;
+    event->age   = (dlpacket->recvtime) ? end + tracewall - dlpacket->recvtime * (1000000000 / DLTMODULUS) : -1;
+    memcpy (event->streamid, dlpacket->streamid, sizeof (event->streamid));
+    event->streamid[sizeof (event->streamid) - 1] = '\0';
+  }
+  else
+  {
+    event->pktid       = -1;
+    event->age         = -1;
+    event->streamid[0] = '\0';
+  }
+
+  buffer->count++;
+} /* End of trace_span() */
+
+/***************************************************************************
+ * trace_parse:
+ *
+ * Parse a miniSEED record with msr3_parse(), recording the header
+ * parsing and sample decoding as separate spans when tracing.  Only
+ * while tracing, and if MSF_UNPACKDATA is set in flags, the samples
+ * are decoded with msr3_unpack_data() after parsing the header.
+ *
+ * Returns the return value of msr3_parse() or msr3_unpack_data() on
+ * error.
+ ***************************************************************************/
+int
+trace_parse (const char *record, uint64_t recbuflen, MS3Record **ppmsr, uint32_t flags,
+             int8_t verbose, const DLPacket *dlpacket)
+{
+  int64_t start;
+  int64_t nsamples;
+  int rv;
+
+  if (!traceenabled)
+    return msr3_parse (record, recbuflen, ppmsr, flags, verbose);
+
+  start = clock_ns ();
+  rv    = msr3_parse (record, recbuflen, ppmsr, flags & ~MSF_UNPACKDATA, verbose);
+  trace_span ("parse", start, dlpacket);
+
+  if (rv != MS_NOERROR || !(flags & MSF_UNPACKDATA) || (*ppmsr)->samplecnt <= 0)
+    return rv;
+
+  start    = clock_ns ();
+  nsamples = msr3_unpack_data (*ppmsr, verbose);
+  trace_span ("unpack", start, dlpacket);
+
+  if (nsamples < 0)
+    return (int)nsamples;
+
+  (*ppmsr)->numsamples = nsamples;
+
+  return MS_NOERROR;
+} /* End of trace_parse() */
+
+/***************************************************************************
+ * trace_close:
+ *
+ * Disable tracing, write the spans of all threads to the trace file as
+ * Chrome trace event JSON and free the buffers.  All threads that
+ * recorded spans must have finished.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+trace_close (void)
+{
+  TraceBuffer *buffer;
+  TraceBuffer *next;
+  FILE *fp  = NULL;
+  char *pool = NULL;
+  int64_t first;
+  int64_t idx;
+  int64_t written = 0;
+  int rv = 0;
+
+  if (!tracefile)
+    return 0;
+
+  traceenabled = 0;
+
+  if (!(pool = (char *)malloc (TRACE_POOLSIZE)))
+  {
+    dl_log (2, 0, "Cannot allocate memory for tracing\n");
+    rv = -1;
+  }
+  else if (!(fp = fopen (tracefile, "w")))
+  {
+    dl_log (2, 0, "Cannot open trace file %s: %s\n", tracefile, strerror (errno));
+    rv = -1;
+  }
+  else if (fputs ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", fp) < 0)
+  {
+    rv = -1;
+  }
+
+  for (buffer = buffers; buffer && rv == 0; buffer = buffer->next)
+  {
+    if (trace_write (fp, pool, (written++ == 0), buffer, NULL))
+    {
+      rv = -1;
+      break;
+    }
+
+    first = (buffer->count > tracesize) ? buffer->count - tracesize : 0;
+
+    if (first > 0)
+      dl_log (1, 0, "Trace of thread %s full, %lld oldest spans discarded\n",
+              buffer->name, (long long int)first);
+
+    for (idx = first; idx < buffer->count; idx++)
+    {
+      if (trace_write (fp, pool, 0, buffer, &buffer->events[idx % tracesize]))
+      {
+        rv = -1;
+        break;
+      }
+
+      written++;
+    }
+  }
+
+  if (fp)
+  {
+    if (rv == 0 && fputs ("\n]}\n", fp) < 0)
+      rv = -1;
+
+    if (fclose (fp) && rv == 0)
+      rv = -1;
+
+    if (rv)
+      dl_log (2, 0, "Error writing trace file %s\n", tracefile);
+    else
+      dl_log (1, 1, "Wrote %lld trace events for %d threads to %s\n",
+              (long long int)written, threads, tracefile);
+  }
+
+  for (buffer = buffers; buffer; buffer = next)
+  {
+    next = buffer->next;
+    free (buffer->events);
+    free (buffer);
+  }
+
+  buffers      = NULL;
+  threads      = 0;
+  threadbuffer = NULL;
+
+  free (pool);
+  free (tracefile);
+  tracefile = NULL;
+
+  return rv;
+} /* End of trace_close() */
+
+/***************************************************************************
+ * trace_buffer:
+ *
+ * Return the span buffer of the calling thread, allocating and
+ * registering it on first use.
+ *
+ * Returns a pointer to the buffer or NULL on error.
+ ***************************************************************************/
+static TraceBuffer *
+trace_buffer (void)
+{
+  TraceBuffer *buffer;
+  TraceBuffer **last;
+
+  if (threadbuffer)
+    return threadbuffer;
+
+  if (!(buffer = (TraceBuffer *)calloc (1, sizeof (TraceBuffer))) ||
+      !(buffer->events = (TraceEvent *)malloc (tracesize * sizeof (TraceEvent))))
+  {
+    dl_log (2, 0, "Cannot allocate memory for trace buffer, tracing disabled\n");
+    free (buffer);
+    traceenabled = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock (&tracelock);
+
+  buffer->tid = ++threads;
+  snprintf (buffer->name, sizeof (buffer->name), "thread %d", buffer->tid);
+
+  /* Append to keep threads in order of creation */
+  for (last = &buffers; *last; last = &(*last)->next)
+    ;
+  *last = buffer;
+
+  pthread_mutex_unlock (&tracelock);
+
+  threadbuffer = buffer;
+
+  return buffer;
+} /* End of trace_buffer() */
+
+/***************************************************************************
+ * trace_write:
+ *
+ * Write a span of a thread as a trace event, or the thread name
+ * metadata event if event is NULL, prefixed with a separator unless
+ * first.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+trace_write (FILE *fp, char *pool, int first, TraceBuffer *buffer, TraceEvent *event)
+{
+  yyjson_alc alc;
+  yyjson_mut_doc *doc;
+  yyjson_mut_val *root;
+  yyjson_write_err err;
+  char *line = NULL;
+  size_t length;
+
+  if (yyjson_alc_pool_init (&alc, pool, TRACE_POOLSIZE) &&
+      (doc = yyjson_mut_doc_new (&alc)) &&
+      (root = yyjson_mut_obj (doc)))
+  {
+    yyjson_mut_doc_set_root (doc, root);
+
+    if ((event) ? trace_event (doc, root, buffer, event) : trace_meta (doc, root, buffer))
+      line = yyjson_mut_write_opts (doc, YYJSON_WRITE_ALLOW_INVALID_UNICODE,
+                                    &alc, &length, &err);
+  }
+
+  if (!line)
+    return -1;
+
+  if ((!first && fputs (",\n", fp) < 0) || fwrite (line, length, 1, fp) != 1)
+    return -1;
+
+  return 0;
+} /* End of trace_write() */
+
+/***************************************************************************
+ * trace_event:
+ *
+ * Build a complete ("X") trace event of a span, times in microseconds
+ * from the start of tracing.
+ *
+ * Returns non-zero on success and zero when out of memory.
+ ***************************************************************************/
+static int
+trace_event (yyjson_mut_doc *doc, yyjson_mut_val *root,
+             TraceBuffer *buffer, TraceEvent *event)
+{
+  yyjson_mut_val *args;
+
+  if (!yyjson_mut_obj_add_str (doc, root, "name", event->name) ||
+      !yyjson_mut_obj_add_str (doc, root, "cat", "dalitool") ||
+      !yyjson_mut_obj_add_str (doc, root, "ph", "X") ||
+      !yyjson_mut_obj_add_real (doc, root, "ts", (event->start - tracebase) / 1e3) ||
+      !yyjson_mut_obj_add_real (doc, root, "dur", event->duration / 1e3) ||
+      !yyjson_mut_obj_add_int (doc, root, "pid", (int64_t)getpid ()) ||
+      !yyjson_mut_obj_add_int (doc, root, "tid", buffer->tid))
+    return 0;
+
+  if (event->streamid[0])
+  {
+    if (!(args = yyjson_mut_obj (doc)) ||
+        !yyjson_mut_obj_add_str (doc, args, "stream", event->streamid) ||
+        !yyjson_mut_obj_add_int (doc, args, "pktid", event->pktid) ||
+        (event->age >= 0 && !yyjson_mut_obj_add_real (doc, args, "age_us", event->age / 1e3)) ||
+        !yyjson_mut_obj_add_val (doc, root, "args", args))
+      return 0;
+  }
+
+  return 1;
+} /* End of trace_event() */
+
+/***************************************************************************
+ * trace_meta:
+ *
+ * Build the metadata ("M") event naming the thread of a buffer.
+ *
+ * Returns non-zero on success and zero when out of memory.
+ ***************************************************************************/
+static int
+trace_meta (yyjson_mut_doc *doc, yyjson_mut_val *root, TraceBuffer *buffer)
+{
+  yyjson_mut_val *args;
+
+  if (!yyjson_mut_obj_add_str (doc, root, "name", "thread_name") ||
+      !yyjson_mut_obj_add_str (doc, root, "ph", "M") ||
+      !yyjson_mut_obj_add_int (doc, root, "pid", (int64_t)getpid ()) ||
+      !yyjson_mut_obj_add_int (doc, root, "tid", buffer->tid) ||
+      !(args = yyjson_mut_obj (doc)) ||
+      !yyjson_mut_obj_add_str (doc, args, "name", buffer->name) ||
+      !yyjson_mut_obj_add_val (doc, root, "args", args))
+    return 0;
+
+  return 1;
+} /* End of trace_meta() */
+
+#else /* WIN32 */
+
+/* Tracing is not supported on Windows */
+
+int
+trace_open (const char *file, int64_t maxevents)
+{
+  dl_log (2, 0, "Tracing is not supported on this platform\n");
+  return -1;
+}
+
+void
+trace_thread (const char *name)
+{
+}
+
+void
+trace_span (const char *name, int64_t start, const DLPacket *dlpacket)
+{
+}
+
+int
+trace_parse (const char *record, uint64_t recbuflen, MS3Record **ppmsr, uint32_t flags,
+             int8_t verbose, const DLPacket *dlpacket)
+{
+  return msr3_parse (record, recbuflen, ppmsr, flags, verbose);
+}
+
+int
+trace_close (void)
+{
+  return 0;
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,31 @@
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <libdali.h>
+#include <libmseed.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+extern int traceenabled;
+
+/* Start time of a span, 0 when tracing is not enabled */
+#define trace_start() ((traceenabled) ? clock_ns () : 0)
+
+extern int trace_open (const char *file, int64_t maxevents);
+extern void trace_thread (const char *name);
+extern void trace_span (const char *name, int64_t start, const DLPacket *dlpacket);
+extern int trace_parse (const char *record, uint64_t recbuflen, MS3Record **ppmsr, uint32_t flags,
+                        int8_t verbose, const DLPacket *dlpacket);
+extern int trace_close (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TRACE_H */